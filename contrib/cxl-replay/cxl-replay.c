@@ -0,0 +1,932 @@
+/*
+ * QEMU CXL Socket Transport Trace Replay
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Replays a recorded stream of CXL requests against a switch emulator through
+ * hw/pci-bridge/cxl_socket_transport.c, without a guest, and reports the
+ * throughput and the latency distribution of each request class.
+ *
+ * The trace is either a pcap-ng file recorded with "-device cxl-rp,capture="
+ * (only outbound requests are replayed; sideband packets are skipped since
+ * every connection does its own handshake) or a text file with one request
+ * per line:
+ *
+ *   <time-ns> mem-read   <hpa>
+ *   <time-ns> mem-write  <hpa> [<fill-byte>]
+ *   <time-ns> mmio-read  <hpa> <size>
+ *   <time-ns> mmio-write <hpa> <size> <value>
+ *   <time-ns> cfg-read   <bus>:<dev>.<fn> <offset> <size> [type1]
+ *   <time-ns> cfg-write  <bus>:<dev>.<fn> <offset> <size> <value> [type1]
+ *
+ * Numbers take a 0x prefix for hex, and '#' starts a comment.
+ *
+ * The transport keeps one table of outstanding requests per process, so each
+ * concurrent connection is served by its own worker process. Requests are
+ * dealt to the workers round-robin. When requests are paced, by rate or by
+ * their recorded times, latency is measured from the time a request was due
+ * rather than from when it was sent, so a stalled switch shows up in the
+ * tail instead of silently slowing the replay down.
+ */
+
+#include "qemu/osdep.h"
+#include <getopt.h>
+#include <sys/wait.h>
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+
+#include "hw/cxl/cxl_capture.h"
+#include "hw/cxl/cxl_endian.h"
+#include "hw/cxl/cxl_socket_transport.h"
+
+#define CXL_REPLAY_DEFAULT_HOST "127.0.0.1"
+#define CXL_REPLAY_DEFAULT_PORT 8000
+#define CXL_REPLAY_FAILED UINT64_MAX
+
+#define PCAPNG_SHB_TYPE 0x0A0D0D0A
+#define PCAPNG_IDB_TYPE 0x00000001
+#define PCAPNG_EPB_TYPE 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_MAX_INTERFACES 16
+
+typedef enum ReplayOpType {
+    REPLAY_MEM_READ,
+    REPLAY_MEM_WRITE,
+    REPLAY_MMIO_READ,
+    REPLAY_MMIO_WRITE,
+    REPLAY_CFG_READ,
+    REPLAY_CFG_WRITE,
+    REPLAY_OP__MAX,
+} ReplayOpType;
+
+/* Same names as CxlLatencyClass, so the report matches info cxl-latency */
+static const char *const replay_op_names[REPLAY_OP__MAX] = {
+    [REPLAY_MEM_READ] = "mem-read",
+    [REPLAY_MEM_WRITE] = "mem-write",
+    [REPLAY_MMIO_READ] = "mmio-read",
+    [REPLAY_MMIO_WRITE] = "mmio-write",
+    [REPLAY_CFG_READ] = "config-read",
+    [REPLAY_CFG_WRITE] = "config-write",
+};
+
+typedef struct ReplayOp {
+    int64_t ts_ns; /* relative to the first request of the trace */
+    ReplayOpType type;
+    uint64_t addr; /* HPA, or register offset for config requests */
+    uint16_t bdf;
+    bool type0;
+    int size;
+    uint64_t val;
+    uint8_t data[CXL_MEM_ACCESS_UNIT];
+} ReplayOp;
+
+typedef enum ReplayPace {
+    REPLAY_PACE_ASAP,
+    REPLAY_PACE_RATE,
+    REPLAY_PACE_TIMING,
+} ReplayPace;
+
+typedef struct ReplayArgs {
+    const char *host;
+    uint32_t port;
+    uint32_t switch_port;
+    unsigned int jobs;
+    unsigned int loops;
+    ReplayPace pace;
+    double rate;
+    double speed;
+    const char *trace;
+} ReplayArgs;
+
+/* Shared with the worker processes */
+typedef struct ReplayWorker {
+    int64_t end_ns;
+    uint64_t done;
+    bool failed;
+} ReplayWorker;
+
+typedef struct ReplayControl {
+    unsigned int ready;
+    bool go;
+    bool abort;
+    int64_t start_ns;
+    ReplayWorker workers[];
+} ReplayControl;
+
+static GArray *replay_ops;
+static int64_t replay_span_ns;
+
+static void replay_usage(const char *name, int code)
+{
+    fprintf(stderr, "Usage: %s [options] TRACE\n"
+            "Replay a CXL request trace against a switch emulator.\n"
+            "\n"
+            "TRACE is a pcap-ng file recorded with cxl-rp,capture=FILE or a\n"
+            "text trace, see the top of contrib/cxl-replay/cxl-replay.c.\n"
+            "\n"
+            "  -H, --host=HOST         switch host (default %s)\n"
+            "  -p, --port=PORT         switch TCP port (default %d)\n"
+            "  -s, --switch-port=PORT  switch port to bind to (default 0)\n"
+            "  -j, --jobs=N            concurrent connections (default 1)\n"
+            "  -r, --rate=OPS          send OPS requests per second in total\n"
+            "  -t, --timing            send requests at their recorded times\n"
+            "  -S, --speed=FACTOR      speed up --timing by FACTOR\n"
+            "  -l, --loops=N           replay the trace N times (default 1)\n"
+            "  -h, --help              show this help\n",
+            name, CXL_REPLAY_DEFAULT_HOST, CXL_REPLAY_DEFAULT_PORT);
+    exit(code);
+}
+
+static void replay_parse_args(ReplayArgs *args, int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "host", required_argument, NULL, 'H' },
+        { "port", required_argument, NULL, 'p' },
+        { "switch-port", required_argument, NULL, 's' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "rate", required_argument, NULL, 'r' },
+        { "timing", no_argument, NULL, 't' },
+        { "speed", required_argument, NULL, 'S' },
+        { "loops", required_argument, NULL, 'l' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    unsigned int val;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "H:p:s:j:r:tS:l:h", long_options,
+                            NULL)) != -1) {
+        switch (c) {
+        case 'H':
+            args->host = optarg;
+            break;
+        case 'p':
+        case 's':
+        case 'j':
+        case 'l':
+            if (qemu_strtoui(optarg, NULL, 0, &val) < 0) {
+                error_report("invalid number '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            if (c == 'p') {
+                args->port = val;
+            } else if (c == 's') {
+                args->switch_port = val;
+            } else if (c == 'j') {
+                args->jobs = MAX(val, 1);
+            } else {
+                args->loops = MAX(val, 1);
+            }
+            break;
+        case 'r':
+            if (qemu_strtod(optarg, NULL, &args->rate) < 0 || args->rate <= 0) {
+                error_report("invalid rate '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            args->pace = REPLAY_PACE_RATE;
+            break;
+        case 't':
+            args->pace = REPLAY_PACE_TIMING;
+            break;
+        case 'S':
+            if (qemu_strtod(optarg, NULL, &args->speed) < 0 ||
+                args->speed <= 0) {
+                error_report("invalid speed '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'h':
+            replay_usage(argv[0], EXIT_SUCCESS);
+            break;
+        default:
+            replay_usage(argv[0], EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if (optind != argc - 1) {
+        replay_usage(argv[0], EXIT_FAILURE);
+    }
+    args->trace = argv[optind];
+}
+
+/*
+ * Text traces
+ */
+
+static bool replay_parse_bdf(const char *str, uint16_t *bdf)
+{
+    unsigned int bus, dev, fn;
+    char end;
+
+    if (sscanf(str, "%x:%x.%x%c", &bus, &dev, &fn, &end) != 3 ||
+        bus > 0xff || dev > 0x1f || fn > 7) {
+        return false;
+    }
+    *bdf = (bus << 8) | (dev << 3) | fn;
+
+    return true;
+}
+
+static bool replay_parse_line(char *line, ReplayOp *op)
+{
+    char *tok[8];
+    char *save = NULL;
+    uint64_t ts, addr = 0, size = 0, val = 0;
+    int n = 0;
+
+    for (char *t = strtok_r(line, " \t\r\n", &save); t && n < ARRAY_SIZE(tok);
+         t = strtok_r(NULL, " \t\r\n", &save)) {
+        tok[n++] = t;
+    }
+    if (n < 3 || qemu_strtou64(tok[0], NULL, 0, &ts) < 0) {
+        return false;
+    }
+
+    memset(op, 0, sizeof(*op));
+    op->ts_ns = ts;
+
+    if (!strcmp(tok[1], "mem-read") || !strcmp(tok[1], "mem-write")) {
+        op->type = tok[1][4] == 'r' ? REPLAY_MEM_READ : REPLAY_MEM_WRITE;
+        if (qemu_strtou64(tok[2], NULL, 0, &addr) < 0 ||
+            (addr & CXL_MEM_ACCESS_OFFSET_MASK)) {
+            return false;
+        }
+        if (n > 3 && qemu_strtou64(tok[3], NULL, 0, &val) < 0) {
+            return false;
+        }
+        op->addr = addr;
+        memset(op->data, val, sizeof(op->data));
+        return n <= (op->type == REPLAY_MEM_READ ? 3 : 4);
+    }
+
+    if (!strcmp(tok[1], "mmio-read") || !strcmp(tok[1], "mmio-write")) {
+        op->type = tok[1][5] == 'r' ? REPLAY_MMIO_READ : REPLAY_MMIO_WRITE;
+        if (n != (op->type == REPLAY_MMIO_READ ? 4 : 5) ||
+            qemu_strtou64(tok[2], NULL, 0, &addr) < 0 ||
+            qemu_strtou64(tok[3], NULL, 0, &size) < 0 ||
+            (size != 4 && size != 8)) {
+            return false;
+        }
+        if (op->type == REPLAY_MMIO_WRITE &&
+            qemu_strtou64(tok[4], NULL, 0, &val) < 0) {
+            return false;
+        }
+        op->addr = addr;
+        op->size = size;
+        op->val = val;
+        return true;
+    }
+
+    if (!strcmp(tok[1], "cfg-read") || !strcmp(tok[1], "cfg-write")) {
+        int args = !strcmp(tok[1], "cfg-read") ? 5 : 6;
+
+        op->type = args == 5 ? REPLAY_CFG_READ : REPLAY_CFG_WRITE;
+        op->type0 = true;
+        if (n == args + 1 && !strcmp(tok[args], "type1")) {
+            op->type0 = false;
+            n--;
+        }
+        if (n != args || !replay_parse_bdf(tok[2], &op->bdf) ||
+            qemu_strtou64(tok[3], NULL, 0, &addr) < 0 || addr > 0xfff ||
+            qemu_strtou64(tok[4], NULL, 0, &size) < 0 || !size ||
+            (addr & 3) + size > 4) {
+            return false;
+        }
+        if (op->type == REPLAY_CFG_WRITE &&
+            qemu_strtou64(tok[5], NULL, 0, &val) < 0) {
+            return false;
+        }
+        op->addr = addr;
+        op->size = size;
+        op->val = val;
+        return true;
+    }
+
+    return false;
+}
+
+static bool replay_load_text(const char *path, const char *contents)
+{
+    g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+    ReplayOp op;
+
+    for (int i = 0; lines[i]; i++) {
+        char *comment = strchr(lines[i], '#');
+
+        if (comment) {
+            *comment = '\0';
+        }
+        g_strstrip(lines[i]);
+        if (!*lines[i]) {
+            continue;
+        }
+        if (!replay_parse_line(lines[i], &op)) {
+            error_report("%s:%d: invalid request", path, i + 1);
+            return false;
+        }
+        g_array_append_val(replay_ops, op);
+    }
+
+    return true;
+}
+
+/*
+ * pcap-ng traces
+ */
+
+static uint64_t replay_decode_mreq_addr(const cxl_io_mreq_header_t *hdr)
+{
+    /* inverse of send_cxl_io_mem_{read,write}() */
+    return ntohll(((uint64_t)hdr->addr_upper << 8) |
+                  ((uint64_t)hdr->addr_lower << 2));
+}
+
+static bool replay_decode_cfg(const cxl_io_cfg_req_header_t *hdr,
+                              ReplayOp *op)
+{
+    /* inverse of fill_cxl_io_cfg_req_packet() */
+    if (!hdr->first_dw_be) {
+        return false;
+    }
+    op->bdf = ntohs(hdr->dest_id);
+    op->addr = (hdr->ext_reg_num << 8) | (hdr->reg_num << 2) |
+               ctz32(hdr->first_dw_be);
+    op->size = ctpop8(hdr->first_dw_be);
+
+    return true;
+}
+
+static bool replay_decode_packet(const uint8_t *buf, size_t len, ReplayOp *op)
+{
+    const system_header_packet_t *sh = (const system_header_packet_t *)buf;
+
+    if (len < sizeof(*sh) || len < sh->payload_length) {
+        return false;
+    }
+
+    if (sh->payload_type == CXL_MEM &&
+        len >= sizeof(cxl_mem_m2s_req_packet_t)) {
+        const cxl_mem_m2s_req_packet_t *req =
+            (const cxl_mem_m2s_req_packet_t *)buf;
+        const cxl_mem_m2s_rwd_packet_t *rwd =
+            (const cxl_mem_m2s_rwd_packet_t *)buf;
+
+        switch (req->cxl_mem_header.cxl_mem_channel_t) {
+        case M2S_REQ:
+            op->type = REPLAY_MEM_READ;
+            op->addr = (uint64_t)req->m2s_req_header.addr << 6;
+            return true;
+        case M2S_RWD:
+            if (len < sizeof(*rwd)) {
+                return false;
+            }
+            op->type = REPLAY_MEM_WRITE;
+            op->addr = (uint64_t)rwd->m2s_rwd_header.addr << 6;
+            memcpy(op->data, rwd->data, sizeof(op->data));
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    if (sh->payload_type == CXL_IO &&
+        len >= sizeof(*sh) + sizeof(cxl_io_header_t)) {
+        const cxl_io_header_t *io = (const cxl_io_header_t *)(buf + sizeof(*sh));
+        const cxl_io_mem_wr_packet_t *mem = (const cxl_io_mem_wr_packet_t *)buf;
+        const cxl_io_cfg_wr_packet_t *cfg = (const cxl_io_cfg_wr_packet_t *)buf;
+
+        switch (io->fmt_type) {
+        case MRD_64B:
+        case MWR_64B:
+            op->type = io->fmt_type == MRD_64B ? REPLAY_MMIO_READ
+                                               : REPLAY_MMIO_WRITE;
+            if (len < (op->type == REPLAY_MMIO_READ
+                           ? sizeof(cxl_io_mem_rd_packet_t)
+                           : sizeof(cxl_io_mem_wr_packet_t))) {
+                return false;
+            }
+            op->addr = replay_decode_mreq_addr(&mem->mreq_header);
+            op->size = (io->length_upper << 8) | io->length_lower;
+            if (op->type == REPLAY_MMIO_WRITE) {
+                op->val = mem->data;
+            }
+            return op->size == 4 || op->size == 8;
+        case CFG_RD0:
+        case CFG_RD1:
+        case CFG_WR0:
+        case CFG_WR1:
+            op->type0 = io->fmt_type == CFG_RD0 || io->fmt_type == CFG_WR0;
+            op->type = (io->fmt_type == CFG_RD0 || io->fmt_type == CFG_RD1)
+                           ? REPLAY_CFG_READ
+                           : REPLAY_CFG_WRITE;
+            if (len < (op->type == REPLAY_CFG_READ
+                           ? sizeof(cxl_io_cfg_rd_packet_t)
+                           : sizeof(cxl_io_cfg_wr_packet_t))) {
+                return false;
+            }
+            if (op->type == REPLAY_CFG_WRITE) {
+                op->val = cfg->value;
+            }
+            return replay_decode_cfg(&cfg->cfg_req_header, op);
+        default:
+            return false;
+        }
+    }
+
+    return false;
+}
+
+static int64_t replay_ts_to_ns(uint64_t ts, uint8_t tsresol)
+{
+    int exp = 9 - tsresol;
+
+    for (; exp > 0; exp--) {
+        ts *= 10;
+    }
+    for (; exp < 0; exp++) {
+        ts /= 10;
+    }
+
+    return ts;
+}
+
+/* Walks the options of a block, returns a pointer to the value of @code */
+static const uint8_t *replay_pcapng_option(const uint8_t *opt,
+                                           const uint8_t *end, uint16_t code,
+                                           uint16_t *len)
+{
+    while (opt + 4 <= end) {
+        uint16_t ocode = lduw_he_p(opt);
+        uint16_t olen = lduw_he_p(opt + 2);
+
+        if (ocode == PCAPNG_OPT_ENDOFOPT || opt + 4 + olen > end) {
+            break;
+        }
+        if (ocode == code) {
+            *len = olen;
+            return opt + 4;
+        }
+        opt += 4 + ROUND_UP(olen, 4);
+    }
+
+    return NULL;
+}
+
+static bool replay_load_pcapng(const char *path, const uint8_t *buf,
+                               size_t size)
+{
+    uint16_t linktype[PCAPNG_MAX_INTERFACES];
+    uint8_t tsresol[PCAPNG_MAX_INTERFACES];
+    unsigned int nr_if = 0;
+    size_t off = 0;
+    ReplayOp op;
+
+    while (off + 12 <= size) {
+        const uint8_t *blk = buf + off;
+        uint32_t type = ldl_he_p(blk);
+        uint32_t len = ldl_he_p(blk + 4);
+        const uint8_t *end = blk + len - 4;
+        const uint8_t *opt;
+        uint16_t olen;
+
+        if (len < 12 || len % 4 || off + len > size) {
+            error_report("%s: truncated block at offset %zu", path, off);
+            return false;
+        }
+
+        switch (type) {
+        case PCAPNG_SHB_TYPE:
+            if (len < 28 || ldl_he_p(blk + 8) != PCAPNG_BYTE_ORDER_MAGIC) {
+                error_report("%s: capture was written with the other byte "
+                             "order", path);
+                return false;
+            }
+            nr_if = 0;
+            break;
+        case PCAPNG_IDB_TYPE:
+            if (len < 20 || nr_if == PCAPNG_MAX_INTERFACES) {
+                error_report("%s: unsupported interface block", path);
+                return false;
+            }
+            linktype[nr_if] = lduw_he_p(blk + 8);
+            tsresol[nr_if] = 6;
+            opt = replay_pcapng_option(blk + 16, end, PCAPNG_OPT_IF_TSRESOL,
+                                       &olen);
+            if (opt && olen == 1) {
+                if (*opt & 0x80) {
+                    error_report("%s: binary timestamp resolution is not "
+                                 "supported", path);
+                    return false;
+                }
+                tsresol[nr_if] = *opt;
+            }
+            nr_if++;
+            break;
+        case PCAPNG_EPB_TYPE: {
+            uint32_t ifid, caplen;
+            uint64_t ts;
+
+            if (len < 32) {
+                break;
+            }
+            ifid = ldl_he_p(blk + 8);
+            ts = ((uint64_t)ldl_he_p(blk + 12) << 32) | ldl_he_p(blk + 16);
+            caplen = ldl_he_p(blk + 20);
+            if (ifid >= nr_if || linktype[ifid] != CXL_CAPTURE_LINKTYPE ||
+                28 + ROUND_UP(caplen, 4) > len - 4) {
+                break;
+            }
+            opt = replay_pcapng_option(blk + 28 + ROUND_UP(caplen, 4), end,
+                                       PCAPNG_OPT_EPB_FLAGS, &olen);
+            if (opt && olen == 4 && (ldl_he_p(opt) & 3) != CXL_CAPTURE_TX) {
+                break;
+            }
+            memset(&op, 0, sizeof(op));
+            if (!replay_decode_packet(blk + 28, caplen, &op)) {
+                break;
+            }
+            op.ts_ns = replay_ts_to_ns(ts, tsresol[ifid]);
+            g_array_append_val(replay_ops, op);
+            break;
+        }
+        default:
+            break;
+        }
+
+        off += len;
+    }
+
+    return true;
+}
+
+static bool replay_load(const char *path)
+{
+    g_autofree char *contents = NULL;
+    g_autoptr(GError) err = NULL;
+    int64_t base;
+    gsize size;
+    bool ok;
+
+    if (!g_file_get_contents(path, &contents, &size, &err)) {
+        error_report("%s", err->message);
+        return false;
+    }
+
+    if (size >= 4 && ldl_he_p(contents) == PCAPNG_SHB_TYPE) {
+        ok = replay_load_pcapng(path, (uint8_t *)contents, size);
+    } else {
+        ok = replay_load_text(path, contents);
+    }
+    if (!ok) {
+        return false;
+    }
+    if (!replay_ops->len) {
+        error_report("%s: no requests to replay", path);
+        return false;
+    }
+
+    base = g_array_index(replay_ops, ReplayOp, 0).ts_ns;
+    for (unsigned int i = 0; i < replay_ops->len; i++) {
+        ReplayOp *op = &g_array_index(replay_ops, ReplayOp, i);
+
+        op->ts_ns = MAX(op->ts_ns - base, replay_span_ns);
+        replay_span_ns = op->ts_ns;
+    }
+    /* leave one average gap between the end of a loop and the next one */
+    replay_span_ns += replay_span_ns / replay_ops->len;
+
+    return true;
+}
+
+/*
+ * Workers
+ */
+
+static int replay_connect(const ReplayArgs *args)
+{
+    base_sideband_packet_t *packet;
+    const uint16_t tag = 0;
+    int fd;
+
+    fd = create_socket_client(args->host, args->port);
+    if (fd < 0) {
+        error_report("cannot connect to %s:%u", args->host, args->port);
+        return -1;
+    }
+
+    if (!send_sideband_connection_request(fd, args->switch_port)) {
+        error_report("cannot send the connection request");
+        close(fd);
+        return -1;
+    }
+
+    packet = wait_for_base_sideband_packet(fd);
+    if (!packet ||
+        packet->sideband_header.type != SIDEBAND_CONNECTION_ACCEPT) {
+        release_packet_entry(tag);
+        error_report("switch did not accept the connection to port %u",
+                     args->switch_port);
+        close(fd);
+        return -1;
+    }
+    release_packet_entry(tag);
+
+    return fd;
+}
+
+/* Sends one request and waits for its completion, as cxl_root_port.c does */
+static bool replay_issue(int fd, const ReplayOp *op)
+{
+    uint8_t data[CXL_MEM_ACCESS_UNIT];
+    uint32_t cfg;
+    uint16_t tag;
+    bool ok;
+
+    switch (op->type) {
+    case REPLAY_MEM_READ:
+        if (!send_cxl_mem_mem_read(fd, op->addr, &tag)) {
+            return false;
+        }
+        ok = wait_for_cxl_mem_mem_data(fd, tag) != NULL;
+        break;
+    case REPLAY_MEM_WRITE:
+        memcpy(data, op->data, sizeof(data));
+        if (!send_cxl_mem_mem_write(fd, op->addr, data, &tag)) {
+            return false;
+        }
+        ok = wait_for_cxl_mem_completion(fd, tag) != NULL;
+        break;
+    case REPLAY_MMIO_READ:
+        if (!send_cxl_io_mem_read(fd, op->addr, op->size, &tag)) {
+            return false;
+        }
+        ok = wait_for_cxl_io_completion_data(fd, tag) != NULL;
+        break;
+    case REPLAY_MMIO_WRITE:
+        /* posted */
+        return send_cxl_io_mem_write(fd, op->addr, op->val, op->size, &tag);
+    case REPLAY_CFG_READ:
+        if (!send_cxl_io_config_space_read(fd, op->bdf, op->addr, op->size,
+                                           op->type0, &tag)) {
+            return false;
+        }
+        wait_for_cxl_io_cfg_completion(fd, tag, &cfg);
+        ok = true;
+        break;
+    case REPLAY_CFG_WRITE:
+        if (!send_cxl_io_config_space_write(fd, op->bdf, op->addr, op->val,
+                                            op->size, op->type0, &tag)) {
+            return false;
+        }
+        wait_for_cxl_io_cfg_completion(fd, tag, NULL);
+        ok = true;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    release_packet_entry(tag);
+
+    return ok;
+}
+
+static int64_t replay_due_ns(const ReplayArgs *args, int64_t start_ns,
+                             unsigned int loop, unsigned int i)
+{
+    uint64_t g = (uint64_t)loop * replay_ops->len + i;
+    const ReplayOp *op = &g_array_index(replay_ops, ReplayOp, i);
+
+    switch (args->pace) {
+    case REPLAY_PACE_RATE:
+        return start_ns + (int64_t)(g * (NANOSECONDS_PER_SECOND / args->rate));
+    case REPLAY_PACE_TIMING:
+        return start_ns + (int64_t)((loop * replay_span_ns + op->ts_ns) /
+                                    args->speed);
+    default:
+        return 0;
+    }
+}
+
+static void replay_sleep_until(int64_t due_ns)
+{
+    struct timespec ts = {
+        .tv_sec = due_ns / NANOSECONDS_PER_SECOND,
+        .tv_nsec = due_ns % NANOSECONDS_PER_SECOND,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR) {
+        continue;
+    }
+}
+
+static void replay_worker(const ReplayArgs *args, ReplayControl *ctl,
+                          unsigned int id, uint64_t *latency)
+{
+    ReplayWorker *w = &ctl->workers[id];
+    int64_t start_ns, due_ns, issue_ns;
+    int fd;
+
+    fd = replay_connect(args);
+    if (fd < 0) {
+        w->failed = true;
+    }
+    qatomic_inc(&ctl->ready);
+    if (fd < 0) {
+        _exit(EXIT_FAILURE);
+    }
+
+    while (!qatomic_load_acquire(&ctl->go)) {
+        g_usleep(100);
+    }
+    if (ctl->abort) {
+        _exit(EXIT_FAILURE);
+    }
+    start_ns = ctl->start_ns;
+    replay_sleep_until(start_ns);
+
+    for (unsigned int loop = 0; loop < args->loops; loop++) {
+        for (unsigned int i = id; i < replay_ops->len; i += args->jobs) {
+            const ReplayOp *op = &g_array_index(replay_ops, ReplayOp, i);
+            uint64_t *slot = &latency[(uint64_t)loop * replay_ops->len + i];
+
+            due_ns = replay_due_ns(args, start_ns, loop, i);
+            if (due_ns) {
+                replay_sleep_until(due_ns);
+            }
+            issue_ns = get_clock();
+            if (!replay_issue(fd, op)) {
+                *slot = CXL_REPLAY_FAILED;
+                continue;
+            }
+            *slot = get_clock() - (due_ns ? due_ns : issue_ns);
+            w->done++;
+        }
+    }
+
+    w->end_ns = get_clock();
+    close(fd);
+    _exit(EXIT_SUCCESS);
+}
+
+/*
+ * Report
+ */
+
+static int replay_cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t replay_percentile(const uint64_t *sorted, size_t n,
+                                  unsigned int permille)
+{
+    size_t rank = DIV_ROUND_UP((uint64_t)n * permille, 1000);
+
+    return sorted[MAX(rank, 1) - 1];
+}
+
+static void replay_report(const ReplayArgs *args, ReplayControl *ctl,
+                          const uint64_t *latency)
+{
+    GArray *lat[REPLAY_OP__MAX];
+    uint64_t total = (uint64_t)args->loops * replay_ops->len;
+    uint64_t done = 0, failed = 0;
+    int64_t end_ns = ctl->start_ns;
+    double secs;
+
+    for (int t = 0; t < REPLAY_OP__MAX; t++) {
+        lat[t] = g_array_new(false, false, sizeof(uint64_t));
+    }
+    for (uint64_t g = 0; g < total; g++) {
+        const ReplayOp *op =
+            &g_array_index(replay_ops, ReplayOp, g % replay_ops->len);
+
+        if (latency[g] == CXL_REPLAY_FAILED) {
+            failed++;
+            continue;
+        }
+        g_array_append_val(lat[op->type], latency[g]);
+    }
+    for (unsigned int i = 0; i < args->jobs; i++) {
+        done += ctl->workers[i].done;
+        end_ns = MAX(end_ns, ctl->workers[i].end_ns);
+    }
+
+    secs = (double)(end_ns - ctl->start_ns) / NANOSECONDS_PER_SECOND;
+    printf("%" PRIu64 " requests, %" PRIu64 " failed, in %.3f s with %u "
+           "connection(s): %.0f requests/s\n",
+           done + failed, failed, secs, args->jobs, secs ? done / secs : 0);
+    printf("  %-12s %12s %10s %10s %10s %10s %10s %10s %10s\n", "class",
+           "count", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+    for (int t = 0; t < REPLAY_OP__MAX; t++) {
+        uint64_t *v = (uint64_t *)lat[t]->data;
+        size_t n = lat[t]->len;
+        uint64_t sum = 0;
+
+        if (!n) {
+            continue;
+        }
+        qsort(v, n, sizeof(*v), replay_cmp_u64);
+        for (size_t i = 0; i < n; i++) {
+            sum += v[i];
+        }
+        printf("  %-12s %12zu %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+               " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+               replay_op_names[t], n, v[0], sum / n,
+               replay_percentile(v, n, 500), replay_percentile(v, n, 900),
+               replay_percentile(v, n, 990), replay_percentile(v, n, 999),
+               v[n - 1]);
+    }
+    for (int t = 0; t < REPLAY_OP__MAX; t++) {
+        g_array_free(lat[t], true);
+    }
+    printf("(latencies in ns%s)\n",
+           args->pace == REPLAY_PACE_ASAP ? "" : ", from the time each "
+           "request was due");
+}
+
+int main(int argc, char *argv[])
+{
+    ReplayArgs args = {
+        .host = CXL_REPLAY_DEFAULT_HOST,
+        .port = CXL_REPLAY_DEFAULT_PORT,
+        .jobs = 1,
+        .loops = 1,
+        .pace = REPLAY_PACE_ASAP,
+        .speed = 1.0,
+    };
+    ReplayControl *ctl;
+    uint64_t *latency;
+    size_t ctl_size, lat_size;
+    bool ok = true;
+    int status;
+
+    error_init(argv[0]);
+    replay_parse_args(&args, argc, argv);
+
+    replay_ops = g_array_new(false, false, sizeof(ReplayOp));
+    if (!replay_load(args.trace)) {
+        return EXIT_FAILURE;
+    }
+
+    ctl_size = sizeof(*ctl) + args.jobs * sizeof(ReplayWorker);
+    lat_size = (size_t)args.loops * replay_ops->len * sizeof(uint64_t);
+    ctl = mmap(NULL, ctl_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    latency = mmap(NULL, lat_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ctl == MAP_FAILED || latency == MAP_FAILED) {
+        error_report("cannot allocate shared memory: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned int i = 0; i < args.jobs; i++) {
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            error_report("fork failed: %s", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (!pid) {
+            replay_worker(&args, ctl, i, latency);
+        }
+    }
+
+    /* start every worker at the same time, once all are connected */
+    while (qatomic_read(&ctl->ready) < args.jobs) {
+        g_usleep(1000);
+    }
+    for (unsigned int i = 0; i < args.jobs; i++) {
+        ok &= !ctl->workers[i].failed;
+    }
+    ctl->abort = !ok;
+    ctl->start_ns = get_clock() + SCALE_MS;
+    qatomic_store_release(&ctl->go, true);
+
+    while (wait(&status) > 0) {
+        ok &= WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    }
+    if (!ok) {
+        error_report("a replay worker failed");
+        return EXIT_FAILURE;
+    }
+
+    replay_report(&args, ctl, latency);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,867 @@
+/*
+ * QEMU CXL Reference Switch and Type 3 Device Emulator
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A small stand-in for the external switch emulator that a remote root port
+ * ("-device cxl-rp,socket-host=...") connects to, speaking the protocol of
+ * include/hw/cxl/cxl_emulator_packet.h over TCP.
+ *
+ * Every switch port number a client asks for in its sideband connection
+ * request selects a virtual CXL switch: one upstream port, --ports downstream
+ * ports, and one Type 3 memory device below each downstream port. Clients
+ * asking for the same switch port share the same virtual switch, so several
+ * connections can drive one topology at the same time.
+ *
+ * The functions have real PCI configuration spaces, with writable masks, bus
+ * number routing for type 1 requests and sizeable 64-bit BAR0s. The Type 3
+ * devices expose the CXL device and register locator DVSECs. MMIO to a BAR is
+ * backed by a plain register file: reads return what was last written. It is
+ * not a model of the CXL device registers. CXL.mem is served from one
+ * memory-mapped file shared by all devices, at the host physical address
+ * modulo the file size, so a small file can stand in for a large window.
+ *
+ * Each connection is served by its own thread.
+ */
+
+#include "qemu/osdep.h"
+#include <getopt.h>
+#include <netinet/tcp.h>
+#include "qemu/bitops.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "hw/pci/pci_ids.h"
+#include "hw/pci/pci_regs.h"
+
+#include "hw/cxl/cxl_emulator_packet.h"
+#include "hw/cxl/cxl_endian.h"
+
+#define EMU_DEFAULT_HOST "0.0.0.0"
+#define EMU_DEFAULT_PORT 8000
+#define EMU_DEFAULT_MEM_SIZE (256 * MiB)
+#define EMU_MAX_PORTS 32
+#define EMU_MAX_VCS 16
+#define EMU_MAX_PACKET 512
+#define EMU_LINE_LOCKS 64
+
+#define EMU_CONFIG_SIZE 4096
+#define EMU_EXP_CAP 0x40
+#define EMU_BRIDGE_BAR_SIZE (64 * KiB)
+#define EMU_DEVICE_BAR_SIZE (128 * KiB)
+
+#define EMU_USP_VENDOR_ID 0x19e5
+#define EMU_USP_DEVICE_ID 0xa128
+#define EMU_DSP_VENDOR_ID 0x19e5
+#define EMU_DSP_DEVICE_ID 0xa129
+#define EMU_T3_VENDOR_ID PCI_VENDOR_ID_INTEL
+#define EMU_T3_DEVICE_ID 0x0d93
+
+#define EMU_CXL_VENDOR_ID 0x1e98
+#define EMU_DVSEC_DEVICE 0
+#define EMU_DVSEC_DEVICE_OFFSET 0x100
+#define EMU_DVSEC_DEVICE_LENGTH 0x38
+#define EMU_DVSEC_REG_LOC 8
+#define EMU_DVSEC_REG_LOC_OFFSET \
+    (EMU_DVSEC_DEVICE_OFFSET + EMU_DVSEC_DEVICE_LENGTH)
+#define EMU_DVSEC_REG_LOC_LENGTH 0x14
+#define EMU_REG_BLOCK_MEMDEV 3
+
+/* PCIe completion status */
+#define EMU_CPL_SC 0
+#define EMU_CPL_UR 1
+
+typedef struct EmuFunction {
+    uint8_t config[EMU_CONFIG_SIZE];
+    uint8_t wmask[EMU_CONFIG_SIZE];
+    uint64_t bar_size;
+    uint8_t *regs;
+} EmuFunction;
+
+/* A virtual switch, selected by the switch port of the connection request */
+typedef struct EmuVcs {
+    QemuMutex lock;
+    EmuFunction usp;
+    EmuFunction dsp[EMU_MAX_PORTS];
+    EmuFunction t3[EMU_MAX_PORTS];
+} EmuVcs;
+
+typedef struct EmuArgs {
+    const char *host;
+    uint32_t port;
+    unsigned int ports;
+    const char *mem_path;
+    uint64_t mem_size;
+    bool verbose;
+} EmuArgs;
+
+static EmuArgs emu_args = {
+    .host = EMU_DEFAULT_HOST,
+    .port = EMU_DEFAULT_PORT,
+    .ports = 1,
+    .mem_size = EMU_DEFAULT_MEM_SIZE,
+};
+
+static QemuMutex emu_vcs_lock;
+static EmuVcs *emu_vcs[EMU_MAX_VCS];
+static uint8_t *emu_mem;
+static QemuSpin emu_line_lock[EMU_LINE_LOCKS];
+
+#define EMU_DEBUG(fmt, ...)                                                   \
+    do {                                                                      \
+        if (emu_args.verbose) {                                               \
+            info_report(fmt, ##__VA_ARGS__);                                  \
+        }                                                                     \
+    } while (0)
+
+/*
+ * Configuration space
+ */
+
+static void emu_set_word(EmuFunction *f, unsigned int off, uint16_t val)
+{
+    stw_le_p(&f->config[off], val);
+}
+
+static void emu_set_long(EmuFunction *f, unsigned int off, uint32_t val)
+{
+    stl_le_p(&f->config[off], val);
+}
+
+static void emu_set_wmask(EmuFunction *f, unsigned int off, unsigned int len,
+                          uint32_t mask)
+{
+    for (unsigned int i = 0; i < len; i++) {
+        f->wmask[off + i] = mask >> (i * 8);
+    }
+}
+
+static void emu_init_function(EmuFunction *f, uint16_t vendor, uint16_t device,
+                              uint32_t class, uint8_t header_type,
+                              uint8_t port_type, uint64_t bar_size)
+{
+    emu_set_word(f, PCI_VENDOR_ID, vendor);
+    emu_set_word(f, PCI_DEVICE_ID, device);
+    emu_set_long(f, PCI_CLASS_REVISION, class << 8 | 1);
+    emu_set_word(f, PCI_STATUS, PCI_STATUS_CAP_LIST);
+    f->config[PCI_HEADER_TYPE] = header_type;
+    f->config[PCI_CAPABILITY_LIST] = EMU_EXP_CAP;
+    emu_set_wmask(f, PCI_COMMAND, 2,
+                  PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER |
+                  PCI_COMMAND_SERR | PCI_COMMAND_INTX_DISABLE);
+    emu_set_wmask(f, PCI_INTERRUPT_LINE, 1, 0xff);
+
+    /* PCI Express capability, version 2 */
+    f->config[EMU_EXP_CAP] = PCI_CAP_ID_EXP;
+    emu_set_word(f, EMU_EXP_CAP + PCI_EXP_FLAGS, 2 | port_type << 4);
+    emu_set_word(f, EMU_EXP_CAP + PCI_EXP_LNKSTA, PCI_EXP_LNKSTA_DLLLA);
+    emu_set_wmask(f, EMU_EXP_CAP + PCI_EXP_DEVCTL, 2, 0xffff);
+
+    /* BAR0, 64-bit memory */
+    f->bar_size = bar_size;
+    f->regs = g_malloc0(bar_size);
+    emu_set_long(f, PCI_BASE_ADDRESS_0, PCI_BASE_ADDRESS_MEM_TYPE_64);
+    emu_set_wmask(f, PCI_BASE_ADDRESS_0, 4, ~(uint32_t)(bar_size - 1));
+    emu_set_wmask(f, PCI_BASE_ADDRESS_1, 4, 0xffffffff);
+
+    if (header_type == PCI_HEADER_TYPE_BRIDGE) {
+        emu_set_wmask(f, PCI_PRIMARY_BUS, 3, 0xffffff);
+        emu_set_wmask(f, PCI_MEMORY_BASE, 4, 0xfff0fff0);
+        emu_set_wmask(f, PCI_PREF_MEMORY_BASE, 4, 0xfff0fff0);
+        emu_set_wmask(f, PCI_PREF_BASE_UPPER32, 4, 0xffffffff);
+        emu_set_wmask(f, PCI_PREF_LIMIT_UPPER32, 4, 0xffffffff);
+        emu_set_wmask(f, PCI_BRIDGE_CONTROL, 2, 0xffff);
+        emu_set_word(f, PCI_PREF_MEMORY_BASE, PCI_PREF_RANGE_TYPE_64);
+        emu_set_word(f, PCI_PREF_MEMORY_LIMIT, PCI_PREF_RANGE_TYPE_64);
+    }
+}
+
+static void emu_init_dvsec(EmuFunction *f, unsigned int off, unsigned int len,
+                           uint16_t id, unsigned int next)
+{
+    emu_set_long(f, off, PCI_EXT_CAP_ID_DVSEC | 1 << 16 | next << 20);
+    emu_set_long(f, off + 4, EMU_CXL_VENDOR_ID | 1 << 16 | len << 20);
+    emu_set_word(f, off + 8, id);
+}
+
+static void emu_init_type3(EmuFunction *f)
+{
+    unsigned int dev = EMU_DVSEC_DEVICE_OFFSET;
+    unsigned int loc = EMU_DVSEC_REG_LOC_OFFSET;
+    uint64_t size = emu_args.mem_size;
+
+    emu_init_function(f, EMU_T3_VENDOR_ID, EMU_T3_DEVICE_ID,
+                      PCI_CLASS_MEMORY_CXL << 8 | 0x10, PCI_HEADER_TYPE_NORMAL,
+                      PCI_EXP_TYPE_ENDPOINT, EMU_DEVICE_BAR_SIZE);
+
+    /* PCIe DVSEC for CXL devices: Mem_Capable, one HDM range */
+    emu_init_dvsec(f, dev, EMU_DVSEC_DEVICE_LENGTH, EMU_DVSEC_DEVICE, loc);
+    emu_set_word(f, dev + 0x0a, BIT(2) | 1 << 4);
+    emu_set_wmask(f, dev + 0x0c, 2, BIT(2));
+    emu_set_long(f, dev + 0x18, size >> 32);
+    emu_set_long(f, dev + 0x1c, (size & 0xf0000000) | BIT(1) | BIT(0));
+
+    /* Register locator: the memory device registers live at BAR0 + 0 */
+    emu_init_dvsec(f, loc, EMU_DVSEC_REG_LOC_LENGTH, EMU_DVSEC_REG_LOC, 0);
+    emu_set_long(f, loc + 0x0c, EMU_REG_BLOCK_MEMDEV << 8);
+}
+
+static EmuVcs *emu_vcs_get(unsigned int port)
+{
+    EmuVcs *vcs;
+
+    if (port >= EMU_MAX_VCS) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&emu_vcs_lock);
+    vcs = emu_vcs[port];
+    if (!vcs) {
+        vcs = g_new0(EmuVcs, 1);
+        qemu_mutex_init(&vcs->lock);
+        emu_init_function(&vcs->usp, EMU_USP_VENDOR_ID, EMU_USP_DEVICE_ID,
+                          PCI_CLASS_BRIDGE_PCI << 8, PCI_HEADER_TYPE_BRIDGE,
+                          PCI_EXP_TYPE_UPSTREAM, EMU_BRIDGE_BAR_SIZE);
+        for (unsigned int i = 0; i < emu_args.ports; i++) {
+            emu_init_function(&vcs->dsp[i], EMU_DSP_VENDOR_ID,
+                              EMU_DSP_DEVICE_ID, PCI_CLASS_BRIDGE_PCI << 8,
+                              PCI_HEADER_TYPE_BRIDGE, PCI_EXP_TYPE_DOWNSTREAM,
+                              EMU_BRIDGE_BAR_SIZE);
+            emu_init_type3(&vcs->t3[i]);
+        }
+        emu_vcs[port] = vcs;
+    }
+    qemu_mutex_unlock(&emu_vcs_lock);
+
+    return vcs;
+}
+
+/* Routes a configuration request the way the switch's bridges would */
+static EmuFunction *emu_route_config(EmuVcs *vcs, uint16_t bdf, bool type0)
+{
+    uint8_t bus = bdf >> 8;
+    uint8_t dev = (bdf >> 3) & 0x1f;
+    uint8_t fn = bdf & 7;
+
+    if (fn) {
+        return NULL;
+    }
+    if (type0) {
+        return dev ? NULL : &vcs->usp;
+    }
+    if (bus == vcs->usp.config[PCI_SECONDARY_BUS]) {
+        return dev < emu_args.ports ? &vcs->dsp[dev] : NULL;
+    }
+    for (unsigned int i = 0; i < emu_args.ports; i++) {
+        if (bus == vcs->dsp[i].config[PCI_SECONDARY_BUS]) {
+            return dev ? NULL : &vcs->t3[i];
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t emu_config_read(EmuFunction *f, unsigned int off,
+                                unsigned int size)
+{
+    uint32_t val = 0;
+
+    if (!f) {
+        return MAKE_64BIT_MASK(0, size * 8);
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        val |= f->config[off + i] << (i * 8);
+    }
+
+    return val;
+}
+
+static void emu_config_write(EmuFunction *f, unsigned int off,
+                             unsigned int size, uint32_t val)
+{
+    if (!f) {
+        return;
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        uint8_t wmask = f->wmask[off + i];
+        uint8_t byte = val >> (i * 8);
+
+        f->config[off + i] = (f->config[off + i] & ~wmask) | (byte & wmask);
+    }
+}
+
+/*
+ * MMIO
+ */
+
+static bool emu_bar_claims(EmuFunction *f, uint64_t addr, uint64_t *off)
+{
+    uint64_t base = ldq_le_p(&f->config[PCI_BASE_ADDRESS_0]) &
+                    ~(uint64_t)0xf;
+
+    if (!base || addr < base || addr - base >= f->bar_size) {
+        return false;
+    }
+    *off = addr - base;
+
+    return true;
+}
+
+static EmuFunction *emu_route_mmio(EmuVcs *vcs, uint64_t addr, uint64_t *off)
+{
+    if (emu_bar_claims(&vcs->usp, addr, off)) {
+        return &vcs->usp;
+    }
+    for (unsigned int i = 0; i < emu_args.ports; i++) {
+        if (emu_bar_claims(&vcs->dsp[i], addr, off)) {
+            return &vcs->dsp[i];
+        }
+        if (emu_bar_claims(&vcs->t3[i], addr, off)) {
+            return &vcs->t3[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * CXL.mem
+ */
+
+static QemuSpin *emu_line_lock_of(uint64_t off)
+{
+    return &emu_line_lock[(off / CXL_MEM_ACCESS_UNIT) % EMU_LINE_LOCKS];
+}
+
+static uint64_t emu_mem_offset(uint64_t hpa)
+{
+    return QEMU_ALIGN_DOWN(hpa % emu_args.mem_size, CXL_MEM_ACCESS_UNIT);
+}
+
+/*
+ * Connection handling
+ */
+
+static bool emu_recv(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len) {
+        ssize_t n = read(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static bool emu_send(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static bool emu_send_sideband(int fd, sideband_type_t type)
+{
+    base_sideband_packet_t packet = {};
+
+    packet.system_header.payload_type = SIDEBAND;
+    packet.system_header.payload_length = sizeof(packet);
+    packet.sideband_header.type = type;
+
+    return emu_send(fd, &packet, sizeof(packet));
+}
+
+static void emu_fill_cpl(cxl_io_header_t *io, cxl_io_completion_header_t *cpl,
+                         cxl_io_fmt_type_t fmt_type, uint16_t req_id,
+                         uint8_t tag, unsigned int size, uint8_t status)
+{
+    io->fmt_type = fmt_type;
+    io->length_upper = 0;
+    io->length_lower = DIV_ROUND_UP(size, 4);
+    cpl->status = status;
+    cpl->byte_count_upper = (size >> 8) & 0xf;
+    cpl->byte_count_lower = size & 0xff;
+    cpl->req_id = req_id;
+    cpl->tag = tag;
+}
+
+static bool emu_send_cpl(int fd, uint16_t req_id, uint8_t tag, uint8_t status)
+{
+    cxl_io_completion_packet_t packet = {};
+
+    packet.system_header.payload_type = CXL_IO;
+    packet.system_header.payload_length = sizeof(packet);
+    emu_fill_cpl(&packet.cxl_io_header, &packet.cpl_header, CPL, req_id, tag,
+                 0, status);
+
+    return emu_send(fd, &packet, sizeof(packet));
+}
+
+static bool emu_send_cpl_data(int fd, uint16_t req_id, uint8_t tag,
+                              unsigned int size, uint64_t data)
+{
+    cxl_io_completion_data_packet_t packet = {};
+
+    packet.system_header.payload_type = CXL_IO;
+    packet.system_header.payload_length = sizeof(packet);
+    emu_fill_cpl(&packet.cxl_io_header, &packet.cpl_header, CPL_D, req_id, tag,
+                 size, EMU_CPL_SC);
+    packet.data = data;
+
+    return emu_send(fd, &packet, sizeof(packet));
+}
+
+static bool emu_handle_cfg(int fd, EmuVcs *vcs, const uint8_t *buf,
+                           size_t len)
+{
+    const cxl_io_cfg_wr_packet_t *req = (const cxl_io_cfg_wr_packet_t *)buf;
+    const cxl_io_cfg_req_header_t *hdr = &req->cfg_req_header;
+    cxl_io_fmt_type_t fmt = req->cxl_io_header.fmt_type;
+    bool is_write = fmt == CFG_WR0 || fmt == CFG_WR1;
+    bool type0 = fmt == CFG_RD0 || fmt == CFG_WR0;
+    uint16_t bdf = ntohs(hdr->dest_id);
+    unsigned int off, size;
+    EmuFunction *f;
+    uint32_t val = 0;
+
+    if (len < (is_write ? sizeof(cxl_io_cfg_wr_packet_t)
+                        : sizeof(cxl_io_cfg_rd_packet_t)) ||
+        !hdr->first_dw_be) {
+        return emu_send_cpl(fd, hdr->req_id, hdr->tag, EMU_CPL_UR);
+    }
+    off = (hdr->ext_reg_num << 8) | (hdr->reg_num << 2) |
+          ctz32(hdr->first_dw_be);
+    size = ctpop8(hdr->first_dw_be);
+
+    qemu_mutex_lock(&vcs->lock);
+    f = emu_route_config(vcs, bdf, type0);
+    if (is_write) {
+        emu_config_write(f, off, size, req->value);
+    } else {
+        val = emu_config_read(f, off, size);
+    }
+    qemu_mutex_unlock(&vcs->lock);
+
+    EMU_DEBUG("cfg %s %02x:%02x.%x +0x%03x/%u = 0x%x%s",
+              is_write ? "wr" : "rd", bdf >> 8, (bdf >> 3) & 0x1f, bdf & 7,
+              off, size, is_write ? req->value : val, f ? "" : " (absent)");
+
+    /* the root port expects all-ones data, not UR, for an absent function */
+    if (is_write) {
+        return emu_send_cpl(fd, hdr->req_id, hdr->tag, EMU_CPL_SC);
+    }
+    return emu_send_cpl_data(fd, hdr->req_id, hdr->tag, size, val);
+}
+
+static bool emu_handle_mmio(int fd, EmuVcs *vcs, const uint8_t *buf,
+                            size_t len)
+{
+    const cxl_io_mem_wr_packet_t *req = (const cxl_io_mem_wr_packet_t *)buf;
+    const cxl_io_mreq_header_t *hdr = &req->mreq_header;
+    bool is_write = req->cxl_io_header.fmt_type == MWR_64B;
+    unsigned int size = (req->cxl_io_header.length_upper << 8) |
+                        req->cxl_io_header.length_lower;
+    uint64_t addr, off, val = UINT64_MAX;
+    EmuFunction *f;
+
+    if (len < (is_write ? sizeof(cxl_io_mem_wr_packet_t)
+                        : sizeof(cxl_io_mem_rd_packet_t)) ||
+        (size != 4 && size != 8)) {
+        /* a posted write gets no completion, even a failing one */
+        return is_write || emu_send_cpl(fd, hdr->req_id, hdr->tag, EMU_CPL_UR);
+    }
+    addr = ntohll(((uint64_t)hdr->addr_upper << 8) |
+                  ((uint64_t)hdr->addr_lower << 2));
+
+    qemu_mutex_lock(&vcs->lock);
+    f = emu_route_mmio(vcs, addr, &off);
+    if (f && off + size <= f->bar_size) {
+        if (is_write) {
+            memcpy(&f->regs[off], &req->data, size);
+        } else {
+            val = size == 4 ? ldl_le_p(&f->regs[off]) : ldq_le_p(&f->regs[off]);
+        }
+    }
+    qemu_mutex_unlock(&vcs->lock);
+
+    EMU_DEBUG("mmio %s 0x%" PRIx64 "/%u = 0x%" PRIx64 "%s",
+              is_write ? "wr" : "rd", addr, size, is_write ? req->data : val,
+              f ? "" : " (unclaimed)");
+
+    if (is_write) {
+        return true;
+    }
+    return emu_send_cpl_data(fd, hdr->req_id, hdr->tag, size,
+                             size == 4 ? (uint32_t)val : val);
+}
+
+static bool emu_handle_mem(int fd, const uint8_t *buf, size_t len)
+{
+    const cxl_mem_m2s_req_packet_t *req = (const cxl_mem_m2s_req_packet_t *)buf;
+    const cxl_mem_m2s_rwd_packet_t *rwd = (const cxl_mem_m2s_rwd_packet_t *)buf;
+    QemuSpin *lock;
+    uint64_t off;
+
+    if (len < sizeof(*req)) {
+        return false;
+    }
+
+    switch (req->cxl_mem_header.cxl_mem_channel_t) {
+    case M2S_REQ: {
+        cxl_mem_s2m_drs_packet_t drs = {};
+
+        off = emu_mem_offset((uint64_t)req->m2s_req_header.addr << 6);
+        drs.system_header.payload_type = CXL_MEM;
+        drs.system_header.payload_length = sizeof(drs);
+        drs.cxl_mem_header.port_index = req->cxl_mem_header.port_index;
+        drs.cxl_mem_header.cxl_mem_channel_t = S2M_DRS;
+        drs.s2m_drs.valid = 1;
+        drs.s2m_drs.tag = req->m2s_req_header.tag;
+        drs.s2m_drs.ld_id = req->m2s_req_header.ld_id;
+
+        lock = emu_line_lock_of(off);
+        qemu_spin_lock(lock);
+        memcpy(drs.data, &emu_mem[off], sizeof(drs.data));
+        qemu_spin_unlock(lock);
+
+        EMU_DEBUG("mem rd 0x%" PRIx64, off);
+        return emu_send(fd, &drs, sizeof(drs));
+    }
+    case M2S_RWD: {
+        cxl_mem_s2m_ndr_packet_t ndr = {};
+
+        if (len < sizeof(*rwd)) {
+            return false;
+        }
+        off = emu_mem_offset((uint64_t)rwd->m2s_rwd_header.addr << 6);
+
+        lock = emu_line_lock_of(off);
+        qemu_spin_lock(lock);
+        memcpy(&emu_mem[off], rwd->data, sizeof(rwd->data));
+        qemu_spin_unlock(lock);
+
+        ndr.system_header.payload_type = CXL_MEM;
+        ndr.system_header.payload_length = sizeof(ndr);
+        ndr.cxl_mem_header.port_index = rwd->cxl_mem_header.port_index;
+        ndr.cxl_mem_header.cxl_mem_channel_t = S2M_NDR;
+        ndr.s2m_ndr.valid = 1;
+        ndr.s2m_ndr.tag = rwd->m2s_rwd_header.tag;
+        ndr.s2m_ndr.ld_id = rwd->m2s_rwd_header.ld_id;
+
+        EMU_DEBUG("mem wr 0x%" PRIx64, off);
+        return emu_send(fd, &ndr, sizeof(ndr));
+    }
+    default:
+        error_report("unexpected CXL.mem channel %u",
+                     req->cxl_mem_header.cxl_mem_channel_t);
+        return false;
+    }
+}
+
+static bool emu_handle_io(int fd, EmuVcs *vcs, const uint8_t *buf, size_t len)
+{
+    const cxl_io_header_t *io =
+        (const cxl_io_header_t *)(buf + sizeof(system_header_packet_t));
+
+    if (len < sizeof(system_header_packet_t) + sizeof(*io)) {
+        return false;
+    }
+
+    switch (io->fmt_type) {
+    case CFG_RD0:
+    case CFG_RD1:
+    case CFG_WR0:
+    case CFG_WR1:
+        return emu_handle_cfg(fd, vcs, buf, len);
+    case MRD_64B:
+    case MWR_64B:
+        return emu_handle_mmio(fd, vcs, buf, len);
+    default:
+        error_report("unsupported CXL.io request 0x%02x", io->fmt_type);
+        return false;
+    }
+}
+
+static void *emu_connection_main(void *opaque)
+{
+    int fd = (intptr_t)opaque;
+    uint8_t buf[EMU_MAX_PACKET] QEMU_ALIGNED(8);
+    system_header_packet_t *sh = (system_header_packet_t *)buf;
+    EmuVcs *vcs = NULL;
+    bool ok = true;
+
+    while (ok && emu_recv(fd, buf, sizeof(*sh))) {
+        size_t len = sh->payload_length;
+
+        if (len < sizeof(*sh) || len > sizeof(buf) ||
+            !emu_recv(fd, buf + sizeof(*sh), len - sizeof(*sh))) {
+            break;
+        }
+
+        if (sh->payload_type == SIDEBAND) {
+            const sideband_connection_request_packet_t *req =
+                (const sideband_connection_request_packet_t *)buf;
+
+            if (len < sizeof(*req) ||
+                req->sideband_header.type != SIDEBAND_CONNECTION_REQUEST) {
+                break;
+            }
+            vcs = emu_vcs_get(req->port);
+            info_report("connection %d: switch port %u %s", fd, req->port,
+                        vcs ? "accepted" : "rejected");
+            ok = emu_send_sideband(fd, vcs ? SIDEBAND_CONNECTION_ACCEPT
+                                           : SIDEBAND_CONNECTION_REJECT);
+            continue;
+        }
+        if (!vcs) {
+            error_report("connection %d: request before connection accept",
+                         fd);
+            break;
+        }
+
+        switch (sh->payload_type) {
+        case CXL_IO:
+            ok = emu_handle_io(fd, vcs, buf, len);
+            break;
+        case CXL_MEM:
+            ok = emu_handle_mem(fd, buf, len);
+            break;
+        default:
+            error_report("connection %d: unsupported payload type %u", fd,
+                         sh->payload_type);
+            ok = false;
+            break;
+        }
+    }
+
+    info_report("connection %d: closed", fd);
+    close(fd);
+
+    return NULL;
+}
+
+/*
+ * Setup
+ */
+
+static void emu_usage(const char *name, int code)
+{
+    fprintf(stderr, "Usage: %s [options]\n"
+            "CXL switch and Type 3 device emulator for remote root ports.\n"
+            "\n"
+            "  -H, --host=ADDR       address to listen on (default %s)\n"
+            "  -p, --port=PORT       TCP port to listen on (default %d)\n"
+            "  -n, --ports=N         downstream ports per switch (default 1)\n"
+            "  -m, --mem-path=FILE   back CXL.mem with FILE (default: "
+            "anonymous)\n"
+            "  -s, --mem-size=SIZE   size of CXL.mem backing (default 256M)\n"
+            "  -v, --verbose         log every request\n"
+            "  -h, --help            show this help\n",
+            name, EMU_DEFAULT_HOST, EMU_DEFAULT_PORT);
+    exit(code);
+}
+
+static void emu_parse_args(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "host", required_argument, NULL, 'H' },
+        { "port", required_argument, NULL, 'p' },
+        { "ports", required_argument, NULL, 'n' },
+        { "mem-path", required_argument, NULL, 'm' },
+        { "mem-size", required_argument, NULL, 's' },
+        { "verbose", no_argument, NULL, 'v' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    unsigned int val;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "H:p:n:m:s:vh", long_options,
+                            NULL)) != -1) {
+        switch (c) {
+        case 'H':
+            emu_args.host = optarg;
+            break;
+        case 'p':
+        case 'n':
+            if (qemu_strtoui(optarg, NULL, 0, &val) < 0) {
+                error_report("invalid number '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            if (c == 'p') {
+                emu_args.port = val;
+            } else if (val < 1 || val > EMU_MAX_PORTS) {
+                error_report("--ports must be between 1 and %d",
+                             EMU_MAX_PORTS);
+                exit(EXIT_FAILURE);
+            } else {
+                emu_args.ports = val;
+            }
+            break;
+        case 'm':
+            emu_args.mem_path = optarg;
+            break;
+        case 's':
+            if (qemu_strtosz(optarg, NULL, &emu_args.mem_size) < 0 ||
+                emu_args.mem_size < CXL_MEM_ACCESS_UNIT) {
+                error_report("invalid size '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'v':
+            emu_args.verbose = true;
+            break;
+        case 'h':
+            emu_usage(argv[0], EXIT_SUCCESS);
+            break;
+        default:
+            emu_usage(argv[0], EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if (optind != argc) {
+        emu_usage(argv[0], EXIT_FAILURE);
+    }
+    emu_args.mem_size = QEMU_ALIGN_DOWN(emu_args.mem_size, CXL_MEM_ACCESS_UNIT);
+}
+
+static bool emu_map_memory(void)
+{
+    int flags = MAP_SHARED;
+    int fd = -1;
+
+    if (emu_args.mem_path) {
+        struct stat st;
+
+        fd = open(emu_args.mem_path, O_RDWR | O_CREAT, 0600);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            error_report("cannot open '%s': %s", emu_args.mem_path,
+                         strerror(errno));
+            return false;
+        }
+        if (st.st_size < emu_args.mem_size &&
+            ftruncate(fd, emu_args.mem_size) < 0) {
+            error_report("cannot resize '%s': %s", emu_args.mem_path,
+                         strerror(errno));
+            close(fd);
+            return false;
+        }
+    } else {
+        flags |= MAP_ANONYMOUS;
+    }
+
+    emu_mem = mmap(NULL, emu_args.mem_size, PROT_READ | PROT_WRITE, flags, fd,
+                   0);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (emu_mem == MAP_FAILED) {
+        error_report("cannot map CXL.mem backing: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static int emu_listen(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(emu_args.port),
+    };
+    int one = 1;
+    int fd;
+
+    if (inet_pton(AF_INET, emu_args.host, &addr.sin_addr) != 1) {
+        error_report("invalid listen address '%s'", emu_args.host);
+        return -1;
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        error_report("cannot listen on %s:%u: %s", emu_args.host,
+                     emu_args.port, strerror(errno));
+        return -1;
+    }
+
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    int listen_fd;
+
+    error_init(argv[0]);
+    emu_parse_args(argc, argv);
+    /* a client going away must only end its own connection */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!emu_map_memory()) {
+        return EXIT_FAILURE;
+    }
+    qemu_mutex_init(&emu_vcs_lock);
+    for (int i = 0; i < EMU_LINE_LOCKS; i++) {
+        qemu_spin_init(&emu_line_lock[i]);
+    }
+
+    listen_fd = emu_listen();
+    if (listen_fd < 0) {
+        return EXIT_FAILURE;
+    }
+    info_report("listening on %s:%u, %u downstream port(s), %" PRIu64
+                " MiB of CXL.mem", emu_args.host, emu_args.port,
+                emu_args.ports, emu_args.mem_size / MiB);
+
+    for (;;) {
+        QemuThread thread;
+        int one = 1;
+        int fd;
+
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                error_report("accept failed: %s", strerror(errno));
+            }
+            continue;
+        }
+        /* requests are small and synchronous, never wait for Nagle */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        qemu_thread_create(&thread, "cxl-emu-conn", emu_connection_main,
+                           (void *)(intptr_t)fd, QEMU_THREAD_DETACHED);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -3,132 +3,751 @@
  *
  * This work is licensed under the terms of the GNU GPL, version 2 or later.
  * See the COPYING file in the top-level directory.
+ *
+ * CXL memory benchmark, run inside the guest.
+ *
+ * Maps a device DAX instance (the remote path through the CXL window) or,
+ * with --anon, anonymous memory bound to a NUMA node (the direct-map path,
+ * e.g. CXL memory onlined as a memory-only node through kmem), and hammers
+ * it from several threads with a configurable access size, pattern and
+ * read/write mix. Reports bandwidth and the latency distribution of reads
+ * and writes.
+ *
+ * Every 8-byte word written holds a pattern derived from its own offset, so
+ * with --verify any read can be checked no matter which thread wrote last.
+ *
+ * Build: gcc -O2 -pthread -o iogen iogen.c
+ *
+ * Examples:
+ *   iogen -d /dev/dax0.0 -t 4 -b 64 -p rand -w 30 -T 10
+ *   iogen --anon 1G --mem-node 1 --cpu-node 0 -p seq -b 4096 --verify
  */
 
+#define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
-#include <inttypes.h>
 
 #define SYSFS_PATH_MAX 256
-#define DEVICE_PATH_MAX 256
 
-#define DEFAULT_STEP_SIZE 64
-#define ALIGNMENT 2097152 // 2 * 1024 * 1024 (2 MiB)
-#define DEFAULT_DEVICE_PATH "dax0.0"
+#define DEFAULT_DEVICE_PATH "/dev/dax0.0"
+#define DEFAULT_BLOCK_SIZE 64
+#define DEFAULT_STRIDE 4096
+#define DEFAULT_DURATION 10
+#define CACHELINE_SIZE 64
+#define MAX_CPUS 1024
+#define MAX_REPORTED_MISMATCHES 8
+
+#define PATTERN_MULTIPLIER 0x9E3779B97F4A7C15ULL
+
+/* Same bucketing as hw/pci-bridge/cxl_latency.c: 1/8 relative precision */
+#define SUB_BUCKET_BITS 3
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define NR_BUCKETS ((64 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS)
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+enum { OP_READ, OP_WRITE, OP_MAX };
+
+static const char *const op_names[OP_MAX] = { "read", "write" };
+
+enum access_pattern { PATTERN_SEQ, PATTERN_RAND, PATTERN_STRIDE };
+
+static const char *const pattern_names[] = { "seq", "rand", "stride" };
+
+struct iogen_args {
+    const char *device;
+    uint64_t anon_size;
+    uint64_t size;
+    unsigned int threads;
+    uint64_t block;
+    enum access_pattern pattern;
+    uint64_t stride;
+    unsigned int write_pct;
+    unsigned int duration;
+    uint64_t ops;
+    bool verify;
+    bool flush;
+    int mem_node;
+    int cpus[MAX_CPUS];
+    unsigned int nr_cpus;
+    uint64_t seed;
+};
+
+struct iogen_thread {
+    pthread_t thread;
+    unsigned int id;
+    uint64_t base;
+    uint64_t slice;
+    uint64_t ops[OP_MAX];
+    uint64_t hist[OP_MAX][NR_BUCKETS];
+    uint64_t max_ns[OP_MAX];
+    uint64_t mismatches;
+} __attribute__((aligned(CACHELINE_SIZE)));
+
+static struct iogen_args args = {
+    .device = DEFAULT_DEVICE_PATH,
+    .threads = 1,
+    .block = DEFAULT_BLOCK_SIZE,
+    .pattern = PATTERN_SEQ,
+    .stride = DEFAULT_STRIDE,
+    .duration = DEFAULT_DURATION,
+    .mem_node = -1,
+};
+
+static uint8_t *region;
+static uint64_t region_size;
+static uint64_t map_size;
+static pthread_barrier_t start_barrier;
+static volatile bool stop;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-void get_device_size(const char *device_path, off_t *device_size)
+static uint64_t pattern_word(uint64_t offset)
 {
+    return (offset * PATTERN_MULTIPLIER) ^ args.seed;
+}
+
+static void fill_pattern(uint64_t *buf, uint64_t offset, uint64_t len)
+{
+    for (uint64_t i = 0; i < len / 8; i++) {
+        buf[i] = pattern_word(offset + i * 8);
+    }
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * Latency histogram
+ */
+
+static unsigned int bucket_of(uint64_t ns)
+{
+    unsigned int msb, shift;
+
+    if (ns < SUB_BUCKETS) {
+        return ns;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    shift = msb - SUB_BUCKET_BITS;
+
+    return ((shift + 1) << SUB_BUCKET_BITS) +
+           ((ns >> shift) & (SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_upper(unsigned int idx)
+{
+    unsigned int shift;
+
+    if (idx < SUB_BUCKETS) {
+        return idx;
+    }
+    shift = (idx >> SUB_BUCKET_BITS) - 1;
+
+    return ((uint64_t)(SUB_BUCKETS + (idx & (SUB_BUCKETS - 1))) << shift) +
+           (1ULL << shift) - 1;
+}
+
+static uint64_t percentile(const uint64_t *hist, uint64_t total,
+                           unsigned int permille)
+{
+    uint64_t rank = (total * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    if (!total) {
+        return 0;
+    }
+    for (unsigned int i = 0; i < NR_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= (rank ? rank : 1)) {
+            return bucket_upper(i);
+        }
+    }
+
+    return bucket_upper(NR_BUCKETS - 1);
+}
+
+/*
+ * Setup
+ */
+
+static int get_dax_size(const char *device_path, uint64_t *size)
+{
+    const char *name = strrchr(device_path, '/');
     char sysfs_path[SYSFS_PATH_MAX];
     FILE *sysfs_file;
+    int ret = 0;
 
     snprintf(sysfs_path, SYSFS_PATH_MAX, "/sys/bus/dax/devices/%s/size",
-             device_path);
+             name ? name + 1 : device_path);
 
     sysfs_file = fopen(sysfs_path, "r");
     if (sysfs_file == NULL) {
-        perror("Failed to open sysfs file");
-        exit(1);
+        return -1;
     }
+    if (fscanf(sysfs_file, "%" SCNu64, size) != 1) {
+        ret = -1;
+    }
+    fclose(sysfs_file);
 
-    if (fscanf(sysfs_file, "%ld", device_size) != 1) {
-        perror("Failed to read device size from sysfs");
-        fclose(sysfs_file);
-        exit(1);
+    return ret;
+}
+
+static int parse_cpulist(const char *list)
+{
+    const char *p = list;
+
+    while (*p && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10), last;
+
+        if (end == p || first < 0) {
+            return -1;
+        }
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last && args.nr_cpus < MAX_CPUS; cpu++) {
+            args.cpus[args.nr_cpus++] = cpu;
+        }
+        p = *end == ',' ? end + 1 : end;
     }
 
-    fclose(sysfs_file);
+    return args.nr_cpus ? 0 : -1;
 }
 
-int main(int argc, char *argv[])
+static int parse_cpu_node(const char *node)
 {
-    const char *target_device = (argc > 1) ? argv[1] : DEFAULT_DEVICE_PATH;
-    char device_path[DEVICE_PATH_MAX];
-    snprintf(device_path, DEVICE_PATH_MAX, "/dev/%s", target_device);
-    printf("Device Path: %s\n", device_path);
+    char path[SYSFS_PATH_MAX];
+    char list[4096];
+    FILE *f;
+    int ret;
 
-    int fd;
-    void *mmap_ptr;
-    off_t pagesize = sysconf(_SC_PAGESIZE);
-    printf("Page size: %ld bytes\n", pagesize);
-
-    // Open the character device
-    fd = open(device_path, O_RDWR);
-    if (fd < 0) {
-        perror("Failed to open the device");
-        return 1;
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%s/cpulist",
+             node);
+    f = fopen(path, "r");
+    if (!f) {
+        return -1;
     }
+    ret = fgets(list, sizeof(list), f) ? parse_cpulist(list) : -1;
+    fclose(f);
 
-    // Get the device size
-    off_t device_size;
-    get_device_size(target_device, &device_size);
-    printf("Device size: %ld bytes\n", device_size);
+    return ret;
+}
 
-    // Memory map the device into user space with proper alignment
-    const uint64_t capacity = device_size;
-    mmap_ptr = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    printf("MMAP at %p\n", mmap_ptr);
+static int parse_size(const char *str, uint64_t *size)
+{
+    char *end;
+    uint64_t val = strtoull(str, &end, 0);
 
-    if (mmap_ptr == MAP_FAILED) {
-        perror("Memory mapping failed");
-        close(fd);
-        return 1;
+    if (end == str) {
+        return -1;
     }
+    switch (*end) {
+    case 'G':
+    case 'g':
+        val <<= 10;
+        /* fall through */
+    case 'M':
+    case 'm':
+        val <<= 10;
+        /* fall through */
+    case 'K':
+    case 'k':
+        val <<= 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+    if (*end) {
+        return -1;
+    }
+    *size = val;
+
+    return 0;
+}
 
-    uint64_t io_offset;
-    uint64_t *memory_map = mmap_ptr;
+static void usage(const char *name, int code)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "\n"
+            "Target:\n"
+            "  -d, --device=PATH      device DAX to map (default %s)\n"
+            "  -A, --anon=SIZE        map anonymous memory instead\n"
+            "  -M, --mem-node=NODE    bind --anon memory to NUMA node NODE\n"
+            "  -s, --size=SIZE        only use the first SIZE bytes\n"
+            "\n"
+            "Workload:\n"
+            "  -t, --threads=N        number of threads (default 1)\n"
+            "  -b, --block=SIZE       access size, multiple of 8 (default %d)\n"
+            "  -p, --pattern=PAT      seq, rand or stride (default seq)\n"
+            "  -S, --stride=SIZE      stride for -p stride (default %d)\n"
+            "  -w, --write=PCT        percentage of writes (default 0)\n"
+            "  -T, --time=SECS        run for SECS seconds (default %d)\n"
+            "  -n, --ops=N            run N operations per thread instead\n"
+            "  -V, --verify           prefill and check every read\n"
+            "  -F, --flush            flush accessed lines from the cache\n"
+            "  -r, --seed=N           seed of the data pattern and offsets\n"
+            "\n"
+            "Placement:\n"
+            "  -C, --cpu-node=NODE    run threads on the CPUs of NUMA node NODE\n"
+            "  -c, --cpus=LIST        run threads on CPUs LIST, e.g. 0-3,8\n",
+            name, DEFAULT_DEVICE_PATH, DEFAULT_BLOCK_SIZE, DEFAULT_STRIDE,
+            DEFAULT_DURATION);
+    exit(code);
+}
 
-    uint64_t *data = (uint64_t *)malloc(DEFAULT_STEP_SIZE);
-    if (data == NULL) {
-        printf("Failed to allocate test data.\n");
+static void parse_args(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "device", required_argument, NULL, 'd' },
+        { "anon", required_argument, NULL, 'A' },
+        { "mem-node", required_argument, NULL, 'M' },
+        { "size", required_argument, NULL, 's' },
+        { "threads", required_argument, NULL, 't' },
+        { "block", required_argument, NULL, 'b' },
+        { "pattern", required_argument, NULL, 'p' },
+        { "stride", required_argument, NULL, 'S' },
+        { "write", required_argument, NULL, 'w' },
+        { "time", required_argument, NULL, 'T' },
+        { "ops", required_argument, NULL, 'n' },
+        { "verify", no_argument, NULL, 'V' },
+        { "flush", no_argument, NULL, 'F' },
+        { "seed", required_argument, NULL, 'r' },
+        { "cpu-node", required_argument, NULL, 'C' },
+        { "cpus", required_argument, NULL, 'c' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    unsigned int i;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "d:A:M:s:t:b:p:S:w:T:n:VFr:C:c:h",
+                            long_options, NULL)) != -1) {
+        switch (c) {
+        case 'd':
+            args.device = optarg;
+            break;
+        case 'A':
+            if (parse_size(optarg, &args.anon_size) || !args.anon_size) {
+                usage(argv[0], 1);
+            }
+            break;
+        case 'M':
+            args.mem_node = atoi(optarg);
+            break;
+        case 's':
+            if (parse_size(optarg, &args.size)) {
+                usage(argv[0], 1);
+            }
+            break;
+        case 't':
+            args.threads = atoi(optarg);
+            break;
+        case 'b':
+            if (parse_size(optarg, &args.block) || !args.block ||
+                args.block % 8) {
+                usage(argv[0], 1);
+            }
+            break;
+        case 'p':
+            for (i = 0; i < 3 && strcmp(optarg, pattern_names[i]); i++) {
+                continue;
+            }
+            if (i == 3) {
+                usage(argv[0], 1);
+            }
+            args.pattern = i;
+            break;
+        case 'S':
+            if (parse_size(optarg, &args.stride) || !args.stride) {
+                usage(argv[0], 1);
+            }
+            break;
+        case 'w':
+            args.write_pct = atoi(optarg);
+            break;
+        case 'T':
+            args.duration = atoi(optarg);
+            break;
+        case 'n':
+            args.ops = strtoull(optarg, NULL, 0);
+            break;
+        case 'V':
+            args.verify = true;
+            break;
+        case 'F':
+            args.flush = true;
+            break;
+        case 'r':
+            args.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'C':
+            if (parse_cpu_node(optarg)) {
+                fprintf(stderr, "Cannot read the CPUs of node %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            if (parse_cpulist(optarg)) {
+                usage(argv[0], 1);
+            }
+            break;
+        case 'h':
+            usage(argv[0], 0);
+            break;
+        default:
+            usage(argv[0], 1);
+            break;
+        }
+    }
+
+    if (optind != argc || !args.threads || args.write_pct > 100 ||
+        (!args.ops && !args.duration)) {
+        usage(argv[0], 1);
+    }
+}
+
+static int map_region(void)
+{
+    uint64_t size;
+    int fd;
+
+    if (args.anon_size) {
+        size = args.anon_size;
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            perror("Memory mapping failed");
+            return -1;
+        }
+        if (args.mem_node >= 0) {
+            unsigned long nodemask[16] = { 0 };
+            unsigned long bits = 8 * sizeof(unsigned long);
+
+            if (args.mem_node >= (int)(16 * bits)) {
+                fprintf(stderr, "NUMA node %d out of range\n", args.mem_node);
+                return -1;
+            }
+            nodemask[args.mem_node / bits] = 1UL << (args.mem_node % bits);
+            if (syscall(SYS_mbind, region, size, MPOL_BIND, nodemask,
+                        16 * bits, MPOL_MF_MOVE)) {
+                perror("Binding memory to node failed");
+                return -1;
+            }
+        }
+    } else {
+        fd = open(args.device, O_RDWR);
+        if (fd < 0) {
+            perror("Failed to open the device");
+            return -1;
+        }
+        if (get_dax_size(args.device, &size)) {
+            struct stat st;
+
+            if (fstat(fd, &st) || !st.st_size) {
+                fprintf(stderr, "Cannot find the size of %s\n", args.device);
+                close(fd);
+                return -1;
+            }
+            size = st.st_size;
+        }
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
         close(fd);
+        if (region == MAP_FAILED) {
+            perror("Memory mapping failed");
+            return -1;
+        }
+    }
+
+    map_size = size;
+    region_size = args.size && args.size < size ? args.size : size;
+    region_size -= region_size % args.block;
+    if (region_size < args.block * args.threads) {
+        fprintf(stderr, "Region too small for %u threads of %" PRIu64
+                " byte blocks\n", args.threads, args.block);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int pin_thread(unsigned int id)
+{
+    cpu_set_t set;
+
+    if (!args.nr_cpus) {
+        return 0;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(args.cpus[id % args.nr_cpus], &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * Workers
+ */
+
+static inline void flush_range(const uint8_t *p, uint64_t len)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    for (uint64_t i = 0; i < len; i += CACHELINE_SIZE) {
+        __builtin_ia32_clflush(p + i);
+    }
+    __builtin_ia32_mfence();
+#else
+    (void)p;
+    (void)len;
+#endif
+}
+
+static uint64_t next_offset(struct iogen_thread *t, uint64_t k,
+                            uint64_t *rng)
+{
+    uint64_t pos;
+
+    switch (args.pattern) {
+    case PATTERN_RAND:
+        return (xorshift64(rng) % (region_size / args.block)) * args.block;
+    case PATTERN_STRIDE:
+        /* shift by a block on every wrap so the whole slice is covered */
+        pos = k * args.stride;
+        pos += (pos / t->slice) * args.block;
+        return t->base + (pos % t->slice) / args.block * args.block;
+    default:
+        return t->base + (k * args.block) % t->slice;
+    }
+}
+
+static void check_block(struct iogen_thread *t, const uint64_t *buf,
+                        uint64_t offset)
+{
+    for (uint64_t i = 0; i < args.block / 8; i++) {
+        uint64_t expected = pattern_word(offset + i * 8);
+
+        if (buf[i] == expected) {
+            continue;
+        }
+        if (t->mismatches++ < MAX_REPORTED_MISMATCHES) {
+            pthread_mutex_lock(&report_lock);
+            fprintf(stderr, "Mismatch at 0x%" PRIx64 ": read 0x%016" PRIx64
+                    ", expected 0x%016" PRIx64 "\n", offset + i * 8, buf[i],
+                    expected);
+            pthread_mutex_unlock(&report_lock);
+        }
+    }
+}
+
+static void *worker_main(void *opaque)
+{
+    struct iogen_thread *t = opaque;
+    uint64_t rng = (args.seed + t->id + 1) * PATTERN_MULTIPLIER;
+    uint64_t *buf = aligned_alloc(CACHELINE_SIZE,
+                                  (args.block + CACHELINE_SIZE - 1) &
+                                  ~(uint64_t)(CACHELINE_SIZE - 1));
+
+    if (!buf || pin_thread(t->id)) {
+        fprintf(stderr, "Thread %u: setup failed\n", t->id);
+        exit(1);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+
+    for (uint64_t k = 0; args.ops ? k < args.ops : !stop; k++) {
+        uint64_t offset = next_offset(t, k, &rng);
+        int op = (xorshift64(&rng) % 100) < args.write_pct ? OP_WRITE
+                                                           : OP_READ;
+        uint64_t start, ns;
+
+        if (op == OP_WRITE) {
+            fill_pattern(buf, offset, args.block);
+        }
+
+        start = now_ns();
+        if (op == OP_WRITE) {
+            memcpy(region + offset, buf, args.block);
+        } else {
+            memcpy(buf, region + offset, args.block);
+        }
+        if (args.flush) {
+            flush_range(region + offset, args.block);
+        }
+        ns = now_ns() - start;
+
+        t->ops[op]++;
+        t->hist[op][bucket_of(ns)]++;
+        if (ns > t->max_ns[op]) {
+            t->max_ns[op] = ns;
+        }
+        if (op == OP_READ && args.verify) {
+            check_block(t, buf, offset);
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static void prefill(void)
+{
+    for (uint64_t off = 0; off < region_size; off += 8) {
+        *(uint64_t *)(region + off) = pattern_word(off);
+    }
+    if (args.flush) {
+        flush_range(region, region_size);
+    }
+}
+
+/*
+ * Report
+ */
+
+static void report(struct iogen_thread *threads, double secs)
+{
+    static uint64_t hist[OP_MAX + 1][NR_BUCKETS];
+    uint64_t ops[OP_MAX + 1] = { 0 };
+    uint64_t max_ns[OP_MAX + 1] = { 0 };
+    uint64_t mismatches = 0;
+
+    for (unsigned int i = 0; i < args.threads; i++) {
+        struct iogen_thread *t = &threads[i];
+
+        for (int op = 0; op < OP_MAX; op++) {
+            ops[op] += t->ops[op];
+            ops[OP_MAX] += t->ops[op];
+            for (unsigned int b = 0; b < NR_BUCKETS; b++) {
+                hist[op][b] += t->hist[op][b];
+                hist[OP_MAX][b] += t->hist[op][b];
+            }
+            if (t->max_ns[op] > max_ns[op]) {
+                max_ns[op] = t->max_ns[op];
+            }
+            if (t->max_ns[op] > max_ns[OP_MAX]) {
+                max_ns[OP_MAX] = t->max_ns[op];
+            }
+        }
+        mismatches += t->mismatches;
+    }
+
+    printf("%s, %" PRIu64 " MiB, %u thread(s), %" PRIu64 " B %s, "
+           "%u%% writes, %.2f s\n",
+           args.anon_size ? "anonymous memory" : args.device,
+           region_size >> 20, args.threads, args.block,
+           pattern_names[args.pattern], args.write_pct, secs);
+    printf("%-6s %14s %12s %10s %10s %10s %10s %10s\n", "", "ops", "ops/s",
+           "MiB/s", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)");
+    for (int op = 0; op <= OP_MAX; op++) {
+        if (!ops[op]) {
+            continue;
+        }
+        printf("%-6s %14" PRIu64 " %12.0f %10.1f %10" PRIu64 " %10" PRIu64
+               " %10" PRIu64 " %10" PRIu64 "\n",
+               op == OP_MAX ? "total" : op_names[op], ops[op], ops[op] / secs,
+               ops[op] * args.block / secs / (1 << 20),
+               percentile(hist[op], ops[op], 500),
+               percentile(hist[op], ops[op], 990),
+               percentile(hist[op], ops[op], 999), max_ns[op]);
+    }
+    if (args.verify) {
+        printf("verify: %" PRIu64 " mismatched words\n", mismatches);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct iogen_thread *threads;
+    uint64_t slice, start;
+    double secs;
+
+    parse_args(argc, argv);
+
+    if (map_region()) {
         return 1;
     }
-    data[0] = 0x1111111111111111;
-    data[1] = 0x2222222222222222;
-    data[2] = 0x3333333333333333;
-    data[3] = 0x4444444444444444;
-    data[4] = 0x5555555555555555;
-    data[5] = 0x6666666666666666;
-    data[6] = 0x7777777777777777;
-    data[7] = 0x8888888888888888;
-
-    // Write to mmap region, 64 bytes at a time
-    for (io_offset = 0; io_offset < capacity / 8; io_offset += 8) {
-        memcpy(&memory_map[io_offset], data, DEFAULT_STEP_SIZE);
-        printf("--Data written at offset 0x%" PRIx64 "--\n", io_offset);
-
-        printf("Data read at 0x%" PRIx64 ": 0x%" PRIx64 "\n", io_offset,
-               memory_map[io_offset]);
-        printf("Data read at 0x%" PRIx64 ": 0x%" PRIx64 "\n", io_offset + 8,
-               memory_map[io_offset + 1]);
-        printf("Data read at 0x%" PRIx64 ": 0x%" PRIx64 "\n", io_offset + 16,
-               memory_map[io_offset + 2]);
-        printf("Data read at 0x%" PRIx64 ": 0x%" PRIx64 "\n", io_offset + 24,
-               memory_map[io_offset + 3]);
-        printf("Data read at 0x%" PRIx64 ": 0x%" PRIx64 "\n", io_offset + 32,
-               memory_map[io_offset + 4]);
-        printf("Data read at 0x%" PRIx64 ": 0x%" PRIx64 "\n", io_offset + 40,
-               memory_map[io_offset + 5]);
-        printf("Data read at 0x%" PRIx64 ": 0x%" PRIx64 "\n", io_offset + 48,
-               memory_map[io_offset + 6]);
-        printf("Data read at 0x%" PRIx64 ": 0x%" PRIx64 "\n", io_offset + 56,
-               memory_map[io_offset + 7]);
-    }
-
-    // Unmap the memory-mapped region
-    if (munmap(mmap_ptr, capacity) == -1) {
-        printf("Unmapping failed\n");
-        close(fd);
+
+    /* anonymous memory is also prefaulted, so page faults are not timed */
+    if (args.verify || args.anon_size) {
+        prefill();
+    }
+
+    threads = aligned_alloc(CACHELINE_SIZE, args.threads * sizeof(*threads));
+    if (!threads) {
+        fprintf(stderr, "Failed to allocate thread state\n");
         return 1;
     }
+    memset(threads, 0, args.threads * sizeof(*threads));
+
+    slice = region_size / args.threads / args.block * args.block;
+    pthread_barrier_init(&start_barrier, NULL, args.threads + 1);
+    for (unsigned int i = 0; i < args.threads; i++) {
+        threads[i].id = i;
+        threads[i].base = i * slice;
+        threads[i].slice = slice;
+        if (pthread_create(&threads[i].thread, NULL, worker_main,
+                           &threads[i])) {
+            fprintf(stderr, "Failed to create thread %u\n", i);
+            return 1;
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    start = now_ns();
+    if (!args.ops) {
+        sleep(args.duration);
+        stop = true;
+    }
+    for (unsigned int i = 0; i < args.threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    secs = (now_ns() - start) / 1e9;
+
+    report(threads, secs);
+
+    munmap(region, map_size);
+    free(threads);
 
-    close(fd);
     return 0;
 }
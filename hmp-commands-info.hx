@@ -1007,3 +1007,17 @@ SRST
   ``info cryptodev``
     Show the crypto devices.
 ERST
+
+    {
+        .name       = "cxl-latency",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show CXL remote root port transaction latencies",
+        .cmd        = hmp_info_cxl_latency,
+    },
+
+SRST
+  ``info cxl-latency``
+    Show the transaction latency percentiles of every CXL root port that is
+    connected to a remote switch.
+ERST
@@ -13,524 +13,291 @@
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 
-static void cdat_len_check(CDATSubHeader *hdr, Error **errp)
+/*
+ * A table is kept serialised, header first, exactly as it goes out over
+ * DOE: each entry is a slice of one buffer and the checksum is worked out
+ * once, when the table is built or loaded. Devices configured alike build
+ * byte identical tables, so those share a single buffer, counted in
+ * cdat_cache, which owns them, by the number of devices using each.
+ */
+static GHashTable *cdat_cache;
+
+static GBytes *__cdat_cache_get(GBytes *table)
+{
+    gpointer key, users;
+
+    if (!cdat_cache) {
+        cdat_cache = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+                                           (GDestroyNotify)g_bytes_unref,
+                                           g_free);
+    }
+
+    if (g_hash_table_lookup_extended(cdat_cache, table, &key, &users)) {
+        g_bytes_unref(table);
+        (*(guint *)users)++;
+        return key;
+    }
+
+    users = g_new(guint, 1);
+    *(guint *)users = 1;
+    g_hash_table_insert(cdat_cache, table, users);
+
+    return table;
+}
+
+static void __cdat_cache_put(GBytes *table)
 {
-    assert(hdr->length);
-    assert(hdr->reserved == 0);
+    guint *users = g_hash_table_lookup(cdat_cache, table);
+
+    assert(users && *users);
+    if (--(*users) == 0) {
+        g_hash_table_remove(cdat_cache, table);
+    }
+}
+
+static bool cdat_len_check(CDATSubHeader *hdr, Error **errp)
+{
+    bool ok;
 
     switch (hdr->type) {
     case CDAT_TYPE_DSMAS:
-        assert(hdr->length == sizeof(CDATDsmas));
+        ok = hdr->length == sizeof(CDATDsmas);
         break;
     case CDAT_TYPE_DSLBIS:
-        assert(hdr->length == sizeof(CDATDslbis));
+        ok = hdr->length == sizeof(CDATDslbis);
         break;
     case CDAT_TYPE_DSMSCIS:
-        assert(hdr->length == sizeof(CDATDsmscis));
+        ok = hdr->length == sizeof(CDATDsmscis);
         break;
     case CDAT_TYPE_DSIS:
-        assert(hdr->length == sizeof(CDATDsis));
+        ok = hdr->length == sizeof(CDATDsis);
         break;
     case CDAT_TYPE_DSEMTS:
-        assert(hdr->length == sizeof(CDATDsemts));
+        ok = hdr->length == sizeof(CDATDsemts);
         break;
     case CDAT_TYPE_SSLBIS:
-        assert(hdr->length >= sizeof(CDATSslbisHeader));
-        assert((hdr->length - sizeof(CDATSslbisHeader)) %
-               sizeof(CDATSslbe) == 0);
+        ok = hdr->length >= sizeof(CDATSslbisHeader) &&
+             (hdr->length - sizeof(CDATSslbisHeader)) % sizeof(CDATSslbe) == 0;
         break;
     default:
         error_setg(errp, "Type %d is reserved", hdr->type);
+        return false;
     }
-}
 
-static void ct1_build_cdat(CDATObject *cdat, Error **errp)
-{
-    g_autofree CDATTableHeader *cdat_header = NULL;
-    g_autofree CDATEntry *cdat_st = NULL;
-    uint8_t sum = 0;
-    int ent, i;
-
-    /* Use default table if fopen == NULL */
-    assert(cdat->build_cdat_table);
-
-    cdat_header = g_malloc0(sizeof(*cdat_header));
-    if (!cdat_header) {
-        error_setg(errp, "Failed to allocate CDAT header");
-        return;
-    }
-
-    cdat->built_buf_len = cdat->build_cdat_table(&cdat->built_buf, cdat->private);
-
-    if (!cdat->built_buf_len) {
-        /* Build later as not all data available yet */
-        cdat->to_update = true;
-        return;
-    }
-    cdat->to_update = false;
-
-    cdat_st = g_malloc0(sizeof(*cdat_st) * (cdat->built_buf_len + 1));
-    if (!cdat_st) {
-        error_setg(errp, "Failed to allocate CDAT entry array");
-        return;
+    if (!ok || hdr->reserved) {
+        error_setg(errp, "CDAT: Malformed structure of type %d", hdr->type);
+        return false;
     }
 
-    /* Entry 0 for CDAT header, starts with Entry 1 */
-    for (ent = 1; ent < cdat->built_buf_len + 1; ent++) {
-        CDATSubHeader *hdr = cdat->built_buf[ent - 1];
-        uint8_t *buf = (uint8_t *)cdat->built_buf[ent - 1];
-
-        cdat_st[ent].base = hdr;
-        cdat_st[ent].length = hdr->length;
-
-        cdat_header->length += hdr->length;
-        for (i = 0; i < hdr->length; i++) {
-            sum += buf[i];
-        }
-    }
-
-    /* CDAT header */
-    cdat_header->revision = CXL_CDAT_REV;
-    /* For now, no runtime updates */
-    cdat_header->sequence = 0;
-    cdat_header->length += sizeof(CDATTableHeader);
-    sum += cdat_header->revision + cdat_header->sequence +
-        cdat_header->length;
-    /* Sum of all bytes including checksum must be 0 */
-    cdat_header->checksum = ~sum + 1;
-
-    cdat_st[0].base = g_steal_pointer(&cdat_header);
-    cdat_st[0].length = sizeof(*cdat_header);
-    cdat->entry_len = 1 + cdat->built_buf_len;
-    cdat->entry = g_steal_pointer(&cdat_st);
+    return true;
 }
 
-static void ct1_load_cdat(CDATObject *cdat, Error **errp)
+static uint8_t __cdat_sum(const uint8_t *buf, size_t len)
 {
-    g_autofree CDATEntry *cdat_st = NULL;
     uint8_t sum = 0;
-    int num_ent;
-    int i = 0, ent = 1, file_size = 0;
-    CDATSubHeader *hdr;
-    FILE *fp = NULL;
-
-    /* Read CDAT file and create its cache */
-    fp = fopen(cdat->filename, "r");
-    if (!fp) {
-        error_setg(errp, "CDAT: Unable to open file");
-        return;
-    }
-
-    fseek(fp, 0, SEEK_END);
-    file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    cdat->buf = g_malloc0(file_size);
 
-    if (fread(cdat->buf, file_size, 1, fp) == 0) {
-        error_setg(errp, "CDAT: File read failed");
-        return;
-    }
-
-    fclose(fp);
-
-    if (file_size < sizeof(CDATTableHeader)) {
-        error_setg(errp, "CDAT: File too short");
-        return;
+    while (len--) {
+        sum += *buf++;
     }
-    i = sizeof(CDATTableHeader);
-    num_ent = 1;
-    while (i < file_size) {
-        hdr = (CDATSubHeader *)(cdat->buf + i);
-        cdat_len_check(hdr, errp);
-        i += hdr->length;
-        num_ent++;
-    }
-    if (i != file_size) {
-        error_setg(errp, "CDAT: File length mismatch");
-        return;
-    }
-
-    cdat_st = g_malloc0(sizeof(*cdat_st) * num_ent);
-    if (!cdat_st) {
-        error_setg(errp, "CDAT: Failed to allocate entry array");
-        return;
-    }
-
-    /* Set CDAT header, Entry = 0 */
-    cdat_st[0].base = cdat->buf;
-    cdat_st[0].length = sizeof(CDATTableHeader);
-    i = 0;
-
-    while (i < cdat_st[0].length) {
-        sum += cdat->buf[i++];
-    }
-
-    /* Read CDAT structures */
-    while (i < file_size) {
-        hdr = (CDATSubHeader *)(cdat->buf + i);
-        cdat_len_check(hdr, errp);
 
-        cdat_st[ent].base = hdr;
-        cdat_st[ent].length = hdr->length;
-
-        while (cdat->buf + i <
-               (uint8_t *)cdat_st[ent].base + cdat_st[ent].length) {
-            assert(i < file_size);
-            sum += cdat->buf[i++];
-        }
-
-        ent++;
-    }
-
-    if (sum != 0) {
-        warn_report("CDAT: Found checksum mismatch in %s", cdat->filename);
-    }
-    cdat->entry_len = num_ent;
-    cdat->entry = g_steal_pointer(&cdat_st);
+    return sum;
 }
 
-static void ct2_build_cdat(CDATObject *cdat, Error **errp)
+/* Point the DOE entries of cdat at the structures of a serialised table */
+static bool __cdat_set_table(CDATObject *cdat, GBytes *table, Error **errp)
 {
-    g_autofree CDATTableHeader *cdat_header = NULL;
     g_autofree CDATEntry *cdat_st = NULL;
-    uint8_t sum = 0;
-    int ent, i;
-
-    /* Use default table if fopen == NULL */
-    assert(cdat->build_cdat_table);
-
-    cdat_header = g_malloc0(sizeof(*cdat_header));
-    if (!cdat_header) {
-        error_setg(errp, "Failed to allocate CDAT header");
-        return;
-    }
-
-    cdat->built_buf_len = cdat->build_cdat_table(&cdat->built_buf, cdat->private);
-
-    if (!cdat->built_buf_len) {
-        /* Build later as not all data available yet */
-        cdat->to_update = true;
-        return;
-    }
-    cdat->to_update = false;
+    const uint8_t *buf;
+    size_t size, i;
+    int num_ent = 1;
 
-    cdat_st = g_malloc0(sizeof(*cdat_st) * (cdat->built_buf_len + 1));
-    if (!cdat_st) {
-        error_setg(errp, "Failed to allocate CDAT entry array");
-        return;
+    buf = g_bytes_get_data(table, &size);
+    if (size < sizeof(CDATTableHeader)) {
+        error_setg(errp, "CDAT: Table too short");
+        goto err;
     }
 
-    /* Entry 0 for CDAT header, starts with Entry 1 */
-    for (ent = 1; ent < cdat->built_buf_len + 1; ent++) {
-        CDATSubHeader *hdr = cdat->built_buf[ent - 1];
-        uint8_t *buf = (uint8_t *)cdat->built_buf[ent - 1];
-
-        cdat_st[ent].base = hdr;
-        cdat_st[ent].length = hdr->length;
+    for (i = sizeof(CDATTableHeader); i < size; num_ent++) {
+        CDATSubHeader *hdr = (CDATSubHeader *)(buf + i);
 
-        cdat_header->length += hdr->length;
-        for (i = 0; i < hdr->length; i++) {
-            sum += buf[i];
+        if (size - i < sizeof(*hdr) || size - i < hdr->length) {
+            error_setg(errp, "CDAT: Table length mismatch");
+            goto err;
+        }
+        if (!cdat_len_check(hdr, errp)) {
+            goto err;
         }
-    }
-
-    /* CDAT header */
-    cdat_header->revision = CXL_CDAT_REV;
-    /* For now, no runtime updates */
-    cdat_header->sequence = 0;
-    cdat_header->length += sizeof(CDATTableHeader);
-    sum += cdat_header->revision + cdat_header->sequence +
-        cdat_header->length;
-    /* Sum of all bytes including checksum must be 0 */
-    cdat_header->checksum = ~sum + 1;
-
-    cdat_st[0].base = g_steal_pointer(&cdat_header);
-    cdat_st[0].length = sizeof(*cdat_header);
-    cdat->entry_len = 1 + cdat->built_buf_len;
-    cdat->entry = g_steal_pointer(&cdat_st);
-}
-
-static void ct2_load_cdat(CDATObject *cdat, Error **errp)
-{
-    g_autofree CDATEntry *cdat_st = NULL;
-    uint8_t sum = 0;
-    int num_ent;
-    int i = 0, ent = 1, file_size = 0;
-    CDATSubHeader *hdr;
-    FILE *fp = NULL;
-
-    /* Read CDAT file and create its cache */
-    fp = fopen(cdat->filename, "r");
-    if (!fp) {
-        error_setg(errp, "CDAT: Unable to open file");
-        return;
-    }
-
-    fseek(fp, 0, SEEK_END);
-    file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    cdat->buf = g_malloc0(file_size);
-
-    if (fread(cdat->buf, file_size, 1, fp) == 0) {
-        error_setg(errp, "CDAT: File read failed");
-        return;
-    }
-
-    fclose(fp);
-
-    if (file_size < sizeof(CDATTableHeader)) {
-        error_setg(errp, "CDAT: File too short");
-        return;
-    }
-    i = sizeof(CDATTableHeader);
-    num_ent = 1;
-    while (i < file_size) {
-        hdr = (CDATSubHeader *)(cdat->buf + i);
-        cdat_len_check(hdr, errp);
         i += hdr->length;
-        num_ent++;
-    }
-    if (i != file_size) {
-        error_setg(errp, "CDAT: File length mismatch");
-        return;
     }
 
-    cdat_st = g_malloc0(sizeof(*cdat_st) * num_ent);
-    if (!cdat_st) {
-        error_setg(errp, "CDAT: Failed to allocate entry array");
-        return;
-    }
+    /*
+     * A table equal to a cached one is freed here, so the entries have to
+     * point into the buffer that comes back.
+     */
+    cdat->table = __cdat_cache_get(table);
+    buf = g_bytes_get_data(cdat->table, &size);
 
-    /* Set CDAT header, Entry = 0 */
-    cdat_st[0].base = cdat->buf;
+    /* Entry 0 for CDAT header, structures start with Entry 1 */
+    cdat_st = g_new0(CDATEntry, num_ent);
+    cdat_st[0].base = (void *)buf;
     cdat_st[0].length = sizeof(CDATTableHeader);
-    i = 0;
+    for (i = sizeof(CDATTableHeader), num_ent = 1; i < size; num_ent++) {
+        CDATSubHeader *hdr = (CDATSubHeader *)(buf + i);
 
-    while (i < cdat_st[0].length) {
-        sum += cdat->buf[i++];
+        cdat_st[num_ent].base = hdr;
+        cdat_st[num_ent].length = hdr->length;
+        i += hdr->length;
     }
 
-    /* Read CDAT structures */
-    while (i < file_size) {
-        hdr = (CDATSubHeader *)(cdat->buf + i);
-        cdat_len_check(hdr, errp);
-
-        cdat_st[ent].base = hdr;
-        cdat_st[ent].length = hdr->length;
-
-        while (cdat->buf + i <
-               (uint8_t *)cdat_st[ent].base + cdat_st[ent].length) {
-            assert(i < file_size);
-            sum += cdat->buf[i++];
-        }
+    cdat->entry = g_steal_pointer(&cdat_st);
+    cdat->entry_len = num_ent;
 
-        ent++;
-    }
+    return true;
 
-    if (sum != 0) {
-        warn_report("CDAT: Found checksum mismatch in %s", cdat->filename);
-    }
-    cdat->entry_len = num_ent;
-    cdat->entry = g_steal_pointer(&cdat_st);
+err:
+    g_bytes_unref(table);
+    return false;
 }
 
-static void ct3_build_cdat(CDATObject *cdat, Error **errp)
+static void __cdat_build(CDATObject *cdat, Error **errp)
 {
-    g_autofree CDATTableHeader *cdat_header = NULL;
-    g_autofree CDATEntry *cdat_st = NULL;
-    uint8_t sum = 0;
-    int ent, i;
+    CDATSubHeader **cdat_table = NULL;
+    CDATTableHeader *cdat_header;
+    uint8_t *buf;
+    size_t len, off;
+    int num, i;
 
     /* Use default table if fopen == NULL */
     assert(cdat->build_cdat_table);
 
-    cdat_header = g_malloc0(sizeof(*cdat_header));
-    if (!cdat_header) {
-        error_setg(errp, "Failed to allocate CDAT header");
+    num = cdat->build_cdat_table(&cdat_table, cdat->private);
+    if (num < 0) {
+        error_setg_errno(errp, -num, "CDAT: Failed to build table");
         return;
     }
-
-    cdat->built_buf_len = cdat->build_cdat_table(&cdat->built_buf, cdat->private);
-
-    if (!cdat->built_buf_len) {
+    if (!num) {
         /* Build later as not all data available yet */
         cdat->to_update = true;
         return;
     }
     cdat->to_update = false;
 
-    cdat_st = g_malloc0(sizeof(*cdat_st) * (cdat->built_buf_len + 1));
-    if (!cdat_st) {
-        error_setg(errp, "Failed to allocate CDAT entry array");
-        return;
+    len = sizeof(*cdat_header);
+    for (i = 0; i < num; i++) {
+        len += cdat_table[i]->length;
     }
 
-    /* Entry 0 for CDAT header, starts with Entry 1 */
-    for (ent = 1; ent < cdat->built_buf_len + 1; ent++) {
-        CDATSubHeader *hdr = cdat->built_buf[ent - 1];
-        uint8_t *buf = (uint8_t *)cdat->built_buf[ent - 1];
-
-        cdat_st[ent].base = hdr;
-        cdat_st[ent].length = hdr->length;
-
-        cdat_header->length += hdr->length;
-        for (i = 0; i < hdr->length; i++) {
-            sum += buf[i];
-        }
+    buf = g_malloc0(len);
+    for (i = 0, off = sizeof(*cdat_header); i < num; i++) {
+        memcpy(buf + off, cdat_table[i], cdat_table[i]->length);
+        off += cdat_table[i]->length;
     }
+    cdat->free_cdat_table(cdat_table, num, cdat->private);
 
-    /* CDAT header */
+    cdat_header = (CDATTableHeader *)buf;
+    cdat_header->length = len;
     cdat_header->revision = CXL_CDAT_REV;
     /* For now, no runtime updates */
     cdat_header->sequence = 0;
-    cdat_header->length += sizeof(CDATTableHeader);
-    sum += cdat_header->revision + cdat_header->sequence +
-        cdat_header->length;
     /* Sum of all bytes including checksum must be 0 */
-    cdat_header->checksum = ~sum + 1;
+    cdat_header->checksum = ~__cdat_sum(buf, len) + 1;
 
-    cdat_st[0].base = g_steal_pointer(&cdat_header);
-    cdat_st[0].length = sizeof(*cdat_header);
-    cdat->entry_len = 1 + cdat->built_buf_len;
-    cdat->entry = g_steal_pointer(&cdat_st);
+    __cdat_set_table(cdat, g_bytes_new_take(buf, len), errp);
 }
 
-static void ct3_load_cdat(CDATObject *cdat, Error **errp)
+static void __cdat_load(CDATObject *cdat, Error **errp)
 {
-    g_autofree CDATEntry *cdat_st = NULL;
-    uint8_t sum = 0;
-    int num_ent;
-    int i = 0, ent = 1, file_size = 0;
-    CDATSubHeader *hdr;
-    FILE *fp = NULL;
-
-    /* Read CDAT file and create its cache */
-    fp = fopen(cdat->filename, "r");
-    if (!fp) {
-        error_setg(errp, "CDAT: Unable to open file");
-        return;
-    }
-
-    fseek(fp, 0, SEEK_END);
-    file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    cdat->buf = g_malloc0(file_size);
+    g_autoptr(GError) err = NULL;
+    gchar *buf;
+    gsize size;
 
-    if (fread(cdat->buf, file_size, 1, fp) == 0) {
-        error_setg(errp, "CDAT: File read failed");
+    if (!g_file_get_contents(cdat->filename, &buf, &size, &err)) {
+        error_setg(errp, "CDAT: Unable to open file: %s", err->message);
         return;
     }
 
-    fclose(fp);
-
-    if (file_size < sizeof(CDATTableHeader)) {
-        error_setg(errp, "CDAT: File too short");
-        return;
-    }
-    i = sizeof(CDATTableHeader);
-    num_ent = 1;
-    while (i < file_size) {
-        hdr = (CDATSubHeader *)(cdat->buf + i);
-        cdat_len_check(hdr, errp);
-        i += hdr->length;
-        num_ent++;
-    }
-    if (i != file_size) {
-        error_setg(errp, "CDAT: File length mismatch");
-        return;
-    }
-
-    cdat_st = g_malloc0(sizeof(*cdat_st) * num_ent);
-    if (!cdat_st) {
-        error_setg(errp, "CDAT: Failed to allocate entry array");
-        return;
-    }
-
-    /* Set CDAT header, Entry = 0 */
-    cdat_st[0].base = cdat->buf;
-    cdat_st[0].length = sizeof(CDATTableHeader);
-    i = 0;
-
-    while (i < cdat_st[0].length) {
-        sum += cdat->buf[i++];
-    }
-
-    /* Read CDAT structures */
-    while (i < file_size) {
-        hdr = (CDATSubHeader *)(cdat->buf + i);
-        cdat_len_check(hdr, errp);
-
-        cdat_st[ent].base = hdr;
-        cdat_st[ent].length = hdr->length;
-
-        while (cdat->buf + i <
-               (uint8_t *)cdat_st[ent].base + cdat_st[ent].length) {
-            assert(i < file_size);
-            sum += cdat->buf[i++];
-        }
-
-        ent++;
-    }
-
-    if (sum != 0) {
+    if (__cdat_sum((uint8_t *)buf, size) != 0) {
         warn_report("CDAT: Found checksum mismatch in %s", cdat->filename);
     }
-    cdat->entry_len = num_ent;
-    cdat->entry = g_steal_pointer(&cdat_st);
+
+    __cdat_set_table(cdat, g_bytes_new_take(buf, size), errp);
 }
 
 void cxl_doe_cdat_init(CXLComponentState *cxl_cstate, Error **errp)
 {
     CDATObject *cdat = &cxl_cstate->cdat;
-    ComponentRegisters *cregs = &cxl_cstate->crb;
-    MemoryRegion *mr = &cregs->component_registers;
-
-    if (g_strcmp0(mr->name, "cxl-type1") == 0) {
-        if (cdat->filename)
-            ct1_load_cdat(cdat, errp);
-        else
-            ct1_build_cdat(cdat, errp);
-    }
-    else if (g_strcmp0(mr->name, "cxl-type2") == 0) {
-        if  (cdat->filename)
-            ct2_load_cdat(cdat, errp);
-        else
-            ct2_build_cdat(cdat, errp);
-    }
-    else if (g_strcmp0(mr->name, "cxl-type3") == 0) {
-        if  (cdat->filename)
-            ct3_load_cdat(cdat, errp);
-        else
-            ct3_build_cdat(cdat, errp);
+
+    if (cdat->filename) {
+        __cdat_load(cdat, errp);
+    } else {
+        __cdat_build(cdat, errp);
     }
 }
 
 void cxl_doe_cdat_update(CXLComponentState *cxl_cstate, Error **errp)
 {
     CDATObject *cdat = &cxl_cstate->cdat;
-    ComponentRegisters *cregs = &cxl_cstate->crb;
-    MemoryRegion *mr = &cregs->component_registers;
 
     if (cdat->to_update) {
-        if (g_strcmp0(mr->name, "cxl-type1") == 0)
-            ct1_build_cdat(cdat, errp);
-        else if (g_strcmp0(mr->name, "cxl-type2") == 0)
-            ct2_build_cdat(cdat, errp);
-        else if (g_strcmp0(mr->name, "cxl-type3") == 0)
-            ct3_build_cdat(cdat, errp);
+        __cdat_build(cdat, errp);
     }
 }
 
+/*
+ * Answer a DOE Read Entry request, CXL r3.0 8.1.11.1. This runs in a DOE
+ * worker thread, so a table still to be built is left to device reset.
+ */
+bool cxl_doe_cdat_read_entry(DOECap *doe_cap, CXLComponentState *cxl_cstate)
+{
+    CDATObject *cdat = &cxl_cstate->cdat;
+    CDATReq *req = pcie_doe_get_write_mbox_ptr(doe_cap);
+    CDATRsp rsp;
+    uint16_t ent;
+    uint32_t len;
+
+    /* Discard if request length mismatched */
+    if (pcie_doe_get_obj_len(req) <
+        DIV_ROUND_UP(sizeof(CDATReq), sizeof(uint32_t))) {
+        return false;
+    }
+
+    ent = req->entry_handle;
+    if (ent >= cdat->entry_len) {
+        return false;
+    }
+    len = cdat->entry[ent].length;
+
+    rsp = (CDATRsp) {
+        .header = {
+            .vendor_id = CXL_VENDOR_ID,
+            .data_obj_type = CXL_DOE_TABLE_ACCESS,
+            .reserved = 0x0,
+            .length = DIV_ROUND_UP((sizeof(rsp) + len), sizeof(uint32_t)),
+        },
+        .rsp_code = CXL_DOE_TAB_RSP,
+        .table_type = CXL_DOE_TAB_TYPE_CDAT,
+        .entry_handle = (ent < cdat->entry_len - 1) ?
+                        ent + 1 : CXL_DOE_TAB_ENT_MAX,
+    };
+
+    memcpy(doe_cap->read_mbox, &rsp, sizeof(rsp));
+    memcpy(doe_cap->read_mbox + DIV_ROUND_UP(sizeof(rsp), sizeof(uint32_t)),
+           cdat->entry[ent].base, len);
+
+    doe_cap->read_mbox_len += rsp.header.length;
+
+    return true;
+}
+
 void cxl_doe_cdat_release(CXLComponentState *cxl_cstate)
 {
     CDATObject *cdat = &cxl_cstate->cdat;
 
-    free(cdat->entry);
-    if (cdat->built_buf) {
-        cdat->free_cdat_table(cdat->built_buf, cdat->built_buf_len,
-                              cdat->private);
-    }
-    if (cdat->buf) {
-        free(cdat->buf);
+    g_free(cdat->entry);
+    cdat->entry = NULL;
+    cdat->entry_len = 0;
+    if (cdat->table) {
+        __cdat_cache_put(cdat->table);
+        cdat->table = NULL;
     }
 }
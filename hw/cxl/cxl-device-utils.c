@@ -9,6 +9,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/log.h"
+#include "qemu/range.h"
 #include "hw/cxl/cxl.h"
 
 /*
@@ -41,13 +42,30 @@ static uint64_t caps_reg_read(void *opaque, hwaddr offset, unsigned size)
 
 static uint64_t dev_reg_read(void *opaque, hwaddr offset, unsigned size)
 {
-    return 0;
+    CXLDeviceState *cxl_dstate = opaque;
+    uint64_t retval = 0;
+
+    retval = FIELD_DP64(retval, CXL_DEV_EVENT_STATUS, EVENT_STATUS,
+                        cxl_event_status(cxl_dstate));
+
+    return extract64(retval, offset * 8, size * 8);
 }
 
 static uint64_t mailbox_reg_read(void *opaque, hwaddr offset, unsigned size)
 {
     CXLDeviceState *cxl_dstate = opaque;
 
+    /* Progress of a running background command is sampled on read */
+    if (cxl_dstate->bg.running &&
+        ranges_overlap(offset, size, A_CXL_DEV_BG_CMD_STS, 8)) {
+        uint64_t *bg_status_reg =
+            &cxl_dstate->mbox_reg_state64[R_CXL_DEV_BG_CMD_STS];
+
+        *bg_status_reg = FIELD_DP64(*bg_status_reg, CXL_DEV_BG_CMD_STS,
+                                    PERCENTAGE_COMP,
+                                    cxl_mailbox_bg_percent(cxl_dstate));
+    }
+
     switch (size) {
     case 1:
         return cxl_dstate->mbox_reg_state[offset];
@@ -88,7 +106,6 @@ static void mailbox_mem_writeq(uint64_t *reg_state, hwaddr offset,
     case A_CXL_DEV_MAILBOX_CMD:
         break;
     case A_CXL_DEV_BG_CMD_STS:
-        /* BG not supported */
         /* fallthrough */
     case A_CXL_DEV_MAILBOX_STS:
         /* Read only register, will get updated by the state machine */
@@ -133,9 +150,12 @@ static void mailbox_reg_write(void *opaque, hwaddr offset, uint64_t value,
 
 static uint64_t mdev_reg_read(void *opaque, hwaddr offset, unsigned size)
 {
+    CXLDeviceState *cxl_dstate = opaque;
     uint64_t retval = 0;
 
-    retval = FIELD_DP64(retval, CXL_MEM_DEV_STS, MEDIA_STATUS, 1);
+    /* 0b11 Disabled while a sanitize is running, 0b01 Ready otherwise */
+    retval = FIELD_DP64(retval, CXL_MEM_DEV_STS, MEDIA_STATUS,
+                        cxl_dstate->bg.media_disabled ? 3 : 1);
     retval = FIELD_DP64(retval, CXL_MEM_DEV_STS, MBOX_READY, 1);
 
     return retval;
@@ -209,16 +229,27 @@ static const MemoryRegionOps caps_ops = {
 
 void cxl_device_register_block_init(Object *obj, CXLDeviceState *cxl_dstate)
 {
+    uint64_t mbox_len;
+
+    cxl_dstate->obj = obj;
+    if (!cxl_dstate->payload_size) {
+        cxl_dstate->payload_size = CXL_MAILBOX_DEFAULT_PAYLOAD_SIZE;
+    }
+    assert(is_power_of_2(cxl_dstate->payload_size) &&
+           cxl_dstate->payload_size <= CXL_MAILBOX_MAX_PAYLOAD_SIZE);
+    mbox_len = CXL_MAILBOX_REGISTERS_LENGTH(cxl_dstate->payload_size);
+    cxl_dstate->mbox_reg_state = g_malloc0(mbox_len);
+
     /* This will be a BAR, so needs to be rounded up to pow2 for PCI spec */
     memory_region_init(&cxl_dstate->device_registers, obj, "device-registers",
-                       pow2ceil(CXL_MMIO_SIZE));
+                       pow2ceil(CXL_MMIO_SIZE(cxl_dstate->payload_size)));
 
     memory_region_init_io(&cxl_dstate->caps, obj, &caps_ops, cxl_dstate,
                           "cap-array", CXL_CAPS_SIZE);
     memory_region_init_io(&cxl_dstate->device, obj, &dev_ops, cxl_dstate,
                           "device-status", CXL_DEVICE_STATUS_REGISTERS_LENGTH);
     memory_region_init_io(&cxl_dstate->mailbox, obj, &mailbox_ops, cxl_dstate,
-                          "mailbox", CXL_MAILBOX_REGISTERS_LENGTH);
+                          "mailbox", mbox_len);
     memory_region_init_io(&cxl_dstate->memory_device, obj, &mdev_ops,
                           cxl_dstate, "memory device caps",
                           CXL_MEMORY_DEVICE_REGISTERS_LENGTH);
@@ -236,35 +267,66 @@ void cxl_device_register_block_init(Object *obj, CXLDeviceState *cxl_dstate)
                                 &cxl_dstate->memory_device);
 }
 
+void cxl_device_register_block_release(CXLDeviceState *cxl_dstate)
+{
+    g_free(cxl_dstate->mbox_reg_state);
+    cxl_dstate->mbox_reg_state = NULL;
+}
+
 static void device_reg_init_common(CXLDeviceState *cxl_dstate) { }
 
 static void mailbox_reg_init_common(CXLDeviceState *cxl_dstate)
 {
-    /* 2048 payload size, with no interrupt or background support */
+    /*
+     * Payload size as chosen by the device, background command completion
+     * is signalled on MSI/MSI-X vector 0
+     */
+    ARRAY_FIELD_DP32(cxl_dstate->mbox_reg_state32, CXL_DEV_MAILBOX_CAP,
+                     PAYLOAD_SIZE, ctz32(cxl_dstate->payload_size));
     ARRAY_FIELD_DP32(cxl_dstate->mbox_reg_state32, CXL_DEV_MAILBOX_CAP,
-                     PAYLOAD_SIZE, CXL_MAILBOX_PAYLOAD_SHIFT);
-    cxl_dstate->payload_size = CXL_MAILBOX_MAX_PAYLOAD_SIZE;
+                     BG_INT_CAP, 1);
+    ARRAY_FIELD_DP32(cxl_dstate->mbox_reg_state32, CXL_DEV_MAILBOX_CAP,
+                     MSI_N, 0);
 }
 
 static void memdev_reg_init_common(CXLDeviceState *cxl_dstate) { }
 
+uint64_t cxl_device_get_timestamp(CXLDeviceState *cxl_dstate)
+{
+    uint64_t time, delta;
+
+    if (!cxl_dstate->timestamp.set) {
+        return 0;
+    }
+
+    /* Advance the host provided time by what elapsed since it was set */
+    time = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    delta = time - cxl_dstate->timestamp.last_set;
+    return cxl_dstate->timestamp.host_set + delta;
+}
+
 void cxl_device_register_init_common(CXLDeviceState *cxl_dstate)
 {
     uint64_t *cap_hdrs = cxl_dstate->caps_reg_state64;
     const int cap_count = 3;
 
+    cxl_mailbox_bg_abort(cxl_dstate);
+
     /* CXL Device Capabilities Array Register */
     ARRAY_FIELD_DP64(cap_hdrs, CXL_DEV_CAP_ARRAY, CAP_ID, 0);
     ARRAY_FIELD_DP64(cap_hdrs, CXL_DEV_CAP_ARRAY, CAP_VERSION, 1);
     ARRAY_FIELD_DP64(cap_hdrs, CXL_DEV_CAP_ARRAY, CAP_COUNT, cap_count);
 
-    cxl_device_cap_init(cxl_dstate, DEVICE_STATUS, 1);
+    cxl_device_cap_init(cxl_dstate, DEVICE_STATUS, 1,
+                        CXL_DEVICE_STATUS_REGISTERS_LENGTH);
     device_reg_init_common(cxl_dstate);
 
-    cxl_device_cap_init(cxl_dstate, MAILBOX, 2);
+    cxl_device_cap_init(cxl_dstate, MAILBOX, 2,
+                        CXL_MAILBOX_REGISTERS_LENGTH(cxl_dstate->payload_size));
     mailbox_reg_init_common(cxl_dstate);
 
-    cxl_device_cap_init(cxl_dstate, MEMORY_DEVICE, 0x4000);
+    cxl_device_cap_init(cxl_dstate, MEMORY_DEVICE, 0x4000,
+                        CXL_MEMORY_DEVICE_REGISTERS_LENGTH);
     memdev_reg_init_common(cxl_dstate);
 
     cxl_initialize_mailbox(cxl_dstate);
@@ -0,0 +1,230 @@
+/*
+ * QEMU CXL Event Log Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "hw/cxl/cxl.h"
+#include "hw/pci/msi.h"
+#include "hw/pci/msix.h"
+
+/*
+ * Each log is a fixed ring allocated up front, so inserting and retiring
+ * records never allocates and QMP can inject at whatever rate it likes. A
+ * full log drops new records and only counts them, CXL 3.0 8.2.9.2.2.
+ */
+
+static CXLEventRecordRaw *__event_log_at(CXLEventLog *log, uint16_t i)
+{
+    return &log->records[(log->head + i) % log->capacity];
+}
+
+static void __event_log_clear_overflow(CXLEventLog *log)
+{
+    log->overflow_err_count = 0;
+    log->first_overflow_timestamp = 0;
+    log->last_overflow_timestamp = 0;
+}
+
+static void __event_log_set_overflow(CXLEventLog *log, uint64_t timestamp)
+{
+    if (log->overflow_err_count == 0) {
+        log->first_overflow_timestamp = timestamp;
+    }
+    if (log->overflow_err_count < UINT16_MAX) {
+        log->overflow_err_count++;
+    }
+    log->last_overflow_timestamp = timestamp;
+}
+
+void cxl_event_init(CXLDeviceState *cxl_dstate, uint16_t log_size,
+                    int irq_vec)
+{
+    int i;
+
+    for (i = 0; i < CXL_EVENT_TYPE_MAX; i++) {
+        CXLEventLog *log = &cxl_dstate->event_logs[i];
+
+        log->records = g_new0(CXLEventRecordRaw, log_size);
+        log->capacity = log_size;
+        log->head = 0;
+        log->count = 0;
+        log->next_handle = 1;
+        log->irq_enabled = false;
+        log->irq_vec = irq_vec;
+        __event_log_clear_overflow(log);
+    }
+}
+
+void cxl_event_release(CXLDeviceState *cxl_dstate)
+{
+    int i;
+
+    for (i = 0; i < CXL_EVENT_TYPE_MAX; i++) {
+        CXLEventLog *log = &cxl_dstate->event_logs[i];
+
+        g_free(log->records);
+        log->records = NULL;
+        log->capacity = 0;
+        log->count = 0;
+    }
+}
+
+/* Bit n is set while log n holds records */
+uint32_t cxl_event_status(CXLDeviceState *cxl_dstate)
+{
+    uint32_t status = 0;
+    int i;
+
+    for (i = 0; i < CXL_EVENT_TYPE_MAX; i++) {
+        if (cxl_dstate->event_logs[i].count) {
+            status |= BIT(i);
+        }
+    }
+
+    return status;
+}
+
+/*
+ * Stamps the handle and timestamp into the record header. Returns true
+ * when the record is the first one in the log, which is the only time the
+ * interrupt needs raising: drivers drain a log until its status bit clears.
+ */
+bool cxl_event_insert(CXLDeviceState *cxl_dstate, CXLEventLogType log_type,
+                      CXLEventRecordRaw *event)
+{
+    CXLEventLog *log;
+    uint64_t time;
+
+    assert(log_type < CXL_EVENT_TYPE_MAX);
+
+    log = &cxl_dstate->event_logs[log_type];
+    time = cxl_device_get_timestamp(cxl_dstate);
+
+    if (log->count == log->capacity) {
+        __event_log_set_overflow(log, time);
+        return false;
+    }
+
+    stw_le_p(&event->hdr.handle, log->next_handle);
+    stq_le_p(&event->hdr.timestamp, time);
+    memcpy(__event_log_at(log, log->count), event, sizeof(*event));
+    log->count++;
+
+    /* 0 is never a valid handle */
+    if (++log->next_handle == 0) {
+        log->next_handle = 1;
+    }
+
+    return log->count == 1;
+}
+
+/*
+ * Fill pl with up to max_recs of the oldest records, which stay in the log
+ * until they are cleared. Returns the number of records copied.
+ */
+uint16_t cxl_event_get_records(CXLDeviceState *cxl_dstate,
+                               CXLEventLogType log_type,
+                               CXLGetEventPayload *pl, uint16_t max_recs)
+{
+    CXLEventLog *log = &cxl_dstate->event_logs[log_type];
+    uint16_t nr, first;
+
+    nr = MIN(log->count, max_recs);
+    memset(pl, 0, sizeof(*pl));
+
+    /* The ring may wrap, in which case the records come in two runs */
+    if (nr) {
+        first = MIN(nr, log->capacity - log->head);
+        memcpy(pl->records, __event_log_at(log, 0),
+               first * sizeof(CXLEventRecordRaw));
+        memcpy(pl->records + first, log->records,
+               (nr - first) * sizeof(CXLEventRecordRaw));
+    }
+
+    if (log->count > nr) {
+        pl->flags |= CXL_GET_EVENT_FLAG_MORE_RECORDS;
+    }
+    if (log->overflow_err_count) {
+        pl->flags |= CXL_GET_EVENT_FLAG_OVERFLOW;
+        stw_le_p(&pl->overflow_err_count, log->overflow_err_count);
+        stq_le_p(&pl->first_overflow_timestamp,
+                 log->first_overflow_timestamp);
+        stq_le_p(&pl->last_overflow_timestamp, log->last_overflow_timestamp);
+    }
+    stw_le_p(&pl->record_count, nr);
+
+    return nr;
+}
+
+/*
+ * Handles have to name the oldest records of the log in order, anything
+ * else is refused with -EINVAL before any record is retired.
+ */
+int cxl_event_clear_records(CXLDeviceState *cxl_dstate,
+                            CXLClearEventPayload *pl)
+{
+    CXLEventLog *log;
+    uint16_t i;
+
+    if (pl->event_log >= CXL_EVENT_TYPE_MAX) {
+        return -EINVAL;
+    }
+    log = &cxl_dstate->event_logs[pl->event_log];
+
+    if (pl->clear_flags & CXL_CLEAR_EVENT_FLAG_ALL) {
+        log->head = 0;
+        log->count = 0;
+        __event_log_clear_overflow(log);
+        return 0;
+    }
+
+    if (!pl->nr_recs) {
+        return 0;
+    }
+    if (pl->nr_recs > log->count) {
+        return -EINVAL;
+    }
+    for (i = 0; i < pl->nr_recs; i++) {
+        uint16_t handle = lduw_le_p(&__event_log_at(log, i)->hdr.handle);
+
+        if (lduw_le_p(&pl->handle[i]) != handle) {
+            return -EINVAL;
+        }
+    }
+
+    log->head = (log->head + pl->nr_recs) % log->capacity;
+    log->count -= pl->nr_recs;
+    if (!log->count) {
+        log->head = 0;
+        __event_log_clear_overflow(log);
+    }
+
+    return 0;
+}
+
+/* Raise the interrupt of every non empty log whose policy asks for one */
+void cxl_event_irq_assert(CXLDeviceState *cxl_dstate)
+{
+    PCIDevice *pdev = PCI_DEVICE(cxl_dstate->obj);
+    int i;
+
+    for (i = 0; i < CXL_EVENT_TYPE_MAX; i++) {
+        CXLEventLog *log = &cxl_dstate->event_logs[i];
+
+        if (!log->irq_enabled || !log->count) {
+            continue;
+        }
+
+        if (msix_enabled(pdev)) {
+            msix_notify(pdev, log->irq_vec);
+        } else if (msi_enabled(pdev)) {
+            msi_notify(pdev, log->irq_vec);
+        }
+    }
+}
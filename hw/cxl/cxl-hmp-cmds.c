@@ -0,0 +1,50 @@
+/*
+ * HMP commands related to CXL
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "monitor/hmp.h"
+#include "monitor/monitor.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-cxl.h"
+#include "qapi/qmp/qdict.h"
+
+void hmp_info_cxl_latency(Monitor *mon, const QDict *qdict)
+{
+    g_autoptr(CxlLatencyInfoList) list = NULL;
+    CxlLatencyInfoList *il;
+    CxlLatencyClassInfoList *cl;
+    Error *err = NULL;
+
+    list = qmp_query_cxl_latency(false, false, &err);
+    if (hmp_handle_error(mon, err)) {
+        return;
+    }
+    if (!list) {
+        monitor_printf(mon, "No remote CXL root ports\n");
+        return;
+    }
+
+    for (il = list; il; il = il->next) {
+        monitor_printf(mon, "%s:\n", il->value->path);
+        monitor_printf(mon, "  %-12s %12s %10s %10s %10s %10s %10s %10s\n",
+                       "class", "count", "min", "mean", "p50", "p99",
+                       "p99.9", "max");
+        for (cl = il->value->classes; cl; cl = cl->next) {
+            CxlLatencyClassInfo *ci = cl->value;
+
+            monitor_printf(mon, "  %-12s %12" PRIu64 " %10" PRIu64
+                           " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+                           " %10" PRIu64 " %10" PRIu64 "\n",
+                           CxlLatencyClass_str(ci->type), ci->count,
+                           ci->min_ns, ci->mean_ns, ci->p50_ns, ci->p99_ns,
+                           ci->p999_ns, ci->max_ns);
+        }
+    }
+    monitor_printf(mon, "(latencies in ns)\n");
+}
@@ -5,6 +5,7 @@
  */
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qapi/qapi-commands-cxl.h"
 #include "hw/cxl/cxl.h"
 #include "hw/cxl/cxl_host.h"
 
@@ -13,3 +14,34 @@ void cxl_machine_init(Object *obj, CXLState *state) {};
 void cxl_hook_up_pxb_registers(PCIBus *bus, CXLState *state, Error **errp) {};
 
 const MemoryRegionOps cfmws_ops;
+
+void qmp_cxl_traffic_start(CxlTrafficOptions *opts, Error **errp)
+{
+    error_setg(errp, "CXL support is not compiled in");
+}
+
+void qmp_cxl_traffic_stop(const char *path, CxlTrafficSide side, Error **errp)
+{
+    error_setg(errp, "CXL support is not compiled in");
+}
+
+CxlTrafficStats *qmp_query_cxl_traffic(const char *path, CxlTrafficSide side,
+                                       Error **errp)
+{
+    error_setg(errp, "CXL support is not compiled in");
+    return NULL;
+}
+
+CxlStats *qmp_query_cxl_stats(const char *path, bool has_reset, bool reset,
+                              Error **errp)
+{
+    error_setg(errp, "CXL support is not compiled in");
+    return NULL;
+}
+
+CxlLatencyInfoList *qmp_query_cxl_latency(bool has_reset, bool reset,
+                                          Error **errp)
+{
+    error_setg(errp, "CXL support is not compiled in");
+    return NULL;
+}
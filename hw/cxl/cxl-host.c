@@ -11,6 +11,7 @@
 #include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "sysemu/qtest.h"
+#include "exec/address-spaces.h"
 #include "hw/boards.h"
 
 #include "qapi/qapi-visit-machine.h"
@@ -107,6 +108,7 @@ static bool cxl_hdm_find_target(uint32_t *cache_mem, hwaddr addr,
     uint32_t ig_enc;
     uint32_t iw_enc;
     uint32_t target_idx;
+    int ways;
 
     ctrl = cache_mem[R_CXL_HDM_DECODER0_CTRL];
     if (!FIELD_EX32(ctrl, CXL_HDM_DECODER0_CTRL, COMMITTED)) {
@@ -115,7 +117,11 @@ static bool cxl_hdm_find_target(uint32_t *cache_mem, hwaddr addr,
 
     ig_enc = FIELD_EX32(ctrl, CXL_HDM_DECODER0_CTRL, IG);
     iw_enc = FIELD_EX32(ctrl, CXL_HDM_DECODER0_CTRL, IW);
-    target_idx = (addr / cxl_decode_ig(ig_enc)) % (1 << iw_enc);
+    ways = cxl_interleave_ways_dec(iw_enc, NULL);
+    if (!ways) {
+        return false;
+    }
+    target_idx = (addr / cxl_decode_ig(ig_enc)) % ways;
 
     if (target_idx < 4) {
         *target = extract32(cache_mem[R_CXL_HDM_DECODER0_TARGET_LIST_LO],
@@ -199,6 +205,72 @@ static PCIDevice *cxl_cfmws_find_device(CXLFixedWindow *fw, hwaddr addr)
     return NULL;
 }
 
+/*
+ * Work out which interleave way of the HDM decoder at [@base, @base + size)
+ * @d is, by routing the first HPA of each way through the fixed window and
+ * host bridge decoders. Returns -1 while those decoders do not route any of
+ * them to @d, e.g. because they are not committed yet.
+ */
+int cxl_host_hdm_position(PCIDevice *d, hwaddr base, int ways, hwaddr gran)
+{
+    MemoryRegion *sysmem = get_system_memory();
+    MemoryRegion *mr;
+    CXLFixedWindow *fw;
+    int pos;
+
+    QTAILQ_FOREACH(mr, &sysmem->subregions, subregions_link) {
+        if (mr->ops != &cfmws_ops) {
+            continue;
+        }
+        fw = mr->opaque;
+        if (base < fw->base || base - fw->base >= fw->size) {
+            continue;
+        }
+        for (pos = 0; pos < ways; pos++) {
+            if (cxl_cfmws_find_device(fw, base - fw->base + pos * gran) == d) {
+                return pos;
+            }
+        }
+        return -1;
+    }
+
+    return -1;
+}
+
+/*
+ * Called once a host bridge HDM decoder is committed. Endpoints are usually
+ * committed first, so their interleave way could not be routed at that point
+ * and has to be resolved now.
+ */
+void cxl_host_hdm_committed(CXLComponentState *cxl_cstate)
+{
+    Object *owner = memory_region_owner(&cxl_cstate->crb.component_registers);
+    PCIHostState *hb;
+    PCIDevice *rp, *d;
+    int devfn;
+
+    if (!object_dynamic_cast(owner, TYPE_PXB_CXL_HOST)) {
+        return;
+    }
+
+    hb = PCI_HOST_BRIDGE(owner);
+    if (!hb->bus) {
+        return;
+    }
+
+    for (devfn = 0; devfn < ARRAY_SIZE(hb->bus->devices); devfn++) {
+        rp = hb->bus->devices[devfn];
+        if (!rp || !object_dynamic_cast(OBJECT(rp), TYPE_PCIE_PORT)) {
+            continue;
+        }
+
+        d = pci_bridge_get_sec_bus(PCI_BRIDGE(rp))->devices[0];
+        if (d && object_dynamic_cast(OBJECT(d), TYPE_CXL_TYPE2)) {
+            cxl_type2_hdm_position_update(d);
+        }
+    }
+}
+
 static MemTxResult cxl_read_cfmws(void *opaque, hwaddr addr, uint64_t *data,
                                   unsigned size, MemTxAttrs attrs)
 {
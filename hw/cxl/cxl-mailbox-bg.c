@@ -0,0 +1,244 @@
+/*
+ * QEMU CXL Mailbox Background Command Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/main-loop.h"
+#include "hw/cxl/cxl.h"
+#include "hw/pci/msi.h"
+#include "hw/pci/msix.h"
+
+/*
+ * A background command is a single pass over a list of host memory
+ * segments. The bytes of all segments are split evenly between the worker
+ * threads, which report progress per chunk; the last one to finish kicks a
+ * bottom half that completes the command on the main loop, where it updates
+ * the registers and raises the completion interrupt. The vCPU that rang the
+ * doorbell only pays for starting the threads.
+ */
+#define CXL_BG_CHUNK (1 * MiB)
+
+static void __bg_do_chunk(CXLBgPass pass, uint8_t *host, uint64_t len)
+{
+    switch (pass) {
+    case CXL_BG_PASS_ZERO:
+        memset(host, 0, len);
+        break;
+    case CXL_BG_PASS_READ:
+        /* Touch every byte, the result does not matter */
+        (void)buffer_is_zero(host, len);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void *__bg_worker_main(void *opaque)
+{
+    CXLBgWorker *w = opaque;
+    CXLDeviceState *cxl_dstate = w->cxl_dstate;
+    uint64_t seg_base = 0;
+    uint64_t pos = w->start;
+    guint i;
+
+    for (i = 0; i < cxl_dstate->bg.segs->len && pos < w->end; i++) {
+        CXLBgSegment *seg = &g_array_index(cxl_dstate->bg.segs,
+                                           CXLBgSegment, i);
+        uint8_t *host = memory_region_get_ram_ptr(seg->mr) + seg->offset;
+        uint64_t seg_end = seg_base + seg->len;
+
+        while (pos < MIN(seg_end, w->end)) {
+            uint64_t len = MIN(CXL_BG_CHUNK, MIN(seg_end, w->end) - pos);
+
+            if (qatomic_read(&cxl_dstate->bg.abort)) {
+                goto out;
+            }
+
+            __bg_do_chunk(cxl_dstate->bg.pass, host + (pos - seg_base), len);
+            qatomic_add(&cxl_dstate->bg.done, len);
+            pos += len;
+        }
+        seg_base = seg_end;
+    }
+
+out:
+    if (qatomic_fetch_dec(&cxl_dstate->bg.pending) == 1) {
+        qemu_bh_schedule(cxl_dstate->bg.bh);
+    }
+    return NULL;
+}
+
+static void __bg_join(CXLDeviceState *cxl_dstate)
+{
+    uint32_t i;
+
+    for (i = 0; i < cxl_dstate->bg.nr_workers; i++) {
+        qemu_thread_join(&cxl_dstate->bg.workers[i].thread);
+    }
+    g_free(cxl_dstate->bg.workers);
+    cxl_dstate->bg.workers = NULL;
+}
+
+static void __bg_finish(CXLDeviceState *cxl_dstate, bool aborted)
+{
+    guint i;
+
+    __bg_join(cxl_dstate);
+
+    /* The workers wrote RAM behind the memory API's back */
+    if (cxl_dstate->bg.pass == CXL_BG_PASS_ZERO) {
+        for (i = 0; i < cxl_dstate->bg.segs->len; i++) {
+            CXLBgSegment *seg = &g_array_index(cxl_dstate->bg.segs,
+                                               CXLBgSegment, i);
+
+            memory_region_set_dirty(seg->mr, seg->offset, seg->len);
+        }
+    }
+
+    /* Cleared first so the completion sees the media back in service */
+    cxl_dstate->bg.media_disabled = false;
+    cxl_dstate->bg.ret_code = 0;
+    if (cxl_dstate->bg.complete) {
+        cxl_dstate->bg.complete(cxl_dstate, aborted);
+    }
+
+    g_array_free(cxl_dstate->bg.segs, true);
+    cxl_dstate->bg.segs = NULL;
+    cxl_dstate->bg.running = false;
+}
+
+static void __bg_notify(CXLDeviceState *cxl_dstate)
+{
+    PCIDevice *pdev = PCI_DEVICE(cxl_dstate->obj);
+    uint8_t vector = ARRAY_FIELD_EX32(cxl_dstate->mbox_reg_state32,
+                                      CXL_DEV_MAILBOX_CAP, MSI_N);
+
+    if (!ARRAY_FIELD_EX32(cxl_dstate->mbox_reg_state32, CXL_DEV_MAILBOX_CTRL,
+                          BG_INT_EN)) {
+        return;
+    }
+
+    if (msix_enabled(pdev)) {
+        msix_notify(pdev, vector);
+    } else if (msi_enabled(pdev)) {
+        msi_notify(pdev, vector);
+    }
+}
+
+static void __bg_complete_bh(void *opaque)
+{
+    CXLDeviceState *cxl_dstate = opaque;
+    uint64_t bg_status_reg;
+
+    if (!cxl_dstate->bg.running) {
+        return;
+    }
+
+    __bg_finish(cxl_dstate, false);
+
+    bg_status_reg = FIELD_DP64(0, CXL_DEV_BG_CMD_STS, OP,
+                               cxl_dstate->bg.opcode);
+    bg_status_reg = FIELD_DP64(bg_status_reg, CXL_DEV_BG_CMD_STS,
+                               PERCENTAGE_COMP, 100);
+    bg_status_reg = FIELD_DP64(bg_status_reg, CXL_DEV_BG_CMD_STS, RET_CODE,
+                               cxl_dstate->bg.ret_code);
+    cxl_dstate->mbox_reg_state64[R_CXL_DEV_BG_CMD_STS] = bg_status_reg;
+
+    cxl_dstate->mbox_reg_state64[R_CXL_DEV_MAILBOX_STS] =
+        FIELD_DP64(cxl_dstate->mbox_reg_state64[R_CXL_DEV_MAILBOX_STS],
+                   CXL_DEV_MAILBOX_STS, BG_OP, 0);
+
+    __bg_notify(cxl_dstate);
+}
+
+/*
+ * Takes ownership of segs. Returns false when a background command is
+ * already running, the caller then reports Busy.
+ */
+bool cxl_mailbox_bg_start(CXLDeviceState *cxl_dstate, uint16_t opcode,
+                          CXLBgPass pass, GArray *segs,
+                          CXLBgComplete complete)
+{
+    uint32_t nr_workers = MAX(cxl_dstate->bg.nr_workers, 1);
+    uint64_t total = 0, per_worker;
+    uint32_t i;
+
+    if (cxl_dstate->bg.running) {
+        g_array_free(segs, true);
+        return false;
+    }
+
+    if (!cxl_dstate->bg.bh) {
+        cxl_dstate->bg.bh = qemu_bh_new(__bg_complete_bh, cxl_dstate);
+    }
+
+    for (i = 0; i < segs->len; i++) {
+        total += g_array_index(segs, CXLBgSegment, i).len;
+    }
+    per_worker = QEMU_ALIGN_UP(DIV_ROUND_UP(total, nr_workers), CXL_BG_CHUNK);
+
+    cxl_dstate->bg.running = true;
+    cxl_dstate->bg.abort = false;
+    cxl_dstate->bg.opcode = opcode;
+    cxl_dstate->bg.pass = pass;
+    cxl_dstate->bg.segs = segs;
+    cxl_dstate->bg.total = total;
+    cxl_dstate->bg.done = 0;
+    cxl_dstate->bg.complete = complete;
+    cxl_dstate->bg.nr_workers = nr_workers;
+    cxl_dstate->bg.pending = nr_workers;
+    cxl_dstate->bg.workers = g_new0(CXLBgWorker, nr_workers);
+
+    for (i = 0; i < nr_workers; i++) {
+        CXLBgWorker *w = &cxl_dstate->bg.workers[i];
+        char *name = g_strdup_printf("cxl-bg-%u", i);
+
+        w->cxl_dstate = cxl_dstate;
+        w->start = MIN((uint64_t)i * per_worker, total);
+        w->end = MIN(w->start + per_worker, total);
+        qemu_thread_create(&w->thread, name, __bg_worker_main, w,
+                           QEMU_THREAD_JOINABLE);
+        g_free(name);
+    }
+
+    return true;
+}
+
+uint8_t cxl_mailbox_bg_percent(CXLDeviceState *cxl_dstate)
+{
+    uint64_t done = qatomic_read(&cxl_dstate->bg.done);
+
+    if (!cxl_dstate->bg.total) {
+        return 99;
+    }
+
+    /* 100 is only reported once the command has completed */
+    return MIN(done * 100 / cxl_dstate->bg.total, 99);
+}
+
+/* Stop the running command, if any, without completing it */
+void cxl_mailbox_bg_abort(CXLDeviceState *cxl_dstate)
+{
+    if (!cxl_dstate->bg.running) {
+        return;
+    }
+
+    qatomic_set(&cxl_dstate->bg.abort, true);
+    __bg_finish(cxl_dstate, true);
+    qemu_bh_cancel(cxl_dstate->bg.bh);
+}
+
+void cxl_mailbox_bg_release(CXLDeviceState *cxl_dstate)
+{
+    cxl_mailbox_bg_abort(cxl_dstate);
+    if (cxl_dstate->bg.bh) {
+        qemu_bh_delete(cxl_dstate->bg.bh);
+        cxl_dstate->bg.bh = NULL;
+    }
+}
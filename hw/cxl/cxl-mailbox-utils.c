@@ -12,11 +12,11 @@
 #include "hw/pci/pci.h"
 #include "qemu/cutils.h"
 #include "qemu/log.h"
+#include "qemu/range.h"
 #include "qemu/units.h"
 #include "qemu/uuid.h"
 #include "trace.h"
 
-#define CXL_CAPACITY_MULTIPLIER   (256 * MiB)
 
 /*
  * How to add a new command, example. The command set FOO, with cmd BAR.
@@ -25,7 +25,7 @@
  *          #define BAR 0
  *  2. Implement the handler
  *    static ret_code cmd_foo_bar(struct cxl_cmd *cmd,
- *                                  CXLDeviceState *cxl_dstate, uint16_t *len)
+ *                                  CXLDeviceState *cxl_dstate, size_t *len)
  *  3. Add the command to the cxl_cmd_set[][]
  *    [FOO][BAR] = { "FOO_BAR", cmd_foo_bar, x, y },
  *  4. Implement your handler
@@ -63,6 +63,23 @@ enum {
         #define GET_PARTITION_INFO     0x0
         #define GET_LSA       0x2
         #define SET_LSA       0x3
+    MEDIA_AND_POISON = 0x43,
+        #define GET_POISON_LIST        0x0
+        #define INJECT_POISON          0x1
+        #define CLEAR_POISON           0x2
+        #define GET_SCAN_MEDIA_CAPABILITIES 0x3
+        #define SCAN_MEDIA             0x4
+        #define GET_SCAN_MEDIA_RESULTS 0x5
+    SANITIZE    = 0x44,
+        #define OVERWRITE     0x0
+        #define SECURE_ERASE  0x1
+    DCD_CONFIG  = 0x48,
+        #define GET_DC_CONFIG          0x0
+        #define GET_DYN_CAP_EXT_LIST   0x1
+        #define ADD_DYN_CAP_RSP        0x2
+        #define RELEASE_DYN_CAP        0x3
+    MHD         = 0x55,
+        #define GET_MHD_INFO           0x0
 };
 
 /* 8.2.8.4.5.1 Command Return Codes */
@@ -90,12 +107,20 @@ typedef enum {
     CXL_MBOX_INCORRECT_PASSPHRASE = 0x14,
     CXL_MBOX_UNSUPPORTED_MAILBOX = 0x15,
     CXL_MBOX_INVALID_PAYLOAD_LENGTH = 0x16,
-    CXL_MBOX_MAX = 0x17
+    CXL_MBOX_INVALID_LOG = 0x17,
+    CXL_MBOX_INTERRUPTED = 0x18,
+    CXL_MBOX_UNSUPPORTED_FEATURE_VERSION = 0x19,
+    CXL_MBOX_UNSUPPORTED_FEATURE_SELECTION_VALUE = 0x1a,
+    CXL_MBOX_FEATURE_TRANSFER_IN_PROGRESS = 0x1b,
+    CXL_MBOX_FEATURE_TRANSFER_OUT_OF_ORDER = 0x1c,
+    CXL_MBOX_RESOURCES_EXHAUSTED = 0x1d,
+    CXL_MBOX_INVALID_EXTENT_LIST = 0x1e,
+    CXL_MBOX_MAX = 0x1f
 } ret_code;
 
 struct cxl_cmd;
 typedef ret_code (*opcode_handler)(struct cxl_cmd *cmd,
-                                   CXLDeviceState *cxl_dstate, uint16_t *len);
+                                   CXLDeviceState *cxl_dstate, size_t *len);
 struct cxl_cmd {
     const char *name;
     opcode_handler handler;
@@ -107,7 +132,7 @@ struct cxl_cmd {
 #define DEFINE_MAILBOX_HANDLER_ZEROED(name, size)                         \
     uint16_t __zero##name = size;                                         \
     static ret_code cmd_##name(struct cxl_cmd *cmd,                       \
-                               CXLDeviceState *cxl_dstate, uint16_t *len) \
+                               CXLDeviceState *cxl_dstate, size_t *len)   \
     {                                                                     \
         *len = __zero##name;                                              \
         memset(cmd->payload, 0, *len);                                    \
@@ -115,20 +140,146 @@ struct cxl_cmd {
     }
 #define DEFINE_MAILBOX_HANDLER_NOP(name)                                  \
     static ret_code cmd_##name(struct cxl_cmd *cmd,                       \
-                               CXLDeviceState *cxl_dstate, uint16_t *len) \
+                               CXLDeviceState *cxl_dstate, size_t *len)   \
     {                                                                     \
         return CXL_MBOX_SUCCESS;                                          \
     }
 
-DEFINE_MAILBOX_HANDLER_ZEROED(events_get_records, 0x20);
-DEFINE_MAILBOX_HANDLER_NOP(events_clear_records);
-DEFINE_MAILBOX_HANDLER_ZEROED(events_get_interrupt_policy, 4);
-DEFINE_MAILBOX_HANDLER_NOP(events_set_interrupt_policy);
+/* NULL unless the mailbox belongs to a Type 3 device */
+static CXLType3Dev *cxl_dstate_to_ct3d(CXLDeviceState *cxl_dstate)
+{
+    return (CXLType3Dev *)object_dynamic_cast(cxl_dstate->obj, TYPE_CXL_TYPE3);
+}
+
+/* CXL 3.0 8.2.9.2.2 Get Event Records */
+static ret_code cmd_events_get_records(struct cxl_cmd *cmd,
+                                       CXLDeviceState *cxl_dstate,
+                                       size_t *len)
+{
+    CXLGetEventPayload *pl = (CXLGetEventPayload *)cmd->payload;
+    uint8_t log_type = cmd->payload[0];
+    uint16_t max_recs, nr;
+
+    if (log_type >= CXL_EVENT_TYPE_MAX) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+
+    /* As many records as the payload holds, a whole log per call at best */
+    max_recs = (cxl_dstate->payload_size - CXL_EVENT_PAYLOAD_HDR_SIZE) /
+               CXL_EVENT_RECORD_SIZE;
+    nr = cxl_event_get_records(cxl_dstate, log_type, pl, max_recs);
+
+    *len = CXL_EVENT_PAYLOAD_HDR_SIZE + nr * CXL_EVENT_RECORD_SIZE;
+    return CXL_MBOX_SUCCESS;
+}
+
+/* CXL 3.0 8.2.9.2.3 Clear Event Records */
+static ret_code cmd_events_clear_records(struct cxl_cmd *cmd,
+                                         CXLDeviceState *cxl_dstate,
+                                         size_t *len)
+{
+    CXLClearEventPayload *pl = (CXLClearEventPayload *)cmd->payload;
+    uint64_t command_reg = cxl_dstate->mbox_reg_state64[R_CXL_DEV_MAILBOX_CMD];
+    size_t in_len = FIELD_EX64(command_reg, CXL_DEV_MAILBOX_CMD, LENGTH);
+
+    if (in_len < sizeof(*pl) ||
+        in_len < sizeof(*pl) + pl->nr_recs * sizeof(pl->handle[0])) {
+        return CXL_MBOX_INVALID_PAYLOAD_LENGTH;
+    }
+
+    *len = 0;
+    if (cxl_event_clear_records(cxl_dstate, pl)) {
+        return CXL_MBOX_INVALID_HANDLE;
+    }
+
+    return CXL_MBOX_SUCCESS;
+}
+
+/* CXL 3.0 8.2.9.2.4 Get Event Interrupt Policy */
+static ret_code cmd_events_get_interrupt_policy(struct cxl_cmd *cmd,
+                                                CXLDeviceState *cxl_dstate,
+                                                size_t *len)
+{
+    CXLEventInterruptPolicy *policy = (CXLEventInterruptPolicy *)cmd->payload;
+    CXLEventLog *logs = cxl_dstate->event_logs;
+
+    memset(policy, 0, sizeof(*policy));
+    if (logs[CXL_EVENT_TYPE_INFO].irq_enabled) {
+        policy->info_settings =
+            CXL_EVENT_INT_SETTING(logs[CXL_EVENT_TYPE_INFO].irq_vec);
+    }
+    if (logs[CXL_EVENT_TYPE_WARN].irq_enabled) {
+        policy->warn_settings =
+            CXL_EVENT_INT_SETTING(logs[CXL_EVENT_TYPE_WARN].irq_vec);
+    }
+    if (logs[CXL_EVENT_TYPE_FAIL].irq_enabled) {
+        policy->failure_settings =
+            CXL_EVENT_INT_SETTING(logs[CXL_EVENT_TYPE_FAIL].irq_vec);
+    }
+    if (logs[CXL_EVENT_TYPE_FATAL].irq_enabled) {
+        policy->fatal_settings =
+            CXL_EVENT_INT_SETTING(logs[CXL_EVENT_TYPE_FATAL].irq_vec);
+    }
+    if (logs[CXL_EVENT_TYPE_DYNAMIC_CAP].irq_enabled) {
+        policy->dyn_cap_settings =
+            CXL_EVENT_INT_SETTING(logs[CXL_EVENT_TYPE_DYNAMIC_CAP].irq_vec);
+    }
+
+    *len = sizeof(*policy);
+    return CXL_MBOX_SUCCESS;
+}
+
+/* CXL 3.0 8.2.9.2.5 Set Event Interrupt Policy, FW interrupts unsupported */
+static ret_code cmd_events_set_interrupt_policy(struct cxl_cmd *cmd,
+                                                CXLDeviceState *cxl_dstate,
+                                                size_t *len)
+{
+    CXLEventInterruptPolicy *policy = (CXLEventInterruptPolicy *)cmd->payload;
+    uint64_t command_reg = cxl_dstate->mbox_reg_state64[R_CXL_DEV_MAILBOX_CMD];
+    size_t in_len = FIELD_EX64(command_reg, CXL_DEV_MAILBOX_CMD, LENGTH);
+    uint8_t settings[] = {
+        [CXL_EVENT_TYPE_INFO] = policy->info_settings,
+        [CXL_EVENT_TYPE_WARN] = policy->warn_settings,
+        [CXL_EVENT_TYPE_FAIL] = policy->failure_settings,
+        [CXL_EVENT_TYPE_FATAL] = policy->fatal_settings,
+        [CXL_EVENT_TYPE_DYNAMIC_CAP] = policy->dyn_cap_settings,
+    };
+    int i;
+
+    if (in_len < CXL_EVENT_INT_SETTING_MIN_LEN) {
+        return CXL_MBOX_INVALID_PAYLOAD_LENGTH;
+    }
+    /* Without the dynamic capacity byte its setting is left alone */
+    if (in_len < sizeof(*policy)) {
+        settings[CXL_EVENT_TYPE_DYNAMIC_CAP] =
+            cxl_dstate->event_logs[CXL_EVENT_TYPE_DYNAMIC_CAP].irq_enabled ?
+            CXL_INT_MSI_MSIX : CXL_INT_NONE;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(settings); i++) {
+        uint8_t mode = settings[i] & CXL_EVENT_INT_MODE_MASK;
+
+        if (mode != CXL_INT_NONE &&
+            (mode != CXL_INT_MSI_MSIX || !cxl_dstate->event_logs[i].capacity)) {
+            return CXL_MBOX_INVALID_INPUT;
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(settings); i++) {
+        cxl_dstate->event_logs[i].irq_enabled =
+            (settings[i] & CXL_EVENT_INT_MODE_MASK) == CXL_INT_MSI_MSIX;
+    }
+
+    /* Records that arrived while the interrupt was off are signalled now */
+    cxl_event_irq_assert(cxl_dstate);
+
+    *len = 0;
+    return CXL_MBOX_SUCCESS;
+}
 
 /* 8.2.9.2.1 */
 static ret_code cmd_firmware_update_get_info(struct cxl_cmd *cmd,
                                              CXLDeviceState *cxl_dstate,
-                                             uint16_t *len)
+                                             size_t *len)
 {
     struct {
         uint8_t slots_supported;
@@ -142,7 +293,7 @@ static ret_code cmd_firmware_update_get_info(struct cxl_cmd *cmd,
     } QEMU_PACKED *fw_info;
     QEMU_BUILD_BUG_ON(sizeof(*fw_info) != 0x50);
 
-    if (cxl_dstate->pmem_size < CXL_CAPACITY_MULTIPLIER) {
+    if (cxl_dstate->mem_size < CXL_CAPACITY_MULTIPLIER) {
         return CXL_MBOX_INTERNAL_ERROR;
     }
 
@@ -161,20 +312,9 @@ static ret_code cmd_firmware_update_get_info(struct cxl_cmd *cmd,
 /* 8.2.9.3.1 */
 static ret_code cmd_timestamp_get(struct cxl_cmd *cmd,
                                   CXLDeviceState *cxl_dstate,
-                                  uint16_t *len)
+                                  size_t *len)
 {
-    uint64_t time, delta;
-    uint64_t final_time = 0;
-
-    if (cxl_dstate->timestamp.set) {
-        /* First find the delta from the last time the host set the time. */
-        time = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-        delta = time - cxl_dstate->timestamp.last_set;
-        final_time = cxl_dstate->timestamp.host_set + delta;
-    }
-
-    /* Then adjust the actual time */
-    stq_le_p(cmd->payload, final_time);
+    stq_le_p(cmd->payload, cxl_device_get_timestamp(cxl_dstate));
     *len = 8;
 
     return CXL_MBOX_SUCCESS;
@@ -183,7 +323,7 @@ static ret_code cmd_timestamp_get(struct cxl_cmd *cmd,
 /* 8.2.9.3.2 */
 static ret_code cmd_timestamp_set(struct cxl_cmd *cmd,
                                   CXLDeviceState *cxl_dstate,
-                                  uint16_t *len)
+                                  size_t *len)
 {
     cxl_dstate->timestamp.set = true;
     cxl_dstate->timestamp.last_set = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
@@ -203,7 +343,7 @@ static const QemuUUID cel_uuid = {
 /* 8.2.9.4.1 */
 static ret_code cmd_logs_get_supported(struct cxl_cmd *cmd,
                                        CXLDeviceState *cxl_dstate,
-                                       uint16_t *len)
+                                       size_t *len)
 {
     struct {
         uint16_t entries;
@@ -226,7 +366,7 @@ static ret_code cmd_logs_get_supported(struct cxl_cmd *cmd,
 /* 8.2.9.4.2 */
 static ret_code cmd_logs_get_log(struct cxl_cmd *cmd,
                                  CXLDeviceState *cxl_dstate,
-                                 uint16_t *len)
+                                 size_t *len)
 {
     struct {
         QemuUUID uuid;
@@ -267,7 +407,7 @@ static ret_code cmd_logs_get_log(struct cxl_cmd *cmd,
 /* 8.2.9.5.1.1 */
 static ret_code cmd_identify_memory_device(struct cxl_cmd *cmd,
                                            CXLDeviceState *cxl_dstate,
-                                           uint16_t *len)
+                                           size_t *len)
 {
     struct {
         char fw_revision[0x10];
@@ -284,14 +424,15 @@ static ret_code cmd_identify_memory_device(struct cxl_cmd *cmd,
         uint16_t inject_poison_limit;
         uint8_t poison_caps;
         uint8_t qos_telemetry_caps;
+        uint16_t dc_event_log_size;
     } QEMU_PACKED *id;
-    QEMU_BUILD_BUG_ON(sizeof(*id) != 0x43);
+    QEMU_BUILD_BUG_ON(sizeof(*id) != 0x45);
 
-    // CXLType3Dev *ct3d = container_of(cxl_dstate, CXLType3Dev, cxl_dstate);
     // CXLType3Class *cvc = CXL_TYPE3_GET_CLASS(ct3d);
-    uint64_t size = cxl_dstate->pmem_size;
+    CXLType3Dev *ct3d;
 
-    if (!QEMU_IS_ALIGNED(size, CXL_CAPACITY_MULTIPLIER)) {
+    if ((!QEMU_IS_ALIGNED(cxl_dstate->vmem_size, CXL_CAPACITY_MULTIPLIER)) ||
+        (!QEMU_IS_ALIGNED(cxl_dstate->pmem_size, CXL_CAPACITY_MULTIPLIER))) {
         return CXL_MBOX_INTERNAL_ERROR;
     }
 
@@ -300,19 +441,39 @@ static ret_code cmd_identify_memory_device(struct cxl_cmd *cmd,
 
     snprintf(id->fw_revision, 0x10, "EEUM FW VER. %d", 1);
 
-    id->total_capacity = size / CXL_CAPACITY_MULTIPLIER;
-    id->persistent_capacity = 0; // We don't support PMEM
-    id->volatile_capacity = size / CXL_CAPACITY_MULTIPLIER;
+    id->total_capacity = cxl_dstate->mem_size / CXL_CAPACITY_MULTIPLIER;
+    id->persistent_capacity = cxl_dstate->pmem_size / CXL_CAPACITY_MULTIPLIER;
+    id->volatile_capacity = cxl_dstate->vmem_size / CXL_CAPACITY_MULTIPLIER;
     id->lsa_size = 0; // cvc->get_lsa_size(ct3d);
+    stw_le_p(&id->info_event_log_size,
+             cxl_dstate->event_logs[CXL_EVENT_TYPE_INFO].capacity);
+    stw_le_p(&id->warning_event_log_size,
+             cxl_dstate->event_logs[CXL_EVENT_TYPE_WARN].capacity);
+    stw_le_p(&id->failure_event_log_size,
+             cxl_dstate->event_logs[CXL_EVENT_TYPE_FAIL].capacity);
+    stw_le_p(&id->fatal_event_log_size,
+             cxl_dstate->event_logs[CXL_EVENT_TYPE_FATAL].capacity);
+    stw_le_p(&id->dc_event_log_size,
+             cxl_dstate->event_logs[CXL_EVENT_TYPE_DYNAMIC_CAP].capacity);
     id->partition_align = 0;
 
+    ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    if (ct3d) {
+        /* 24 bit little endian field */
+        id->poison_list_max_mer[0] = ct3d->poison_list_limit;
+        id->poison_list_max_mer[1] = ct3d->poison_list_limit >> 8;
+        id->poison_list_max_mer[2] = ct3d->poison_list_limit >> 16;
+        /* No limit on the number of poison injections */
+        id->inject_poison_limit = 0;
+    }
+
     *len = sizeof(*id);
     return CXL_MBOX_SUCCESS;
 }
 
 static ret_code cmd_ccls_get_partition_info(struct cxl_cmd *cmd,
                                            CXLDeviceState *cxl_dstate,
-                                           uint16_t *len)
+                                           size_t *len)
 {
     struct {
         uint64_t active_vmem;
@@ -321,16 +482,16 @@ static ret_code cmd_ccls_get_partition_info(struct cxl_cmd *cmd,
         uint64_t next_pmem;
     } QEMU_PACKED *part_info = (void *)cmd->payload;
     QEMU_BUILD_BUG_ON(sizeof(*part_info) != 0x20);
-    uint64_t size = cxl_dstate->pmem_size;
 
-    if (!QEMU_IS_ALIGNED(size, CXL_CAPACITY_MULTIPLIER)) {
+    if ((!QEMU_IS_ALIGNED(cxl_dstate->vmem_size, CXL_CAPACITY_MULTIPLIER)) ||
+        (!QEMU_IS_ALIGNED(cxl_dstate->pmem_size, CXL_CAPACITY_MULTIPLIER))) {
         return CXL_MBOX_INTERNAL_ERROR;
     }
 
-    /* PMEM only */
-    part_info->active_vmem = 0;
+    /* The partitions follow the backends, there is no repartitioning */
+    part_info->active_vmem = cxl_dstate->vmem_size / CXL_CAPACITY_MULTIPLIER;
     part_info->next_vmem = 0;
-    part_info->active_pmem = size / CXL_CAPACITY_MULTIPLIER;
+    part_info->active_pmem = cxl_dstate->pmem_size / CXL_CAPACITY_MULTIPLIER;
     part_info->next_pmem = 0;
 
     *len = sizeof(*part_info);
@@ -339,7 +500,7 @@ static ret_code cmd_ccls_get_partition_info(struct cxl_cmd *cmd,
 
 static ret_code cmd_ccls_get_lsa(struct cxl_cmd *cmd,
                                  CXLDeviceState *cxl_dstate,
-                                 uint16_t *len)
+                                 size_t *len)
 {
     struct {
         uint32_t offset;
@@ -353,7 +514,9 @@ static ret_code cmd_ccls_get_lsa(struct cxl_cmd *cmd,
     offset = get_lsa->offset;
     length = get_lsa->length;
 
-    if (offset + length > cvc->get_lsa_size(ct3d)) {
+    /* Large payloads let the host read the whole label area in one go */
+    if ((uint64_t)offset + length > cvc->get_lsa_size(ct3d) ||
+        length > cxl_dstate->payload_size) {
         *len = 0;
         return CXL_MBOX_INVALID_INPUT;
     }
@@ -364,7 +527,7 @@ static ret_code cmd_ccls_get_lsa(struct cxl_cmd *cmd,
 
 static ret_code cmd_ccls_set_lsa(struct cxl_cmd *cmd,
                                  CXLDeviceState *cxl_dstate,
-                                 uint16_t *len)
+                                 size_t *len)
 {
     struct set_lsa_pl {
         uint32_t offset;
@@ -375,26 +538,831 @@ static ret_code cmd_ccls_set_lsa(struct cxl_cmd *cmd,
     CXLType3Dev *ct3d = container_of(cxl_dstate, CXLType3Dev, cxl_dstate);
     CXLType3Class *cvc = CXL_TYPE3_GET_CLASS(ct3d);
     const size_t hdr_len = offsetof(struct set_lsa_pl, data);
-    uint16_t plen = *len;
+    size_t plen = *len;
 
     *len = 0;
     if (!plen) {
         return CXL_MBOX_SUCCESS;
     }
+    if (plen < hdr_len) {
+        return CXL_MBOX_INVALID_PAYLOAD_LENGTH;
+    }
+    plen -= hdr_len;
 
-    if (set_lsa_payload->offset + plen > cvc->get_lsa_size(ct3d) + hdr_len) {
+    if ((uint64_t)set_lsa_payload->offset + plen > cvc->get_lsa_size(ct3d)) {
         return CXL_MBOX_INVALID_INPUT;
     }
-    plen -= hdr_len;
 
     cvc->set_lsa(ct3d, set_lsa_payload->data, plen, set_lsa_payload->offset);
     return CXL_MBOX_SUCCESS;
 }
 
+/*
+ * CXL 3.0 8.2.9.8.4.1 Get Poison List
+ *
+ * Records that do not fit the payload are left for a follow-up query, with
+ * More Err List Records set, starting after the last returned record.
+ */
+static ret_code cmd_media_get_poison_list(struct cxl_cmd *cmd,
+                                          CXLDeviceState *cxl_dstate,
+                                          size_t *len)
+{
+    struct get_poison_list_pl {
+        uint64_t pa;
+        uint64_t length;
+    } QEMU_PACKED;
+
+    struct get_poison_list_out_pl {
+        uint8_t flags;
+        uint8_t rsvd1;
+        uint64_t overflow_timestamp;
+        uint16_t count;
+        uint8_t rsvd2[0x14];
+        struct {
+            uint64_t addr;
+            uint32_t length;
+            uint32_t resv;
+        } QEMU_PACKED records[];
+    } QEMU_PACKED;
+    QEMU_BUILD_BUG_ON(sizeof(struct get_poison_list_out_pl) != 0x20);
+
+    struct get_poison_list_pl *in = (void *)cmd->payload;
+    struct get_poison_list_out_pl *out = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint64_t query_start, query_length, query_last;
+    uint16_t record_count = 0, max_records;
+    IntervalTreeNode *node;
+    uint8_t flags = 0;
+
+    if (!ct3d) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    query_start = ldq_le_p(&in->pa);
+    /* 64 byte alignment required */
+    if (query_start & 0x3f) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+    query_length = ldq_le_p(&in->length) * 64;
+    if (!query_length) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+    query_last = query_start + query_length - 1;
+    if (query_last < query_start) {
+        query_last = UINT64_MAX;
+    }
+
+    max_records = (cxl_dstate->payload_size - sizeof(*out)) /
+                  sizeof(out->records[0]);
+
+    memset(out, 0, sizeof(*out));
+    for (node = interval_tree_iter_first(&ct3d->poison_tree, query_start,
+                                         query_last);
+         node; node = interval_tree_iter_next(node, query_start, query_last)) {
+        CXLPoison *p = container_of(node, CXLPoison, node);
+        uint64_t start = MAX(node->start, query_start);
+        uint64_t last = MIN(node->last, query_last);
+
+        if (record_count == max_records) {
+            flags |= BIT(0);
+            break;
+        }
+
+        stq_le_p(&out->records[record_count].addr, start | (p->type & 0x7));
+        stl_le_p(&out->records[record_count].length, (last - start + 1) / 64);
+        stl_le_p(&out->records[record_count].resv, 0);
+        record_count++;
+    }
+
+    if (ct3d->poison_list_overflowed) {
+        flags |= BIT(1);
+        stq_le_p(&out->overflow_timestamp, ct3d->poison_list_overflow_ts);
+    }
+    out->flags = flags;
+    stw_le_p(&out->count, record_count);
+
+    *len = sizeof(*out) + record_count * sizeof(out->records[0]);
+    return CXL_MBOX_SUCCESS;
+}
+
+/* CXL 3.0 8.2.9.8.4.2 Inject Poison */
+static ret_code cmd_media_inject_poison(struct cxl_cmd *cmd,
+                                        CXLDeviceState *cxl_dstate,
+                                        size_t *len)
+{
+    struct inject_poison_pl {
+        uint64_t dpa;
+    } QEMU_PACKED *in = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint64_t dpa;
+
+    if (!ct3d) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    dpa = ldq_le_p(&in->dpa);
+    if (dpa & 0x3f) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+    if (dpa + 64 > cxl_dstate->mem_size) {
+        return CXL_MBOX_INVALID_PA;
+    }
+
+    *len = 0;
+
+    /* Already poisoned, nothing to record */
+    if (cxl_type3_poison_find(ct3d, dpa, 64)) {
+        return CXL_MBOX_SUCCESS;
+    }
+
+    if (!cxl_type3_poison_add(ct3d, dpa, 64, CXL_POISON_TYPE_INJECTED)) {
+        return CXL_MBOX_INJECT_POISON_LIMIT;
+    }
+
+    return CXL_MBOX_SUCCESS;
+}
+
+/* CXL 3.0 8.2.9.8.4.3 Clear Poison */
+static ret_code cmd_media_clear_poison(struct cxl_cmd *cmd,
+                                       CXLDeviceState *cxl_dstate,
+                                       size_t *len)
+{
+    struct clear_poison_pl {
+        uint64_t dpa;
+        uint8_t data[64];
+    } QEMU_PACKED *in = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint64_t dpa;
+
+    if (!ct3d) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    dpa = ldq_le_p(&in->dpa);
+    if (dpa & 0x3f) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+    if (dpa + 64 > cxl_dstate->mem_size) {
+        return CXL_MBOX_INVALID_PA;
+    }
+
+    /* The write data replaces whatever the poisoned line held */
+    if (MEMTX_OK != cxl_type3_dpa_write(ct3d, dpa, in->data, 64)) {
+        return CXL_MBOX_INTERNAL_ERROR;
+    }
+
+    cxl_type3_poison_clear(ct3d, dpa, 64);
+
+    *len = 0;
+    return CXL_MBOX_SUCCESS;
+}
+
+/* Nominal media bandwidth of one background worker */
+#define CXL_SCAN_MEDIA_BYTES_PER_MS (1 * MiB)
+
+static void __media_error_records_from_poison(CXLType3Dev *ct3d, GArray *recs,
+                                              uint64_t dpa, uint64_t length)
+{
+    IntervalTreeNode *node;
+    uint64_t last = dpa + length - 1;
+
+    for (node = interval_tree_iter_first(&ct3d->poison_tree, dpa, last);
+         node; node = interval_tree_iter_next(node, dpa, last)) {
+        CXLPoison *p = container_of(node, CXLPoison, node);
+        CXLMediaErrorRecord rec = {
+            .dpa = MAX(node->start, dpa),
+            .type = p->type,
+        };
+
+        rec.length = MIN(node->last, last) - rec.dpa + 1;
+        g_array_append_val(recs, rec);
+    }
+}
+
+/* CXL 3.0 8.2.9.8.4.4 Get Scan Media Capabilities */
+static ret_code cmd_media_get_scan_media_capabilities(struct cxl_cmd *cmd,
+                                                      CXLDeviceState *cxl_dstate,
+                                                      size_t *len)
+{
+    struct get_scan_media_capabilities_pl {
+        uint64_t pa;
+        uint64_t length;
+    } QEMU_PACKED *in = (void *)cmd->payload;
+    struct get_scan_media_capabilities_out_pl {
+        uint32_t estimated_runtime_ms;
+    } QEMU_PACKED *out = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint64_t query_start, query_length, runtime_ms;
+
+    if (!ct3d) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    query_start = ldq_le_p(&in->pa);
+    query_length = ldq_le_p(&in->length) * 64;
+    if (query_start & 0x3f) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+    if (query_start + query_length > cxl_dstate->mem_size ||
+        query_start + query_length < query_start) {
+        return CXL_MBOX_INVALID_PA;
+    }
+
+    runtime_ms = DIV_ROUND_UP(query_length, CXL_SCAN_MEDIA_BYTES_PER_MS *
+                              MAX(cxl_dstate->bg.nr_workers, 1));
+    stl_le_p(&out->estimated_runtime_ms, MIN(runtime_ms, UINT32_MAX));
+
+    *len = sizeof(*out);
+    return CXL_MBOX_SUCCESS;
+}
+
+static void __scan_media_complete(CXLDeviceState *cxl_dstate, bool aborted)
+{
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+
+    if (aborted) {
+        g_array_set_size(ct3d->scan_media_pending, 0);
+        return;
+    }
+
+    /* A new scan replaces the results of the previous one */
+    g_array_set_size(ct3d->scan_media_results, 0);
+    g_array_append_vals(ct3d->scan_media_results,
+                        ct3d->scan_media_pending->data,
+                        ct3d->scan_media_pending->len);
+    g_array_set_size(ct3d->scan_media_pending, 0);
+    cxl_dstate->bg.ret_code = CXL_MBOX_SUCCESS;
+}
+
+/*
+ * CXL 3.0 8.2.9.8.4.5 Scan Media
+ *
+ * The media errors are the poison list entries in the range, taken when the
+ * scan starts; the background pass reads through the range at the speed of
+ * the backend.
+ */
+static ret_code cmd_media_scan_media(struct cxl_cmd *cmd,
+                                     CXLDeviceState *cxl_dstate,
+                                     size_t *len)
+{
+    struct scan_media_pl {
+        uint64_t pa;
+        uint64_t length;
+        uint8_t flags;
+    } QEMU_PACKED *in = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint64_t query_start, query_length;
+    GArray *segs;
+
+    if (!ct3d) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    query_start = ldq_le_p(&in->pa);
+    query_length = ldq_le_p(&in->length) * 64;
+    if ((query_start & 0x3f) || !query_length) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+    if (query_start + query_length > cxl_dstate->mem_size ||
+        query_start + query_length < query_start) {
+        return CXL_MBOX_INVALID_PA;
+    }
+
+    segs = cxl_type3_dpa_segments(ct3d, query_start, query_length);
+    if (!cxl_mailbox_bg_start(cxl_dstate, (MEDIA_AND_POISON << 8) | SCAN_MEDIA,
+                              CXL_BG_PASS_READ, segs,
+                              __scan_media_complete)) {
+        return CXL_MBOX_BUSY;
+    }
+
+    __media_error_records_from_poison(ct3d, ct3d->scan_media_pending,
+                                      query_start, query_length);
+
+    *len = 0;
+    return CXL_MBOX_BG_STARTED;
+}
+
+/* CXL 3.0 8.2.9.8.4.6 Get Scan Media Results, records are consumed */
+static ret_code cmd_media_get_scan_media_results(struct cxl_cmd *cmd,
+                                                 CXLDeviceState *cxl_dstate,
+                                                 size_t *len)
+{
+    struct get_scan_media_results_out_pl {
+        uint64_t dpa_restart;
+        uint64_t length;
+        uint8_t flags;
+        uint8_t rsvd1;
+        uint16_t count;
+        uint8_t rsvd2[0xc];
+        struct {
+            uint64_t addr;
+            uint32_t length;
+            uint32_t resv;
+        } QEMU_PACKED records[];
+    } QEMU_PACKED;
+    QEMU_BUILD_BUG_ON(sizeof(struct get_scan_media_results_out_pl) != 0x20);
+
+    struct get_scan_media_results_out_pl *out = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint16_t record_count, max_records, i;
+    GArray *results;
+
+    if (!ct3d) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    results = ct3d->scan_media_results;
+    max_records = (cxl_dstate->payload_size - sizeof(*out)) /
+                  sizeof(out->records[0]);
+    record_count = MIN(results->len, max_records);
+
+    memset(out, 0, sizeof(*out));
+    for (i = 0; i < record_count; i++) {
+        CXLMediaErrorRecord *rec = &g_array_index(results,
+                                                  CXLMediaErrorRecord, i);
+
+        stq_le_p(&out->records[i].addr, rec->dpa | (rec->type & 0x7));
+        stl_le_p(&out->records[i].length, rec->length / 64);
+        stl_le_p(&out->records[i].resv, 0);
+    }
+    g_array_remove_range(results, 0, record_count);
+
+    /* More Media Error Records */
+    if (results->len) {
+        out->flags |= BIT(0);
+    }
+    stw_le_p(&out->count, record_count);
+
+    *len = sizeof(*out) + record_count * sizeof(out->records[0]);
+    return CXL_MBOX_SUCCESS;
+}
+
+static void __sanitize_complete(CXLDeviceState *cxl_dstate, bool aborted)
+{
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+
+    if (aborted) {
+        return;
+    }
+
+    /* Nothing of the old contents survives, poison included */
+    cxl_type3_poison_clear(ct3d, 0,
+                           cxl_dstate->mem_size + ct3d->dc.total_capacity);
+    ct3d->poison_list_overflowed = false;
+    g_array_set_size(ct3d->scan_media_results, 0);
+    cxl_dstate->bg.ret_code = CXL_MBOX_SUCCESS;
+}
+
+/*
+ * CXL 3.0 8.2.9.9.5.1 Sanitize and 8.2.9.9.5.2 Secure Erase
+ *
+ * Both zero all user data and the LSA in the background: the static
+ * partitions and every accepted dynamic capacity extent. The media is
+ * disabled until that is done, so guest accesses do not race the workers.
+ */
+static ret_code __media_sanitize(CXLDeviceState *cxl_dstate, uint8_t cmd)
+{
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    GArray *segs;
+
+    /* The media is shared, one head must not wipe it under the others */
+    if (!ct3d || ct3d->mhd.state) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+    /* Checked here so that the rollback below never undoes another pass */
+    if (cxl_dstate->bg.running) {
+        return CXL_MBOX_BUSY;
+    }
+
+    segs = cxl_type3_dpa_segments(ct3d, 0, cxl_dstate->mem_size +
+                                  ct3d->dc.total_capacity);
+    if (ct3d->lsa) {
+        CXLBgSegment lsa = {
+            .mr = host_memory_backend_get_memory(ct3d->lsa),
+        };
+
+        lsa.len = memory_region_size(lsa.mr);
+        g_array_append_val(segs, lsa);
+    }
+
+    /*
+     * Take the media away from the guest, direct map included, before
+     * the first chunk is zeroed, or a store could land behind the workers.
+     */
+    cxl_dstate->bg.media_disabled = true;
+    cxl_type3_direct_map_update(ct3d);
+
+    if (!cxl_mailbox_bg_start(cxl_dstate, (SANITIZE << 8) | cmd,
+                              CXL_BG_PASS_ZERO, segs, __sanitize_complete)) {
+        cxl_dstate->bg.media_disabled = false;
+        cxl_type3_direct_map_update(ct3d);
+        return CXL_MBOX_BUSY;
+    }
+
+    return CXL_MBOX_BG_STARTED;
+}
+
+static ret_code cmd_sanitize_overwrite(struct cxl_cmd *cmd,
+                                       CXLDeviceState *cxl_dstate,
+                                       size_t *len)
+{
+    *len = 0;
+    return __media_sanitize(cxl_dstate, OVERWRITE);
+}
+
+static ret_code cmd_sanitize_secure_erase(struct cxl_cmd *cmd,
+                                          CXLDeviceState *cxl_dstate,
+                                          size_t *len)
+{
+    *len = 0;
+    return __media_sanitize(cxl_dstate, SECURE_ERASE);
+}
+
+/* CXL 3.0 8.2.9.8.9.1 Get Dynamic Capacity Configuration */
+static ret_code cmd_dcd_get_dyn_cap_config(struct cxl_cmd *cmd,
+                                           CXLDeviceState *cxl_dstate,
+                                           size_t *len)
+{
+    struct get_dyn_cap_config_in_pl {
+        uint8_t region_cnt;
+        uint8_t start_region_id;
+    } QEMU_PACKED *in = (void *)cmd->payload;
+    struct get_dyn_cap_config_out_pl {
+        uint8_t num_regions;
+        uint8_t rsvd1[7];
+        struct {
+            uint64_t base;
+            uint64_t decode_len;
+            uint64_t region_len;
+            uint64_t block_size;
+            uint32_t dsmadhandle;
+            uint8_t flags;
+            uint8_t rsvd2[3];
+        } QEMU_PACKED records[];
+    } QEMU_PACKED *out = (void *)cmd->payload;
+    struct {
+        uint32_t num_extents_supported;
+        uint32_t num_extents_available;
+        uint32_t num_tags_supported;
+        uint32_t num_tags_available;
+    } QEMU_PACKED *extra_out;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint8_t start_region_id, region_cnt;
+    uint16_t record_count, i;
+
+    if (!ct3d || !ct3d->dc.num_regions) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    start_region_id = in->start_region_id;
+    if (start_region_id >= ct3d->dc.num_regions) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+    region_cnt = in->region_cnt;
+    record_count = MIN(region_cnt, ct3d->dc.num_regions - start_region_id);
+    /* The smallest payloads do not hold all eight regions */
+    record_count = MIN(record_count, (cxl_dstate->payload_size -
+                                      sizeof(*out) - sizeof(*extra_out)) /
+                                     sizeof(out->records[0]));
+
+    memset(out, 0, sizeof(*out));
+    out->num_regions = record_count;
+    for (i = 0; i < record_count; i++) {
+        CXLDCRegion *region = &ct3d->dc.regions[start_region_id + i];
+
+        stq_le_p(&out->records[i].base, region->base);
+        stq_le_p(&out->records[i].decode_len,
+                 region->decode_len / CXL_CAPACITY_MULTIPLIER);
+        stq_le_p(&out->records[i].region_len, region->len);
+        stq_le_p(&out->records[i].block_size, region->block_size);
+        stl_le_p(&out->records[i].dsmadhandle, region->dsmadhandle);
+        out->records[i].flags = region->flags;
+        memset(out->records[i].rsvd2, 0, sizeof(out->records[i].rsvd2));
+    }
+
+    extra_out = (void *)&out->records[record_count];
+    stl_le_p(&extra_out->num_extents_supported, CXL_DC_MAX_EXTENTS);
+    stl_le_p(&extra_out->num_extents_available,
+             CXL_DC_MAX_EXTENTS - MIN(ct3d->dc.total_extent_count,
+                                      CXL_DC_MAX_EXTENTS));
+    stl_le_p(&extra_out->num_tags_supported, 0);
+    stl_le_p(&extra_out->num_tags_available, 0);
+
+    *len = sizeof(*out) + record_count * sizeof(out->records[0]) +
+           sizeof(*extra_out);
+    return CXL_MBOX_SUCCESS;
+}
+
+/* CXL 3.0 8.2.9.8.9.2 Get Dynamic Capacity Extent List */
+static ret_code cmd_dcd_get_dyn_cap_ext_list(struct cxl_cmd *cmd,
+                                             CXLDeviceState *cxl_dstate,
+                                             size_t *len)
+{
+    struct get_dyn_cap_ext_list_in_pl {
+        uint32_t extent_cnt;
+        uint32_t start_extent_id;
+    } QEMU_PACKED *in = (void *)cmd->payload;
+    struct get_dyn_cap_ext_list_out_pl {
+        uint32_t count;
+        uint32_t total_extents;
+        uint32_t generation_num;
+        uint8_t rsvd[4];
+        CXLDCExtentRaw records[];
+    } QEMU_PACKED *out = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint32_t start_extent_id, extent_cnt, max_records, record_count;
+    uint32_t i = 0, n = 0;
+    CXLDCExtent *extent;
+
+    if (!ct3d || !ct3d->dc.num_regions) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    start_extent_id = ldl_le_p(&in->start_extent_id);
+    extent_cnt = ldl_le_p(&in->extent_cnt);
+    if (start_extent_id > ct3d->dc.total_extent_count) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+
+    max_records = (cxl_dstate->payload_size - sizeof(*out)) /
+                  sizeof(out->records[0]);
+    record_count = MIN(MIN(extent_cnt, max_records),
+                       ct3d->dc.total_extent_count - start_extent_id);
+
+    stl_le_p(&out->count, record_count);
+    stl_le_p(&out->total_extents, ct3d->dc.total_extent_count);
+    stl_le_p(&out->generation_num, ct3d->dc.ext_list_gen_seq);
+    memset(out->rsvd, 0, sizeof(out->rsvd));
+
+    QTAILQ_FOREACH(extent, &ct3d->dc.extents, node) {
+        if (n == record_count) {
+            break;
+        }
+        if (i++ < start_extent_id) {
+            continue;
+        }
+        stq_le_p(&out->records[n].start_dpa, extent->start_dpa);
+        stq_le_p(&out->records[n].len, extent->len);
+        memcpy(out->records[n].tag, extent->tag, sizeof(extent->tag));
+        stw_le_p(&out->records[n].shared_seq, extent->shared_seq);
+        memset(out->records[n].rsvd, 0, sizeof(out->records[n].rsvd));
+        n++;
+    }
+
+    *len = sizeof(*out) + record_count * sizeof(out->records[0]);
+    return CXL_MBOX_SUCCESS;
+}
+
+/* Input of Add Dynamic Capacity Response and Release Dynamic Capacity */
+typedef struct CXLUpdateDCExtentListInPl {
+    uint32_t num_entries_updated;
+    uint8_t flags;
+    uint8_t rsvd[3];
+    struct {
+        uint64_t start_dpa;
+        uint64_t len;
+        uint8_t rsvd[8];
+    } QEMU_PACKED updated_entries[];
+} QEMU_PACKED CXLUpdateDCExtentListInPl;
+
+/*
+ * Every entry has to be block aligned, inside one region and must not
+ * overlap the entries before it.
+ */
+static ret_code __dcd_validate_extent_list(CXLType3Dev *ct3d,
+                                           CXLUpdateDCExtentListInPl *in,
+                                           uint32_t num)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < num; i++) {
+        uint64_t dpa = ldq_le_p(&in->updated_entries[i].start_dpa);
+        uint64_t len = ldq_le_p(&in->updated_entries[i].len);
+        CXLDCRegion *region = cxl_type3_dc_find_region(ct3d, dpa, len);
+
+        if (!len || !region) {
+            return CXL_MBOX_INVALID_PA;
+        }
+        if (!QEMU_IS_ALIGNED(dpa - region->base, region->block_size) ||
+            !QEMU_IS_ALIGNED(len, region->block_size)) {
+            return CXL_MBOX_INVALID_EXTENT_LIST;
+        }
+
+        for (j = 0; j < i; j++) {
+            uint64_t prev = ldq_le_p(&in->updated_entries[j].start_dpa);
+            uint64_t prev_len = ldq_le_p(&in->updated_entries[j].len);
+
+            if (ranges_overlap(dpa, len, prev, prev_len)) {
+                return CXL_MBOX_INVALID_EXTENT_LIST;
+            }
+        }
+    }
+
+    return CXL_MBOX_SUCCESS;
+}
+
+static ret_code __dcd_check_update_len(CXLDeviceState *cxl_dstate,
+                                       CXLUpdateDCExtentListInPl *in)
+{
+    uint64_t command_reg = cxl_dstate->mbox_reg_state64[R_CXL_DEV_MAILBOX_CMD];
+    size_t in_len = FIELD_EX64(command_reg, CXL_DEV_MAILBOX_CMD, LENGTH);
+
+    if (in_len < sizeof(*in) ||
+        (in_len - sizeof(*in)) / sizeof(in->updated_entries[0]) <
+        ldl_le_p(&in->num_entries_updated)) {
+        return CXL_MBOX_INVALID_PAYLOAD_LENGTH;
+    }
+
+    return CXL_MBOX_SUCCESS;
+}
+
+/*
+ * CXL 3.0 8.2.9.8.9.3 Add Dynamic Capacity Response
+ *
+ * The host answers the whole pending offer at once: the entries are the
+ * parts it accepts, everything else offered is dropped.
+ */
+static ret_code cmd_dcd_add_dyn_cap_rsp(struct cxl_cmd *cmd,
+                                        CXLDeviceState *cxl_dstate,
+                                        size_t *len)
+{
+    CXLUpdateDCExtentListInPl *in = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint32_t num, i;
+    ret_code ret;
+
+    if (!ct3d || !ct3d->dc.num_regions) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    ret = __dcd_check_update_len(cxl_dstate, in);
+    if (ret != CXL_MBOX_SUCCESS) {
+        return ret;
+    }
+
+    num = ldl_le_p(&in->num_entries_updated);
+    if (num + ct3d->dc.total_extent_count > CXL_DC_MAX_EXTENTS) {
+        return CXL_MBOX_RESOURCES_EXHAUSTED;
+    }
+
+    ret = __dcd_validate_extent_list(ct3d, in, num);
+    if (ret != CXL_MBOX_SUCCESS) {
+        return ret;
+    }
+
+    for (i = 0; i < num; i++) {
+        uint64_t dpa = ldq_le_p(&in->updated_entries[i].start_dpa);
+        uint64_t len = ldq_le_p(&in->updated_entries[i].len);
+
+        if (!cxl_type3_dc_extent_list_covers(&ct3d->dc.extents_pending,
+                                             dpa, len)) {
+            return CXL_MBOX_INVALID_PA;
+        }
+        /* Already accepted by an earlier response */
+        if (cxl_type3_dc_range_backed(ct3d, dpa, len)) {
+            return CXL_MBOX_INVALID_PA;
+        }
+    }
+
+    /* Another head may have taken part of the offer since it was made */
+    for (i = 0; i < num; i++) {
+        if (!cxl_type3_mhd_claim(ct3d,
+                ldq_le_p(&in->updated_entries[i].start_dpa),
+                ldq_le_p(&in->updated_entries[i].len))) {
+            while (i--) {
+                cxl_type3_mhd_unclaim(ct3d,
+                    ldq_le_p(&in->updated_entries[i].start_dpa),
+                    ldq_le_p(&in->updated_entries[i].len));
+            }
+            return CXL_MBOX_RESOURCES_EXHAUSTED;
+        }
+    }
+
+    for (i = 0; i < num; i++) {
+        uint64_t dpa = ldq_le_p(&in->updated_entries[i].start_dpa);
+        uint64_t len = ldq_le_p(&in->updated_entries[i].len);
+        CXLDCExtent *extent;
+
+        QTAILQ_FOREACH(extent, &ct3d->dc.extents_pending, node) {
+            if (dpa >= extent->start_dpa &&
+                dpa + len <= extent->start_dpa + extent->len) {
+                break;
+            }
+        }
+        cxl_type3_dc_accept(ct3d, dpa, len, extent->tag);
+    }
+    cxl_type3_dc_extent_list_clear(&ct3d->dc.extents_pending);
+
+    *len = 0;
+    return CXL_MBOX_SUCCESS;
+}
+
+/*
+ * CXL 3.0 8.2.9.8.9.4 Release Dynamic Capacity
+ *
+ * Either unprompted or in answer to a release event, the released ranges
+ * have to be fully backed.
+ */
+static ret_code cmd_dcd_release_dyn_cap(struct cxl_cmd *cmd,
+                                        CXLDeviceState *cxl_dstate,
+                                        size_t *len)
+{
+    CXLUpdateDCExtentListInPl *in = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint32_t num, i;
+    ret_code ret;
+
+    if (!ct3d || !ct3d->dc.num_regions) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    ret = __dcd_check_update_len(cxl_dstate, in);
+    if (ret != CXL_MBOX_SUCCESS) {
+        return ret;
+    }
+
+    num = ldl_le_p(&in->num_entries_updated);
+    if (!num) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+
+    ret = __dcd_validate_extent_list(ct3d, in, num);
+    if (ret != CXL_MBOX_SUCCESS) {
+        return ret;
+    }
+
+    for (i = 0; i < num; i++) {
+        if (!cxl_type3_dc_range_backed(ct3d,
+                ldq_le_p(&in->updated_entries[i].start_dpa),
+                ldq_le_p(&in->updated_entries[i].len))) {
+            return CXL_MBOX_INVALID_PA;
+        }
+    }
+
+    for (i = 0; i < num; i++) {
+        cxl_type3_dc_release(ct3d, ldq_le_p(&in->updated_entries[i].start_dpa),
+                             ldq_le_p(&in->updated_entries[i].len));
+    }
+
+    *len = 0;
+    return CXL_MBOX_SUCCESS;
+}
+
+/*
+ * CXL 3.0 7.6.7.5.1 Get Multi-Headed Info
+ *
+ * Each head of the device is a single LD, LD n being head n. Only the
+ * device's own mailbox answers it here, there is no FM-owned LD.
+ */
+static ret_code cmd_mhd_get_info(struct cxl_cmd *cmd,
+                                 CXLDeviceState *cxl_dstate,
+                                 size_t *len)
+{
+    struct {
+        uint8_t start_ld;
+        uint8_t ld_map_len;
+    } QEMU_PACKED *in = (void *)cmd->payload;
+    struct {
+        uint8_t nr_lds;
+        uint8_t nr_heads;
+        uint16_t rsvd1;
+        uint8_t start_ld;
+        uint8_t ld_map_len;
+        uint16_t rsvd2;
+        uint8_t ld_map[];
+    } QEMU_PACKED *out = (void *)cmd->payload;
+    CXLType3Dev *ct3d = cxl_dstate_to_ct3d(cxl_dstate);
+    uint8_t start_ld, map_len, i;
+
+    if (!ct3d || !ct3d->mhd.state) {
+        return CXL_MBOX_UNSUPPORTED;
+    }
+
+    start_ld = in->start_ld;
+    if (start_ld >= ct3d->mhd.nr_heads) {
+        return CXL_MBOX_INVALID_INPUT;
+    }
+    map_len = MIN(in->ld_map_len, ct3d->mhd.nr_heads - start_ld);
+
+    memset(out, 0, sizeof(*out));
+    out->nr_lds = ct3d->mhd.nr_heads;
+    out->nr_heads = ct3d->mhd.nr_heads;
+    out->start_ld = start_ld;
+    out->ld_map_len = map_len;
+    for (i = 0; i < map_len; i++) {
+        out->ld_map[i] = start_ld + i;
+    }
+
+    *len = sizeof(*out) + map_len;
+    return CXL_MBOX_SUCCESS;
+}
+
 #define IMMEDIATE_CONFIG_CHANGE (1 << 1)
 #define IMMEDIATE_DATA_CHANGE (1 << 2)
 #define IMMEDIATE_POLICY_CHANGE (1 << 3)
 #define IMMEDIATE_LOG_CHANGE (1 << 4)
+#define SECURITY_STATE_CHANGE (1 << 5)
+#define BACKGROUND_OPERATION (1 << 6)
 
 static struct cxl_cmd cxl_cmd_set[256][256] = {
     [EVENTS][GET_RECORDS] = { "EVENTS_GET_RECORDS",
@@ -404,7 +1372,7 @@ static struct cxl_cmd cxl_cmd_set[256][256] = {
     [EVENTS][GET_INTERRUPT_POLICY] = { "EVENTS_GET_INTERRUPT_POLICY",
         cmd_events_get_interrupt_policy, 0, 0 },
     [EVENTS][SET_INTERRUPT_POLICY] = { "EVENTS_SET_INTERRUPT_POLICY",
-        cmd_events_set_interrupt_policy, 4, IMMEDIATE_CONFIG_CHANGE },
+        cmd_events_set_interrupt_policy, ~0, IMMEDIATE_CONFIG_CHANGE },
     [FIRMWARE_UPDATE][GET_INFO] = { "FIRMWARE_UPDATE_GET_INFO",
         cmd_firmware_update_get_info, 0, 0 },
     [TIMESTAMP][GET] = { "TIMESTAMP_GET", cmd_timestamp_get, 0, 0 },
@@ -418,8 +1386,52 @@ static struct cxl_cmd cxl_cmd_set[256][256] = {
     [CCLS][GET_LSA] = { "CCLS_GET_LSA", cmd_ccls_get_lsa, 8, 0 },
     [CCLS][SET_LSA] = { "CCLS_SET_LSA", cmd_ccls_set_lsa,
         ~0, IMMEDIATE_CONFIG_CHANGE | IMMEDIATE_DATA_CHANGE },
+    [MEDIA_AND_POISON][GET_POISON_LIST] = { "MEDIA_AND_POISON_GET_POISON_LIST",
+        cmd_media_get_poison_list, 16, 0 },
+    [MEDIA_AND_POISON][INJECT_POISON] = { "MEDIA_AND_POISON_INJECT_POISON",
+        cmd_media_inject_poison, 8, 0 },
+    [MEDIA_AND_POISON][CLEAR_POISON] = { "MEDIA_AND_POISON_CLEAR_POISON",
+        cmd_media_clear_poison, 72, 0 },
+    [MEDIA_AND_POISON][GET_SCAN_MEDIA_CAPABILITIES] = {
+        "MEDIA_AND_POISON_GET_SCAN_MEDIA_CAPABILITIES",
+        cmd_media_get_scan_media_capabilities, 16, 0 },
+    [MEDIA_AND_POISON][SCAN_MEDIA] = { "MEDIA_AND_POISON_SCAN_MEDIA",
+        cmd_media_scan_media, 17, BACKGROUND_OPERATION },
+    [MEDIA_AND_POISON][GET_SCAN_MEDIA_RESULTS] = {
+        "MEDIA_AND_POISON_GET_SCAN_MEDIA_RESULTS",
+        cmd_media_get_scan_media_results, 0, 0 },
+    [SANITIZE][OVERWRITE] = { "SANITIZE_OVERWRITE", cmd_sanitize_overwrite, 0,
+        IMMEDIATE_DATA_CHANGE | SECURITY_STATE_CHANGE | BACKGROUND_OPERATION },
+    [SANITIZE][SECURE_ERASE] = { "SANITIZE_SECURE_ERASE",
+        cmd_sanitize_secure_erase, 0,
+        IMMEDIATE_DATA_CHANGE | SECURITY_STATE_CHANGE | BACKGROUND_OPERATION },
+    [DCD_CONFIG][GET_DC_CONFIG] = { "DCD_GET_DC_CONFIG",
+        cmd_dcd_get_dyn_cap_config, 2, 0 },
+    [DCD_CONFIG][GET_DYN_CAP_EXT_LIST] = {
+        "DCD_GET_DYNAMIC_CAPACITY_EXTENT_LIST",
+        cmd_dcd_get_dyn_cap_ext_list, 8, 0 },
+    [DCD_CONFIG][ADD_DYN_CAP_RSP] = { "DCD_ADD_DYNAMIC_CAPACITY_RESPONSE",
+        cmd_dcd_add_dyn_cap_rsp, ~0, IMMEDIATE_DATA_CHANGE },
+    [DCD_CONFIG][RELEASE_DYN_CAP] = { "DCD_RELEASE_DYNAMIC_CAPACITY",
+        cmd_dcd_release_dyn_cap, ~0, IMMEDIATE_DATA_CHANGE },
+    [MHD][GET_MHD_INFO] = { "MHD_GET_MHD_INFO", cmd_mhd_get_info, 2, 0 },
 };
 
+/*
+ * Only one background command runs at a time. While one does, commands that
+ * touch the media or its metadata would race the workers and report Busy.
+ */
+static bool cxl_mailbox_bg_conflict(CXLDeviceState *cxl_dstate, uint8_t set,
+                                    struct cxl_cmd *cxl_cmd)
+{
+    if (!cxl_dstate->bg.running) {
+        return false;
+    }
+
+    return set == MEDIA_AND_POISON || set == SANITIZE || set == CCLS ||
+           (cxl_cmd->effect & BACKGROUND_OPERATION);
+}
+
 void cxl_process_mailbox(CXLDeviceState *cxl_dstate)
 {
     uint16_t ret = CXL_MBOX_SUCCESS;
@@ -430,11 +1442,15 @@ void cxl_process_mailbox(CXLDeviceState *cxl_dstate)
 
     uint8_t set = FIELD_EX64(command_reg, CXL_DEV_MAILBOX_CMD, COMMAND_SET);
     uint8_t cmd = FIELD_EX64(command_reg, CXL_DEV_MAILBOX_CMD, COMMAND);
-    uint16_t len = FIELD_EX64(command_reg, CXL_DEV_MAILBOX_CMD, LENGTH);
+    size_t len = FIELD_EX64(command_reg, CXL_DEV_MAILBOX_CMD, LENGTH);
     cxl_cmd = &cxl_cmd_set[set][cmd];
     h = cxl_cmd->handler;
-    if (h) {
-        if (len == cxl_cmd->in || cxl_cmd->in == ~0) {
+    if (h && cxl_mailbox_bg_conflict(cxl_dstate, set, cxl_cmd)) {
+        ret = CXL_MBOX_BUSY;
+    } else if (h) {
+        if (len > cxl_dstate->payload_size) {
+            ret = CXL_MBOX_INVALID_PAYLOAD_LENGTH;
+        } else if (len == cxl_cmd->in || cxl_cmd->in == ~0) {
             cxl_cmd->payload = cxl_dstate->mbox_reg_state +
                 A_CXL_DEV_CMD_PAYLOAD;
             trace_cxl_mailbox_process(set, cmd);
@@ -451,6 +1467,14 @@ void cxl_process_mailbox(CXLDeviceState *cxl_dstate)
 
     /* Set the return code */
     status_reg = FIELD_DP64(0, CXL_DEV_MAILBOX_STS, ERRNO, ret);
+    if (ret == CXL_MBOX_BG_STARTED) {
+        uint64_t bg_status_reg;
+
+        status_reg = FIELD_DP64(status_reg, CXL_DEV_MAILBOX_STS, BG_OP, 1);
+        bg_status_reg = FIELD_DP64(0, CXL_DEV_BG_CMD_STS, OP,
+                                   (set << 8) | cmd);
+        cxl_dstate->mbox_reg_state64[R_CXL_DEV_BG_CMD_STS] = bg_status_reg;
+    }
 
     /* Set the return length */
     command_reg = FIELD_DP64(command_reg, CXL_DEV_MAILBOX_CMD, COMMAND_SET, 0);
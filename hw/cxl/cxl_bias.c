@@ -0,0 +1,93 @@
+/*
+ * QEMU CXL Type2 Bias Table Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/units.h"
+
+#include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_bias.h"
+
+/*
+ * The address comes from the guest, through the coherence and traffic
+ * paths; anything past the table is not device memory, so host bias.
+ */
+BiasState cxl_bias_table_lookup(CXLBiasTable *bt, uint64_t dpa)
+{
+    uint64_t page = dpa >> bt->page_shift;
+
+    if (page >= bt->nr_pages) {
+        return HOST_BIAS;
+    }
+
+    return test_bit(page, bt->bitmap) ? DEVICE_BIAS : HOST_BIAS;
+}
+
+bool cxl_bias_table_range_valid(CXLBiasTable *bt, uint64_t dpa, uint64_t size)
+{
+    uint64_t mask = (1ULL << bt->page_shift) - 1;
+
+    if (!size || (dpa & mask) || (size & mask))
+        return false;
+
+    return (dpa >> bt->page_shift) + (size >> bt->page_shift) <= bt->nr_pages;
+}
+
+void cxl_bias_table_set_range(CXLBiasTable *bt, uint64_t dpa, uint64_t size,
+                              BiasState state)
+{
+    uint64_t page = dpa >> bt->page_shift;
+    uint64_t nr = size >> bt->page_shift;
+
+    g_assert(cxl_bias_table_range_valid(bt, dpa, size));
+
+    if (state == DEVICE_BIAS)
+        bitmap_set(bt->bitmap, page, nr);
+    else
+        bitmap_clear(bt->bitmap, page, nr);
+
+    bt->flips++;
+}
+
+void cxl_bias_table_init(CXLBiasTable **bt, uint64_t mem_size,
+                         uint64_t granularity)
+{
+    CXLBiasTable *table;
+    uint64_t host_pages;
+
+    g_assert(is_power_of_2(granularity));
+
+    table = g_new0(CXLBiasTable, 1);
+    table->page_shift = ctz64(granularity);
+    table->nr_pages = DIV_ROUND_UP(mem_size, granularity);
+    table->bitmap = bitmap_new(table->nr_pages);
+
+    host_pages = MIN(CXL_BIAS_BOOT_HOST_SIZE >> table->page_shift,
+                     table->nr_pages);
+    bitmap_set(table->bitmap, host_pages, table->nr_pages - host_pages);
+
+    *bt = table;
+
+    CXL_DEBUG("ct2 bias table realized: 0x%lx pages of 0x%lx bytes",
+              table->nr_pages, granularity);
+}
+
+void cxl_bias_table_release(CXLBiasTable **bt)
+{
+    CXLBiasTable *table = *bt;
+
+    CXL_DEBUG("bias table flips 0x%lx", table->flips);
+
+    g_free(table->bitmap);
+    g_free(table);
+    *bt = NULL;
+
+    CXL_DEBUG("ct2 bias table released");
+}
@@ -10,8 +10,8 @@
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
 
-#include "hw/cxl/cxl_hcache.h"
 #include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_hcache.h"
 #include "hw/cxl/cxl_type1_hcoh.h"
 #include "hw/cxl/cxl_type2_hcoh.h"
 
@@ -68,6 +68,9 @@ static Cache *__host_cache_init(void)
 static void __host_cache_free(Cache *cache)
 {
     for (uint64_t set = 0; set < cache->num_sets; set++) {
+        for (uint32_t blk = 0; blk < cache->assoc; blk++) {
+            g_free(cache->sets[set].blocks[blk].data);
+        }
         g_free(cache->sets[set].blocks);
     }
 
@@ -98,6 +101,12 @@ uint8_t *host_cache_extract_block_addr(Cache *cache, uint64_t set, int32_t blk)
     return cache->sets[set].blocks[blk].data;
 }
 
+PCIDevice *host_cache_extract_block_owner(Cache *cache, uint64_t set,
+                                          int32_t blk)
+{
+    return cache->sets[set].blocks[blk].owner;
+}
+
 uint64_t host_cache_assem_haddr(Cache *cache, uint64_t set, int32_t blk)
 {
     uint64_t tag = cache->sets[set].blocks[blk].tag;
@@ -119,6 +128,12 @@ void host_cache_update_block_state(Cache *cache, uint64_t tag, uint64_t set,
     cache->sets[set].blocks[blk].state = state;
 }
 
+void host_cache_update_block_owner(Cache *cache, uint64_t set, int32_t blk,
+                                   PCIDevice *owner)
+{
+    cache->sets[set].blocks[blk].owner = owner;
+}
+
 int32_t host_cache_find_replace_block(Cache *cache, uint64_t set)
 {
     uint32_t min_idx, min_priority;
@@ -200,6 +215,32 @@ void host_cache_data_write(Cache *cache, uint64_t haddr, uint64_t set,
     __host_cache_priority_update(cache, set, blk);
 }
 
+MemTxResult host_cache_evict_block(Cache *cache, uint64_t set, int32_t blk,
+                                   MemTxAttrs attrs)
+{
+    PCIDevice *owner = cache->sets[set].blocks[blk].owner;
+
+    g_assert(owner);
+
+    /* The victim may belong to any device sharing this host bridge */
+    if (object_dynamic_cast(OBJECT(owner), TYPE_CXL_TYPE1)) {
+        return cxl_host_type1_hcoh_evict(owner, cache, set, blk, attrs);
+    }
+    return cxl_host_type2_hcoh_evict(owner, cache, set, blk, attrs);
+}
+
+void host_cache_invalidate_owner(Cache *cache, PCIDevice *owner)
+{
+    for (uint32_t set = 0; set < cache->num_sets; set++) {
+        for (uint32_t blk = 0; blk < cache->assoc; blk++) {
+            if (cache->sets[set].blocks[blk].owner == owner) {
+                cache->sets[set].blocks[blk].state = CACHE_INVALID;
+                cache->sets[set].blocks[blk].owner = NULL;
+            }
+        }
+    }
+}
+
 void cxl_host_cache_init(Cache **cache)
 {
     *cache = __host_cache_init();
@@ -213,3 +254,33 @@ void cxl_host_cache_release(Cache **cache)
 
     CXL_DEBUG("ct2 host cache released");
 }
+
+CXLHost *cxl_host_cache_attach(PCIDevice *d)
+{
+    BusState *bus = BUS(pci_device_root_bus(d));
+    CXLHost *hb;
+
+    hb = (CXLHost *)object_dynamic_cast(OBJECT(bus->parent), TYPE_PXB_CXL_HOST);
+    if (!hb) {
+        return NULL;
+    }
+
+    if (!hb->hcache_users++) {
+        qemu_spin_init(&hb->coh_lock);
+        cxl_host_cache_init(&hb->hcache);
+    }
+
+    return hb;
+}
+
+void cxl_host_cache_detach(CXLHost *hb, PCIDevice *d)
+{
+    qemu_spin_lock(&hb->coh_lock);
+    host_cache_invalidate_owner(hb->hcache, d);
+    qemu_spin_unlock(&hb->coh_lock);
+
+    if (!--hb->hcache_users) {
+        cxl_host_cache_release(&hb->hcache);
+        hb->hcache = NULL;
+    }
+}
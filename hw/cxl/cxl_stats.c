@@ -0,0 +1,158 @@
+/*
+ * QEMU CXL Coherence Statistics Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-cxl.h"
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "qemu/memalign.h"
+
+#include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_stats.h"
+
+static __thread int cxl_stats_shard = -1;
+static unsigned int cxl_stats_next_shard;
+
+static inline int __cxl_stats_shard(void)
+{
+    if (unlikely(cxl_stats_shard < 0)) {
+        cxl_stats_shard =
+            qatomic_fetch_inc(&cxl_stats_next_shard) % CXL_STATS_SHARDS;
+    }
+    return cxl_stats_shard;
+}
+
+static uint64_t __cxl_stats_get(CXLStats *stats, CXLStatCounter counter)
+{
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < CXL_STATS_SHARDS; i++) {
+        sum += stat64_get(&stats->shards[i].counters[counter]);
+    }
+    return sum;
+}
+
+static CxlCacheStats *__cxl_stats_cache(CXLStats *stats, CXLStatCounter hit,
+                                        CXLStatCounter miss,
+                                        CXLStatCounter eviction,
+                                        CXLStatCounter writeback)
+{
+    CxlCacheStats *info = g_new0(CxlCacheStats, 1);
+
+    info->hits = __cxl_stats_get(stats, hit);
+    info->misses = __cxl_stats_get(stats, miss);
+    info->evictions = __cxl_stats_get(stats, eviction);
+    info->writebacks = __cxl_stats_get(stats, writeback);
+
+    return info;
+}
+
+static CxlSnoopStats *__cxl_stats_snoop(CXLStats *stats, CXLStatCounter data,
+                                        CXLStatCounter cur, CXLStatCounter inv)
+{
+    CxlSnoopStats *info = g_new0(CxlSnoopStats, 1);
+
+    info->data = __cxl_stats_get(stats, data);
+    info->cur = __cxl_stats_get(stats, cur);
+    info->inv = __cxl_stats_get(stats, inv);
+
+    return info;
+}
+
+void cxl_stats_inc(CXLStats *stats, CXLStatCounter counter)
+{
+    stat64_add(&stats->shards[__cxl_stats_shard()].counters[counter], 1);
+}
+
+CxlStats *cxl_stats_query(CXLStats *stats)
+{
+    CxlStats *info = g_new0(CxlStats, 1);
+
+    info->host = __cxl_stats_cache(stats, CXL_STAT_HOST_HIT, CXL_STAT_HOST_MISS,
+                                   CXL_STAT_HOST_EVICTION,
+                                   CXL_STAT_HOST_WRITEBACK);
+    info->device = __cxl_stats_cache(stats, CXL_STAT_DEVICE_HIT,
+                                     CXL_STAT_DEVICE_MISS,
+                                     CXL_STAT_DEVICE_EVICTION,
+                                     CXL_STAT_DEVICE_WRITEBACK);
+    info->snoops_sent = __cxl_stats_snoop(stats, CXL_STAT_SNP_SENT_DATA,
+                                          CXL_STAT_SNP_SENT_CUR,
+                                          CXL_STAT_SNP_SENT_INV);
+    info->snoops_received = __cxl_stats_snoop(stats, CXL_STAT_SNP_RECV_DATA,
+                                              CXL_STAT_SNP_RECV_CUR,
+                                              CXL_STAT_SNP_RECV_INV);
+    info->bias_flips = __cxl_stats_get(stats, CXL_STAT_BIAS_FLIP);
+    info->back_invalidations =
+        __cxl_stats_get(stats, CXL_STAT_BACK_INVALIDATION);
+
+    return info;
+}
+
+void cxl_stats_reset(CXLStats *stats)
+{
+    int i, counter;
+
+    for (i = 0; i < CXL_STATS_SHARDS; i++) {
+        for (counter = 0; counter < CXL_STAT__MAX; counter++) {
+            stat64_init(&stats->shards[i].counters[counter], 0);
+        }
+    }
+}
+
+void cxl_stats_init(CXLStats **stats)
+{
+    *stats = qemu_memalign(__alignof__(CXLStats), sizeof(CXLStats));
+    memset(*stats, 0, sizeof(CXLStats));
+}
+
+void cxl_stats_release(CXLStats **stats)
+{
+    qemu_vfree(*stats);
+    *stats = NULL;
+}
+
+static CXLStats *cxl_stats_find(const char *path, Error **errp)
+{
+    Object *obj = object_resolve_path(path, NULL);
+
+    if (!obj) {
+        error_setg(errp, "Unable to resolve path");
+        return NULL;
+    }
+
+    if (object_dynamic_cast(obj, TYPE_CXL_TYPE1)) {
+        return CXL_TYPE1(obj)->stats;
+    }
+    if (object_dynamic_cast(obj, TYPE_CXL_TYPE2)) {
+        return CXL_TYPE2(obj)->stats;
+    }
+
+    error_setg(errp, "Path does not point to a CXL type 1 or type 2 device");
+    return NULL;
+}
+
+CxlStats *qmp_query_cxl_stats(const char *path, bool has_reset, bool reset,
+                              Error **errp)
+{
+    CXLStats *stats = cxl_stats_find(path, errp);
+    CxlStats *info;
+
+    if (!stats) {
+        return NULL;
+    }
+
+    info = cxl_stats_query(stats);
+    if (has_reset && reset) {
+        cxl_stats_reset(stats);
+    }
+
+    return info;
+}
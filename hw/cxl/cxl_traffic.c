@@ -0,0 +1,375 @@
+/*
+ * QEMU CXL Traffic Generator Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-cxl.h"
+#include "qapi/util.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+
+#include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_traffic.h"
+
+#define CXL_TRAFFIC_POLL_US (10000)
+
+static uint64_t __traffic_rand64(GRand *rng)
+{
+    return ((uint64_t)g_rand_int(rng) << 32) | g_rand_int(rng);
+}
+
+static bool __traffic_wait(CXLTrafficGen *gen, uint32_t delay_ms)
+{
+    int64_t deadline = get_clock() + (int64_t)delay_ms * SCALE_MS;
+
+    while (!qatomic_read(&gen->stop) && get_clock() < deadline) {
+        g_usleep(CXL_TRAFFIC_POLL_US);
+    }
+
+    return !qatomic_read(&gen->stop);
+}
+
+static void *__traffic_worker_main(void *opaque)
+{
+    CXLTrafficWorker *w = opaque;
+    CXLTrafficGen *gen = w->gen;
+    CXLTrafficConfig *cfg = &gen->cfg;
+    uint64_t slots = cfg->working_set / cfg->size;
+    uint64_t stride = MAX(cfg->stride / cfg->size, 1);
+    uint64_t slot = w->idx * (slots / cfg->threads);
+    int64_t interval = 0, next, now;
+    uint32_t seed[3] = { cfg->seed, cfg->seed >> 32, w->idx };
+    GRand *rng = g_rand_new_with_seed_array(seed, ARRAY_SIZE(seed));
+    uint8_t *buf = g_malloc(cfg->size);
+    MemTxResult result;
+    bool is_write;
+
+    if (cfg->rate) {
+        interval = NANOSECONDS_PER_SECOND * cfg->threads / cfg->rate;
+    }
+
+    if (!__traffic_wait(gen, cfg->delay_ms)) {
+        goto out;
+    }
+
+    CXL_DEBUG("%s worker %u starts", gen->name, w->idx);
+
+    next = get_clock();
+    while (!qatomic_read(&gen->stop)) {
+        switch (cfg->pattern) {
+        case CXL_TRAFFIC_PATTERN_SEQUENTIAL:
+            slot = (slot + 1) % slots;
+            break;
+        case CXL_TRAFFIC_PATTERN_STRIDED:
+            slot = (slot + stride) % slots;
+            break;
+        case CXL_TRAFFIC_PATTERN_RANDOM:
+        default:
+            slot = __traffic_rand64(rng) % slots;
+            break;
+        }
+
+        is_write = g_rand_int_range(rng, 0, 100) >= cfg->read_pct;
+        if (is_write) {
+            memset(buf, gen->fill, cfg->size);
+        }
+
+        result = gen->access(gen->d, cfg->base + slot * cfg->size, buf,
+                             cfg->size, is_write);
+        if (result == MEMTX_OK) {
+            stat64_add(is_write ? &w->writes : &w->reads, 1);
+            stat64_add(&w->bytes, cfg->size);
+        } else if (result == MEMTX_DECODE_ERROR) {
+            stat64_add(&w->skipped, 1);
+        } else {
+            stat64_add(&w->errors, 1);
+        }
+
+        if (interval) {
+            next += interval;
+            now = get_clock();
+            if (next > now) {
+                g_usleep((next - now) / SCALE_US);
+            } else if (now - next > NANOSECONDS_PER_SECOND) {
+                /* do not burst to catch up after a long stall */
+                next = now;
+            }
+        }
+    }
+
+out:
+    g_free(buf);
+    g_rand_free(rng);
+
+    return NULL;
+}
+
+static bool __traffic_check_config(CXLTrafficGen *gen,
+                                   const CXLTrafficConfig *cfg, Error **errp)
+{
+    if (cfg->threads < 1 || cfg->threads > CXL_TRAFFIC_MAX_THREADS) {
+        error_setg(errp, "traffic threads must be between 1 and %d",
+                   CXL_TRAFFIC_MAX_THREADS);
+        return false;
+    }
+    if (cfg->size < 1 || cfg->size > CXL_TRAFFIC_MAX_SIZE) {
+        error_setg(errp, "traffic size must be between 1 and %d bytes",
+                   (int)CXL_TRAFFIC_MAX_SIZE);
+        return false;
+    }
+    if (cfg->read_pct > 100) {
+        error_setg(errp, "traffic read percentage must not exceed 100");
+        return false;
+    }
+    if (cfg->working_set < cfg->size) {
+        error_setg(errp, "traffic working set must hold at least one access");
+        return false;
+    }
+    if (cfg->base > gen->mem_size ||
+        cfg->working_set > gen->mem_size - cfg->base) {
+        error_setg(errp, "traffic working set 0x%" PRIx64 "+0x%" PRIx64
+                   " exceeds device memory size 0x%" PRIx64, cfg->base,
+                   cfg->working_set, gen->mem_size);
+        return false;
+    }
+
+    return true;
+}
+
+bool cxl_traffic_start(CXLTrafficGen *gen, const CXLTrafficConfig *cfg,
+                       Error **errp)
+{
+    char *name;
+    uint32_t i;
+
+    if (gen->running) {
+        error_setg(errp, "%s traffic generator is already running", gen->name);
+        return false;
+    }
+    if (!__traffic_check_config(gen, cfg, errp)) {
+        return false;
+    }
+
+    g_free(gen->workers);
+
+    gen->cfg = *cfg;
+    gen->nr_workers = cfg->threads;
+    gen->workers = g_new0(CXLTrafficWorker, gen->nr_workers);
+    gen->stop = false;
+    gen->running = true;
+    gen->start_ns = get_clock();
+
+    for (i = 0; i < gen->nr_workers; i++) {
+        CXLTrafficWorker *w = &gen->workers[i];
+
+        w->gen = gen;
+        w->idx = i;
+        name = g_strdup_printf("%s-%u", gen->name, i);
+        qemu_thread_create(&w->thread, name, __traffic_worker_main, w,
+                           QEMU_THREAD_JOINABLE);
+        g_free(name);
+    }
+
+    CXL_DEBUG("%s traffic generator started with %u threads", gen->name,
+              gen->nr_workers);
+
+    return true;
+}
+
+void cxl_traffic_stop(CXLTrafficGen *gen)
+{
+    uint32_t i;
+
+    if (!gen->running) {
+        return;
+    }
+
+    qatomic_set(&gen->stop, true);
+    for (i = 0; i < gen->nr_workers; i++) {
+        qemu_thread_join(&gen->workers[i].thread);
+    }
+    gen->running = false;
+    gen->stop_ns = get_clock();
+
+    CXL_DEBUG("%s traffic generator stopped", gen->name);
+}
+
+void cxl_traffic_get_stats(CXLTrafficGen *gen, CxlTrafficStats *stats)
+{
+    uint32_t i;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->running = gen->running;
+
+    for (i = 0; i < gen->nr_workers; i++) {
+        CXLTrafficWorker *w = &gen->workers[i];
+
+        stats->reads += stat64_get(&w->reads);
+        stats->writes += stat64_get(&w->writes);
+        stats->bytes += stat64_get(&w->bytes);
+        stats->errors += stat64_get(&w->errors);
+        stats->skipped += stat64_get(&w->skipped);
+    }
+
+    if (gen->workers) {
+        stats->elapsed_ns =
+            (gen->running ? get_clock() : gen->stop_ns) - gen->start_ns;
+    }
+}
+
+bool cxl_traffic_realize(CXLTrafficGen *gens, PCIDevice *d,
+                         CXLTrafficProps *props, uint64_t mem_size,
+                         CXLTrafficAccess host, CXLTrafficAccess device,
+                         Error **errp)
+{
+    const char *type = object_get_typename(OBJECT(d));
+    CXLTrafficConfig *cfg = &props->cfg;
+    int pattern;
+
+    pattern = qapi_enum_parse(&CxlTrafficPattern_lookup, props->pattern,
+                              CXL_TRAFFIC_PATTERN_RANDOM, errp);
+    if (pattern < 0) {
+        return false;
+    }
+    cfg->pattern = pattern;
+
+    gens[CXL_TRAFFIC_SIDE_HOST] = (CXLTrafficGen) {
+        .d = d,
+        .name = g_strdup_printf("%s-host", type),
+        .access = host,
+        .mem_size = mem_size,
+        .fill = 0xFF,
+        .cfg = *cfg,
+    };
+    gens[CXL_TRAFFIC_SIDE_DEVICE] = (CXLTrafficGen) {
+        .d = d,
+        .name = g_strdup_printf("%s-device", type),
+        .access = device,
+        .mem_size = mem_size,
+        .fill = 0x5A,
+        .cfg = *cfg,
+    };
+
+    if (props->host &&
+        !cxl_traffic_start(&gens[CXL_TRAFFIC_SIDE_HOST], cfg, errp)) {
+        goto err;
+    }
+    if (props->device &&
+        !cxl_traffic_start(&gens[CXL_TRAFFIC_SIDE_DEVICE], cfg, errp)) {
+        goto err;
+    }
+
+    return true;
+
+err:
+    cxl_traffic_unrealize(gens);
+    return false;
+}
+
+void cxl_traffic_unrealize(CXLTrafficGen *gens)
+{
+    int side;
+
+    for (side = 0; side < CXL_TRAFFIC_SIDE__MAX; side++) {
+        cxl_traffic_stop(&gens[side]);
+        g_free(gens[side].workers);
+        g_free((char *)gens[side].name);
+        gens[side].workers = NULL;
+        gens[side].nr_workers = 0;
+        gens[side].name = NULL;
+    }
+}
+
+static CXLTrafficGen *cxl_traffic_find(const char *path, CxlTrafficSide side,
+                                       Error **errp)
+{
+    Object *obj = object_resolve_path(path, NULL);
+
+    if (!obj) {
+        error_setg(errp, "Unable to resolve path");
+        return NULL;
+    }
+
+    if (object_dynamic_cast(obj, TYPE_CXL_TYPE1)) {
+        return &CXL_TYPE1(obj)->traffic[side];
+    }
+    if (object_dynamic_cast(obj, TYPE_CXL_TYPE2)) {
+        return &CXL_TYPE2(obj)->traffic[side];
+    }
+
+    error_setg(errp, "Path does not point to a CXL type 1 or type 2 device");
+    return NULL;
+}
+
+void qmp_cxl_traffic_start(CxlTrafficOptions *opts, Error **errp)
+{
+    CXLTrafficGen *gen = cxl_traffic_find(opts->path, opts->side, errp);
+    CXLTrafficConfig cfg;
+
+    if (!gen) {
+        return;
+    }
+
+    cfg = gen->cfg;
+    if (opts->has_pattern) {
+        cfg.pattern = opts->pattern;
+    }
+    if (opts->has_read_percent) {
+        cfg.read_pct = opts->read_percent;
+    }
+    if (opts->has_size) {
+        cfg.size = opts->size;
+    }
+    if (opts->has_base) {
+        cfg.base = opts->base;
+    }
+    if (opts->has_working_set) {
+        cfg.working_set = opts->working_set;
+    }
+    if (opts->has_stride) {
+        cfg.stride = opts->stride;
+    }
+    if (opts->has_rate) {
+        cfg.rate = opts->rate;
+    }
+    if (opts->has_threads) {
+        cfg.threads = opts->threads;
+    }
+    if (opts->has_seed) {
+        cfg.seed = opts->seed;
+    }
+    cfg.delay_ms = opts->has_delay ? opts->delay : 0;
+
+    cxl_traffic_start(gen, &cfg, errp);
+}
+
+void qmp_cxl_traffic_stop(const char *path, CxlTrafficSide side, Error **errp)
+{
+    CXLTrafficGen *gen = cxl_traffic_find(path, side, errp);
+
+    if (gen) {
+        cxl_traffic_stop(gen);
+    }
+}
+
+CxlTrafficStats *qmp_query_cxl_traffic(const char *path, CxlTrafficSide side,
+                                       Error **errp)
+{
+    CXLTrafficGen *gen = cxl_traffic_find(path, side, errp);
+    CxlTrafficStats *stats;
+
+    if (!gen) {
+        return NULL;
+    }
+
+    stats = g_new0(CxlTrafficStats, 1);
+    cxl_traffic_get_stats(gen, stats);
+
+    return stats;
+}
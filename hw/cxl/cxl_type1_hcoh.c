@@ -8,19 +8,13 @@
  */
 
 #include "qemu/osdep.h"
+#include "qapi/error.h"
 #include "qemu/error-report.h"
 
 #include "hw/cxl/cxl.h"
 #include "hw/cxl/cxl_hcache.h"
 #include "hw/cxl/cxl_type1_hcoh.h"
 
-static Cache *hcache;
-QemuSpin ct1d_lock;
-
-static GRand *rng_opc;
-static GRand *rng_addr;
-static GRand *rng_size;
-
 static CXLCacheReq __host_hcoh_assem_request_packet(H2DReq opc, uint64_t haddr)
 {
     CXLCacheReq req = {
@@ -65,10 +59,11 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
                                       uint64_t haddr, uint64_t *data,
                                       uint32_t size, MemTxAttrs attrs)
 {
+    Cache *hcache = CXL_TYPE1(d)->hb->hcache;
     CacheState cache_cstate, cache_nstate;
     CXLCacheReq req;
     D2HRsp rsp;
-    uint64_t assem_addr, tag, set;
+    uint64_t tag, set;
     int32_t cache_blk;
     uint8_t *blk_addr;
 
@@ -78,6 +73,8 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
     cache_blk = host_cache_find_valid_block(hcache, tag, set);
 
     if (cache_blk != -1) {
+        cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_HOST_HIT);
+
         if (cmd == CACHE_READ) {
             host_cache_data_read(hcache, haddr, set, cache_blk, data, size);
         } else if (cmd == CACHE_UPDATE) {
@@ -101,38 +98,15 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
             host_cache_data_write(hcache, haddr, set, cache_blk, data, size);
         }
     } else {
+        cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_HOST_MISS);
+
         cache_blk = host_cache_find_invalid_block(hcache, set);
 
         if (cache_blk == -1) {
             cache_blk = host_cache_find_replace_block(hcache, set);
-            blk_addr = host_cache_extract_block_addr(hcache, set, cache_blk);
-            assem_addr = host_cache_assem_haddr(hcache, set, cache_blk);
-            cache_cstate =
-                host_cache_extract_block_state(hcache, set, cache_blk);
-
-            if (cache_cstate == CACHE_SHARED) {
-                req =
-                    __host_hcoh_assem_request_packet(H2DReq_SnpInv, assem_addr);
-                rsp = cxl_type1_access(d, req, blk_addr, HOST_BLKSIZE, attrs);
-                if (D2HRsp_RspError == rsp)
-                    return MEMTX_ERROR;
-
-                cache_nstate = __host_hcoh_response_check(req, rsp);
-                g_assert(cache_nstate == CACHE_EXCLUSIVE);
-                host_cache_update_block_state(hcache, tag, set, cache_blk,
-                                              cache_nstate);
-            }
-            if (MEMTX_OK != cxl_type1_write(d, assem_addr, (uint64_t *)blk_addr,
-                                            HOST_BLKSIZE, attrs))
+            if (MEMTX_OK !=
+                host_cache_evict_block(hcache, set, cache_blk, attrs))
                 return MEMTX_ERROR;
-
-            CXL_DEBUG("cache miss -> vitctim write -> as write - haddr: 0x%lx, "
-                      "data: 0x%lx",
-                      assem_addr, *(uint64_t *)blk_addr);
-            host_cache_print_data_block(hcache, set, cache_blk);
-
-            host_cache_update_block_state(hcache, tag, set, cache_blk,
-                                          CACHE_INVALID);
         }
 
         CXL_DEBUG("cache miss -> read request -> from device or as read - "
@@ -149,9 +123,11 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
         if (D2HRsp_RspError == rsp)
             return MEMTX_ERROR;
 
+        /* the whole line is filled, not just the bytes at haddr */
         if ((rsp != D2HRsp_RspIFwdM) && (rsp != D2HRsp_RspSFwdM)) {
-            if (MEMTX_OK != cxl_type1_read(d, haddr, (uint64_t *)blk_addr,
-                                           HOST_BLKSIZE, attrs))
+            if (MEMTX_OK != cxl_type1_read(d, req.Address,
+                                           (uint64_t *)blk_addr, HOST_BLKSIZE,
+                                           attrs))
                 return MEMTX_ERROR;
         }
 
@@ -162,6 +138,7 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
         cache_nstate = __host_hcoh_response_check(req, rsp);
         host_cache_update_block_state(hcache, tag, set, cache_blk,
                                       cache_nstate);
+        host_cache_update_block_owner(hcache, set, cache_blk, d);
 
         if (cmd == CACHE_READ) {
             g_assert((cache_nstate == CACHE_EXCLUSIVE) ||
@@ -176,68 +153,6 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
     return MEMTX_OK;
 }
 
-static void *__ct1d_host_main(void *opaque)
-{
-#define ACCESS_DATA_PATTERN 0xFF
-#define ACCESS_DATA_SIZE    1
-
-    PCIDevice *d = (PCIDevice *)opaque;
-    MemTxAttrs attrs = {
-        0,
-    };
-    MemTxResult result;
-    uint32_t opc, size;
-    uint64_t haddr, data;
-    static uint64_t cnt = 0;
-
-    g_usleep(CXL_BOOT_WAIT_TIME);
-
-    CXL_DEBUG("ct1d host main process starts");
-
-    while (true) {
-        g_usleep(CXL_THREAD_DELAY);
-
-        opc = g_rand_int_range(rng_opc, 0, 2);
-        haddr =
-            g_rand_int_range(rng_addr, 0x8000000, 0x10000000 - HOST_BLKSIZE) +
-            CFMWS_BASE_ADDR;
-        size = g_rand_int_range(rng_size, 0, ACCESS_DATA_SIZE) + 1;
-
-        qemu_spin_lock(&ct1d_lock);
-        CXL_THREAD("host hcache lock");
-
-        switch (opc) {
-        case 0:
-            data = 0;
-            result =
-                __host_hcoh_access(CACHE_READ, d, haddr, &data, size, attrs);
-            break;
-        case 1:
-            data = (ACCESS_DATA_PATTERN << ((size - 1) * 8));
-            result =
-                __host_hcoh_access(CACHE_UPDATE, d, haddr, &data, size, attrs);
-            break;
-        default:
-            g_assert(0);
-        }
-
-        if (result != MEMTX_OK) {
-            g_assert(0);
-        }
-        cnt++;
-        if (cnt % 0x100000 == 0)
-            error_report("%s processing cnt 0x%lx", __func__, cnt);
-
-        CXL_THREAD("host hcache unlock");
-        qemu_spin_unlock(&ct1d_lock);
-    }
-
-#undef ACCESS_DATA_PATTERN
-#undef ACCESS_DATA_SIZE
-
-    return NULL;
-}
-
 MemTxResult cxl_host_type1_hcoh_read(PCIDevice *d, uint64_t haddr,
                                      uint64_t *data, uint32_t size,
                                      MemTxAttrs attrs)
@@ -290,9 +205,85 @@ MemTxResult cxl_host_type1_hcoh_write(PCIDevice *d, uint64_t haddr,
     return __host_hcoh_access(CACHE_UPDATE, d, haddr, &data, size, attrs);
 }
 
+/* Traffic generator access, see cxl_traffic.h */
+MemTxResult cxl_host_type1_hcoh_traffic(PCIDevice *d, uint64_t daddr,
+                                        uint8_t *buf, uint32_t size,
+                                        bool is_write)
+{
+    CXLHost *hb = CXL_TYPE1(d)->hb;
+    MemTxAttrs attrs = MEMTXATTRS_UNSPECIFIED;
+    MemTxResult result = MEMTX_OK;
+    uint64_t haddr = daddr + CFMWS_BASE_ADDR;
+    uint32_t chunk;
+
+    qemu_spin_lock(&hb->coh_lock);
+    CXL_THREAD("host hcache lock");
+
+    while (size) {
+        chunk = MIN(size, HOST_BLKSIZE - (haddr & (HOST_BLKSIZE - 1)));
+
+        result = __host_hcoh_access(is_write ? CACHE_UPDATE : CACHE_READ, d,
+                                    haddr, (uint64_t *)buf, chunk, attrs);
+        if (result != MEMTX_OK)
+            break;
+
+        haddr += chunk;
+        buf += chunk;
+        size -= chunk;
+    }
+
+    CXL_THREAD("host hcache unlock");
+    qemu_spin_unlock(&hb->coh_lock);
+
+    return result;
+}
+
+MemTxResult cxl_host_type1_hcoh_evict(PCIDevice *d, Cache *hcache,
+                                      uint64_t set, int32_t blk,
+                                      MemTxAttrs attrs)
+{
+    CacheState cache_cstate, cache_nstate;
+    CXLCacheReq req;
+    D2HRsp rsp;
+    uint64_t assem_addr, tag;
+    uint8_t *blk_addr;
+
+    blk_addr = host_cache_extract_block_addr(hcache, set, blk);
+    assem_addr = host_cache_assem_haddr(hcache, set, blk);
+    tag = host_cache_extract_tag(hcache, assem_addr);
+    cache_cstate = host_cache_extract_block_state(hcache, set, blk);
+
+    if (cache_cstate == CACHE_SHARED) {
+        req = __host_hcoh_assem_request_packet(H2DReq_SnpInv, assem_addr);
+        rsp = cxl_type1_access(d, req, blk_addr, HOST_BLKSIZE, attrs);
+        if (D2HRsp_RspError == rsp)
+            return MEMTX_ERROR;
+
+        cache_nstate = __host_hcoh_response_check(req, rsp);
+        g_assert(cache_nstate == CACHE_EXCLUSIVE);
+    }
+    if (MEMTX_OK != cxl_type1_write(d, assem_addr, (uint64_t *)blk_addr,
+                                    HOST_BLKSIZE, attrs))
+        return MEMTX_ERROR;
+
+    CXL_DEBUG("cache miss -> vitctim write -> as write - haddr: 0x%lx, "
+              "data: 0x%lx",
+              assem_addr, *(uint64_t *)blk_addr);
+    host_cache_print_data_block(hcache, set, blk);
+
+    host_cache_update_block_state(hcache, tag, set, blk, CACHE_INVALID);
+    host_cache_update_block_owner(hcache, set, blk, NULL);
+
+    cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_HOST_EVICTION);
+    cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_HOST_WRITEBACK);
+
+    return MEMTX_OK;
+}
+
 H2DRsp cxl_host_type1_hcoh_response(PCIDevice *d, CXLCacheReq req, uint8_t *buf,
                                     unsigned size, MemTxAttrs attrs)
 {
+    Cache *hcache = CXL_TYPE1(d)->hb->hcache;
     CacheState cache_cstate = CACHE_INVALID;
     CacheState cache_nstate = CACHE_INVALID;
     uint64_t tag, set;
@@ -434,30 +425,29 @@ H2DRsp cxl_host_type1_hcoh_response(PCIDevice *d, CXLCacheReq req, uint8_t *buf,
     return rsp;
 }
 
-void cxl_host_type1_hcoh_init(PCIDevice *d)
+bool cxl_host_type1_hcoh_init(PCIDevice *d, Error **errp)
 {
-    QemuThread thread;
-
-    cxl_host_cache_init(&hcache);
-    // cache_lock = g_new0(GMutex, 1);
-
-    rng_opc = g_rand_new();
-    rng_addr = g_rand_new();
-    rng_size = g_rand_new();
+    CXLType1Dev *ct1d = CXL_TYPE1(d);
 
-    qemu_spin_lock(&ct1d_lock);
-
-    qemu_thread_create(&thread, "ct1d_host_main", __ct1d_host_main, d,
-                       QEMU_THREAD_DETACHED);
-
-    qemu_spin_unlock(&ct1d_lock);
+    ct1d->hb = cxl_host_cache_attach(d);
+    if (!ct1d->hb) {
+        error_setg(errp, "cxl-type1 must be attached below a CXL host bridge");
+        return false;
+    }
+    cxl_stats_init(&ct1d->stats);
 
     CXL_DEBUG("ct1 host hcoh realized");
+
+    return true;
 }
 
-void cxl_host_type1_hcoh_release(void)
+void cxl_host_type1_hcoh_release(PCIDevice *d)
 {
-    cxl_host_cache_release(&hcache);
+    CXLType1Dev *ct1d = CXL_TYPE1(d);
+
+    cxl_host_cache_detach(ct1d->hb, d);
+    ct1d->hb = NULL;
+    cxl_stats_release(&ct1d->stats);
 
     CXL_DEBUG("ct1 host hcoh released");
 }
@@ -8,20 +8,14 @@
  */
 
 #include "qemu/osdep.h"
+#include "qapi/error.h"
 #include "qemu/error-report.h"
 
 #include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_bias.h"
 #include "hw/cxl/cxl_hcache.h"
 #include "hw/cxl/cxl_type2_hcoh.h"
 
-static HostCoh *hcoh;
-static Cache *hcache;
-QemuSpin ct2d_lock;
-
-static GRand *rng_opc;
-static GRand *rng_addr;
-static GRand *rng_size;
-
 static CXLMemReq __host_hcoh_assem_request_packet(M2SReq opc, SnpType snp,
                                                   MetaValue state,
                                                   uint64_t haddr)
@@ -93,6 +87,8 @@ static MemTxResult __host_hcoh_request(MemCommand cmd, PCIDevice *d,
                                        uint64_t haddr, uint8_t *buf,
                                        MemTxAttrs attrs)
 {
+    CXLHost *hb = CXL_TYPE2(d)->hb;
+    Cache *hcache = hb->hcache;
     CXLMemReq req;
     S2MRsp rsp;
     CacheState cache_state;
@@ -131,7 +127,7 @@ static MemTxResult __host_hcoh_request(MemCommand cmd, PCIDevice *d,
         return MEMTX_ERROR;
     }
 
-    qemu_spin_lock(&ct2d_lock);
+    qemu_spin_lock(&hb->coh_lock);
     CXL_THREAD("host hcache lock");
 
     tag = host_cache_extract_tag(hcache, haddr);
@@ -144,7 +140,7 @@ static MemTxResult __host_hcoh_request(MemCommand cmd, PCIDevice *d,
     }
 
     CXL_THREAD("host hcache unlock");
-    qemu_spin_unlock(&ct2d_lock);
+    qemu_spin_unlock(&hb->coh_lock);
 
     return MEMTX_OK;
 }
@@ -153,10 +149,11 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
                                       uint64_t haddr, uint64_t *data,
                                       uint32_t size, MemTxAttrs attrs)
 {
+    Cache *hcache = CXL_TYPE2(d)->hb->hcache;
     CacheState cache_state;
     CXLMemReq req;
     S2MRsp rsp;
-    uint64_t assem_addr, tag, set;
+    uint64_t tag, set;
     int32_t cache_blk;
     uint8_t *blk_addr;
     bool bias_state;
@@ -167,10 +164,12 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
     cache_blk = host_cache_find_valid_block(hcache, tag, set);
 
     if (cache_blk != -1) {
+        cxl_stats_inc(CXL_TYPE2(d)->stats, CXL_STAT_HOST_HIT);
+
         if (cmd == CACHE_READ) {
             host_cache_data_read(hcache, haddr, set, cache_blk, data, size);
         } else if (cmd == CACHE_UPDATE) {
-            bias_state = cxl_host_type2_hcoh_bias_lookup(haddr);
+            bias_state = cxl_host_type2_hcoh_bias_lookup(d, haddr);
 
             if (DEVICE_BIAS == bias_state) {
                 cache_state =
@@ -195,45 +194,22 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
             host_cache_data_write(hcache, haddr, set, cache_blk, data, size);
         }
     } else {
+        cxl_stats_inc(CXL_TYPE2(d)->stats, CXL_STAT_HOST_MISS);
+
         cache_blk = host_cache_find_invalid_block(hcache, set);
 
         if (cache_blk == -1) {
             cache_blk = host_cache_find_replace_block(hcache, set);
-            blk_addr = host_cache_extract_block_addr(hcache, set, cache_blk);
-
-            assem_addr = host_cache_assem_haddr(hcache, set, cache_blk);
-            bias_state = cxl_host_type2_hcoh_bias_lookup(assem_addr);
-            if (HOST_BIAS == bias_state)
-                req = __host_hcoh_assem_request_packet(M2SReq_MemWr, Snp_NoOp,
-                                                       MV_Any, assem_addr);
-            else
-                req = __host_hcoh_assem_request_packet(M2SReq_MemWr, Snp_SnpInv,
-                                                       MV_Invalid, assem_addr);
-
-            CXL_HCOH_BIAS(
-                assem_addr,
-                "cache miss -> vitctim write -> haddr: 0x%lx, data: 0x%lx",
-                assem_addr, *(uint64_t *)blk_addr);
-            host_cache_print_data_block(hcache, set, cache_blk);
-
-            rsp = cxl_type2_access(d, req, blk_addr, HOST_BLKSIZE, attrs);
-            if (S2MRsp_CMP_ERROR == rsp) {
+            if (MEMTX_OK !=
+                host_cache_evict_block(hcache, set, cache_blk, attrs)) {
                 return MEMTX_ERROR;
             }
-
-            cache_state = __host_hcoh_response_check(req, rsp);
-            if (HOST_BIAS == bias_state)
-                host_cache_update_block_state(hcache, tag, set, cache_blk,
-                                              CACHE_EXCLUSIVE);
-            else
-                host_cache_update_block_state(hcache, tag, set, cache_blk,
-                                              cache_state);
         }
 
         CXL_HCOH_BIAS(haddr, "cache miss -> read request -> haddr: 0x%lx",
                       haddr);
         blk_addr = host_cache_extract_block_addr(hcache, set, cache_blk);
-        bias_state = cxl_host_type2_hcoh_bias_lookup(haddr);
+        bias_state = cxl_host_type2_hcoh_bias_lookup(d, haddr);
 
         if (HOST_BIAS == bias_state) {
             req = __host_hcoh_assem_request_packet(M2SReq_MemRd, Snp_NoOp,
@@ -262,6 +238,7 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
             cache_state = CACHE_EXCLUSIVE;
 
         host_cache_update_block_state(hcache, tag, set, cache_blk, cache_state);
+        host_cache_update_block_owner(hcache, set, cache_blk, d);
 
         if (cmd == CACHE_READ) {
             g_assert((cache_state == CACHE_EXCLUSIVE) ||
@@ -276,128 +253,61 @@ static MemTxResult __host_hcoh_access(CacheCommand cmd, PCIDevice *d,
     return MEMTX_OK;
 }
 
-static HostCoh *__host_hcoh_init(void)
+BiasState cxl_host_type2_hcoh_bias_lookup(PCIDevice *d, uint64_t haddr)
 {
-    HostCoh *coh;
-
-    coh = g_new(HostCoh, 1);
-    coh->bias_table_size = HOST_BIAS_TABLE_SIZE;
-    coh->bias_entry_size = HOST_BIAS_ENTRY_SIZE;
-    coh->bias_table = g_new0(uint32_t, coh->bias_table_size);
+    uint64_t daddr;
 
-    coh->bias_table[0] = HOST_BIAS;
-    coh->bias_table[1] = DEVICE_BIAS;
+    /* not decoded by this device, the access will fail in the device */
+    if (!cxl_type2_hpa_to_dpa(d, haddr, &daddr))
+        return HOST_BIAS;
 
-    return coh;
+    return cxl_bias_table_lookup(CXL_TYPE2(d)->bias, daddr);
 }
 
-static void __host_hcoh_free(HostCoh *coh)
-{
-    g_free(coh->bias_table);
-    g_free(coh);
-}
-
-static void *__ct2d_host_main(void *opaque)
+/*
+ * Walk [haddr, haddr + len) one cache line at a time under a single lock
+ * acquisition, so each line is looked up once and a multi-line copy pays
+ * the coherence cost per line rather than per guest access.
+ */
+static MemTxResult __host_hcoh_access_range(CacheCommand cmd, PCIDevice *d,
+                                            uint64_t haddr, uint8_t *buf,
+                                            uint64_t len, MemTxAttrs attrs)
 {
-#define ACCESS_DATA_PATTERN 0xFF
-#define ACCESS_DATA_SIZE    1
-
-    PCIDevice *d = (PCIDevice *)opaque;
-    MemTxAttrs attrs = {
-        0,
-    };
-    MemTxResult result;
-    uint32_t opc, size;
-    uint64_t haddr, data;
-    static uint64_t cnt = 0;
-
-    g_usleep(CXL_BOOT_WAIT_TIME);
-
-    CXL_DEBUG("ct2d host main process starts");
-
-    while (true) {
-        g_usleep(CXL_THREAD_DELAY);
+    CXLHost *hb = CXL_TYPE2(d)->hb;
+    MemTxResult result = MEMTX_OK;
+    uint32_t chunk;
 
-        opc = g_rand_int_range(rng_opc, 0, 2);
-        haddr = g_rand_int_range(rng_addr, HOST_BIAS_ENTRY_SIZE,
-                                 HOST_BIAS_ENTRY_SIZE * 2 - HOST_BLKSIZE) +
-                CFMWS_BASE_ADDR;
-        size = g_rand_int_range(rng_size, 0, ACCESS_DATA_SIZE) + 1;
+    qemu_spin_lock(&hb->coh_lock);
+    CXL_THREAD("host hcache lock");
 
-        qemu_spin_lock(&ct2d_lock);
-        CXL_THREAD("host hcache lock");
+    while (len) {
+        chunk = MIN(len, HOST_BLKSIZE - (haddr & (HOST_BLKSIZE - 1)));
 
-        switch (opc) {
-        case 0:
-            data = 0;
-            result =
-                __host_hcoh_access(CACHE_READ, d, haddr, &data, size, attrs);
-            break;
-        case 1:
-            data = (ACCESS_DATA_PATTERN << ((size - 1) * 8));
-            result =
-                __host_hcoh_access(CACHE_UPDATE, d, haddr, &data, size, attrs);
+        result = __host_hcoh_access(cmd, d, haddr, (uint64_t *)buf, chunk,
+                                    attrs);
+        if (result != MEMTX_OK)
             break;
-        default:
-            g_assert(0);
-        }
-
-        if (result != MEMTX_OK) {
-            g_assert(0);
-        }
-        cnt++;
-        if (cnt % 0x100000 == 0)
-            error_report("%s processing cnt 0x%lx", __func__, cnt);
 
-        CXL_THREAD("host hcache unlock");
-        qemu_spin_unlock(&ct2d_lock);
+        haddr += chunk;
+        buf += chunk;
+        len -= chunk;
     }
 
-#undef ACCESS_DATA_PATTERN
-#undef ACCESS_DATA_SIZE
-
-    return NULL;
-}
-
-BiasState cxl_host_type2_hcoh_bias_lookup(uint64_t haddr)
-{
-    uint32_t entry_idx = (haddr - CFMWS_BASE_ADDR) / hcoh->bias_entry_size;
+    CXL_THREAD("host hcache unlock");
+    qemu_spin_unlock(&hb->coh_lock);
 
-    return hcoh->bias_table[entry_idx];
+    return result;
 }
 
 MemTxResult cxl_host_type2_hcoh_read(PCIDevice *d, uint64_t haddr,
                                      uint64_t *data, uint32_t size,
                                      MemTxAttrs attrs)
 {
-    MemTxResult result = MEMTX_OK;
-    uint64_t cur_cb_addr = haddr & ~(HOST_BLKSIZE - 1);
-    uint64_t next_cb_addr = (haddr + size - 1) & ~(HOST_BLKSIZE - 1);
-
-    qemu_spin_lock(&ct2d_lock);
-    CXL_THREAD("host hcache lock");
-
-    if (cur_cb_addr != next_cb_addr) {
-        uint64_t next_data;
-        uint32_t cur_cb_size = next_cb_addr - haddr;
-
-        if (MEMTX_OK == __host_hcoh_access(CACHE_READ, d, haddr, data,
-                                           cur_cb_size, attrs)) {
-            if (MEMTX_OK == __host_hcoh_access(CACHE_READ, d, next_cb_addr,
-                                               &next_data, size - cur_cb_size,
-                                               attrs)) {
-                *data |= (next_data << (cur_cb_size * BITS_PER_BYTE));
-                goto out;
-            }
-        }
-        result = MEMTX_ERROR;
-        goto out;
-    }
-    result = __host_hcoh_access(CACHE_READ, d, haddr, data, size, attrs);
+    uint8_t buf[sizeof(uint64_t)];
+    MemTxResult result;
 
-out:
-    CXL_THREAD("host hcache unlock");
-    qemu_spin_unlock(&ct2d_lock);
+    result = __host_hcoh_access_range(CACHE_READ, d, haddr, buf, size, attrs);
+    *data = (result == MEMTX_OK) ? ldn_le_p(buf, size) : 0;
 
     return result;
 }
@@ -406,36 +316,55 @@ MemTxResult cxl_host_type2_hcoh_write(PCIDevice *d, uint64_t haddr,
                                       uint64_t data, uint32_t size,
                                       MemTxAttrs attrs)
 {
-    MemTxResult result = MEMTX_OK;
-    uint64_t cur_cb_addr = haddr & ~(HOST_BLKSIZE - 1);
-    uint64_t next_cb_addr = (haddr + size - 1) & ~(HOST_BLKSIZE - 1);
+    uint8_t buf[sizeof(uint64_t)];
 
-    qemu_spin_lock(&ct2d_lock);
-    CXL_THREAD("host hcache lock");
+    stn_le_p(buf, size, data);
 
-    if (cur_cb_addr != next_cb_addr) {
-        uint64_t next_data;
-        uint32_t cur_cb_size = next_cb_addr - haddr;
+    return __host_hcoh_access_range(CACHE_UPDATE, d, haddr, buf, size, attrs);
+}
 
-        next_data = data >> (cur_cb_size * BITS_PER_BYTE);
-        data &= (((uint64_t)1 << (cur_cb_size * BITS_PER_BYTE)) - 1);
+MemTxResult cxl_host_type2_hcoh_read_range(PCIDevice *d, uint64_t haddr,
+                                           uint8_t *buf, uint64_t len,
+                                           MemTxAttrs attrs)
+{
+    return __host_hcoh_access_range(CACHE_READ, d, haddr, buf, len, attrs);
+}
 
-        if (MEMTX_OK == __host_hcoh_access(CACHE_UPDATE, d, haddr, &data,
-                                           cur_cb_size, attrs)) {
-            if (MEMTX_OK == __host_hcoh_access(CACHE_UPDATE, d, next_cb_addr,
-                                               &next_data, size - cur_cb_size,
-                                               attrs)) {
-                goto out;
-            }
+MemTxResult cxl_host_type2_hcoh_write_range(PCIDevice *d, uint64_t haddr,
+                                            const uint8_t *buf, uint64_t len,
+                                            MemTxAttrs attrs)
+{
+    return __host_hcoh_access_range(CACHE_UPDATE, d, haddr, (uint8_t *)buf,
+                                    len, attrs);
+}
+
+/* Traffic generator access, see cxl_traffic.h */
+MemTxResult cxl_host_type2_hcoh_traffic(PCIDevice *d, uint64_t daddr,
+                                        uint8_t *buf, uint32_t size,
+                                        bool is_write)
+{
+    MemTxResult result = MEMTX_OK;
+    hwaddr haddr;
+    uint32_t chunk;
+
+    /* interleaving may split device-contiguous lines in host space */
+    while (size && result == MEMTX_OK) {
+        chunk = MIN(size, HOST_BLKSIZE - (daddr & (HOST_BLKSIZE - 1)));
+
+        if (!cxl_type2_dpa_to_hpa(d, daddr, &haddr))
+            return MEMTX_DECODE_ERROR;
+
+        if (is_write) {
+            result = cxl_host_type2_hcoh_write_range(d, haddr, buf, chunk,
+                                                     MEMTXATTRS_UNSPECIFIED);
+        } else {
+            result = cxl_host_type2_hcoh_read_range(d, haddr, buf, chunk,
+                                                    MEMTXATTRS_UNSPECIFIED);
         }
-        result = MEMTX_ERROR;
-        goto out;
+        daddr += chunk;
+        buf += chunk;
+        size -= chunk;
     }
-    result = __host_hcoh_access(CACHE_UPDATE, d, haddr, &data, size, attrs);
-
-out:
-    CXL_THREAD("host hcache unlock");
-    qemu_spin_unlock(&ct2d_lock);
 
     return result;
 }
@@ -455,8 +384,95 @@ MemTxResult cxl_host_type2_hcoh_command(PCIDevice *d, uint64_t haddr,
     return result;
 }
 
-M2SRsp_BIRsp cxl_host_type2_hcoh_response(CXLMemReq req, MemTxAttrs attrs)
+MemTxResult cxl_host_type2_hcoh_evict(PCIDevice *d, Cache *hcache,
+                                      uint64_t set, int32_t blk,
+                                      MemTxAttrs attrs)
+{
+    CXLMemReq req;
+    S2MRsp rsp;
+    uint64_t assem_addr, tag;
+    uint8_t *blk_addr;
+    bool bias_state;
+
+    blk_addr = host_cache_extract_block_addr(hcache, set, blk);
+    assem_addr = host_cache_assem_haddr(hcache, set, blk);
+    tag = host_cache_extract_tag(hcache, assem_addr);
+
+    bias_state = cxl_host_type2_hcoh_bias_lookup(d, assem_addr);
+    if (HOST_BIAS == bias_state)
+        req = __host_hcoh_assem_request_packet(M2SReq_MemWr, Snp_NoOp, MV_Any,
+                                               assem_addr);
+    else
+        req = __host_hcoh_assem_request_packet(M2SReq_MemWr, Snp_SnpInv,
+                                               MV_Invalid, assem_addr);
+
+    CXL_HCOH_BIAS(assem_addr,
+                  "cache miss -> vitctim write -> haddr: 0x%lx, data: 0x%lx",
+                  assem_addr, *(uint64_t *)blk_addr);
+    host_cache_print_data_block(hcache, set, blk);
+
+    rsp = cxl_type2_access(d, req, blk_addr, HOST_BLKSIZE, attrs);
+    if (S2MRsp_CMP_ERROR == rsp) {
+        return MEMTX_ERROR;
+    }
+    __host_hcoh_response_check(req, rsp);
+
+    host_cache_update_block_state(hcache, tag, set, blk, CACHE_INVALID);
+    host_cache_update_block_owner(hcache, set, blk, NULL);
+
+    cxl_stats_inc(CXL_TYPE2(d)->stats, CXL_STAT_HOST_EVICTION);
+    cxl_stats_inc(CXL_TYPE2(d)->stats, CXL_STAT_HOST_WRITEBACK);
+
+    return MEMTX_OK;
+}
+
+/*
+ * Drop every host cached line of d that falls in [daddr, daddr + size)
+ * before the range moves to device bias. The range is still in host bias,
+ * so dirty lines are written back and clean ones are dropped silently.
+ */
+MemTxResult cxl_host_type2_hcoh_flush_range(PCIDevice *d, uint64_t daddr,
+                                            uint64_t size, MemTxAttrs attrs)
+{
+    Cache *hcache = CXL_TYPE2(d)->hb->hcache;
+    CacheState cache_state;
+    uint64_t set, tag, haddr, line_daddr;
+    int32_t blk;
+
+    for (set = 0; set < hcache->num_sets; set++) {
+        for (blk = 0; blk < hcache->assoc; blk++) {
+            cache_state = host_cache_extract_block_state(hcache, set, blk);
+            if (cache_state == CACHE_INVALID ||
+                host_cache_extract_block_owner(hcache, set, blk) != d)
+                continue;
+
+            haddr = host_cache_assem_haddr(hcache, set, blk);
+            if (!cxl_type2_hpa_to_dpa(d, haddr, &line_daddr) ||
+                line_daddr < daddr || line_daddr >= daddr + size)
+                continue;
+
+            if (cache_state == CACHE_MODIFIED) {
+                if (MEMTX_OK !=
+                    cxl_host_type2_hcoh_evict(d, hcache, set, blk, attrs)) {
+                    return MEMTX_ERROR;
+                }
+            } else {
+                tag = host_cache_extract_tag(hcache, haddr);
+                host_cache_update_block_state(hcache, tag, set, blk,
+                                              CACHE_INVALID);
+                host_cache_update_block_owner(hcache, set, blk, NULL);
+                cxl_stats_inc(CXL_TYPE2(d)->stats, CXL_STAT_HOST_EVICTION);
+            }
+        }
+    }
+
+    return MEMTX_OK;
+}
+
+M2SRsp_BIRsp cxl_host_type2_hcoh_response(PCIDevice *d, CXLMemReq req,
+                                          MemTxAttrs attrs)
 {
+    Cache *hcache = CXL_TYPE2(d)->hb->hcache;
     uint64_t tag, set;
     uint32_t cache_blk;
     CacheState cache_state;
@@ -484,17 +500,30 @@ M2SRsp_BIRsp cxl_host_type2_hcoh_response(CXLMemReq req, MemTxAttrs attrs)
     case S2MReq_BISnpDataBlk:
         if (cache_state == CACHE_SHARED) {
             rsp = M2SRsp_BIRspS;
-        } else if (cache_state == CACHE_EXCLUSIVE ||
-                   cache_state == CACHE_MODIFIED) {
+        } else if (cache_state == CACHE_MODIFIED) {
+            if (MEMTX_OK != cxl_host_type2_hcoh_evict(d, hcache, set,
+                                                      cache_blk, attrs))
+                break;
+            rsp = M2SRsp_BIRspI;
+        } else if (cache_state == CACHE_EXCLUSIVE) {
             host_cache_update_block_state(hcache, tag, set, cache_blk,
                                           CACHE_INVALID);
+            cxl_stats_inc(CXL_TYPE2(d)->stats, CXL_STAT_HOST_EVICTION);
             rsp = M2SRsp_BIRspI;
         }
         break;
     case S2MReq_BISnpInv:
     case S2MReq_BISnpInvBlk:
-        host_cache_update_block_state(hcache, tag, set, cache_blk,
-                                      CACHE_INVALID);
+        /* dirty data must reach device memory before the line is dropped */
+        if (cache_state == CACHE_MODIFIED) {
+            if (MEMTX_OK != cxl_host_type2_hcoh_evict(d, hcache, set,
+                                                      cache_blk, attrs))
+                break;
+        } else {
+            host_cache_update_block_state(hcache, tag, set, cache_blk,
+                                          CACHE_INVALID);
+            cxl_stats_inc(CXL_TYPE2(d)->stats, CXL_STAT_HOST_EVICTION);
+        }
         rsp = M2SRsp_BIRspI;
         break;
     default:
@@ -504,31 +533,29 @@ M2SRsp_BIRsp cxl_host_type2_hcoh_response(CXLMemReq req, MemTxAttrs attrs)
     return rsp;
 }
 
-void cxl_host_type2_hcoh_init(PCIDevice *d)
+bool cxl_host_type2_hcoh_init(PCIDevice *d, Error **errp)
 {
-    QemuThread thread;
-
-    cxl_host_cache_init(&hcache);
-    hcoh = __host_hcoh_init();
+    CXLType2Dev *ct2d = CXL_TYPE2(d);
 
-    rng_opc = g_rand_new();
-    rng_addr = g_rand_new();
-    rng_size = g_rand_new();
-
-    qemu_spin_lock(&ct2d_lock);
-
-    qemu_thread_create(&thread, "ct2d_host_main", __ct2d_host_main, d,
-                       QEMU_THREAD_JOINABLE);
-
-    qemu_spin_unlock(&ct2d_lock);
+    ct2d->hb = cxl_host_cache_attach(d);
+    if (!ct2d->hb) {
+        error_setg(errp, "cxl-type2 must be attached below a CXL host bridge");
+        return false;
+    }
+    cxl_stats_init(&ct2d->stats);
 
     CXL_DEBUG("ct2 host hcoh realized");
+
+    return true;
 }
 
-void cxl_host_type2_hcoh_release(void)
+void cxl_host_type2_hcoh_release(PCIDevice *d)
 {
-    __host_hcoh_free(hcoh);
-    cxl_host_cache_release(&hcache);
+    CXLType2Dev *ct2d = CXL_TYPE2(d);
+
+    cxl_host_cache_detach(ct2d->hb, d);
+    ct2d->hb = NULL;
+    cxl_stats_release(&ct2d->stats);
 
     CXL_DEBUG("ct2 host hcoh released");
 }
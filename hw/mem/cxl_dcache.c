@@ -14,9 +14,6 @@
 #include "hw/cxl/cxl_type1_dcoh.h"
 #include "hw/cxl/cxl_type2_dcoh.h"
 
-static GRand *rng_set;
-static GRand *rng_assoc;
-
 static void __device_cache_priority_init(Cache *cache)
 {
     for (uint32_t set = 0; set < cache->num_sets; set++) {
@@ -70,6 +67,9 @@ static Cache *__device_cache_init(void)
 static void __device_cache_free(Cache *cache)
 {
     for (uint64_t set = 0; set < cache->num_sets; set++) {
+        for (uint32_t blk = 0; blk < cache->assoc; blk++) {
+            g_free(cache->sets[set].blocks[blk].data);
+        }
         g_free(cache->sets[set].blocks);
     }
 
@@ -234,8 +234,8 @@ void device_cache_data_write(Cache *cache, uint64_t daddr, uint64_t set,
 uint64_t device_cache_rand_valid_block(Cache *cache)
 {
     uint64_t valid_daddr = -1;
-    uint64_t set = g_rand_int_range(rng_set, 0, DEVICE_SET);
-    uint32_t blk = g_rand_int_range(rng_assoc, 0, DEVICE_ASSOC);
+    uint64_t set = g_rand_int_range(cache->rng, 0, DEVICE_SET);
+    uint32_t blk = g_rand_int_range(cache->rng, 0, DEVICE_ASSOC);
 
     if (cache->sets[set].blocks[blk].state != CACHE_INVALID) {
         valid_daddr = device_cache_assem_daddr(cache, set, blk);
@@ -247,15 +247,14 @@ uint64_t device_cache_rand_valid_block(Cache *cache)
 void cxl_device_cache_init(Cache **cache)
 {
     *cache = __device_cache_init();
-
-    rng_set = g_rand_new();
-    rng_assoc = g_rand_new();
+    (*cache)->rng = g_rand_new();
 
     CXL_DEBUG("ct2 device cache realized");
 }
 
 void cxl_device_cache_release(Cache **cache)
 {
+    g_rand_free((*cache)->rng);
     __device_cache_free(*cache);
 
     CXL_DEBUG("ct2 device cache released");
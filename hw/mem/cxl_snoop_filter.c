@@ -0,0 +1,167 @@
+/*
+ * QEMU CXL Device Snoop Filter Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+
+#include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_dcache.h"
+#include "hw/cxl/cxl_snoop_filter.h"
+
+static inline uint64_t __device_sf_key(uint64_t daddr)
+{
+    return (daddr >> DEVICE_BLKSIZE_BIT) + 1;
+}
+
+static inline uint64_t __device_sf_daddr(uint64_t key)
+{
+    return (key - 1) << DEVICE_BLKSIZE_BIT;
+}
+
+static inline uint32_t __device_sf_hash(SnoopFilter *sf, uint64_t key)
+{
+    return (key * 0x9e3779b97f4a7c15ULL) >> sf->hash_shift;
+}
+
+static int64_t __device_sf_find(SnoopFilter *sf, uint64_t key)
+{
+    uint32_t mask = sf->num_slots - 1;
+    uint32_t idx;
+
+    for (idx = __device_sf_hash(sf, key); sf->slots[idx];
+         idx = (idx + 1) & mask) {
+        if (sf->slots[idx] == key) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Backward-shift deletion: later entries of the probe run are moved into
+ * the hole when that does not take them before their home slot, so no
+ * tombstones are needed and lookups stay bounded by the run length.
+ */
+static void __device_sf_delete_slot(SnoopFilter *sf, uint32_t idx)
+{
+    uint32_t mask = sf->num_slots - 1;
+    uint32_t next, home;
+
+    for (next = (idx + 1) & mask; sf->slots[next]; next = (next + 1) & mask) {
+        home = __device_sf_hash(sf, sf->slots[next]);
+        if (((next - home) & mask) >= ((next - idx) & mask)) {
+            sf->slots[idx] = sf->slots[next];
+            idx = next;
+        }
+    }
+    sf->slots[idx] = 0;
+    sf->stats.occupancy--;
+}
+
+bool device_sf_lookup(SnoopFilter *sf, uint64_t daddr)
+{
+    bool hit = __device_sf_find(sf, __device_sf_key(daddr)) != -1;
+
+    sf->stats.lookups++;
+    if (hit) {
+        sf->stats.hits++;
+    }
+    return hit;
+}
+
+uint64_t device_sf_insert(SnoopFilter *sf, uint64_t daddr)
+{
+    uint64_t key = __device_sf_key(daddr);
+    uint64_t victim = DEVICE_SF_NO_VICTIM;
+    uint32_t mask = sf->num_slots - 1;
+    uint32_t idx;
+
+    if (__device_sf_find(sf, key) != -1) {
+        return victim;
+    }
+
+    if (sf->stats.occupancy == sf->capacity) {
+        while (!sf->slots[sf->hand]) {
+            sf->hand = (sf->hand + 1) & mask;
+        }
+        victim = __device_sf_daddr(sf->slots[sf->hand]);
+        __device_sf_delete_slot(sf, sf->hand);
+        sf->hand = (sf->hand + 1) & mask;
+        sf->stats.back_invalidations++;
+    }
+
+    for (idx = __device_sf_hash(sf, key); sf->slots[idx];
+         idx = (idx + 1) & mask) {
+    }
+    sf->slots[idx] = key;
+
+    sf->stats.inserts++;
+    sf->stats.occupancy++;
+    if (sf->stats.occupancy > sf->stats.peak_occupancy) {
+        sf->stats.peak_occupancy = sf->stats.occupancy;
+    }
+
+    return victim;
+}
+
+void device_sf_remove(SnoopFilter *sf, uint64_t daddr)
+{
+    int64_t idx = __device_sf_find(sf, __device_sf_key(daddr));
+
+    if (idx != -1) {
+        __device_sf_delete_slot(sf, idx);
+        sf->stats.removes++;
+    }
+}
+
+void device_sf_remove_range(SnoopFilter *sf, uint64_t daddr, uint64_t size)
+{
+    uint64_t first = __device_sf_key(daddr);
+    uint64_t last = __device_sf_key(daddr + size - 1);
+    uint32_t idx = 0;
+
+    /* a deletion may shift the next entry into idx, so recheck it */
+    while (idx < sf->num_slots) {
+        if (sf->slots[idx] >= first && sf->slots[idx] <= last) {
+            __device_sf_delete_slot(sf, idx);
+            sf->stats.removes++;
+        } else {
+            idx++;
+        }
+    }
+}
+
+void cxl_device_sf_init(SnoopFilter **sf, uint32_t capacity)
+{
+    SnoopFilter *filter;
+
+    g_assert(capacity && capacity <= DEVICE_SF_MAX_ENTRIES);
+
+    filter = g_new0(SnoopFilter, 1);
+    filter->capacity = capacity;
+    filter->num_slots = pow2ceil((uint64_t)capacity * 2);
+    filter->hash_shift = 64 - ctz64(filter->num_slots);
+    filter->slots = g_new0(uint64_t, filter->num_slots);
+
+    *sf = filter;
+
+    CXL_DEBUG("ct2 device snoop filter realized");
+}
+
+void cxl_device_sf_release(SnoopFilter **sf)
+{
+    SnoopFilter *filter = *sf;
+
+    g_free(filter->slots);
+    g_free(filter);
+    *sf = NULL;
+
+    CXL_DEBUG("ct2 device snoop filter released");
+}
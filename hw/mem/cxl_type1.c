@@ -22,7 +22,6 @@
 #include "sysemu/numa.h"
 
 #include "trace.h"
-#define DWORD_BYTE 4
 
 /* Default CDAT entries for a memory region */
 enum {
@@ -198,44 +197,8 @@ static void ct1_free_cdat_table(CDATSubHeader **cdat_table, int num, void *priv)
 
 static bool cxl_doe_cdat_rsp(DOECap *doe_cap)
 {
-    CDATObject *cdat = &CXL_TYPE1(doe_cap->pdev)->cxl_cstate.cdat;
-    uint16_t ent;
-    void *base;
-    uint32_t len;
-    CDATReq *req = pcie_doe_get_write_mbox_ptr(doe_cap);
-    CDATRsp rsp;
-
-    assert(cdat->entry_len);
-
-    /* Discard if request length mismatched */
-    if (pcie_doe_get_obj_len(req) < DIV_ROUND_UP(sizeof(CDATReq), DWORD_BYTE)) {
-        return false;
-    }
-
-    ent = req->entry_handle;
-    base = cdat->entry[ent].base;
-    len = cdat->entry[ent].length;
-
-    rsp = (CDATRsp) {
-        .header = {
-            .vendor_id = CXL_VENDOR_ID,
-            .data_obj_type = CXL_DOE_TABLE_ACCESS,
-            .reserved = 0x0,
-            .length = DIV_ROUND_UP((sizeof(rsp) + len), DWORD_BYTE),
-        },
-        .rsp_code = CXL_DOE_TAB_RSP,
-        .table_type = CXL_DOE_TAB_TYPE_CDAT,
-        .entry_handle = (ent < cdat->entry_len - 1) ?
-                        ent + 1 : CXL_DOE_TAB_ENT_MAX,
-    };
-
-    memcpy(doe_cap->read_mbox, &rsp, sizeof(rsp));
-    memcpy(doe_cap->read_mbox + DIV_ROUND_UP(sizeof(rsp), DWORD_BYTE), base,
-           len);
-
-    doe_cap->read_mbox_len += rsp.header.length;
-
-    return true;
+    return cxl_doe_cdat_read_entry(doe_cap,
+                                   &CXL_TYPE1(doe_cap->pdev)->cxl_cstate);
 }
 
 static uint32_t ct1d_config_read(PCIDevice *pci_dev, uint32_t addr, int size)
@@ -473,9 +436,8 @@ static bool cxl_setup_memory(CXLType1Dev *ct1d, Error **errp)
     address_space_init(&ct1d->hostmem_as, mr, name);
     g_free(name);
 
-    // pmem_size was originally creaed for PMEM. We will be using it for
-    // volatile memory instead.
-    ct1d->cxl_dstate.pmem_size = ct1d->hostmem->size;
+    ct1d->cxl_dstate.vmem_size = ct1d->hostmem->size;
+    ct1d->cxl_dstate.mem_size = ct1d->hostmem->size;
 
     // TODO: Remove this
     // LSA is only necessary for PMEM therefore this should be optional
@@ -555,22 +517,38 @@ static void ct1_realize(PCIDevice *pci_dev, Error **errp)
     cxl_doe_cdat_init(cxl_cstate, errp);
 
     /* Device COH/Cache Initailization */
-    cxl_host_type1_hcoh_init(pci_dev);
+    if (!cxl_host_type1_hcoh_init(pci_dev, errp)) {
+        goto err_release_cdat;
+    }
     cxl_device_type1_dcoh_init(pci_dev);
 
     pcie_cap_deverr_init(pci_dev);
     /* Leave a bit of room for expansion */
     rc = pcie_aer_init(pci_dev, PCI_ERR_VER, 0x200, PCI_ERR_SIZEOF, NULL);
     if (rc) {
-        goto err_release_cdat;
+        goto err_release_coh;
+    }
+
+    /* Traffic Generators */
+    if (!cxl_traffic_realize(ct1d->traffic, pci_dev, &ct1d->traffic_props,
+                             ct1d->hostmem->size,
+                             cxl_host_type1_hcoh_traffic,
+                             cxl_device_type1_dcoh_traffic, errp)) {
+        goto err_aer_exit;
     }
 
     return;
 
+err_aer_exit:
+    pcie_aer_exit(pci_dev);
+err_release_coh:
+    cxl_host_type1_hcoh_release(pci_dev);
+    cxl_device_type1_dcoh_release(pci_dev);
 err_release_cdat:
     cxl_doe_cdat_release(cxl_cstate);
     g_free(regs->special_ops);
 err_address_space_free:
+    cxl_device_register_block_release(&ct1d->cxl_dstate);
     address_space_destroy(&ct1d->hostmem_as);
     return;
 }
@@ -581,13 +559,17 @@ static void ct1_exit(PCIDevice *pci_dev)
     CXLComponentState *cxl_cstate = &ct1d->cxl_cstate;
     ComponentRegisters *regs = &cxl_cstate->crb;
 
+    cxl_traffic_unrealize(ct1d->traffic);
+
     pcie_aer_exit(pci_dev);
+    pcie_doe_fini(&ct1d->doe_cdat);
     cxl_doe_cdat_release(cxl_cstate);
 
     /* Device COH/Cache Release */
-    cxl_host_type1_hcoh_release();
-    cxl_device_type1_dcoh_release();
+    cxl_host_type1_hcoh_release(pci_dev);
+    cxl_device_type1_dcoh_release(pci_dev);
 
+    cxl_device_register_block_release(&ct1d->cxl_dstate);
     g_free(regs->special_ops);
     address_space_destroy(&ct1d->hostmem_as);
 }
@@ -712,8 +694,8 @@ D2HRsp cxl_type1_access(PCIDevice *d, CXLCacheReq req, uint8_t *buf,
     //				__func__, req.MemOpcode, (uint64_t)req.Address, dpa_offset, size,
     //data);
 
-    return cxl_device_type1_dcoh_access(&ct1d->hostmem_as, dpa_offset, req, buf,
-                                        size, attrs);
+    return cxl_device_type1_dcoh_access(d, dpa_offset, req, buf, size,
+                                        attrs);
 }
 
 H2DRsp cxl_type1_response(PCIDevice *d, CXLCacheReq req, uint8_t *buf,
@@ -739,6 +721,7 @@ static Property ct1_props[] = {
                      HostMemoryBackend *),
     DEFINE_PROP_UINT64("sn", CXLType1Dev, sn, UI64_NULL),
     DEFINE_PROP_STRING("cdat", CXLType1Dev, cxl_cstate.cdat.filename),
+    DEFINE_CXL_TRAFFIC_PROPERTIES(CXLType1Dev, traffic_props),
     DEFINE_PROP_END_OF_LIST(),
 };
 
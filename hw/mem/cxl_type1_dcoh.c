@@ -15,13 +15,6 @@
 #include "hw/cxl/cxl_dcache.h"
 #include "hw/cxl/cxl_type1_dcoh.h"
 
-static Cache *dcache;
-extern QemuSpin ct1d_lock;
-
-static GRand *rng_opc;
-static GRand *rng_addr;
-static GRand *rng_size;
-
 static CXLCacheReq __device_dcoh_assem_request_packet(D2HReq opc,
                                                       uint64_t daddr)
 {
@@ -76,6 +69,7 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
                                         uint64_t daddr, uint64_t *data,
                                         uint32_t size, MemTxAttrs attrs)
 {
+    Cache *dcache = CXL_TYPE1(d)->dcache;
     CacheState cache_cstate, cache_nstate;
     CXLCacheReq req;
     D2HReq opc;
@@ -90,6 +84,8 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
     cache_blk = device_cache_find_valid_block(dcache, tag, set);
 
     if (cache_blk != -1) {
+        cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_DEVICE_HIT);
+
         if (cmd == CACHE_READ) {
             device_cache_data_read(dcache, daddr, set, cache_blk, data, size);
         } else if (cmd == CACHE_UPDATE) {
@@ -113,6 +109,8 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
             device_cache_data_write(dcache, daddr, set, cache_blk, data, size);
         }
     } else {
+        cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_DEVICE_MISS);
+
         cache_blk = device_cache_find_invalid_block(dcache, set);
 
         if (cache_blk == -1) {
@@ -145,6 +143,10 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
 
             device_cache_update_block_state(dcache, tag, set, cache_blk,
                                             cache_nstate);
+
+            cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_DEVICE_EVICTION);
+            if (opc != D2HReq_CleanEvictNoData)
+                cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_DEVICE_WRITEBACK);
         }
 
         CXL_DEBUG("cache miss -> read request -> host read - daddr: 0x%lx",
@@ -198,82 +200,62 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
     return MEMTX_OK;
 }
 
-static void *__ct1d_device_main(void *opaque)
+/* Traffic generator access, see cxl_traffic.h */
+MemTxResult cxl_device_type1_dcoh_traffic(PCIDevice *d, uint64_t daddr,
+                                          uint8_t *buf, uint32_t size,
+                                          bool is_write)
 {
-#define ACCESS_DATA_PATTERN 0x5A
-#define ACCESS_DATA_SIZE    1
-
-    PCIDevice *d = (PCIDevice *)opaque;
-    CXLType1Dev *ct1d = CXL_TYPE1(d);
-    MemoryRegion *mr = host_memory_backend_get_memory(ct1d->hostmem);
-    if (!mr) {
-        g_assert(0);
-    }
-
-    MemTxAttrs attrs = {
-        0,
-    };
-    MemTxResult result;
-    uint32_t opc, size;
-    uint64_t daddr, data;
-    static uint64_t cnt;
-
-    g_usleep(CXL_BOOT_WAIT_TIME);
-
-    CXL_DEBUG("ct1d device main process starts");
-
-    while (true) {
-        g_usleep(CXL_THREAD_DELAY);
+    CXLHost *hb = CXL_TYPE1(d)->hb;
+    MemTxAttrs attrs = MEMTXATTRS_UNSPECIFIED;
+    MemTxResult result = MEMTX_OK;
+    uint32_t chunk;
 
-        opc = g_rand_int_range(rng_opc, 0, 2);
-        daddr = g_rand_int_range(rng_addr, 0x8000000,
-                                 int128_get64(mr->size) - DEVICE_BLKSIZE);
-        size = g_rand_int_range(rng_size, 0, ACCESS_DATA_SIZE) + 1;
+    qemu_spin_lock(&hb->coh_lock);
+    CXL_THREAD("device dcache lock");
 
-        qemu_spin_lock(&ct1d_lock);
-        CXL_THREAD("device dcache lock");
+    while (size) {
+        chunk = MIN(size, DEVICE_BLKSIZE - (daddr & (DEVICE_BLKSIZE - 1)));
 
-        switch (opc) {
-        case 0:
-            data = 0;
-            result =
-                __device_dcoh_access(CACHE_READ, d, daddr, &data, size, attrs);
+        result = __device_dcoh_access(is_write ? CACHE_UPDATE : CACHE_READ, d,
+                                      daddr, (uint64_t *)buf, chunk, attrs);
+        if (result != MEMTX_OK)
             break;
-        case 1:
-            data = (ACCESS_DATA_PATTERN << ((size - 1) * 8));
-            result = __device_dcoh_access(CACHE_UPDATE, d, daddr, &data, size,
-                                          attrs);
-            break;
-        default:
-            g_assert(0);
-        }
 
-        if (result != MEMTX_OK) {
-            g_assert(0);
-        }
-        cnt++;
-        if (cnt % 0x100000 == 0)
-            error_report("%s processing cnt 0x%lx", __func__, cnt);
-
-        CXL_THREAD("device dcache unlock");
-        qemu_spin_unlock(&ct1d_lock);
+        daddr += chunk;
+        buf += chunk;
+        size -= chunk;
     }
 
-#undef ACCESS_DATA_PATTERN
-#undef ACCESS_DATA_SIZE
+    CXL_THREAD("device dcache unlock");
+    qemu_spin_unlock(&hb->coh_lock);
 
-    return NULL;
+    return result;
 }
 
-D2HRsp cxl_device_type1_dcoh_access(AddressSpace *as, uint64_t daddr,
+D2HRsp cxl_device_type1_dcoh_access(PCIDevice *d, uint64_t daddr,
                                     CXLCacheReq req, uint8_t *buf,
                                     uint32_t size, MemTxAttrs attrs)
 {
+    Cache *dcache = CXL_TYPE1(d)->dcache;
     CacheState cache_state = CACHE_INVALID;
     D2HRsp rsp;
     uint64_t tag, set;
     int32_t cache_blk;
 
+    switch (req.CacheOpcode) {
+    case H2DReq_SnpData:
+        cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_SNP_RECV_DATA);
+        break;
+    case H2DReq_SnpInv:
+        cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_SNP_RECV_INV);
+        break;
+    case H2DReq_SnpCur:
+        cxl_stats_inc(CXL_TYPE1(d)->stats, CXL_STAT_SNP_RECV_CUR);
+        break;
+    default:
+        break;
+    }
+
     tag = device_cache_extract_tag(dcache, daddr);
     set = device_cache_extract_set(dcache, daddr);
 
@@ -316,27 +298,19 @@ D2HRsp cxl_device_type1_dcoh_access(AddressSpace *as, uint64_t daddr,
 
 void cxl_device_type1_dcoh_init(PCIDevice *d)
 {
-    QemuThread thread;
-
-    cxl_device_cache_init(&dcache);
-
-    rng_opc = g_rand_new();
-    rng_addr = g_rand_new();
-    rng_size = g_rand_new();
-
-    qemu_spin_lock(&ct1d_lock);
-
-    qemu_thread_create(&thread, "ct1d_device_main", __ct1d_device_main, d,
-                       QEMU_THREAD_DETACHED);
+    CXLType1Dev *ct1d = CXL_TYPE1(d);
 
-    qemu_spin_unlock(&ct1d_lock);
+    cxl_device_cache_init(&ct1d->dcache);
 
     CXL_DEBUG("ct1 device dcoh realized");
 }
 
-void cxl_device_type1_dcoh_release(void)
+void cxl_device_type1_dcoh_release(PCIDevice *d)
 {
-    cxl_device_cache_release(&dcache);
+    CXLType1Dev *ct1d = CXL_TYPE1(d);
+
+    cxl_device_cache_release(&ct1d->dcache);
+    ct1d->dcache = NULL;
 
     CXL_DEBUG("ct1 device dcoh released");
 }
@@ -8,6 +8,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-cxl.h"
+#include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
@@ -17,6 +18,9 @@
 #include "qemu/units.h"
 
 #include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_bias.h"
+#include "hw/cxl/cxl_host.h"
+#include "hw/cxl/cxl_snoop_filter.h"
 #include "hw/cxl/cxl_type2_dcoh.h"
 #include "hw/cxl/cxl_type2_hcoh.h"
 #include "hw/mem/memory-device.h"
@@ -28,7 +32,6 @@
 #include "sysemu/numa.h"
 #include "trace.h"
 
-#define DWORD_BYTE 4
 
 /* Default CDAT entries for a memory region */
 enum {
@@ -204,44 +207,8 @@ static void ct2_free_cdat_table(CDATSubHeader **cdat_table, int num, void *priv)
 
 static bool cxl_doe_cdat_rsp(DOECap *doe_cap)
 {
-    CDATObject *cdat = &CXL_TYPE2(doe_cap->pdev)->cxl_cstate.cdat;
-    uint16_t ent;
-    void *base;
-    uint32_t len;
-    CDATReq *req = pcie_doe_get_write_mbox_ptr(doe_cap);
-    CDATRsp rsp;
-
-    assert(cdat->entry_len);
-
-    /* Discard if request length mismatched */
-    if (pcie_doe_get_obj_len(req) < DIV_ROUND_UP(sizeof(CDATReq), DWORD_BYTE)) {
-        return false;
-    }
-
-    ent = req->entry_handle;
-    base = cdat->entry[ent].base;
-    len = cdat->entry[ent].length;
-
-    rsp = (CDATRsp) {
-        .header = {
-            .vendor_id = CXL_VENDOR_ID,
-            .data_obj_type = CXL_DOE_TABLE_ACCESS,
-            .reserved = 0x0,
-            .length = DIV_ROUND_UP((sizeof(rsp) + len), DWORD_BYTE),
-        },
-        .rsp_code = CXL_DOE_TAB_RSP,
-        .table_type = CXL_DOE_TAB_TYPE_CDAT,
-        .entry_handle = (ent < cdat->entry_len - 1) ?
-                        ent + 1 : CXL_DOE_TAB_ENT_MAX,
-    };
-
-    memcpy(doe_cap->read_mbox, &rsp, sizeof(rsp));
-    memcpy(doe_cap->read_mbox + DIV_ROUND_UP(sizeof(rsp), DWORD_BYTE), base,
-           len);
-
-    doe_cap->read_mbox_len += rsp.header.length;
-
-    return true;
+    return cxl_doe_cdat_read_entry(doe_cap,
+                                   &CXL_TYPE2(doe_cap->pdev)->cxl_cstate);
 }
 
 static uint32_t ct2d_config_read(PCIDevice *pci_dev, uint32_t addr, int size)
@@ -337,6 +304,7 @@ static void hdm_decoder_commit(CXLType2Dev *ct2d, int which)
     ARRAY_FIELD_DP32(cache_mem, CXL_HDM_DECODER0_CTRL, ERR, 0);
 
     ARRAY_FIELD_DP32(cache_mem, CXL_HDM_DECODER0_CTRL, COMMITTED, 1);
+    cxl_type2_hdm_position_update(PCI_DEVICE(ct2d));
 
     trace_cxl_type2_debug_message("HDM Decoder Commit");
 }
@@ -449,6 +417,124 @@ static void ct2d_reg_write(void *opaque, hwaddr offset, uint64_t value,
     }
 }
 
+static void ct2d_bias_flip(CXLType2Dev *ct2d)
+{
+    PCIDevice *d = PCI_DEVICE(ct2d);
+    uint8_t *reg_state = ct2d->bias_reg_state;
+    uint64_t base = ldq_le_p(reg_state + A_CXL_BIAS_RANGE_BASE);
+    uint64_t size = ldq_le_p(reg_state + A_CXL_BIAS_RANGE_SIZE);
+    uint32_t ctrl = ldl_le_p(reg_state + A_CXL_BIAS_CTRL);
+    uint32_t sts = 0;
+    MemTxResult result = MEMTX_ERROR;
+    BiasState target;
+
+    target = FIELD_EX32(ctrl, CXL_BIAS_CTRL, TARGET) ? DEVICE_BIAS : HOST_BIAS;
+
+    if (cxl_bias_table_range_valid(ct2d->bias, base, size)) {
+        qemu_spin_lock(&ct2d->hb->coh_lock);
+
+        /* the side losing ownership flushes before the table changes */
+        if (target == DEVICE_BIAS) {
+            result = cxl_host_type2_hcoh_flush_range(d, base, size,
+                                                     MEMTXATTRS_UNSPECIFIED);
+        } else {
+            result = cxl_device_type2_dcoh_flush_range(d, base, size,
+                                                       MEMTXATTRS_UNSPECIFIED);
+        }
+        if (result == MEMTX_OK) {
+            cxl_bias_table_set_range(ct2d->bias, base, size, target);
+            cxl_stats_inc(ct2d->stats, CXL_STAT_BIAS_FLIP);
+        }
+
+        qemu_spin_unlock(&ct2d->hb->coh_lock);
+    }
+
+    trace_cxl_type2_bias_flip(base, size, target, result);
+
+    sts = FIELD_DP32(sts, CXL_BIAS_STS, DONE, 1);
+    sts = FIELD_DP32(sts, CXL_BIAS_STS, ERR, result != MEMTX_OK);
+    ctrl = FIELD_DP32(ctrl, CXL_BIAS_CTRL, FLIP, 0);
+    stl_le_p(reg_state + A_CXL_BIAS_STS, sts);
+    stl_le_p(reg_state + A_CXL_BIAS_CTRL, ctrl);
+}
+
+static uint64_t ct2d_bias_reg_read(void *opaque, hwaddr offset, unsigned size)
+{
+    CXLType2Dev *ct2d = opaque;
+
+    return ldn_le_p(ct2d->bias_reg_state + offset, size);
+}
+
+static void ct2d_bias_reg_write(void *opaque, hwaddr offset, uint64_t value,
+                                unsigned size)
+{
+    CXLType2Dev *ct2d = opaque;
+
+    switch (offset) {
+    case A_CXL_BIAS_RANGE_BASE ... A_CXL_BIAS_CTRL - 1:
+        stn_le_p(ct2d->bias_reg_state + offset, size, value);
+        break;
+    case A_CXL_BIAS_CTRL:
+        stl_le_p(ct2d->bias_reg_state + offset, value);
+        if (FIELD_EX32(value, CXL_BIAS_CTRL, FLIP)) {
+            ct2d_bias_flip(ct2d);
+        }
+        break;
+    default:
+        /* CAP and STS are read only */
+        break;
+    }
+}
+
+static const MemoryRegionOps ct2d_bias_ops = {
+    .read = ct2d_bias_reg_read,
+    .write = ct2d_bias_reg_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 8,
+        .unaligned = false,
+    },
+    .impl = {
+        .min_access_size = 4,
+        .max_access_size = 8,
+    },
+};
+
+static bool cxl_setup_bias(CXLType2Dev *ct2d, Error **errp)
+{
+    uint8_t *reg_state = ct2d->bias_reg_state;
+    uint64_t cap = 0;
+
+    /* The bias registers sit above a mailbox with the default payload */
+    QEMU_BUILD_BUG_ON(CXL_BIAS_CONTROL_REGISTERS_OFFSET <
+                      CXL_MMIO_SIZE(CXL_MAILBOX_DEFAULT_PAYLOAD_SIZE));
+
+    if (!is_power_of_2(ct2d->bias_granularity) ||
+        ct2d->bias_granularity < CXL_BIAS_MIN_GRANULARITY ||
+        ct2d->bias_granularity > CXL_BIAS_MAX_GRANULARITY) {
+        error_setg(errp, "bias-granularity must be a power of 2 between "
+                   "4 KiB and 2 MiB");
+        return false;
+    }
+
+    cxl_bias_table_init(&ct2d->bias, ct2d->hostmem->size,
+                        ct2d->bias_granularity);
+
+    cap = FIELD_DP64(cap, CXL_BIAS_CAP, PAGE_SHIFT, ct2d->bias->page_shift);
+    cap = FIELD_DP64(cap, CXL_BIAS_CAP, NUM_PAGES, ct2d->bias->nr_pages);
+    stq_le_p(reg_state + A_CXL_BIAS_CAP, cap);
+
+    memory_region_init_io(&ct2d->bias_registers, OBJECT(ct2d), &ct2d_bias_ops,
+                          ct2d, "bias-control",
+                          CXL_BIAS_CONTROL_REGISTERS_LENGTH);
+    memory_region_add_subregion(&ct2d->cxl_dstate.device_registers,
+                                CXL_BIAS_CONTROL_REGISTERS_OFFSET,
+                                &ct2d->bias_registers);
+
+    return true;
+}
+
 static bool cxl_setup_memory(CXLType2Dev *ct2d, Error **errp)
 {
     DeviceState *ds = DEVICE(ct2d);
@@ -479,9 +565,8 @@ static bool cxl_setup_memory(CXLType2Dev *ct2d, Error **errp)
     address_space_init(&ct2d->hostmem_as, mr, name);
     g_free(name);
 
-    // pmem_size was originally creaed for PMEM. We will be using it for
-    // volatile memory instead.
-    ct2d->cxl_dstate.pmem_size = ct2d->hostmem->size;
+    ct2d->cxl_dstate.vmem_size = ct2d->hostmem->size;
+    ct2d->cxl_dstate.mem_size = ct2d->hostmem->size;
 
     // TODO: Remove this
     // LSA is only necessary for PMEM therefore this should be optional
@@ -510,6 +595,16 @@ static void ct2_realize(PCIDevice *pci_dev, Error **errp)
 
     QTAILQ_INIT(&ct2d->error_list);
 
+    if (!ct2d->sf_entries) {
+        error_setg(errp, "sf-entries property must be greater than 0");
+        return;
+    }
+    if (ct2d->sf_entries > DEVICE_SF_MAX_ENTRIES) {
+        error_setg(errp, "sf-entries property must be at most %u",
+                   DEVICE_SF_MAX_ENTRIES);
+        return;
+    }
+
     if (!cxl_setup_memory(ct2d, errp)) {
         return;
     }
@@ -538,6 +633,9 @@ static void ct2_realize(PCIDevice *pci_dev, Error **errp)
         PCI_BASE_ADDRESS_SPACE_MEMORY | PCI_BASE_ADDRESS_MEM_TYPE_64, mr);
 
     cxl_device_register_block_init(OBJECT(pci_dev), &ct2d->cxl_dstate);
+    if (!cxl_setup_bias(ct2d, errp)) {
+        goto err_free_special_ops;
+    }
     pci_register_bar(pci_dev, CXL_DEVICE_REG_BAR_IDX,
                      PCI_BASE_ADDRESS_SPACE_MEMORY |
                          PCI_BASE_ADDRESS_MEM_TYPE_64,
@@ -546,7 +644,7 @@ static void ct2_realize(PCIDevice *pci_dev, Error **errp)
     /* MSI(-X) Initailization */
     rc = msix_init_exclusive_bar(pci_dev, msix_num, 4, NULL);
     if (rc) {
-        goto err_address_space_free;
+        goto err_release_bias;
     }
     for (i = 0; i < msix_num; i++) {
         msix_vector_use(pci_dev, i);
@@ -561,22 +659,40 @@ static void ct2_realize(PCIDevice *pci_dev, Error **errp)
     cxl_doe_cdat_init(cxl_cstate, errp);
 
     /* Device COH/Cache Initailization */
-    cxl_host_type2_hcoh_init(pci_dev);
+    if (!cxl_host_type2_hcoh_init(pci_dev, errp)) {
+        goto err_release_cdat;
+    }
     cxl_device_type2_dcoh_init(pci_dev);
 
     pcie_cap_deverr_init(pci_dev);
     /* Leave a bit of room for expansion */
     rc = pcie_aer_init(pci_dev, PCI_ERR_VER, 0x200, PCI_ERR_SIZEOF, NULL);
     if (rc) {
-        goto err_release_cdat;
+        goto err_release_coh;
+    }
+
+    /* Traffic Generators */
+    if (!cxl_traffic_realize(ct2d->traffic, pci_dev, &ct2d->traffic_props,
+                             ct2d->hostmem->size,
+                             cxl_host_type2_hcoh_traffic,
+                             cxl_device_type2_dcoh_traffic, errp)) {
+        goto err_aer_exit;
     }
 
     return;
 
+err_aer_exit:
+    pcie_aer_exit(pci_dev);
+err_release_coh:
+    cxl_host_type2_hcoh_release(pci_dev);
+    cxl_device_type2_dcoh_release(pci_dev);
 err_release_cdat:
     cxl_doe_cdat_release(cxl_cstate);
+err_release_bias:
+    cxl_bias_table_release(&ct2d->bias);
+err_free_special_ops:
+    cxl_device_register_block_release(&ct2d->cxl_dstate);
     g_free(regs->special_ops);
-err_address_space_free:
     address_space_destroy(&ct2d->hostmem_as);
     return;
 }
@@ -586,34 +702,45 @@ static void ct2_exit(PCIDevice *pci_dev)
     CXLType2Dev *ct2d = CXL_TYPE2(pci_dev);
     CXLComponentState *cxl_cstate = &ct2d->cxl_cstate;
     ComponentRegisters *regs = &cxl_cstate->crb;
+    SnoopFilter *sf;
+
+    cxl_traffic_unrealize(ct2d->traffic);
 
     pcie_aer_exit(pci_dev);
+    pcie_doe_fini(&ct2d->doe_cdat);
     cxl_doe_cdat_release(cxl_cstate);
 
     /* Device COH/Cache Release */
-    cxl_host_type2_hcoh_release();
-    cxl_device_type2_dcoh_release();
-
+    cxl_host_type2_hcoh_release(pci_dev);
+    sf = ct2d->dcoh->sf;
+    trace_cxl_type2_sf_stats(pci_dev->name, sf->stats.lookups, sf->stats.hits,
+                             sf->stats.inserts, sf->stats.removes,
+                             sf->stats.back_invalidations,
+                             sf->stats.peak_occupancy, sf->capacity);
+    cxl_device_type2_dcoh_release(pci_dev);
+    cxl_bias_table_release(&ct2d->bias);
+
+    cxl_device_register_block_release(&ct2d->cxl_dstate);
     g_free(regs->special_ops);
     address_space_destroy(&ct2d->hostmem_as);
 }
 
-/* TODO: Support multiple HDM decoders and DPA skip */
-static bool cxl_type2_dpa(CXLType2Dev *ct2d, hwaddr host_addr, uint64_t *dpa)
+bool cxl_type2_hpa_to_dpa(PCIDevice *d, hwaddr hpa, uint64_t *dpa)
 {
+    CXLType2Dev *ct2d = CXL_TYPE2(d);
     uint32_t *cache_mem = ct2d->cxl_cstate.crb.cache_mem_registers;
-    uint64_t decoder_base, decoder_size, hpa_offset;
+    uint64_t decoder_base, decoder_size, hpa_offset, gran;
     uint32_t hdm0_ctrl;
-    int ig, iw;
+    int ways;
 
     decoder_base = (((uint64_t)cache_mem[R_CXL_HDM_DECODER0_BASE_HI] << 32) |
                     cache_mem[R_CXL_HDM_DECODER0_BASE_LO]);
-    if ((uint64_t)host_addr < decoder_base) {
-        trace_cxl_type2_decoder_base_error(host_addr, decoder_base);
+    if ((uint64_t)hpa < decoder_base) {
+        trace_cxl_type2_decoder_base_error(hpa, decoder_base);
         return false;
     }
 
-    hpa_offset = (uint64_t)host_addr - decoder_base;
+    hpa_offset = (uint64_t)hpa - decoder_base;
 
     decoder_size = ((uint64_t)cache_mem[R_CXL_HDM_DECODER0_SIZE_HI] << 32) |
                    cache_mem[R_CXL_HDM_DECODER0_SIZE_LO];
@@ -623,12 +750,82 @@ static bool cxl_type2_dpa(CXLType2Dev *ct2d, hwaddr host_addr, uint64_t *dpa)
     }
 
     hdm0_ctrl = cache_mem[R_CXL_HDM_DECODER0_CTRL];
-    iw = FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, IW);
-    ig = FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, IG);
+    ways = cxl_interleave_ways_dec(
+        FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, IW), NULL);
+    if (!ways) {
+        return false;
+    }
+    gran = cxl_decode_ig(FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, IG));
 
-    *dpa =
-        (MAKE_64BIT_MASK(0, 8 + ig) & hpa_offset) |
-        ((MAKE_64BIT_MASK(8 + ig + iw, 64 - 8 - ig - iw) & hpa_offset) >> iw);
+    /* Drop the way bits, whichever way routed the access here */
+    *dpa = (hpa_offset / gran / ways) * gran + hpa_offset % gran;
+
+    return true;
+}
+
+/*
+ * Resolve which interleave way of its committed HDM decoder this device is.
+ * Until the host bridge and fixed window decoders route one of the ways to
+ * it the position stays -1, and it is retried when they commit.
+ */
+void cxl_type2_hdm_position_update(PCIDevice *d)
+{
+    CXLType2Dev *ct2d = CXL_TYPE2(d);
+    uint32_t *cache_mem = ct2d->cxl_cstate.crb.cache_mem_registers;
+    uint32_t hdm0_ctrl = cache_mem[R_CXL_HDM_DECODER0_CTRL];
+    uint64_t decoder_base;
+    hwaddr gran;
+    int ways, pos = -1;
+
+    if (FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, COMMITTED)) {
+        decoder_base =
+            (((uint64_t)cache_mem[R_CXL_HDM_DECODER0_BASE_HI] << 32) |
+             cache_mem[R_CXL_HDM_DECODER0_BASE_LO]);
+        ways = cxl_interleave_ways_dec(
+            FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, IW), NULL);
+        gran = cxl_decode_ig(FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, IG));
+
+        if (ways == 1) {
+            pos = 0;
+        } else {
+            pos = cxl_host_hdm_position(d, decoder_base, ways, gran);
+        }
+    }
+
+    qatomic_set(&ct2d->hdm_position, pos);
+}
+
+bool cxl_type2_dpa_to_hpa(PCIDevice *d, uint64_t dpa, hwaddr *hpa)
+{
+    CXLType2Dev *ct2d = CXL_TYPE2(d);
+    uint32_t *cache_mem = ct2d->cxl_cstate.crb.cache_mem_registers;
+    uint64_t decoder_base, decoder_size, hpa_offset, gran;
+    uint32_t hdm0_ctrl;
+    int pos, ways;
+
+    hdm0_ctrl = cache_mem[R_CXL_HDM_DECODER0_CTRL];
+    if (!FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, COMMITTED)) {
+        return false;
+    }
+    pos = qatomic_read(&ct2d->hdm_position);
+    if (pos < 0) {
+        return false;
+    }
+    ways = cxl_interleave_ways_dec(
+        FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, IW), NULL);
+    gran = cxl_decode_ig(FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, IG));
+
+    hpa_offset = (dpa / gran) * gran * ways + pos * gran + dpa % gran;
+
+    decoder_size = ((uint64_t)cache_mem[R_CXL_HDM_DECODER0_SIZE_HI] << 32) |
+                   cache_mem[R_CXL_HDM_DECODER0_SIZE_LO];
+    if (hpa_offset >= decoder_size) {
+        return false;
+    }
+
+    decoder_base = (((uint64_t)cache_mem[R_CXL_HDM_DECODER0_BASE_HI] << 32) |
+                    cache_mem[R_CXL_HDM_DECODER0_BASE_LO]);
+    *hpa = decoder_base + hpa_offset;
 
     return true;
 }
@@ -646,7 +843,7 @@ S2MRsp cxl_type2_access(PCIDevice *d, CXLMemReq req, uint8_t *buf,
         return S2MRsp_CMP_ERROR;
     }
 
-    if (!cxl_type2_dpa(ct2d, req.Address, &dpa_offset)) {
+    if (!cxl_type2_hpa_to_dpa(d, req.Address, &dpa_offset)) {
         return S2MRsp_CMP_ERROR;
     }
 
@@ -659,13 +856,30 @@ S2MRsp cxl_type2_access(PCIDevice *d, CXLMemReq req, uint8_t *buf,
     //				__func__, req.MemOpcode, (uint64_t)req.Address, dpa_offset, size,
     //data);
 
-    return cxl_device_type2_dcoh_access(&ct2d->hostmem_as, dpa_offset, req, buf,
-                                        size, attrs);
+    return cxl_device_type2_dcoh_access(d, dpa_offset, req, buf, size,
+                                        attrs);
 }
 
-M2SRsp_BIRsp cxl_type2_response(CXLMemReq req, MemTxAttrs attrs)
+M2SRsp_BIRsp cxl_type2_response(PCIDevice *d, CXLMemReq req,
+                                MemTxAttrs attrs)
 {
-    return cxl_host_type2_hcoh_response(req, attrs);
+    return cxl_host_type2_hcoh_response(d, req, attrs);
+}
+
+/* Device memory accesses of the DCOH, by DPA */
+MemTxResult cxl_type2_mem_read(PCIDevice *d, uint64_t dpa, uint8_t *buf,
+                               unsigned size, MemTxAttrs attrs)
+{
+    return address_space_read(&CXL_TYPE2(d)->hostmem_as, dpa, attrs, buf,
+                              size);
+}
+
+MemTxResult cxl_type2_mem_write(PCIDevice *d, uint64_t dpa,
+                                const uint8_t *buf, unsigned size,
+                                MemTxAttrs attrs)
+{
+    return address_space_write(&CXL_TYPE2(d)->hostmem_as, dpa, attrs, buf,
+                               size);
 }
 
 static void ct2d_reset(DeviceState *dev)
@@ -676,6 +890,15 @@ static void ct2d_reset(DeviceState *dev)
 
     cxl_component_register_init_common(reg_state, write_msk, CXL2_TYPE2_DEVICE);
     cxl_device_register_init_common(&ct2d->cxl_dstate);
+    ct2d->hdm_position = -1;
+
+    /* Expose the bias control block as an extra device capability */
+    ARRAY_FIELD_DP64(ct2d->cxl_dstate.caps_reg_state64, CXL_DEV_CAP_ARRAY,
+                     CAP_COUNT, 4);
+    cxl_device_cap_init((&ct2d->cxl_dstate), BIAS_CONTROL,
+                        CXL_BIAS_CONTROL_CAP_ID);
+    memset(ct2d->bias_reg_state + A_CXL_BIAS_RANGE_BASE, 0,
+           CXL_BIAS_CONTROL_REGISTERS_LENGTH - A_CXL_BIAS_RANGE_BASE);
 }
 
 static Property ct2_props[] = {
@@ -685,6 +908,11 @@ static Property ct2_props[] = {
                      HostMemoryBackend *),
     DEFINE_PROP_UINT64("sn", CXLType2Dev, sn, UI64_NULL),
     DEFINE_PROP_STRING("cdat", CXLType2Dev, cxl_cstate.cdat.filename),
+    DEFINE_PROP_UINT32("sf-entries", CXLType2Dev, sf_entries,
+                       DEVICE_SF_DEFAULT_ENTRIES),
+    DEFINE_PROP_SIZE("bias-granularity", CXLType2Dev, bias_granularity,
+                     CXL_BIAS_DEFAULT_GRANULARITY),
+    DEFINE_CXL_TRAFFIC_PROPERTIES(CXLType2Dev, traffic_props),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -737,11 +965,71 @@ static void set_lsa(CXLType2Dev *ct2d, const void *buf, uint64_t size,
      */
 }
 
+/*
+ * Snoop filter counters, readable with qom-get while the device is
+ * realized. Misses are the lookups that did not hit, and evictions are the
+ * lines back-invalidated to make room in a full filter.
+ */
+enum {
+    CT2_SF_LOOKUPS,
+    CT2_SF_HITS,
+    CT2_SF_MISSES,
+    CT2_SF_EVICTIONS,
+    CT2_SF_OCCUPANCY,
+    CT2_SF_PEAK_OCCUPANCY,
+};
+
+static const char *const ct2_sf_stat_names[] = {
+    [CT2_SF_LOOKUPS] = "sf-lookups",
+    [CT2_SF_HITS] = "sf-hits",
+    [CT2_SF_MISSES] = "sf-misses",
+    [CT2_SF_EVICTIONS] = "sf-evictions",
+    [CT2_SF_OCCUPANCY] = "sf-occupancy",
+    [CT2_SF_PEAK_OCCUPANCY] = "sf-peak-occupancy",
+};
+
+static void ct2_get_sf_stat(Object *obj, Visitor *v, const char *name,
+                            void *opaque, Error **errp)
+{
+    CXLType2Dev *ct2d = CXL_TYPE2(obj);
+    SnoopFilterStats *stats;
+    uint64_t value = 0;
+
+    if (ct2d->dcoh) {
+        stats = &ct2d->dcoh->sf->stats;
+        switch ((uintptr_t)opaque) {
+        case CT2_SF_LOOKUPS:
+            value = stats->lookups;
+            break;
+        case CT2_SF_HITS:
+            value = stats->hits;
+            break;
+        case CT2_SF_MISSES:
+            value = stats->lookups - stats->hits;
+            break;
+        case CT2_SF_EVICTIONS:
+            value = stats->back_invalidations;
+            break;
+        case CT2_SF_OCCUPANCY:
+            value = stats->occupancy;
+            break;
+        case CT2_SF_PEAK_OCCUPANCY:
+            value = stats->peak_occupancy;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+
+    visit_type_uint64(v, name, &value, errp);
+}
+
 static void ct2_class_init(ObjectClass *oc, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(oc);
     PCIDeviceClass *pc = PCI_DEVICE_CLASS(oc);
     CXLType2Class *cvc = CXL_TYPE2_CLASS(oc);
+    int i;
 
     pc->realize = ct2_realize;
     pc->exit = ct2_exit;
@@ -761,6 +1049,12 @@ static void ct2_class_init(ObjectClass *oc, void *data)
     cvc->get_lsa_size = get_lsa_size;
     cvc->get_lsa = get_lsa;
     cvc->set_lsa = set_lsa;
+
+    for (i = 0; i < ARRAY_SIZE(ct2_sf_stat_names); i++) {
+        object_class_property_add(oc, ct2_sf_stat_names[i], "uint64",
+                                  ct2_get_sf_stat, NULL, NULL,
+                                  (void *)(uintptr_t)i);
+    }
 }
 
 static const TypeInfo ct2d_info = {
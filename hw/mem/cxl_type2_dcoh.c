@@ -12,31 +12,59 @@
 #include "sysemu/hostmem.h"
 
 #include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_bias.h"
 #include "hw/cxl/cxl_dcache.h"
+#include "hw/cxl/cxl_snoop_filter.h"
 #include "hw/cxl/cxl_type2_dcoh.h"
 
-static DeviceCoh *dcoh;
-static Cache *dcache;
-extern QemuSpin ct2d_lock;
-
-static GRand *rng_opc;
-static GRand *rng_addr;
-static GRand *rng_size;
-
 static CXLMemReq __device_dcoh_assem_request_packet(S2MReq_BISnp opc,
-                                                    uint64_t daddr)
+                                                    uint64_t haddr)
 {
     CXLMemReq req = {
         0,
     };
 
     req.MemOpcode = opc;
-    daddr += CFMWS_BASE_ADDR;
-    req.Address = (daddr & ~(DEVICE_BLKSIZE - 1));
+    req.Address = (haddr & ~(DEVICE_BLKSIZE - 1));
 
     return req;
 }
 
+/*
+ * Back-snoop the host for daddr. The request carries the HPA the committed
+ * HDM decoder maps daddr to; without a mapping the host cannot hold the
+ * line, which is answered like a miss.
+ */
+static M2SRsp_BIRsp __device_dcoh_bi_snoop(PCIDevice *d, S2MReq_BISnp opc,
+                                           uint64_t daddr, CXLMemReq *req,
+                                           MemTxAttrs attrs)
+{
+    CXLStats *stats = CXL_TYPE2(d)->stats;
+    hwaddr haddr = 0;
+    bool mapped = cxl_type2_dpa_to_hpa(d, daddr, &haddr);
+
+    switch (opc) {
+    case S2MReq_BISnpCur:
+    case S2MReq_BISnpCurBlk:
+        cxl_stats_inc(stats, CXL_STAT_SNP_SENT_CUR);
+        break;
+    case S2MReq_BISnpData:
+    case S2MReq_BISnpDataBlk:
+        cxl_stats_inc(stats, CXL_STAT_SNP_SENT_DATA);
+        break;
+    case S2MReq_BISnpInv:
+    case S2MReq_BISnpInvBlk:
+        cxl_stats_inc(stats, CXL_STAT_SNP_SENT_INV);
+        break;
+    }
+
+    *req = __device_dcoh_assem_request_packet(opc, haddr);
+    if (!mapped)
+        return M2SRsp_BIRspI;
+
+    return cxl_type2_response(d, *req, attrs);
+}
+
 static CacheState __device_dcoh_response_check(CXLMemReq req, M2SRsp_BIRsp rsp)
 {
     CacheState cache_state = CACHE_INVALID;
@@ -73,7 +101,8 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
                                         uint32_t size, MemTxAttrs attrs)
 {
     CXLType2Dev *ct2d = CXL_TYPE2(d);
-    AddressSpace *as = &ct2d->hostmem_as;
+    Cache *dcache = ct2d->dcache;
+    DeviceCoh *dcoh = ct2d->dcoh;
     CacheState cache_state;
     CXLMemReq req;
     M2SRsp_BIRsp rsp;
@@ -81,7 +110,7 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
     uint32_t cache_blk;
     uint8_t *blk_addr;
 
-    if (HOST_BIAS == cxl_device_type2_dcoh_bias_lookup(daddr))
+    if (HOST_BIAS == cxl_device_type2_dcoh_bias_lookup(d, daddr))
         g_assert(0);
 
     tag = device_cache_extract_tag(dcache, daddr);
@@ -90,25 +119,26 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
     cache_blk = device_cache_find_valid_block(dcache, tag, set);
 
     if (cache_blk != -1) {
+        cxl_stats_inc(ct2d->stats, CXL_STAT_DEVICE_HIT);
+
         if (cmd == CACHE_READ) {
             device_cache_data_read(dcache, daddr, set, cache_blk, data, size);
         } else if (cmd == CACHE_UPDATE) {
-            if (g_hash_table_lookup(dcoh->sf_table, (gpointer)daddr)) {
+            if (device_sf_lookup(dcoh->sf, daddr)) {
                 cache_state =
                     device_cache_extract_block_state(dcache, set, cache_blk);
                 g_assert(cache_state != CACHE_INVALID);
 
                 if (cache_state == CACHE_SHARED) {
-                    req = __device_dcoh_assem_request_packet(S2MReq_BISnpInv,
-                                                             daddr);
-                    rsp = cxl_type2_response(req, attrs);
+                    rsp = __device_dcoh_bi_snoop(d, S2MReq_BISnpInv, daddr,
+                                                 &req, attrs);
                     if (rsp == M2SRsp_BINoOp) {
                         return MEMTX_ERROR;
                     }
                     cache_state = __device_dcoh_response_check(req, rsp);
 
                     g_assert(cache_state == CACHE_EXCLUSIVE);
-                    g_hash_table_remove(dcoh->sf_table, (gpointer)daddr);
+                    device_sf_remove(dcoh->sf, daddr);
                     device_cache_update_block_state(dcache, tag, set, cache_blk,
                                                     cache_state);
                 }
@@ -116,6 +146,8 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
             device_cache_data_write(dcache, daddr, set, cache_blk, data, size);
         }
     } else {
+        cxl_stats_inc(ct2d->stats, CXL_STAT_DEVICE_MISS);
+
         cache_blk = device_cache_find_invalid_block(dcache, set);
 
         if (cache_blk == -1) {
@@ -123,8 +155,8 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
             blk_addr = device_cache_extract_block_addr(dcache, set, cache_blk);
             assem_addr = device_cache_assem_daddr(dcache, set, cache_blk);
 
-            if (MEMTX_OK != address_space_write(as, assem_addr, attrs, blk_addr,
-                                                DEVICE_BLKSIZE)) {
+            if (MEMTX_OK != cxl_type2_mem_write(d, assem_addr, blk_addr,
+                                                DEVICE_BLKSIZE, attrs)) {
                 return MEMTX_ERROR;
             }
 
@@ -135,6 +167,27 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
             device_cache_print_data_block(dcache, set, cache_blk);
             device_cache_update_block_state(dcache, tag, set, cache_blk,
                                             CACHE_INVALID);
+
+            cxl_stats_inc(ct2d->stats, CXL_STAT_DEVICE_EVICTION);
+            cxl_stats_inc(ct2d->stats, CXL_STAT_DEVICE_WRITEBACK);
+        }
+
+        /*
+         * The host may still hold the line from an earlier access in device
+         * bias. Take it back before filling from memory: dirty data is
+         * written back by the host, and a read leaves a shared host copy.
+         */
+        cache_state = CACHE_EXCLUSIVE;
+        if (device_sf_lookup(dcoh->sf, daddr)) {
+            rsp = __device_dcoh_bi_snoop(d, cmd == CACHE_READ ?
+                                         S2MReq_BISnpData : S2MReq_BISnpInv,
+                                         daddr, &req, attrs);
+            if (rsp == M2SRsp_BINoOp) {
+                return MEMTX_ERROR;
+            }
+            cache_state = __device_dcoh_response_check(req, rsp);
+            if (cache_state == CACHE_EXCLUSIVE)
+                device_sf_remove(dcoh->sf, daddr);
         }
 
         CXL_DCOH_BIAS(daddr,
@@ -143,8 +196,8 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
         blk_addr = device_cache_extract_block_addr(dcache, set, cache_blk);
         assem_addr = daddr & ~(DEVICE_BLKSIZE - 1);
 
-        if (MEMTX_OK != address_space_read(as, assem_addr, attrs, blk_addr,
-                                           DEVICE_BLKSIZE)) {
+        if (MEMTX_OK != cxl_type2_mem_read(d, assem_addr, blk_addr,
+                                           DEVICE_BLKSIZE, attrs)) {
             return MEMTX_ERROR;
         }
 
@@ -154,7 +207,7 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
             assem_addr, *(uint64_t *)blk_addr);
         device_cache_print_data_block(dcache, set, cache_blk);
         device_cache_update_block_state(dcache, tag, set, cache_blk,
-                                        CACHE_EXCLUSIVE);
+                                        cache_state);
         /*
                         for (uint32_t i = 0; i < DEVICE_BLKSIZE; i+=8) {
                                 if (*(uint64_t *)&blk_addr[i] != 0) {
@@ -182,111 +235,112 @@ static MemTxResult __device_dcoh_access(CacheCommand cmd, PCIDevice *d,
     return MEMTX_OK;
 }
 
-static DeviceCoh *__device_dcoh_init(void)
+/*
+ * The snoop filter ran out of entries and dropped the line at daddr, so the
+ * host has to give up its copy before the device may stop tracking it.
+ */
+static MemTxResult __device_dcoh_back_invalidate(PCIDevice *d, uint64_t daddr,
+                                                 MemTxAttrs attrs)
 {
-    DeviceCoh *coh;
+    Cache *dcache = CXL_TYPE2(d)->dcache;
+    CXLMemReq req;
+    M2SRsp_BIRsp rsp;
+    CacheState cache_state;
+    uint64_t tag, set;
+    uint32_t cache_blk;
 
-    coh = g_new(DeviceCoh, 1);
+    rsp = __device_dcoh_bi_snoop(d, S2MReq_BISnpInv, daddr, &req, attrs);
+    if (rsp == M2SRsp_BINoOp) {
+        return MEMTX_ERROR;
+    }
+    cache_state = __device_dcoh_response_check(req, rsp);
 
-    coh->sf_table = g_hash_table_new(NULL, NULL);
+    tag = device_cache_extract_tag(dcache, daddr);
+    set = device_cache_extract_set(dcache, daddr);
 
-    coh->bias_cache_size = DEVICE_BIAS_CACHE_SIZE;
-    coh->bias_entry_size = DEVICE_BIAS_ENTRY_SIZE;
-    coh->bias_cache = g_new0(uint32_t, coh->bias_cache_size);
+    cache_blk = device_cache_find_valid_block(dcache, tag, set);
+    if (cache_blk != -1)
+        device_cache_update_block_state(dcache, tag, set, cache_blk,
+                                        cache_state);
 
-    coh->bias_cache[0] = HOST_BIAS;
-    coh->bias_cache[1] = DEVICE_BIAS;
+    cxl_stats_inc(CXL_TYPE2(d)->stats, CXL_STAT_BACK_INVALIDATION);
 
-    return coh;
-}
+    CXL_DCOH_BIAS(daddr, "snoop filter overflow -> back-invalidate - daddr: "
+                  "0x%lx", daddr);
 
-static void __device_dcoh_free(DeviceCoh *coh)
-{
-    g_free(coh->bias_cache);
-    g_free(coh);
+    return MEMTX_OK;
 }
 
-static void *__ct2d_device_main(void *opaque)
+static DeviceCoh *__device_dcoh_init(uint32_t sf_entries)
 {
-#define ACCESS_DATA_PATTERN 0x5A
-#define ACCESS_DATA_SIZE    1
+    DeviceCoh *coh;
 
-    PCIDevice *d = (PCIDevice *)opaque;
-    CXLType2Dev *ct2d = CXL_TYPE2(d);
-    MemoryRegion *mr = host_memory_backend_get_memory(ct2d->hostmem);
-    if (!mr) {
-        g_assert(0);
-    }
+    coh = g_new(DeviceCoh, 1);
 
-    MemTxAttrs attrs = {
-        0,
-    };
-    MemTxResult result;
-    uint32_t opc, size;
-    uint64_t daddr, data;
-    static uint64_t cnt;
+    cxl_device_sf_init(&coh->sf, sf_entries);
 
-    g_usleep(CXL_BOOT_WAIT_TIME);
+    return coh;
+}
 
-    CXL_DEBUG("ct2d device main process starts");
+static void __device_dcoh_free(DeviceCoh *coh)
+{
+    cxl_device_sf_release(&coh->sf);
+    g_free(coh);
+}
 
-    while (true) {
-        g_usleep(CXL_THREAD_DELAY);
+/* Traffic generator access, see cxl_traffic.h */
+MemTxResult cxl_device_type2_dcoh_traffic(PCIDevice *d, uint64_t daddr,
+                                          uint8_t *buf, uint32_t size,
+                                          bool is_write)
+{
+    CXLHost *hb = CXL_TYPE2(d)->hb;
+    MemTxAttrs attrs = MEMTXATTRS_UNSPECIFIED;
+    MemTxResult result = MEMTX_OK;
+    uint32_t chunk;
 
-        opc = g_rand_int_range(rng_opc, 0, 2);
-        daddr = g_rand_int_range(rng_addr, DEVICE_BIAS_ENTRY_SIZE,
-                                 int128_get64(mr->size) - DEVICE_BLKSIZE);
-        size = g_rand_int_range(rng_size, 0, ACCESS_DATA_SIZE) + 1;
+    qemu_spin_lock(&hb->coh_lock);
+    CXL_THREAD("device dcache lock");
 
-        qemu_spin_lock(&ct2d_lock);
-        CXL_THREAD("device dcache lock");
+    while (size) {
+        chunk = MIN(size, DEVICE_BLKSIZE - (daddr & (DEVICE_BLKSIZE - 1)));
 
-        switch (opc) {
-        case 0:
-            data = 0;
-            result =
-                __device_dcoh_access(CACHE_READ, d, daddr, &data, size, attrs);
+        /* host-bias pages are only reachable through the host */
+        if (HOST_BIAS == cxl_device_type2_dcoh_bias_lookup(d, daddr)) {
+            result = MEMTX_DECODE_ERROR;
             break;
-        case 1:
-            data = (ACCESS_DATA_PATTERN << ((size - 1) * 8));
-            result = __device_dcoh_access(CACHE_UPDATE, d, daddr, &data, size,
-                                          attrs);
-            break;
-        default:
-            g_assert(0);
         }
 
-        if (result != MEMTX_OK) {
-            g_assert(0);
-        }
-        cnt++;
-        if (cnt % 0x100000 == 0)
-            error_report("%s processing cnt 0x%lx", __func__, cnt);
+        result = __device_dcoh_access(is_write ? CACHE_UPDATE : CACHE_READ, d,
+                                      daddr, (uint64_t *)buf, chunk, attrs);
+        if (result != MEMTX_OK)
+            break;
 
-        CXL_THREAD("device dcache unlock");
-        qemu_spin_unlock(&ct2d_lock);
+        daddr += chunk;
+        buf += chunk;
+        size -= chunk;
     }
 
-#undef ACCESS_DATA_PATTERN
-#undef ACCESS_DATA_SIZE
+    CXL_THREAD("device dcache unlock");
+    qemu_spin_unlock(&hb->coh_lock);
 
-    return NULL;
+    return result;
 }
 
-BiasState cxl_device_type2_dcoh_bias_lookup(uint64_t daddr)
+BiasState cxl_device_type2_dcoh_bias_lookup(PCIDevice *d, uint64_t daddr)
 {
-    uint32_t entry_idx = daddr / dcoh->bias_entry_size;
-
-    return dcoh->bias_cache[entry_idx];
+    return cxl_bias_table_lookup(CXL_TYPE2(d)->bias, daddr);
 }
 
-S2MRsp cxl_device_type2_dcoh_access(AddressSpace *as, uint64_t daddr,
+S2MRsp cxl_device_type2_dcoh_access(PCIDevice *d, uint64_t daddr,
                                     CXLMemReq req, uint8_t *buf, uint32_t size,
                                     MemTxAttrs attrs)
 {
+    CXLType2Dev *ct2d = CXL_TYPE2(d);
+    Cache *dcache = ct2d->dcache;
+    DeviceCoh *dcoh = ct2d->dcoh;
     CacheState cache_cstate = CACHE_INVALID;
     CacheState cache_nstate = CACHE_INVALID;
-    uint64_t tag, set;
+    uint64_t tag, set, victim;
     uint32_t cache_blk;
     uint8_t *blk_addr;
     bool data_read = false;
@@ -295,6 +349,20 @@ S2MRsp cxl_device_type2_dcoh_access(AddressSpace *as, uint64_t daddr,
     bool cache_update = false;
     S2MRsp rsp = S2MRsp_CMP;
 
+    switch (req.SnpType) {
+    case Snp_SnpData:
+        cxl_stats_inc(ct2d->stats, CXL_STAT_SNP_RECV_DATA);
+        break;
+    case Snp_SnpCur:
+        cxl_stats_inc(ct2d->stats, CXL_STAT_SNP_RECV_CUR);
+        break;
+    case Snp_SnpInv:
+        cxl_stats_inc(ct2d->stats, CXL_STAT_SNP_RECV_INV);
+        break;
+    default:
+        break;
+    }
+
     tag = device_cache_extract_tag(dcache, daddr);
     set = device_cache_extract_set(dcache, daddr);
 
@@ -302,7 +370,7 @@ S2MRsp cxl_device_type2_dcoh_access(AddressSpace *as, uint64_t daddr,
     if (cache_blk != -1)
         cache_cstate = device_cache_extract_block_state(dcache, set, cache_blk);
 
-    if (HOST_BIAS == cxl_device_type2_dcoh_bias_lookup(daddr)) {
+    if (HOST_BIAS == cxl_device_type2_dcoh_bias_lookup(d, daddr)) {
         switch (req.MemOpcode) {
         case M2SReq_MemRd:
         case M2SReq_MemRdData:
@@ -477,18 +545,25 @@ S2MRsp cxl_device_type2_dcoh_access(AddressSpace *as, uint64_t daddr,
             device_cache_update_block_sf(dcache, set, cache_blk, true);
     }
 
+    /*
+     * A dirty line handed to the host is written back as it leaves M, the
+     * host takes the line clean and may drop it without a write back.
+     */
+    if (data_read && cache_update && cache_cstate == CACHE_MODIFIED)
+        data_flush = true;
+
     if (data_read == true) {
         if (cache_cstate != CACHE_INVALID) {
             device_cache_data_read(dcache, daddr, set, cache_blk,
                                    (uint64_t *)buf, size);
         } else {
-            if (MEMTX_OK != address_space_read(as, daddr, attrs, buf, size)) {
+            if (MEMTX_OK != cxl_type2_mem_read(d, daddr, buf, size, attrs)) {
                 return S2MRsp_CMP_ERROR;
             }
         }
     }
     if (data_write == true) {
-        if (MEMTX_OK != address_space_write(as, daddr, attrs, buf, size)) {
+        if (MEMTX_OK != cxl_type2_mem_write(d, daddr, buf, size, attrs)) {
             return S2MRsp_CMP_ERROR;
         }
     }
@@ -496,7 +571,7 @@ S2MRsp cxl_device_type2_dcoh_access(AddressSpace *as, uint64_t daddr,
         if (cache_cstate != CACHE_INVALID) {
             blk_addr = device_cache_extract_block_addr(dcache, set, cache_blk);
             if (MEMTX_OK !=
-                address_space_write(as, daddr, attrs, blk_addr, size)) {
+                cxl_type2_mem_write(d, daddr, blk_addr, size, attrs)) {
                 return S2MRsp_CMP_ERROR;
             }
         }
@@ -509,9 +584,13 @@ S2MRsp cxl_device_type2_dcoh_access(AddressSpace *as, uint64_t daddr,
     }
 
     if (rsp == S2MRsp_CMP) {
-        g_hash_table_remove(dcoh->sf_table, (gpointer)daddr);
-    } else {
-        g_hash_table_insert(dcoh->sf_table, (gpointer)daddr, (gpointer) true);
+        device_sf_remove(dcoh->sf, daddr);
+    } else if (rsp == S2MRsp_CMP_SHARED || rsp == S2MRsp_CMP_EXCLUSIVE) {
+        victim = device_sf_insert(dcoh->sf, daddr);
+        if (victim != DEVICE_SF_NO_VICTIM &&
+            MEMTX_OK != __device_dcoh_back_invalidate(d, victim, attrs)) {
+            return S2MRsp_CMP_ERROR;
+        }
     }
 
     return rsp;
@@ -694,31 +773,70 @@ out:
         return rsp;
 }
 */
-void cxl_device_type2_dcoh_init(PCIDevice *d)
+/*
+ * Give up device ownership of [daddr, daddr + size) before the range moves
+ * to host bias: dirty device cache lines are written back, all device
+ * copies are dropped and the snoop filter stops tracking the range.
+ */
+MemTxResult cxl_device_type2_dcoh_flush_range(PCIDevice *d, uint64_t daddr,
+                                              uint64_t size, MemTxAttrs attrs)
 {
-    QemuThread thread;
-
-    cxl_device_cache_init(&dcache);
-    dcoh = __device_dcoh_init();
+    CXLType2Dev *ct2d = CXL_TYPE2(d);
+    Cache *dcache = ct2d->dcache;
+    CacheState cache_state;
+    uint64_t set, tag, assem_addr;
+    uint8_t *blk_addr;
+    int32_t blk;
+
+    for (set = 0; set < dcache->num_sets; set++) {
+        for (blk = 0; blk < dcache->assoc; blk++) {
+            cache_state = device_cache_extract_block_state(dcache, set, blk);
+            if (cache_state == CACHE_INVALID)
+                continue;
+
+            assem_addr = device_cache_assem_daddr(dcache, set, blk);
+            if (assem_addr < daddr || assem_addr >= daddr + size)
+                continue;
+
+            if (cache_state == CACHE_MODIFIED) {
+                blk_addr = device_cache_extract_block_addr(dcache, set, blk);
+                if (MEMTX_OK != cxl_type2_mem_write(d, assem_addr, blk_addr,
+                                                    DEVICE_BLKSIZE, attrs)) {
+                    return MEMTX_ERROR;
+                }
+                cxl_stats_inc(ct2d->stats, CXL_STAT_DEVICE_WRITEBACK);
+            }
+            tag = device_cache_extract_tag(dcache, assem_addr);
+            device_cache_update_block_state(dcache, tag, set, blk,
+                                            CACHE_INVALID);
+            device_cache_update_block_sf(dcache, set, blk, false);
+            cxl_stats_inc(ct2d->stats, CXL_STAT_DEVICE_EVICTION);
+        }
+    }
 
-    rng_opc = g_rand_new();
-    rng_addr = g_rand_new();
-    rng_size = g_rand_new();
+    device_sf_remove_range(ct2d->dcoh->sf, daddr, size);
 
-    qemu_spin_lock(&ct2d_lock);
+    return MEMTX_OK;
+}
 
-    qemu_thread_create(&thread, "ct2d_device_main", __ct2d_device_main, d,
-                       QEMU_THREAD_JOINABLE);
+void cxl_device_type2_dcoh_init(PCIDevice *d)
+{
+    CXLType2Dev *ct2d = CXL_TYPE2(d);
 
-    qemu_spin_unlock(&ct2d_lock);
+    cxl_device_cache_init(&ct2d->dcache);
+    ct2d->dcoh = __device_dcoh_init(ct2d->sf_entries);
 
     CXL_DEBUG("ct2 device dcoh realized");
 }
 
-void cxl_device_type2_dcoh_release(void)
+void cxl_device_type2_dcoh_release(PCIDevice *d)
 {
-    __device_dcoh_free(dcoh);
-    cxl_device_cache_release(&dcache);
+    CXLType2Dev *ct2d = CXL_TYPE2(d);
+
+    __device_dcoh_free(ct2d->dcoh);
+    cxl_device_cache_release(&ct2d->dcache);
+    ct2d->dcoh = NULL;
+    ct2d->dcache = NULL;
 
     CXL_DEBUG("ct2 device dcoh released");
 }
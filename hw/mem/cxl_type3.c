@@ -1,6 +1,10 @@
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/bitmap.h"
 #include "qemu/error-report.h"
+#include "exec/address-spaces.h"
+#include "exec/cpu-common.h"
+#include "exec/ram_addr.h"
 #include "qapi/qapi-commands-cxl.h"
 #include "hw/mem/memory-device.h"
 #include "hw/mem/pc-dimm.h"
@@ -12,13 +16,20 @@
 #include "qemu/pmem.h"
 #include "qemu/range.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "sysemu/hostmem.h"
 #include "sysemu/numa.h"
 #include "hw/cxl/cxl.h"
 #include "hw/pci/msix.h"
 #include "trace.h"
 
-#define DWORD_BYTE 4
+
+/* MSI-X vectors, the mailbox one is fixed by the MSI_N field at 0 */
+enum {
+    CT3_MSIX_MBOX,
+    CT3_MSIX_EVENT,
+    CT3_MSIX_NUM
+};
 
 /* Default CDAT entries for a memory region */
 enum {
@@ -31,9 +42,30 @@ enum {
     CT3_CDAT_NUM_ENTRIES
 };
 
+/*
+ * Encode value in the finest unit, min_unit times a power of ten, that
+ * keeps the entry in range: 0 means not reported and 0xffff is reserved.
+ */
+static void ct3_cdat_dslbis_entry(CDATDslbis *dslbis, uint64_t value,
+                                  uint64_t min_unit)
+{
+    uint64_t unit = min_unit;
+
+    while (DIV_ROUND_UP(value, unit) > UINT16_MAX - 1) {
+        unit *= 10;
+    }
+    dslbis->entry_base_unit = unit;
+    dslbis->entry[0] = MAX(DIV_ROUND_UP(value, unit), 1);
+}
+
 static int ct3_build_cdat_entries_for_mr(CDATSubHeader **cdat_table,
-                                         int dsmad_handle, MemoryRegion *mr)
+                                         int dsmad_handle, uint64_t size,
+                                         bool is_pmem, bool is_dynamic,
+                                         uint64_t dpa_base,
+                                         const CXLType3Perf *perf)
 {
+    uint8_t flags = 0;
+
     g_autofree CDATDsmas *dsmas = NULL;
     g_autofree CDATDslbis *dslbis0 = NULL;
     g_autofree CDATDslbis *dslbis1 = NULL;
@@ -41,24 +73,30 @@ static int ct3_build_cdat_entries_for_mr(CDATSubHeader **cdat_table,
     g_autofree CDATDslbis *dslbis3 = NULL;
     g_autofree CDATDsemts *dsemts = NULL;
 
+    if (is_pmem) {
+        flags |= CDAT_DSMAS_FLAG_NV;
+    }
+    if (is_dynamic) {
+        flags |= CDAT_DSMAS_FLAG_DYNAMIC_CAP;
+    }
+
     dsmas = g_malloc(sizeof(*dsmas));
     if (!dsmas) {
         return -ENOMEM;
     }
 
-    /* Paul: Removed CDAT_DSMAS_FLAG_NV */
     *dsmas = (CDATDsmas) {
         .header = {
             .type = CDAT_TYPE_DSMAS,
             .length = sizeof(*dsmas),
         },
         .DSMADhandle = dsmad_handle,
-        .flags = 0,
-        .DPA_base = 0,
-        .DPA_length = int128_get64(mr->size),
+        .flags = flags,
+        .DPA_base = dpa_base,
+        .DPA_length = size,
     };
 
-    /* For now, no memory side cache, plausiblish numbers */
+    /* For now, no memory side cache */
     dslbis0 = g_malloc(sizeof(*dslbis0));
     if (!dslbis0) {
         return -ENOMEM;
@@ -71,9 +109,8 @@ static int ct3_build_cdat_entries_for_mr(CDATSubHeader **cdat_table,
         .handle = dsmad_handle,
         .flags = HMAT_LB_MEM_MEMORY,
         .data_type = HMAT_LB_DATA_READ_LATENCY,
-        .entry_base_unit = 10000, /* 10ns base */
-        .entry[0] = 15, /* 150ns */
     };
+    ct3_cdat_dslbis_entry(dslbis0, perf->read_latency, 1000);
 
     dslbis1 = g_malloc(sizeof(*dslbis1));
     if (!dslbis1) {
@@ -87,9 +124,8 @@ static int ct3_build_cdat_entries_for_mr(CDATSubHeader **cdat_table,
         .handle = dsmad_handle,
         .flags = HMAT_LB_MEM_MEMORY,
         .data_type = HMAT_LB_DATA_WRITE_LATENCY,
-        .entry_base_unit = 10000,
-        .entry[0] = 25, /* 250ns */
     };
+    ct3_cdat_dslbis_entry(dslbis1, perf->write_latency, 1000);
 
     dslbis2 = g_malloc(sizeof(*dslbis2));
     if (!dslbis2) {
@@ -103,9 +139,8 @@ static int ct3_build_cdat_entries_for_mr(CDATSubHeader **cdat_table,
         .handle = dsmad_handle,
         .flags = HMAT_LB_MEM_MEMORY,
         .data_type = HMAT_LB_DATA_READ_BANDWIDTH,
-        .entry_base_unit = 1000, /* GB/s */
-        .entry[0] = 16,
     };
+    ct3_cdat_dslbis_entry(dslbis2, perf->read_bandwidth, 1);
 
     dslbis3 = g_malloc(sizeof(*dslbis3));
     if (!dslbis3) {
@@ -119,9 +154,8 @@ static int ct3_build_cdat_entries_for_mr(CDATSubHeader **cdat_table,
         .handle = dsmad_handle,
         .flags = HMAT_LB_MEM_MEMORY,
         .data_type = HMAT_LB_DATA_WRITE_BANDWIDTH,
-        .entry_base_unit = 1000, /* GB/s */
-        .entry[0] = 16,
     };
+    ct3_cdat_dslbis_entry(dslbis3, perf->write_bandwidth, 1);
 
     dsemts = g_malloc(sizeof(*dsemts));
     if (!dsemts) {
@@ -135,8 +169,8 @@ static int ct3_build_cdat_entries_for_mr(CDATSubHeader **cdat_table,
         .DSMAS_handle = dsmad_handle,
         /* Reserved - the non volatile from DSMAS matters */
         .EFI_memory_type_attr = 2,
-        .DPA_offset = 0,
-        .DPA_length = int128_get64(mr->size),
+        .DPA_offset = dpa_base,
+        .DPA_length = size,
     };
 
     /* Header always at start of structure */
@@ -153,33 +187,87 @@ static int ct3_build_cdat_entries_for_mr(CDATSubHeader **cdat_table,
 static int ct3_build_cdat_table(CDATSubHeader ***cdat_table, void *priv)
 {
     g_autofree CDATSubHeader **table = NULL;
-    MemoryRegion *nonvolatile_mr;
+    MemoryRegion *volatile_mr = NULL, *nonvolatile_mr = NULL;
     CXLType3Dev *ct3d = priv;
     int dsmad_handle = 0;
+    int cur_ent = 0;
+    int len = 0;
     int rc;
 
-    if (!ct3d->hostmem) {
+    if (!ct3d->hostvmem && !ct3d->hostpmem && !ct3d->dc.num_regions) {
         return 0;
     }
 
-    nonvolatile_mr = host_memory_backend_get_memory(ct3d->hostmem);
-    if (!nonvolatile_mr) {
-        return -EINVAL;
+    if (ct3d->hostvmem) {
+        volatile_mr = host_memory_backend_get_memory(ct3d->hostvmem);
+        if (!volatile_mr) {
+            return -EINVAL;
+        }
+        len += CT3_CDAT_NUM_ENTRIES;
     }
 
-    table = g_malloc0(CT3_CDAT_NUM_ENTRIES * sizeof(*table));
+    if (ct3d->hostpmem) {
+        nonvolatile_mr = host_memory_backend_get_memory(ct3d->hostpmem);
+        if (!nonvolatile_mr) {
+            return -EINVAL;
+        }
+        len += CT3_CDAT_NUM_ENTRIES;
+    }
+
+    len += CT3_CDAT_NUM_ENTRIES * ct3d->dc.num_regions;
+
+    table = g_malloc0(len * sizeof(*table));
     if (!table) {
         return -ENOMEM;
     }
 
-    rc = ct3_build_cdat_entries_for_mr(table, dsmad_handle++, nonvolatile_mr);
-    if (rc < 0) {
-        return rc;
+    /* Now fill them in */
+    if (volatile_mr) {
+        rc = ct3_build_cdat_entries_for_mr(table, dsmad_handle++,
+                                           memory_region_size(volatile_mr),
+                                           false, false, 0, &ct3d->vmem_perf);
+        if (rc < 0) {
+            return rc;
+        }
+        cur_ent = CT3_CDAT_NUM_ENTRIES;
+    }
+
+    if (nonvolatile_mr) {
+        uint64_t base = volatile_mr ? int128_get64(volatile_mr->size) : 0;
+
+        rc = ct3_build_cdat_entries_for_mr(&(table[cur_ent]), dsmad_handle++,
+                                           memory_region_size(nonvolatile_mr),
+                                           true, false, base,
+                                           &ct3d->pmem_perf);
+        if (rc < 0) {
+            goto error_cleanup;
+        }
+        cur_ent += CT3_CDAT_NUM_ENTRIES;
+    }
+
+    for (int i = 0; i < ct3d->dc.num_regions; i++) {
+        CXLDCRegion *region = &ct3d->dc.regions[i];
+
+        rc = ct3_build_cdat_entries_for_mr(&(table[cur_ent]),
+                                           region->dsmadhandle, region->len,
+                                           false, true, region->base,
+                                           &ct3d->dc.perf);
+        if (rc < 0) {
+            goto error_cleanup;
+        }
+        cur_ent += CT3_CDAT_NUM_ENTRIES;
     }
+    assert(len == cur_ent);
 
     *cdat_table = g_steal_pointer(&table);
 
-    return CT3_CDAT_NUM_ENTRIES;
+    return len;
+
+error_cleanup:
+    for (int i = 0; i < cur_ent; i++) {
+        g_free(table[i]);
+    }
+    return rc;
 }
 
 static void ct3_free_cdat_table(CDATSubHeader **cdat_table, int num, void *priv)
@@ -194,45 +282,8 @@ static void ct3_free_cdat_table(CDATSubHeader **cdat_table, int num, void *priv)
 
 static bool cxl_doe_cdat_rsp(DOECap *doe_cap)
 {
-    CDATObject *cdat = &CXL_TYPE3(doe_cap->pdev)->cxl_cstate.cdat;
-    uint16_t ent;
-    void *base;
-    uint32_t len;
-    CDATReq *req = pcie_doe_get_write_mbox_ptr(doe_cap);
-    CDATRsp rsp;
-
-    assert(cdat->entry_len);
-
-    /* Discard if request length mismatched */
-    if (pcie_doe_get_obj_len(req) <
-        DIV_ROUND_UP(sizeof(CDATReq), DWORD_BYTE)) {
-        return false;
-    }
-
-    ent = req->entry_handle;
-    base = cdat->entry[ent].base;
-    len = cdat->entry[ent].length;
-
-    rsp = (CDATRsp) {
-        .header = {
-            .vendor_id = CXL_VENDOR_ID,
-            .data_obj_type = CXL_DOE_TABLE_ACCESS,
-            .reserved = 0x0,
-            .length = DIV_ROUND_UP((sizeof(rsp) + len), DWORD_BYTE),
-        },
-        .rsp_code = CXL_DOE_TAB_RSP,
-        .table_type = CXL_DOE_TAB_TYPE_CDAT,
-        .entry_handle = (ent < cdat->entry_len - 1) ?
-                        ent + 1 : CXL_DOE_TAB_ENT_MAX,
-    };
-
-    memcpy(doe_cap->read_mbox, &rsp, sizeof(rsp));
-    memcpy(doe_cap->read_mbox + DIV_ROUND_UP(sizeof(rsp), DWORD_BYTE),
-           base, len);
-
-    doe_cap->read_mbox_len += rsp.header.length;
-
-    return true;
+    return cxl_doe_cdat_read_entry(doe_cap,
+                                   &CXL_TYPE3(doe_cap->pdev)->cxl_cstate);
 }
 
 static uint32_t ct3d_config_read(PCIDevice *pci_dev, uint32_t addr, int size)
@@ -274,16 +325,42 @@ static void build_dvsecs(CXLType3Dev *ct3d)
 {
     CXLComponentState *cxl_cstate = &ct3d->cxl_cstate;
     uint8_t *dvsec;
+    uint32_t range1_size_hi, range1_size_lo,
+             range1_base_hi = 0, range1_base_lo = 0,
+             range2_size_hi = 0, range2_size_lo = 0,
+             range2_base_hi = 0, range2_base_lo = 0;
+
+    /*
+     * Volatile memory is mapped as (0x0)
+     * Persistent memory is mapped at (volatile->size)
+     */
+    if (ct3d->hostvmem) {
+        range1_size_hi = ct3d->hostvmem->size >> 32;
+        range1_size_lo = (2 << 5) | (2 << 2) | 0x3 |
+                         (ct3d->hostvmem->size & 0xF0000000);
+        if (ct3d->hostpmem) {
+            range2_size_hi = ct3d->hostpmem->size >> 32;
+            range2_size_lo = (2 << 5) | (2 << 2) | 0x3 |
+                             (ct3d->hostpmem->size & 0xF0000000);
+        }
+    } else {
+        range1_size_hi = ct3d->hostpmem->size >> 32;
+        range1_size_lo = (2 << 5) | (2 << 2) | 0x3 |
+                         (ct3d->hostpmem->size & 0xF0000000);
+    }
 
     dvsec = (uint8_t *)&(CXLDVSECDevice){
         .cap = 0x1e,
         .ctrl = 0x2,
         .status2 = 0x2,
-        .range1_size_hi = ct3d->hostmem->size >> 32,
-        .range1_size_lo = (2 << 5) | (2 << 2) | 0x3 |
-        (ct3d->hostmem->size & 0xF0000000),
-        .range1_base_hi = 0,
-        .range1_base_lo = 0,
+        .range1_size_hi = range1_size_hi,
+        .range1_size_lo = range1_size_lo,
+        .range1_base_hi = range1_base_hi,
+        .range1_base_lo = range1_base_lo,
+        .range2_size_hi = range2_size_hi,
+        .range2_size_lo = range2_size_lo,
+        .range2_base_hi = range2_base_hi,
+        .range2_base_lo = range2_base_lo,
     };
     cxl_component_create_dvsec(cxl_cstate, CXL2_TYPE3_DEVICE,
                                PCIE_CXL_DEVICE_DVSEC_LENGTH,
@@ -335,6 +412,62 @@ static void hdm_decoder_commit(CXLType3Dev *ct3d, int which)
     trace_cxl_type3_debug_message("HDM Decoder Commit");
 }
 
+static void cxl_type3_direct_map_one(MemoryRegion *alias, uint64_t base,
+                                     uint64_t size)
+{
+    if (memory_region_is_mapped(alias)) {
+        memory_region_del_subregion(get_system_memory(), alias);
+    }
+    if (size) {
+        memory_region_set_size(alias, size);
+        memory_region_add_subregion_overlap(get_system_memory(), base, alias,
+                                            1);
+    }
+}
+
+/*
+ * With direct-map set, a committed decoder that does not interleave maps
+ * the static capacity straight into the guest physical address space, over
+ * the fixed memory window, so accesses run at memory speed instead of
+ * trapping into cxl_type3_read/write. Anything the MMIO path has to see,
+ * poison or a sanitize in progress, drops the mapping until it is gone.
+ * Dynamic capacity is sparse and always stays on the MMIO path.
+ */
+void cxl_type3_direct_map_update(CXLType3Dev *ct3d)
+{
+    uint32_t *cache_mem = ct3d->cxl_cstate.crb.cache_mem_registers;
+    uint32_t hdm0_ctrl = cache_mem[R_CXL_HDM_DECODER0_CTRL];
+    uint64_t vmem_size = ct3d->cxl_dstate.vmem_size;
+    uint64_t pmem_size = ct3d->cxl_dstate.pmem_size;
+    uint64_t base = 0, size = 0;
+
+    if (!ct3d->direct_map) {
+        return;
+    }
+
+    if (FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, COMMITTED) &&
+        !FIELD_EX32(hdm0_ctrl, CXL_HDM_DECODER0_CTRL, IW) &&
+        interval_tree_is_empty(&ct3d->poison_tree) &&
+        !ct3d->cxl_dstate.bg.media_disabled) {
+        base = ((uint64_t)cache_mem[R_CXL_HDM_DECODER0_BASE_HI] << 32) |
+            cache_mem[R_CXL_HDM_DECODER0_BASE_LO];
+        size = ((uint64_t)cache_mem[R_CXL_HDM_DECODER0_SIZE_HI] << 32) |
+            cache_mem[R_CXL_HDM_DECODER0_SIZE_LO];
+    }
+
+    memory_region_transaction_begin();
+    if (ct3d->hostvmem) {
+        cxl_type3_direct_map_one(&ct3d->direct_vmem, base,
+                                 MIN(size, vmem_size));
+    }
+    if (ct3d->hostpmem) {
+        cxl_type3_direct_map_one(&ct3d->direct_pmem, base + vmem_size,
+                                 size > vmem_size ?
+                                 MIN(size - vmem_size, pmem_size) : 0);
+    }
+    memory_region_transaction_commit();
+}
+
 static int ct3d_qmp_uncor_err_to_cxl(CxlUncorErrorType qmp_err)
 {
     switch (qmp_err) {
@@ -500,6 +633,174 @@ static void ct3d_reg_write(void *opaque, hwaddr offset, uint64_t value,
     if (should_commit) {
         hdm_decoder_commit(ct3d, which_hdm);
     }
+    if (which_hdm == 0) {
+        cxl_type3_direct_map_update(ct3d);
+    }
+}
+
+/*
+ * Split the dynamic capacity backend evenly into num-dc-regions regions
+ * placed right after the static capacity, with DSMAD handles following
+ * those of the static partitions.
+ */
+static bool cxl_create_dc_regions(CXLType3Dev *ct3d, uint64_t dc_size,
+                                  Error **errp)
+{
+    uint64_t region_base = ct3d->cxl_dstate.mem_size;
+    uint64_t region_len = dc_size / ct3d->dc.num_regions;
+    uint32_t dsmadhandle = !!ct3d->hostvmem + !!ct3d->hostpmem;
+    int i;
+
+    if (!region_len || region_len % CXL_CAPACITY_MULTIPLIER ||
+        region_len * ct3d->dc.num_regions != dc_size) {
+        error_setg(errp, "volatile-dc-memdev size must split into "
+                   "num-dc-regions multiples of 256MiB");
+        return false;
+    }
+
+    for (i = 0; i < ct3d->dc.num_regions; i++) {
+        CXLDCRegion *region = &ct3d->dc.regions[i];
+
+        *region = (CXLDCRegion) {
+            .base = region_base + i * region_len,
+            .decode_len = region_len,
+            .len = region_len,
+            .block_size = CXL_DC_BLOCK_SIZE,
+            .dsmadhandle = dsmadhandle++,
+        };
+        region->blk_bitmap = bitmap_new(region_len / region->block_size);
+    }
+    ct3d->dc.total_capacity = dc_size;
+
+    QTAILQ_INIT(&ct3d->dc.extents);
+    QTAILQ_INIT(&ct3d->dc.extents_pending);
+    ct3d->dc.total_extent_count = 0;
+
+    return true;
+}
+
+static void cxl_destroy_dc_regions(CXLType3Dev *ct3d)
+{
+    int i;
+
+    if (!ct3d->dc.num_regions) {
+        return;
+    }
+
+    cxl_type3_dc_extent_list_clear(&ct3d->dc.extents);
+    cxl_type3_dc_extent_list_clear(&ct3d->dc.extents_pending);
+    for (i = 0; i < ct3d->dc.num_regions; i++) {
+        g_free(ct3d->dc.regions[i].blk_bitmap);
+        ct3d->dc.regions[i].blk_bitmap = NULL;
+    }
+    address_space_destroy(&ct3d->dc.host_dc_as);
+}
+
+static bool cxl_setup_memory(CXLType3Dev *ct3d, Error **errp)
+{
+    DeviceState *ds = DEVICE(ct3d);
+
+    if (!ct3d->hostmem && !ct3d->hostvmem && !ct3d->hostpmem &&
+        !ct3d->dc.num_regions) {
+        error_setg(errp, "at least one memdev property must be set");
+        return false;
+    } else if (ct3d->hostmem && ct3d->hostvmem) {
+        error_setg(errp, "[memdev] cannot be used with new "
+                         "[volatile-memdev] property");
+        return false;
+    } else if (ct3d->hostmem) {
+        /* The legacy memdev has always been exposed as volatile capacity */
+        ct3d->hostvmem = ct3d->hostmem;
+        ct3d->hostmem = NULL;
+    }
+
+    if (ct3d->hostvmem) {
+        MemoryRegion *vmr;
+        char *v_name;
+
+        vmr = host_memory_backend_get_memory(ct3d->hostvmem);
+        if (!vmr) {
+            error_setg(errp, "volatile memdev must have backing device");
+            return false;
+        }
+        memory_region_set_nonvolatile(vmr, false);
+        memory_region_set_enabled(vmr, true);
+        host_memory_backend_set_mapped(ct3d->hostvmem, true);
+        if (ds->id) {
+            v_name = g_strdup_printf("cxl-type3-dpa-vmem-space:%s", ds->id);
+        } else {
+            v_name = g_strdup("cxl-type3-dpa-vmem-space");
+        }
+        address_space_init(&ct3d->hostvmem_as, vmr, v_name);
+        memory_region_init_alias(&ct3d->direct_vmem, OBJECT(ct3d),
+                                 "cxl-type3-direct-vmem", vmr, 0,
+                                 memory_region_size(vmr));
+        ct3d->cxl_dstate.vmem_size = memory_region_size(vmr);
+        ct3d->cxl_dstate.mem_size += memory_region_size(vmr);
+        g_free(v_name);
+    }
+
+    if (ct3d->hostpmem) {
+        MemoryRegion *pmr;
+        char *p_name;
+
+        pmr = host_memory_backend_get_memory(ct3d->hostpmem);
+        if (!pmr) {
+            error_setg(errp, "persistent memdev must have backing device");
+            return false;
+        }
+        memory_region_set_nonvolatile(pmr, true);
+        memory_region_set_enabled(pmr, true);
+        host_memory_backend_set_mapped(ct3d->hostpmem, true);
+        if (ds->id) {
+            p_name = g_strdup_printf("cxl-type3-dpa-pmem-space:%s", ds->id);
+        } else {
+            p_name = g_strdup("cxl-type3-dpa-pmem-space");
+        }
+        address_space_init(&ct3d->hostpmem_as, pmr, p_name);
+        memory_region_init_alias(&ct3d->direct_pmem, OBJECT(ct3d),
+                                 "cxl-type3-direct-pmem", pmr, 0,
+                                 memory_region_size(pmr));
+        ct3d->cxl_dstate.pmem_size = memory_region_size(pmr);
+        ct3d->cxl_dstate.mem_size += memory_region_size(pmr);
+        g_free(p_name);
+    }
+
+    if (ct3d->dc.num_regions) {
+        MemoryRegion *dc_mr;
+        char *dc_name;
+
+        dc_mr = host_memory_backend_get_memory(ct3d->dc.host_dc);
+        if (!dc_mr) {
+            error_setg(errp, "dynamic capacity must have backing device");
+            goto err_destroy_static;
+        }
+        if (!cxl_create_dc_regions(ct3d, memory_region_size(dc_mr), errp)) {
+            goto err_destroy_static;
+        }
+        /* Nothing is touched until the host accepts an extent */
+        memory_region_set_nonvolatile(dc_mr, false);
+        memory_region_set_enabled(dc_mr, true);
+        host_memory_backend_set_mapped(ct3d->dc.host_dc, true);
+        if (ds->id) {
+            dc_name = g_strdup_printf("cxl-dcd-dpa-dc-space:%s", ds->id);
+        } else {
+            dc_name = g_strdup("cxl-dcd-dpa-dc-space");
+        }
+        address_space_init(&ct3d->dc.host_dc_as, dc_mr, dc_name);
+        g_free(dc_name);
+    }
+
+    return true;
+
+err_destroy_static:
+    if (ct3d->hostpmem) {
+        address_space_destroy(&ct3d->hostpmem_as);
+    }
+    if (ct3d->hostvmem) {
+        address_space_destroy(&ct3d->hostvmem_as);
+    }
+    return false;
 }
 
 static DOEProtocol doe_cdat_prot[] = {
@@ -514,10 +815,60 @@ static void ct3_realize(PCIDevice *pci_dev, Error **errp)
     ComponentRegisters *regs = &cxl_cstate->crb;
     MemoryRegion *mr = &regs->component_registers;
     uint8_t *pci_conf = pci_dev->config;
-    int rc;
+    int rc, i;
 
     QTAILQ_INIT(&ct3d->error_list);
 
+    /* Reported through the 24 bit Poison List Maximum Media Error Records */
+    if (ct3d->poison_list_limit > 0xffffff) {
+        error_setg(errp, "poison-list-limit must be below 2^24");
+        return;
+    }
+
+    if (ct3d->dc.num_regions > DCD_MAX_NUM_REGION) {
+        error_setg(errp, "num-dc-regions must be at most %d",
+                   DCD_MAX_NUM_REGION);
+        return;
+    }
+    if (!ct3d->dc.num_regions != !ct3d->dc.host_dc) {
+        error_setg(errp, "volatile-dc-memdev and num-dc-regions must be "
+                   "set together");
+        return;
+    }
+
+    if (!ct3d->event_log_size) {
+        error_setg(errp, "event-log-size must be at least 1");
+        return;
+    }
+
+    if (!is_power_of_2(ct3d->cxl_dstate.payload_size) ||
+        ct3d->cxl_dstate.payload_size < BIT(CXL_MAILBOX_PAYLOAD_SHIFT_MIN) ||
+        ct3d->cxl_dstate.payload_size > CXL_MAILBOX_MAX_PAYLOAD_SIZE) {
+        error_setg(errp, "mbox-payload-size must be a power of 2 between "
+                   "256 bytes and 1 MiB");
+        return;
+    }
+
+    if (ct3d->cxl_dstate.bg.nr_workers < 1 ||
+        ct3d->cxl_dstate.bg.nr_workers > CXL_BG_MAX_WORKERS) {
+        error_setg(errp, "bg-workers must be between 1 and %d",
+                   CXL_BG_MAX_WORKERS);
+        return;
+    }
+
+    if (!cxl_setup_memory(ct3d, errp)) {
+        return;
+    }
+
+    if (!cxl_type3_mhd_init(ct3d, errp)) {
+        goto err_destroy_memory;
+    }
+
+    ct3d->scan_media_pending = g_array_new(false, false,
+                                           sizeof(CXLMediaErrorRecord));
+    ct3d->scan_media_results = g_array_new(false, false,
+                                           sizeof(CXLMediaErrorRecord));
+
     pci_config_set_prog_interface(pci_conf, 0x10);
 
     pcie_endpoint_cap_init(pci_dev, 0x80);
@@ -547,19 +898,22 @@ static void ct3_realize(PCIDevice *pci_dev, Error **errp)
                          PCI_BASE_ADDRESS_MEM_TYPE_64,
                      &ct3d->cxl_dstate.device_registers);
 
-    // /* MSI(-X) Initailization */
-    // rc = msix_init_exclusive_bar(pci_dev, msix_num, 4, NULL);
-    // if (rc) {
-    //     goto err_address_space_free;
-    // }
-    // for (i = 0; i < msix_num; i++) {
-    //     msix_vector_use(pci_dev, i);
-    // }
+    /* MSI-X Initialization */
+    rc = msix_init_exclusive_bar(pci_dev, CT3_MSIX_NUM, 4, NULL);
+    if (rc) {
+        error_setg_errno(errp, -rc, "failed to initialize MSI-X");
+        goto err_free_special_ops;
+    }
+    for (i = 0; i < CT3_MSIX_NUM; i++) {
+        msix_vector_use(pci_dev, i);
+    }
 
+    cxl_event_init(&ct3d->cxl_dstate, ct3d->event_log_size, CT3_MSIX_EVENT);
 
     /* DOE Initailization */
     pcie_doe_init(pci_dev, &ct3d->doe_cdat, 0x190, doe_cdat_prot, true, 0);
 
+    cxl_type3_calibrate(ct3d);
     cxl_cstate->cdat.build_cdat_table = ct3_build_cdat_table;
     cxl_cstate->cdat.free_cdat_table = ct3_free_cdat_table;
     cxl_cstate->cdat.private = ct3d;
@@ -576,7 +930,22 @@ static void ct3_realize(PCIDevice *pci_dev, Error **errp)
 
 err_release_cdat:
     cxl_doe_cdat_release(cxl_cstate);
+    cxl_event_release(&ct3d->cxl_dstate);
+    msix_uninit_exclusive_bar(pci_dev);
+err_free_special_ops:
+    cxl_device_register_block_release(&ct3d->cxl_dstate);
     g_free(regs->special_ops);
+    g_array_free(ct3d->scan_media_pending, true);
+    g_array_free(ct3d->scan_media_results, true);
+    cxl_type3_mhd_release(ct3d);
+err_destroy_memory:
+    if (ct3d->hostpmem) {
+        address_space_destroy(&ct3d->hostpmem_as);
+    }
+    if (ct3d->hostvmem) {
+        address_space_destroy(&ct3d->hostvmem_as);
+    }
+    cxl_destroy_dc_regions(ct3d);
 }
 
 static void ct3_exit(PCIDevice *pci_dev)
@@ -585,10 +954,32 @@ static void ct3_exit(PCIDevice *pci_dev)
     CXLComponentState *cxl_cstate = &ct3d->cxl_cstate;
     ComponentRegisters *regs = &cxl_cstate->crb;
 
+    cxl_mailbox_bg_release(&ct3d->cxl_dstate);
+    ct3d->direct_map = false;
+    if (ct3d->hostvmem && memory_region_is_mapped(&ct3d->direct_vmem)) {
+        memory_region_del_subregion(get_system_memory(), &ct3d->direct_vmem);
+    }
+    if (ct3d->hostpmem && memory_region_is_mapped(&ct3d->direct_pmem)) {
+        memory_region_del_subregion(get_system_memory(), &ct3d->direct_pmem);
+    }
     pcie_aer_exit(pci_dev);
+    pcie_doe_fini(&ct3d->doe_cdat);
     cxl_doe_cdat_release(cxl_cstate);
+    cxl_event_release(&ct3d->cxl_dstate);
+    msix_uninit_exclusive_bar(pci_dev);
+    cxl_device_register_block_release(&ct3d->cxl_dstate);
     g_free(regs->special_ops);
-    address_space_destroy(&ct3d->hostmem_as);
+    if (ct3d->hostpmem) {
+        address_space_destroy(&ct3d->hostpmem_as);
+    }
+    if (ct3d->hostvmem) {
+        address_space_destroy(&ct3d->hostvmem_as);
+    }
+    cxl_destroy_dc_regions(ct3d);
+    cxl_type3_mhd_release(ct3d);
+    cxl_type3_poison_release(ct3d);
+    g_array_free(ct3d->scan_media_pending, true);
+    g_array_free(ct3d->scan_media_results, true);
 }
 
 /* TODO: Support multiple HDM decoders and DPA skip */
@@ -625,53 +1016,414 @@ static bool cxl_type3_dpa(CXLType3Dev *ct3d, hwaddr host_addr, uint64_t *dpa)
     return true;
 }
 
+/*
+ * The volatile partition sits at the bottom of the DPA space with the
+ * persistent one right above it.
+ */
+static int cxl_type3_dpa_to_as(CXLType3Dev *ct3d, uint64_t *dpa_offset,
+                               unsigned int size, AddressSpace **as)
+{
+    MemoryRegion *vmr = NULL, *pmr = NULL;
+
+    /* Dynamic capacity only decodes where the host accepted an extent */
+    if (*dpa_offset >= ct3d->cxl_dstate.mem_size && ct3d->dc.num_regions) {
+        if (!cxl_type3_dc_range_backed(ct3d, *dpa_offset, size)) {
+            return -ENODEV;
+        }
+        *as = &ct3d->dc.host_dc_as;
+        *dpa_offset -= ct3d->cxl_dstate.mem_size;
+        return 0;
+    }
+
+    if (ct3d->hostvmem) {
+        vmr = host_memory_backend_get_memory(ct3d->hostvmem);
+    }
+    if (ct3d->hostpmem) {
+        pmr = host_memory_backend_get_memory(ct3d->hostpmem);
+    }
+
+    if (!vmr && !pmr) {
+        return -ENODEV;
+    }
+
+    if (*dpa_offset + size > ct3d->cxl_dstate.mem_size) {
+        return -EINVAL;
+    }
+
+    if (vmr) {
+        if (*dpa_offset < memory_region_size(vmr)) {
+            *as = &ct3d->hostvmem_as;
+        } else {
+            *as = &ct3d->hostpmem_as;
+            *dpa_offset -= memory_region_size(vmr);
+        }
+    } else {
+        *as = &ct3d->hostpmem_as;
+    }
+
+    return 0;
+}
+
+static int cxl_type3_hpa_to_as_and_dpa(CXLType3Dev *ct3d, hwaddr host_addr,
+                                       unsigned int size, AddressSpace **as,
+                                       uint64_t *dpa_offset)
+{
+    if (!cxl_type3_dpa(ct3d, host_addr, dpa_offset)) {
+        return -EINVAL;
+    }
+
+    return cxl_type3_dpa_to_as(ct3d, dpa_offset, size, as);
+}
+
 MemTxResult cxl_type3_read(PCIDevice *d, hwaddr host_addr, uint64_t *data,
                            unsigned size, MemTxAttrs attrs)
 {
     CXLType3Dev *ct3d = CXL_TYPE3(d);
-    uint64_t dpa_offset;
-    MemoryRegion *mr;
+    uint64_t dpa_offset = 0;
+    AddressSpace *as = NULL;
+    int res;
 
-    /* TODO support volatile region */
-    mr = host_memory_backend_get_memory(ct3d->hostmem);
-    if (!mr) {
-        return MEMTX_ERROR;
+    /* Media disabled by a running sanitize, see 8.2.9.9.5.1 */
+    if (ct3d->cxl_dstate.bg.media_disabled) {
+        *data = ~0ULL;
+        return MEMTX_OK;
     }
 
-    if (!cxl_type3_dpa(ct3d, host_addr, &dpa_offset)) {
+    if (!interval_tree_is_empty(&ct3d->poison_tree) &&
+        cxl_type3_dpa(ct3d, host_addr, &dpa_offset) &&
+        cxl_type3_poison_find(ct3d, dpa_offset, size)) {
+        trace_cxl_type3_debug_message("read of poisoned memory");
         return MEMTX_ERROR;
     }
 
-    if (dpa_offset > int128_get64(mr->size)) {
+    res = cxl_type3_hpa_to_as_and_dpa(ct3d, host_addr, size, &as,
+                                      &dpa_offset);
+    if (res) {
         return MEMTX_ERROR;
     }
 
-    return address_space_read(&ct3d->hostmem_as, dpa_offset, attrs, data, size);
+    return address_space_read(as, dpa_offset, attrs, data, size);
 }
 
 MemTxResult cxl_type3_write(PCIDevice *d, hwaddr host_addr, uint64_t data,
                             unsigned size, MemTxAttrs attrs)
 {
     CXLType3Dev *ct3d = CXL_TYPE3(d);
-    uint64_t dpa_offset;
-    MemoryRegion *mr;
+    uint64_t dpa_offset = 0;
+    AddressSpace *as = NULL;
+    int res;
 
-    mr = host_memory_backend_get_memory(ct3d->hostmem);
-    if (!mr) {
-        trace_cxl_type3_debug_message("backend memory not found");
+    if (ct3d->cxl_dstate.bg.media_disabled) {
         return MEMTX_OK;
     }
 
-    if (!cxl_type3_dpa(ct3d, host_addr, &dpa_offset)) {
+    res = cxl_type3_hpa_to_as_and_dpa(ct3d, host_addr, size, &as,
+                                      &dpa_offset);
+    if (res) {
+        trace_cxl_type3_debug_message("HPA does not map to backend memory");
         return MEMTX_OK;
     }
 
-    if (dpa_offset > int128_get64(mr->size)) {
-        trace_cxl_type3_debug_message("DPA offset is greater than the memory backend size");
-        return MEMTX_OK;
+    return address_space_write(as, dpa_offset, attrs, &data, size);
+}
+
+MemTxResult cxl_type3_dpa_write(CXLType3Dev *ct3d, uint64_t dpa,
+                                const void *buf, unsigned size)
+{
+    AddressSpace *as = NULL;
+
+    if (cxl_type3_dpa_to_as(ct3d, &dpa, size, &as)) {
+        return MEMTX_ERROR;
     }
-    return address_space_write(&ct3d->hostmem_as, dpa_offset, attrs,
-                               &data, size);
+
+    return address_space_write(as, dpa, MEMTXATTRS_UNSPECIFIED, buf, size);
+}
+
+/*
+ * Host memory behind [dpa, dpa + length), one segment per partition it
+ * touches and per accepted dynamic capacity extent it overlaps, for the
+ * background mailbox workers. Dynamic capacity nobody accepted is skipped.
+ */
+GArray *cxl_type3_dpa_segments(CXLType3Dev *ct3d, uint64_t dpa,
+                               uint64_t length)
+{
+    GArray *segs = g_array_new(false, false, sizeof(CXLBgSegment));
+    uint64_t mem_size = ct3d->cxl_dstate.mem_size;
+    uint64_t end = dpa + length;
+    uint64_t static_end = MIN(end, mem_size);
+    uint64_t vmem_size = 0;
+    CXLDCExtent *extent;
+
+    if (ct3d->hostvmem) {
+        CXLBgSegment seg = {
+            .mr = host_memory_backend_get_memory(ct3d->hostvmem),
+        };
+
+        vmem_size = memory_region_size(seg.mr);
+        if (dpa < vmem_size) {
+            seg.offset = dpa;
+            seg.len = MIN(static_end, vmem_size) - dpa;
+            g_array_append_val(segs, seg);
+        }
+    }
+
+    if (ct3d->hostpmem && static_end > MAX(dpa, vmem_size)) {
+        CXLBgSegment seg = {
+            .mr = host_memory_backend_get_memory(ct3d->hostpmem),
+        };
+
+        seg.offset = MAX(dpa, vmem_size) - vmem_size;
+        seg.len = static_end - MAX(dpa, vmem_size);
+        g_array_append_val(segs, seg);
+    }
+
+    if (!ct3d->dc.num_regions || end <= mem_size) {
+        return segs;
+    }
+
+    /* The dc backend starts at the first region, right above mem_size */
+    QTAILQ_FOREACH(extent, &ct3d->dc.extents, node) {
+        uint64_t start = MAX(dpa, extent->start_dpa);
+        uint64_t stop = MIN(end, extent->start_dpa + extent->len);
+        CXLBgSegment seg = {
+            .mr = host_memory_backend_get_memory(ct3d->dc.host_dc),
+        };
+
+        if (start >= stop) {
+            continue;
+        }
+        seg.offset = start - mem_size;
+        seg.len = stop - start;
+        g_array_append_val(segs, seg);
+    }
+
+    return segs;
+}
+
+/* The region holding all of [dpa, dpa + len), if any */
+CXLDCRegion *cxl_type3_dc_find_region(CXLType3Dev *ct3d, uint64_t dpa,
+                                      uint64_t len)
+{
+    int i;
+
+    for (i = 0; i < ct3d->dc.num_regions; i++) {
+        CXLDCRegion *region = &ct3d->dc.regions[i];
+
+        if (dpa >= region->base && len <= region->len &&
+            dpa - region->base <= region->len - len) {
+            return region;
+        }
+    }
+
+    return NULL;
+}
+
+static void cxl_type3_dc_set_backed(CXLDCRegion *region, uint64_t dpa,
+                                    uint64_t len, bool backed)
+{
+    uint64_t first = (dpa - region->base) / region->block_size;
+    uint64_t nr = DIV_ROUND_UP(len, region->block_size);
+
+    if (backed) {
+        bitmap_set(region->blk_bitmap, first, nr);
+    } else {
+        bitmap_clear(region->blk_bitmap, first, nr);
+    }
+}
+
+/* Whether every block of [dpa, dpa + len) belongs to an accepted extent */
+bool cxl_type3_dc_range_backed(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len)
+{
+    CXLDCRegion *region = cxl_type3_dc_find_region(ct3d, dpa, len);
+    uint64_t first, last;
+
+    if (!region || !len) {
+        return false;
+    }
+
+    first = (dpa - region->base) / region->block_size;
+    last = (dpa + len - 1 - region->base) / region->block_size;
+    return find_next_zero_bit(region->blk_bitmap, last + 1, first) > last;
+}
+
+void cxl_type3_dc_extent_list_insert(CXLDCExtentList *list, uint64_t dpa,
+                                     uint64_t len, const uint8_t *tag,
+                                     uint16_t shared_seq)
+{
+    CXLDCExtent *extent = g_new0(CXLDCExtent, 1);
+
+    extent->start_dpa = dpa;
+    extent->len = len;
+    if (tag) {
+        memcpy(extent->tag, tag, sizeof(extent->tag));
+    }
+    extent->shared_seq = shared_seq;
+    QTAILQ_INSERT_TAIL(list, extent, node);
+}
+
+void cxl_type3_dc_extent_list_clear(CXLDCExtentList *list)
+{
+    CXLDCExtent *extent, *next;
+
+    QTAILQ_FOREACH_SAFE(extent, list, node, next) {
+        QTAILQ_REMOVE(list, extent, node);
+        g_free(extent);
+    }
+}
+
+/* Whether a single extent of the list holds all of [dpa, dpa + len) */
+bool cxl_type3_dc_extent_list_covers(CXLDCExtentList *list, uint64_t dpa,
+                                     uint64_t len)
+{
+    CXLDCExtent *extent;
+
+    QTAILQ_FOREACH(extent, list, node) {
+        if (dpa >= extent->start_dpa &&
+            dpa + len <= extent->start_dpa + extent->len) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* The host took [dpa, dpa + len) on, the caller checked it was offered */
+void cxl_type3_dc_accept(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len,
+                         const uint8_t *tag)
+{
+    CXLDCRegion *region = cxl_type3_dc_find_region(ct3d, dpa, len);
+
+    cxl_type3_dc_extent_list_insert(&ct3d->dc.extents, dpa, len, tag, 0);
+    cxl_type3_dc_set_backed(region, dpa, len, true);
+    ct3d->dc.total_extent_count++;
+    ct3d->dc.ext_list_gen_seq++;
+}
+
+/*
+ * The host gave [dpa, dpa + len) back, the caller checked it was backed.
+ * Extents straddling the range are split and the backend memory behind it
+ * is handed back to the host kernel, punching a hole in file backends.
+ */
+void cxl_type3_dc_release(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len)
+{
+    CXLDCRegion *region = cxl_type3_dc_find_region(ct3d, dpa, len);
+    MemoryRegion *dc_mr = host_memory_backend_get_memory(ct3d->dc.host_dc);
+    uint64_t last = dpa + len - 1;
+    CXLDCExtent *extent, *next;
+
+    QTAILQ_FOREACH_SAFE(extent, &ct3d->dc.extents, node, next) {
+        uint64_t e_start = extent->start_dpa;
+        uint64_t e_last = extent->start_dpa + extent->len - 1;
+
+        if (e_last < dpa || e_start > last) {
+            continue;
+        }
+
+        QTAILQ_REMOVE(&ct3d->dc.extents, extent, node);
+        ct3d->dc.total_extent_count--;
+        if (e_start < dpa) {
+            cxl_type3_dc_extent_list_insert(&ct3d->dc.extents, e_start,
+                                            dpa - e_start, extent->tag,
+                                            extent->shared_seq);
+            ct3d->dc.total_extent_count++;
+        }
+        if (e_last > last) {
+            cxl_type3_dc_extent_list_insert(&ct3d->dc.extents, last + 1,
+                                            e_last - last, extent->tag,
+                                            extent->shared_seq);
+            ct3d->dc.total_extent_count++;
+        }
+        g_free(extent);
+    }
+
+    cxl_type3_dc_set_backed(region, dpa, len, false);
+    ct3d->dc.ext_list_gen_seq++;
+
+    /*
+     * Punch the hole while the blocks are still ours: once unclaimed,
+     * another head may take them and write before the discard lands.
+     */
+    if (ram_block_discard_range(dc_mr->ram_block,
+                                dpa - ct3d->cxl_dstate.mem_size, len)) {
+        trace_cxl_type3_debug_message("failed to discard released capacity");
+    }
+    cxl_type3_mhd_unclaim(ct3d, dpa, len);
+}
+
+/* First poisoned range overlapping [dpa, dpa + length) */
+CXLPoison *cxl_type3_poison_find(CXLType3Dev *ct3d, uint64_t dpa,
+                                 uint64_t length)
+{
+    IntervalTreeNode *node;
+
+    node = interval_tree_iter_first(&ct3d->poison_tree, dpa, dpa + length - 1);
+    return node ? container_of(node, CXLPoison, node) : NULL;
+}
+
+/* Returns false once the list is full, the caller decides about overflow */
+bool cxl_type3_poison_add(CXLType3Dev *ct3d, uint64_t dpa, uint64_t length,
+                          uint8_t type)
+{
+    CXLPoison *p;
+
+    if (ct3d->poison_list_cnt >= ct3d->poison_list_limit) {
+        return false;
+    }
+
+    p = g_new0(CXLPoison, 1);
+    p->node.start = dpa;
+    p->node.last = dpa + length - 1;
+    p->type = type;
+    interval_tree_insert(&p->node, &ct3d->poison_tree);
+    ct3d->poison_list_cnt++;
+    cxl_type3_direct_map_update(ct3d);
+
+    return true;
+}
+
+/* Unpoison [dpa, dpa + length), splitting any range that straddles it */
+void cxl_type3_poison_clear(CXLType3Dev *ct3d, uint64_t dpa, uint64_t length)
+{
+    uint64_t last = dpa + length - 1;
+    CXLPoison *p;
+
+    while ((p = cxl_type3_poison_find(ct3d, dpa, length))) {
+        uint64_t p_start = p->node.start;
+        uint64_t p_last = p->node.last;
+        uint8_t type = p->type;
+
+        interval_tree_remove(&p->node, &ct3d->poison_tree);
+        ct3d->poison_list_cnt--;
+        g_free(p);
+
+        if (p_start < dpa &&
+            !cxl_type3_poison_add(ct3d, p_start, dpa - p_start, type)) {
+            cxl_type3_poison_set_overflowed(ct3d);
+        }
+        if (p_last > last &&
+            !cxl_type3_poison_add(ct3d, last + 1, p_last - last, type)) {
+            cxl_type3_poison_set_overflowed(ct3d);
+        }
+    }
+    cxl_type3_direct_map_update(ct3d);
+}
+
+void cxl_type3_poison_set_overflowed(CXLType3Dev *ct3d)
+{
+    ct3d->poison_list_overflowed = true;
+    ct3d->poison_list_overflow_ts = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+static void cxl_type3_poison_release(CXLType3Dev *ct3d)
+{
+    IntervalTreeNode *node;
+
+    while ((node = interval_tree_iter_first(&ct3d->poison_tree, 0,
+                                            UINT64_MAX))) {
+        interval_tree_remove(node, &ct3d->poison_tree);
+        g_free(container_of(node, CXLPoison, node));
+    }
+    ct3d->poison_list_cnt = 0;
 }
 
 static void ct3d_reset(DeviceState *dev)
@@ -682,15 +1434,37 @@ static void ct3d_reset(DeviceState *dev)
 
     cxl_component_register_init_common(reg_state, write_msk, CXL2_TYPE3_DEVICE);
     cxl_device_register_init_common(&ct3d->cxl_dstate);
+    cxl_type3_direct_map_update(ct3d);
 }
 
 static Property ct3_props[] = {
     DEFINE_PROP_LINK("memdev", CXLType3Dev, hostmem, TYPE_MEMORY_BACKEND,
-                     HostMemoryBackend *),
+                     HostMemoryBackend *), /* for backward compatibility */
+    DEFINE_PROP_LINK("volatile-memdev", CXLType3Dev, hostvmem,
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_LINK("persistent-memdev", CXLType3Dev, hostpmem,
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
     DEFINE_PROP_LINK("lsa", CXLType3Dev, lsa, TYPE_MEMORY_BACKEND,
                      HostMemoryBackend *),
     DEFINE_PROP_UINT64("sn", CXLType3Dev, sn, UI64_NULL),
+    DEFINE_PROP_UINT32("poison-list-limit", CXLType3Dev, poison_list_limit,
+                       CXL_POISON_LIST_LIMIT_DEFAULT),
     DEFINE_PROP_STRING("cdat", CXLType3Dev, cxl_cstate.cdat.filename),
+    DEFINE_PROP_SIZE32("mbox-payload-size", CXLType3Dev,
+                       cxl_dstate.payload_size,
+                       CXL_MAILBOX_DEFAULT_PAYLOAD_SIZE),
+    DEFINE_PROP_UINT32("bg-workers", CXLType3Dev, cxl_dstate.bg.nr_workers,
+                       CXL_BG_DEFAULT_WORKERS),
+    DEFINE_PROP_UINT16("event-log-size", CXLType3Dev, event_log_size,
+                       CXL_EVENT_LOG_SIZE_DEFAULT),
+    DEFINE_PROP_LINK("volatile-dc-memdev", CXLType3Dev, dc.host_dc,
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_UINT8("num-dc-regions", CXLType3Dev, dc.num_regions, 0),
+    DEFINE_PROP_BOOL("direct-map", CXLType3Dev, direct_map, false),
+    DEFINE_PROP_BOOL("cdat-calibrate", CXLType3Dev, cdat_calibrate, false),
+    DEFINE_PROP_STRING("mhd-state-file", CXLType3Dev, mhd.state_file),
+    DEFINE_PROP_UINT32("mhd-head", CXLType3Dev, mhd.head, 0),
+    DEFINE_PROP_UINT32("mhd-heads", CXLType3Dev, mhd.nr_heads, 2),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -698,6 +1472,10 @@ static uint64_t get_lsa_size(CXLType3Dev *ct3d)
 {
     MemoryRegion *mr;
 
+    if (!ct3d->lsa) {
+        return 0;
+    }
+
     mr = host_memory_backend_get_memory(ct3d->lsa);
     return memory_region_size(mr);
 }
@@ -738,9 +1516,341 @@ static void set_lsa(CXLType3Dev *ct3d, const void *buf, uint64_t size,
     memory_region_set_dirty(mr, offset, size);
 
     /*
-     * Just like the PMEM, if the guest is not allowed to exit gracefully, label
-     * updates will get lost.
+     * Labels are metadata the guest expects to survive a crash, so unlike
+     * the persistent capacity itself they are flushed to a file or pmem
+     * backend straight away. Volatile backends make this a no-op.
      */
+    qemu_ram_msync(mr->ram_block, offset, size);
+}
+
+static CXLEventLogType ct3d_qmp_event_log_to_cxl(CxlEventLog log)
+{
+    switch (log) {
+    case CXL_EVENT_LOG_INFORMATIONAL:
+        return CXL_EVENT_TYPE_INFO;
+    case CXL_EVENT_LOG_WARNING:
+        return CXL_EVENT_TYPE_WARN;
+    case CXL_EVENT_LOG_FAILURE:
+        return CXL_EVENT_TYPE_FAIL;
+    case CXL_EVENT_LOG_FATAL:
+        return CXL_EVENT_TYPE_FATAL;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+void qmp_cxl_inject_general_media_event(const char *path, CxlEventLog log,
+                                        uint8_t flags, uint64_t dpa,
+                                        uint8_t descriptor, uint8_t type,
+                                        uint8_t transaction_type,
+                                        bool has_channel, uint8_t channel,
+                                        bool has_rank, uint8_t rank,
+                                        bool has_device, uint32_t device,
+                                        bool has_count, uint32_t count,
+                                        Error **errp)
+{
+    /* CXL 3.0 Table 8-43 General Media Event Record */
+    static const QemuUUID gen_media_uuid = {
+        .data = UUID(0xfbcd0a77, 0xc260, 0x417f,
+                     0x85, 0xa9, 0x08, 0x8b, 0x16, 0x21, 0xeb, 0xa6),
+    };
+    Object *obj = object_resolve_path(path, NULL);
+    CXLEventGenMedia gem;
+    CXLEventRecordHdr *hdr = &gem.hdr;
+    CXLDeviceState *cxl_dstate;
+    CXLEventLogType log_type;
+    uint16_t valid_flags = 0;
+    bool assert_irq = false;
+    uint32_t i;
+
+    QEMU_BUILD_BUG_ON(sizeof(gem) != CXL_EVENT_RECORD_SIZE);
+
+    if (!obj) {
+        error_setg(errp, "Unable to resolve path");
+        return;
+    }
+    if (!object_dynamic_cast(obj, TYPE_CXL_TYPE3)) {
+        error_setg(errp, "Path does not point to a CXL type 3 device");
+        return;
+    }
+    if (has_count && !count) {
+        error_setg(errp, "Event count must be non zero");
+        return;
+    }
+
+    cxl_dstate = &CXL_TYPE3(obj)->cxl_dstate;
+    log_type = ct3d_qmp_event_log_to_cxl(log);
+
+    memset(&gem, 0, sizeof(gem));
+    hdr->id = gen_media_uuid;
+    hdr->length = sizeof(gem);
+    hdr->flags[0] = flags;
+
+    stq_le_p(&gem.phys_addr, dpa);
+    gem.descriptor = descriptor;
+    gem.type = type;
+    gem.transaction_type = transaction_type;
+
+    /* Validity Flags, Table 8-43 */
+    if (has_channel) {
+        gem.channel = channel;
+        valid_flags |= BIT(0);
+    }
+    if (has_rank) {
+        gem.rank = rank;
+        valid_flags |= BIT(1);
+    }
+    if (has_device) {
+        gem.device[0] = device;
+        gem.device[1] = device >> 8;
+        gem.device[2] = device >> 16;
+        valid_flags |= BIT(2);
+    }
+    stw_le_p(&gem.validity_flags, valid_flags);
+
+    /* One interrupt for the whole batch, the driver drains the log */
+    for (i = 0; i < (has_count ? count : 1); i++) {
+        assert_irq |= cxl_event_insert(cxl_dstate, log_type,
+                                       (CXLEventRecordRaw *)&gem);
+    }
+    if (assert_irq) {
+        cxl_event_irq_assert(cxl_dstate);
+    }
+}
+
+/* CXL 3.0 Table 8-47 Dynamic Capacity Event Record */
+static bool cxl_type3_dc_event(CXLType3Dev *ct3d, uint8_t type,
+                               uint8_t region_id, uint64_t dpa, uint64_t len,
+                               bool more)
+{
+    static const QemuUUID dynamic_capacity_uuid = {
+        .data = UUID(0xca95afa7, 0xf183, 0x4018,
+                     0x8c, 0x2f, 0x95, 0x26, 0x8e, 0x10, 0x1a, 0x2a),
+    };
+    CXLEventDynamicCapacity dc_event;
+    CXLDCExtentRaw extent = {};
+
+    QEMU_BUILD_BUG_ON(sizeof(dc_event) != CXL_EVENT_RECORD_SIZE);
+    QEMU_BUILD_BUG_ON(sizeof(extent) != sizeof(dc_event.dynamic_capacity_extent));
+
+    memset(&dc_event, 0, sizeof(dc_event));
+    dc_event.hdr.id = dynamic_capacity_uuid;
+    dc_event.hdr.length = sizeof(dc_event);
+    dc_event.type = type;
+    stw_le_p(&dc_event.host_id, ct3d->mhd.head);
+    dc_event.updated_region_id = region_id;
+    dc_event.flags = more ? DC_EVENT_FLAG_MORE : 0;
+
+    stq_le_p(&extent.start_dpa, dpa);
+    stq_le_p(&extent.len, len);
+    memcpy(dc_event.dynamic_capacity_extent, &extent, sizeof(extent));
+    stl_le_p(&dc_event.extents_avail, CXL_DC_MAX_EXTENTS -
+             MIN(ct3d->dc.total_extent_count, CXL_DC_MAX_EXTENTS));
+
+    return cxl_event_insert(&ct3d->cxl_dstate, CXL_EVENT_TYPE_DYNAMIC_CAP,
+                            (CXLEventRecordRaw *)&dc_event);
+}
+
+static CXLType3Dev *cxl_type3_dc_resolve(const char *path, uint8_t region_id,
+                                         CxlDynamicCapacityExtentList *extents,
+                                         Error **errp)
+{
+    Object *obj = object_resolve_path(path, NULL);
+    CxlDynamicCapacityExtentList *list, *prev;
+    CXLType3Dev *ct3d;
+    CXLDCRegion *region;
+
+    if (!obj) {
+        error_setg(errp, "Unable to resolve path");
+        return NULL;
+    }
+    if (!object_dynamic_cast(obj, TYPE_CXL_TYPE3)) {
+        error_setg(errp, "Path does not point to a CXL type 3 device");
+        return NULL;
+    }
+
+    ct3d = CXL_TYPE3(obj);
+    if (region_id >= ct3d->dc.num_regions) {
+        error_setg(errp, "Region id %u is not a dynamic capacity region",
+                   region_id);
+        return NULL;
+    }
+    if (!extents) {
+        error_setg(errp, "No extents given");
+        return NULL;
+    }
+
+    region = &ct3d->dc.regions[region_id];
+    for (list = extents; list; list = list->next) {
+        uint64_t offset = list->value->offset;
+        uint64_t len = list->value->len;
+
+        if (!len || !QEMU_IS_ALIGNED(offset, region->block_size) ||
+            !QEMU_IS_ALIGNED(len, region->block_size)) {
+            error_setg(errp, "Extents must be non empty and aligned to the "
+                       "0x%" PRIx64 " block size", region->block_size);
+            return NULL;
+        }
+        if (len > region->len || offset > region->len - len) {
+            error_setg(errp, "Extent 0x%" PRIx64 "+0x%" PRIx64 " is outside "
+                       "of region %u", offset, len, region_id);
+            return NULL;
+        }
+        for (prev = extents; prev != list; prev = prev->next) {
+            if (ranges_overlap(offset, len, prev->value->offset,
+                               prev->value->len)) {
+                error_setg(errp, "Extents must not overlap");
+                return NULL;
+            }
+        }
+    }
+
+    return ct3d;
+}
+
+void qmp_cxl_add_dynamic_capacity(const char *path, uint8_t region_id,
+                                  CxlDynamicCapacityExtentList *extents,
+                                  Error **errp)
+{
+    CxlDynamicCapacityExtentList *list;
+    CXLDCRegion *region;
+    CXLType3Dev *ct3d;
+    bool assert_irq = false;
+
+    ct3d = cxl_type3_dc_resolve(path, region_id, extents, errp);
+    if (!ct3d) {
+        return;
+    }
+    region = &ct3d->dc.regions[region_id];
+
+    for (list = extents; list; list = list->next) {
+        uint64_t dpa = region->base + list->value->offset;
+        uint64_t len = list->value->len;
+        uint64_t first = list->value->offset / region->block_size;
+        uint64_t last = first + len / region->block_size - 1;
+        CXLDCExtent *pending;
+
+        if (find_next_bit(region->blk_bitmap, last + 1, first) <= last) {
+            error_setg(errp, "Extent 0x%" PRIx64 "+0x%" PRIx64 " overlaps "
+                       "accepted capacity", list->value->offset, len);
+            return;
+        }
+        QTAILQ_FOREACH(pending, &ct3d->dc.extents_pending, node) {
+            if (ranges_overlap(dpa, len, pending->start_dpa, pending->len)) {
+                error_setg(errp, "Extent 0x%" PRIx64 "+0x%" PRIx64 " overlaps "
+                           "capacity already offered", list->value->offset,
+                           len);
+                return;
+            }
+        }
+        /* Checked again when the host accepts, another head may race us */
+        if (!cxl_type3_mhd_available(ct3d, dpa, len)) {
+            error_setg(errp, "Extent 0x%" PRIx64 "+0x%" PRIx64 " is held by "
+                       "another head", list->value->offset, len);
+            return;
+        }
+    }
+
+    for (list = extents; list; list = list->next) {
+        uint64_t dpa = region->base + list->value->offset;
+
+        cxl_type3_dc_extent_list_insert(&ct3d->dc.extents_pending, dpa,
+                                        list->value->len, NULL, 0);
+        assert_irq |= cxl_type3_dc_event(ct3d, DC_EVENT_ADD_CAPACITY,
+                                         region_id, dpa, list->value->len,
+                                         list->next);
+    }
+    if (assert_irq) {
+        cxl_event_irq_assert(&ct3d->cxl_dstate);
+    }
+}
+
+void qmp_cxl_release_dynamic_capacity(const char *path, uint8_t region_id,
+                                      CxlDynamicCapacityExtentList *extents,
+                                      bool has_forced, bool forced,
+                                      Error **errp)
+{
+    CxlDynamicCapacityExtentList *list;
+    CXLDCRegion *region;
+    CXLType3Dev *ct3d;
+    bool assert_irq = false;
+
+    ct3d = cxl_type3_dc_resolve(path, region_id, extents, errp);
+    if (!ct3d) {
+        return;
+    }
+    region = &ct3d->dc.regions[region_id];
+
+    for (list = extents; list; list = list->next) {
+        if (!cxl_type3_dc_range_backed(ct3d,
+                                       region->base + list->value->offset,
+                                       list->value->len)) {
+            error_setg(errp, "Extent 0x%" PRIx64 "+0x%" PRIx64 " is not "
+                       "accepted capacity", list->value->offset,
+                       list->value->len);
+            return;
+        }
+    }
+
+    for (list = extents; list; list = list->next) {
+        uint64_t dpa = region->base + list->value->offset;
+
+        if (has_forced && forced) {
+            cxl_type3_dc_release(ct3d, dpa, list->value->len);
+        }
+        assert_irq |= cxl_type3_dc_event(ct3d, has_forced && forced ?
+                                         DC_EVENT_FORCED_RELEASE_CAPACITY :
+                                         DC_EVENT_RELEASE_CAPACITY,
+                                         region_id, dpa, list->value->len,
+                                         list->next);
+    }
+    if (assert_irq) {
+        cxl_event_irq_assert(&ct3d->cxl_dstate);
+    }
+}
+
+void qmp_cxl_inject_poison(const char *path, uint64_t start, uint64_t length,
+                           Error **errp)
+{
+    Object *obj = object_resolve_path(path, NULL);
+    CXLType3Dev *ct3d;
+
+    if (length % 64) {
+        error_setg(errp, "Poison injection must be in multiples of 64 bytes");
+        return;
+    }
+    if (start % 64) {
+        error_setg(errp, "Poison start address must be 64 byte aligned");
+        return;
+    }
+    if (!length) {
+        error_setg(errp, "Poison length must be non zero");
+        return;
+    }
+    if (!obj) {
+        error_setg(errp, "Unable to resolve path");
+        return;
+    }
+    if (!object_dynamic_cast(obj, TYPE_CXL_TYPE3)) {
+        error_setg(errp, "Path does not point to a CXL type 3 device");
+        return;
+    }
+
+    ct3d = CXL_TYPE3(obj);
+
+    if (start + length > ct3d->cxl_dstate.mem_size || start + length < start) {
+        error_setg(errp, "Poison range is outside of the device memory");
+        return;
+    }
+    if (cxl_type3_poison_find(ct3d, start, length)) {
+        error_setg(errp, "Overlap with existing poisoned region not supported");
+        return;
+    }
+
+    if (!cxl_type3_poison_add(ct3d, start, length,
+                              CXL_POISON_TYPE_INTERNAL)) {
+        cxl_type3_poison_set_overflowed(ct3d);
+    }
 }
 
 /* For uncorrectable errors include support for multiple header recording */
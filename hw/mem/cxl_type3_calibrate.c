@@ -0,0 +1,235 @@
+/*
+ * QEMU CXL Type 3 Device Access Calibration Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/atomic.h"
+#include "qemu/timer.h"
+#include "sysemu/hostmem.h"
+#include "hw/cxl/cxl.h"
+#include "trace.h"
+
+/*
+ * The DSLBIS numbers published in CDAT are what the guest uses to place
+ * memory, so with cdat-calibrate they are measured on the path guest
+ * accesses actually take: straight to the backend when it is direct
+ * mapped, otherwise one address space access per load or store, as
+ * cxl_type3_read() and cxl_type3_write() do. The decode in front of that
+ * and the exit into QEMU that leads there are not counted.
+ *
+ * Only a bounded window at the start of each backend is timed, and it is
+ * touched once beforehand so that neither page faults nor the shared zero
+ * page of a fresh anonymous backend end up in the numbers.
+ *
+ * Stores write back what was just read, so the contents survive. With
+ * several heads sharing the backends that could still lose a concurrent
+ * write of another head, so there only loads are timed and stores are
+ * assumed to cost the same.
+ *
+ * Dynamic capacity keeps the defaults: only extents the guest accepted
+ * are backed, and none are at startup.
+ */
+#define CALIB_LAT_ACCESSES (1 << 16)
+#define CALIB_RAM_WINDOW (64 * MiB)
+#define CALIB_RAM_CHUNK (1 * MiB)
+#define CALIB_EMU_WINDOW (4 * MiB)
+
+static const CXLType3Perf ct3_default_perf = {
+    .read_latency = 150000,  /* 150ns */
+    .write_latency = 250000, /* 250ns */
+    .read_bandwidth = 16000, /* 16 GB/s */
+    .write_bandwidth = 16000,
+};
+
+/* Next slot of a pseudo random walk that depends on the value just read */
+static uint64_t __calib_next(uint64_t slot, uint64_t val, uint64_t nr_slots)
+{
+    return (slot * 6364136223846793005ULL + 1442695040888963407ULL +
+            (val & 1)) % nr_slots;
+}
+
+static uint64_t __calib_mbps(uint64_t bytes, int64_t ns)
+{
+    return MAX(bytes * 1000 / MAX(ns, 1), 1);
+}
+
+static void __calib_ram(uint8_t *base, uint64_t size, bool write,
+                        CXLType3Perf *perf)
+{
+    uint64_t window = MIN(size, CALIB_RAM_WINDOW);
+    uint64_t nr_slots = window / sizeof(unsigned long);
+    uint64_t bw_window = window & ~(CALIB_RAM_CHUNK - 1);
+    g_autofree uint8_t *scratch = NULL;
+    int64_t start, rd_ns = 0, wr_ns = 0;
+    uint64_t slot = 0, off;
+    unsigned long val = 0;
+    int i;
+
+    for (off = 0; off + sizeof(val) <= window;
+         off += qemu_real_host_page_size()) {
+        unsigned long *p = (unsigned long *)(base + off);
+
+        val = qatomic_read(p);
+        if (write) {
+            qatomic_set(p, val);
+        }
+    }
+
+    start = get_clock();
+    for (i = 0; i < CALIB_LAT_ACCESSES; i++) {
+        val = qatomic_read((unsigned long *)base + slot);
+        slot = __calib_next(slot, val, nr_slots);
+    }
+    perf->read_latency = (get_clock() - start) * 1000 / CALIB_LAT_ACCESSES;
+
+    if (write) {
+        slot = 0;
+        start = get_clock();
+        for (i = 0; i < CALIB_LAT_ACCESSES; i++) {
+            unsigned long *p = (unsigned long *)base + slot;
+
+            val = qatomic_read(p);
+            qatomic_set(p, val);
+            slot = __calib_next(slot, val, nr_slots);
+        }
+        perf->write_latency = (get_clock() - start) * 1000 /
+                              CALIB_LAT_ACCESSES;
+    }
+
+    if (!bw_window) {
+        return;
+    }
+    scratch = g_malloc(CALIB_RAM_CHUNK);
+    for (off = 0; off < bw_window; off += CALIB_RAM_CHUNK) {
+        start = get_clock();
+        memcpy(scratch, base + off, CALIB_RAM_CHUNK);
+        rd_ns += get_clock() - start;
+        if (write) {
+            start = get_clock();
+            memcpy(base + off, scratch, CALIB_RAM_CHUNK);
+            wr_ns += get_clock() - start;
+        }
+    }
+    perf->read_bandwidth = __calib_mbps(bw_window, rd_ns);
+    if (write) {
+        perf->write_bandwidth = __calib_mbps(bw_window, wr_ns);
+    }
+}
+
+static void __calib_emulated(AddressSpace *as, uint64_t size, bool write,
+                             CXLType3Perf *perf)
+{
+    uint64_t window = MIN(size, CALIB_EMU_WINDOW);
+    uint64_t nr_slots = window / sizeof(uint64_t);
+    uint64_t slot = 0, val = 0, off, rmw;
+    int64_t start, rd_ns, wr_ns;
+    int i;
+
+    for (off = 0; off + sizeof(val) <= window;
+         off += qemu_real_host_page_size()) {
+        address_space_read(as, off, MEMTXATTRS_UNSPECIFIED, &val, sizeof(val));
+        if (write) {
+            address_space_write(as, off, MEMTXATTRS_UNSPECIFIED, &val,
+                                sizeof(val));
+        }
+    }
+
+    start = get_clock();
+    for (i = 0; i < CALIB_LAT_ACCESSES; i++) {
+        address_space_read(as, slot * sizeof(val), MEMTXATTRS_UNSPECIFIED,
+                           &val, sizeof(val));
+        slot = __calib_next(slot, val, nr_slots);
+    }
+    perf->read_latency = (get_clock() - start) * 1000 / CALIB_LAT_ACCESSES;
+
+    if (write) {
+        slot = 0;
+        start = get_clock();
+        for (i = 0; i < CALIB_LAT_ACCESSES; i++) {
+            address_space_read(as, slot * sizeof(val), MEMTXATTRS_UNSPECIFIED,
+                               &val, sizeof(val));
+            address_space_write(as, slot * sizeof(val), MEMTXATTRS_UNSPECIFIED,
+                                &val, sizeof(val));
+            slot = __calib_next(slot, val, nr_slots);
+        }
+        /* Take off the load that fetched the value written back */
+        rmw = (get_clock() - start) * 1000 / CALIB_LAT_ACCESSES;
+        perf->write_latency = rmw > perf->read_latency ?
+                              rmw - perf->read_latency : rmw;
+    }
+
+    /* Guest accesses reach the device at most 8 bytes at a time */
+    start = get_clock();
+    for (off = 0; off + sizeof(val) <= window; off += sizeof(val)) {
+        address_space_read(as, off, MEMTXATTRS_UNSPECIFIED, &val, sizeof(val));
+    }
+    rd_ns = get_clock() - start;
+    perf->read_bandwidth = __calib_mbps(window, rd_ns);
+
+    if (write) {
+        start = get_clock();
+        for (off = 0; off + sizeof(val) <= window; off += sizeof(val)) {
+            address_space_read(as, off, MEMTXATTRS_UNSPECIFIED, &val,
+                               sizeof(val));
+            address_space_write(as, off, MEMTXATTRS_UNSPECIFIED, &val,
+                                sizeof(val));
+        }
+        wr_ns = get_clock() - start;
+        perf->write_bandwidth = __calib_mbps(window, wr_ns > rd_ns ?
+                                             wr_ns - rd_ns : wr_ns);
+    }
+}
+
+static void __calib_backend(CXLType3Dev *ct3d, HostMemoryBackend *hostmem,
+                            AddressSpace *as, bool direct, const char *name,
+                            CXLType3Perf *perf)
+{
+    MemoryRegion *mr = host_memory_backend_get_memory(hostmem);
+    uint64_t size = memory_region_size(mr);
+    bool write = !ct3d->mhd.state_file;
+
+    if (size < sizeof(uint64_t)) {
+        return;
+    }
+
+    if (direct) {
+        __calib_ram(memory_region_get_ram_ptr(mr), size, write, perf);
+    } else {
+        __calib_emulated(as, size, write, perf);
+    }
+    if (!write) {
+        perf->write_latency = perf->read_latency;
+        perf->write_bandwidth = perf->read_bandwidth;
+    }
+
+    trace_cxl_type3_calibrate(name, perf->read_latency, perf->write_latency,
+                              perf->read_bandwidth, perf->write_bandwidth);
+}
+
+/* Fill in the performance published for each kind of capacity */
+void cxl_type3_calibrate(CXLType3Dev *ct3d)
+{
+    ct3d->vmem_perf = ct3_default_perf;
+    ct3d->pmem_perf = ct3_default_perf;
+    /* Dynamic capacity is left on the defaults, see above */
+    ct3d->dc.perf = ct3_default_perf;
+
+    if (!ct3d->cdat_calibrate) {
+        return;
+    }
+
+    if (ct3d->hostvmem) {
+        __calib_backend(ct3d, ct3d->hostvmem, &ct3d->hostvmem_as,
+                        ct3d->direct_map, "volatile", &ct3d->vmem_perf);
+    }
+    if (ct3d->hostpmem) {
+        __calib_backend(ct3d, ct3d->hostpmem, &ct3d->hostpmem_as,
+                        ct3d->direct_map, "persistent", &ct3d->pmem_perf);
+    }
+}
@@ -0,0 +1,291 @@
+/*
+ * QEMU CXL Multi-Headed Type 3 Device Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "exec/ramblock.h"
+#include "sysemu/hostmem.h"
+#include "hw/cxl/cxl.h"
+#include "trace.h"
+
+/*
+ * Every QEMU process sharing the device is one head. Each maps the same
+ * share=on backends, so the static capacity is plain shared memory, and
+ * each decodes it through its own HDM decoders. What the heads have to
+ * agree on is who holds which dynamic capacity block: that lives in a
+ * small state file all of them map, one owner byte per block, updated
+ * with atomics so that no lock is needed on the accept and release paths.
+ * The file is created by the first head to start; removing it while no
+ * head runs resets the device.
+ */
+#define CXL_MHD_STATE_MAGIC 0x3130444d484c5843ULL /* "CXLMHD01" */
+#define CXL_MHD_MAX_HEADS 32
+
+struct CXLMHDState {
+    uint64_t magic;
+    uint32_t nr_heads;
+    uint32_t nr_blocks;
+    uint64_t block_size;
+    uint32_t heads_attached; /* one bit per head */
+    uint32_t rsvd;
+    uint8_t owner[];         /* head + 1 holding the block, 0 when free */
+};
+
+static uint8_t __mhd_owner_id(CXLType3Dev *ct3d)
+{
+    return ct3d->mhd.head + 1;
+}
+
+static bool __mhd_block_range(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len,
+                              uint64_t *first, uint64_t *last)
+{
+    uint64_t dc_base = ct3d->cxl_dstate.mem_size;
+
+    if (!ct3d->mhd.state || dpa < dc_base || !len) {
+        return false;
+    }
+
+    *first = (dpa - dc_base) / CXL_DC_BLOCK_SIZE;
+    *last = (dpa + len - 1 - dc_base) / CXL_DC_BLOCK_SIZE;
+    assert(*last < ct3d->mhd.state->nr_blocks);
+    return true;
+}
+
+static bool __mhd_check_shared(HostMemoryBackend *hostmem, const char *prop,
+                               Error **errp)
+{
+    MemoryRegion *mr;
+
+    if (!hostmem) {
+        return true;
+    }
+
+    mr = host_memory_backend_get_memory(hostmem);
+    if (!mr || !mr->ram_block || !qemu_ram_is_shared(mr->ram_block)) {
+        error_setg(errp, "%s must be a share=on backend for a multi-headed "
+                   "device", prop);
+        return false;
+    }
+
+    return true;
+}
+
+static bool __mhd_state_setup(CXLType3Dev *ct3d, uint32_t nr_blocks,
+                              Error **errp)
+{
+    struct CXLMHDState *state = ct3d->mhd.state;
+
+    if (state->magic == 0) {
+        state->nr_heads = ct3d->mhd.nr_heads;
+        state->nr_blocks = nr_blocks;
+        state->block_size = CXL_DC_BLOCK_SIZE;
+        state->heads_attached = 0;
+        memset(state->owner, 0, nr_blocks);
+        qatomic_store_release(&state->magic, CXL_MHD_STATE_MAGIC);
+        return true;
+    }
+
+    if (state->magic != CXL_MHD_STATE_MAGIC) {
+        error_setg(errp, "%s is not a CXL multi-headed device state file",
+                   ct3d->mhd.state_file);
+        return false;
+    }
+    if (state->nr_heads != ct3d->mhd.nr_heads ||
+        state->nr_blocks != nr_blocks ||
+        state->block_size != CXL_DC_BLOCK_SIZE) {
+        error_setg(errp, "%s describes a device with %u heads and %u dynamic "
+                   "capacity blocks, this head expects %u and %u",
+                   ct3d->mhd.state_file, state->nr_heads, state->nr_blocks,
+                   ct3d->mhd.nr_heads, nr_blocks);
+        return false;
+    }
+
+    return true;
+}
+
+bool cxl_type3_mhd_init(CXLType3Dev *ct3d, Error **errp)
+{
+    uint32_t nr_blocks = ct3d->dc.total_capacity / CXL_DC_BLOCK_SIZE;
+    size_t size = sizeof(struct CXLMHDState) + nr_blocks;
+    uint32_t head_bit, attached;
+    struct stat st;
+    void *map;
+    int fd, ret;
+
+    if (!ct3d->mhd.state_file) {
+        return true;
+    }
+
+    if (!ct3d->mhd.nr_heads || ct3d->mhd.nr_heads > CXL_MHD_MAX_HEADS) {
+        error_setg(errp, "mhd-heads must be between 1 and %d",
+                   CXL_MHD_MAX_HEADS);
+        return false;
+    }
+    if (ct3d->mhd.head >= ct3d->mhd.nr_heads) {
+        error_setg(errp, "mhd-head must be below mhd-heads (%u)",
+                   ct3d->mhd.nr_heads);
+        return false;
+    }
+    if (!__mhd_check_shared(ct3d->hostvmem, "volatile-memdev", errp) ||
+        !__mhd_check_shared(ct3d->hostpmem, "persistent-memdev", errp) ||
+        !__mhd_check_shared(ct3d->dc.host_dc, "volatile-dc-memdev", errp)) {
+        return false;
+    }
+
+    fd = qemu_open(ct3d->mhd.state_file, O_RDWR | O_CREAT, errp);
+    if (fd < 0) {
+        return false;
+    }
+
+    /* Serialize creation of the file against heads starting alongside */
+    while ((ret = qemu_lock_fd(fd, 0, 0, true)) == -EAGAIN ||
+           ret == -EACCES) {
+        g_usleep(1000);
+    }
+    if (ret) {
+        error_setg_errno(errp, -ret, "cannot lock %s", ct3d->mhd.state_file);
+        goto err_close;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "cannot stat %s", ct3d->mhd.state_file);
+        goto err_unlock;
+    }
+    if (st.st_size == 0 && ftruncate(fd, size) < 0) {
+        error_setg_errno(errp, errno, "cannot size %s", ct3d->mhd.state_file);
+        goto err_unlock;
+    } else if (st.st_size != 0 && st.st_size != size) {
+        error_setg(errp, "%s has the wrong size for this device",
+                   ct3d->mhd.state_file);
+        goto err_unlock;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        error_setg_errno(errp, errno, "cannot map %s", ct3d->mhd.state_file);
+        goto err_unlock;
+    }
+    ct3d->mhd.state = map;
+    ct3d->mhd.state_size = size;
+
+    if (!__mhd_state_setup(ct3d, nr_blocks, errp)) {
+        goto err_unmap;
+    }
+    qemu_unlock_fd(fd, 0, 0);
+    ct3d->mhd.fd = fd;
+
+    head_bit = BIT(ct3d->mhd.head);
+    attached = qatomic_fetch_or(&ct3d->mhd.state->heads_attached, head_bit);
+    if (attached & head_bit) {
+        /* Most likely a previous run of this head that did not exit */
+        warn_report("CXL head %u was not detached cleanly, dropping the "
+                    "dynamic capacity it held", ct3d->mhd.head);
+        cxl_type3_mhd_unclaim(ct3d, ct3d->cxl_dstate.mem_size,
+                              ct3d->dc.total_capacity);
+    }
+
+    return true;
+
+err_unmap:
+    munmap(map, size);
+    ct3d->mhd.state = NULL;
+err_unlock:
+    qemu_unlock_fd(fd, 0, 0);
+err_close:
+    close(fd);
+    return false;
+}
+
+void cxl_type3_mhd_release(CXLType3Dev *ct3d)
+{
+    if (!ct3d->mhd.state) {
+        return;
+    }
+
+    cxl_type3_mhd_unclaim(ct3d, ct3d->cxl_dstate.mem_size,
+                          ct3d->dc.total_capacity);
+    qatomic_and(&ct3d->mhd.state->heads_attached, ~BIT(ct3d->mhd.head));
+
+    munmap(ct3d->mhd.state, ct3d->mhd.state_size);
+    ct3d->mhd.state = NULL;
+    close(ct3d->mhd.fd);
+}
+
+/* Whether no other head holds any block of [dpa, dpa + len) */
+bool cxl_type3_mhd_available(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len)
+{
+    uint64_t first, last, i;
+
+    if (!__mhd_block_range(ct3d, dpa, len, &first, &last)) {
+        return true;
+    }
+
+    for (i = first; i <= last; i++) {
+        uint8_t owner = qatomic_read(&ct3d->mhd.state->owner[i]);
+
+        if (owner && owner != __mhd_owner_id(ct3d)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Take every block of [dpa, dpa + len) for this head. Blocks it already
+ * holds are fine. Fails, leaving the blocks as they were, when another head
+ * got to one of them first.
+ */
+bool cxl_type3_mhd_claim(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len)
+{
+    uint8_t id = __mhd_owner_id(ct3d);
+    g_autofree unsigned long *taken = NULL;
+    uint64_t first, last, i;
+    uint8_t owner;
+
+    if (!__mhd_block_range(ct3d, dpa, len, &first, &last)) {
+        return true;
+    }
+
+    taken = bitmap_new(last - first + 1);
+    for (i = first; i <= last; i++) {
+        owner = qatomic_cmpxchg(&ct3d->mhd.state->owner[i], 0, id);
+        if (owner == 0) {
+            set_bit(i - first, taken);
+        } else if (owner != id) {
+            trace_cxl_type3_debug_message("block held by another head");
+            while (i-- > first) {
+                if (test_bit(i - first, taken)) {
+                    qatomic_set(&ct3d->mhd.state->owner[i], 0);
+                }
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Give back the blocks of [dpa, dpa + len) that this head holds */
+void cxl_type3_mhd_unclaim(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len)
+{
+    uint8_t id = __mhd_owner_id(ct3d);
+    uint64_t first, last, i;
+
+    if (!__mhd_block_range(ct3d, dpa, len, &first, &last)) {
+        return;
+    }
+
+    for (i = first; i <= last; i++) {
+        qatomic_cmpxchg(&ct3d->mhd.state->owner[i], id, 0);
+    }
+}
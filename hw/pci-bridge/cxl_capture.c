@@ -0,0 +1,238 @@
+/*
+ * QEMU CXL Socket Packet Capture Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "hw/cxl/cxl_capture.h"
+
+#define PCAPNG_SHB_TYPE 0x0A0D0D0A
+#define PCAPNG_IDB_TYPE 0x00000001
+#define PCAPNG_EPB_TYPE 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+
+typedef struct QEMU_PACKED PcapngShb {
+    uint32_t type;
+    uint32_t len;
+    uint32_t magic;
+    uint16_t major;
+    uint16_t minor;
+    int64_t section_len;
+    uint32_t len_trailer;
+} PcapngShb;
+
+typedef struct QEMU_PACKED PcapngIdb {
+    uint32_t type;
+    uint32_t len;
+    uint16_t linktype;
+    uint16_t reserved;
+    uint32_t snaplen;
+    uint16_t tsresol_code;
+    uint16_t tsresol_len;
+    uint8_t tsresol;
+    uint8_t tsresol_pad[3];
+    uint16_t end_code;
+    uint16_t end_len;
+    uint32_t len_trailer;
+} PcapngIdb;
+
+typedef struct QEMU_PACKED PcapngEpbHeader {
+    uint32_t type;
+    uint32_t len;
+    uint32_t ifid;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    uint32_t cap_len;
+    uint32_t orig_len;
+} PcapngEpbHeader;
+
+typedef struct QEMU_PACKED PcapngEpbTrailer {
+    uint16_t flags_code;
+    uint16_t flags_len;
+    uint32_t flags;
+    uint16_t end_code;
+    uint16_t end_len;
+    uint32_t len;
+} PcapngEpbTrailer;
+
+static bool cxl_capture_write_header(FILE *file)
+{
+    PcapngShb shb = {
+        .type = PCAPNG_SHB_TYPE,
+        .len = sizeof(shb),
+        .magic = PCAPNG_BYTE_ORDER_MAGIC,
+        .major = 1,
+        .minor = 0,
+        .section_len = -1,
+        .len_trailer = sizeof(shb),
+    };
+    PcapngIdb idb = {
+        .type = PCAPNG_IDB_TYPE,
+        .len = sizeof(idb),
+        .linktype = CXL_CAPTURE_LINKTYPE,
+        .snaplen = CXL_CAPTURE_SNAPLEN,
+        .tsresol_code = PCAPNG_OPT_IF_TSRESOL,
+        .tsresol_len = 1,
+        .tsresol = 9, /* 10^-9 s */
+        .end_code = PCAPNG_OPT_ENDOFOPT,
+        .len_trailer = sizeof(idb),
+    };
+
+    return fwrite(&shb, sizeof(shb), 1, file) == 1 &&
+           fwrite(&idb, sizeof(idb), 1, file) == 1;
+}
+
+static void cxl_capture_write_slot(CXLCapture *cap, CXLCaptureSlot *slot)
+{
+    static const uint8_t pad[4];
+    uint32_t padded = ROUND_UP(slot->len, 4);
+    uint32_t block_len = sizeof(PcapngEpbHeader) + padded +
+                         sizeof(PcapngEpbTrailer);
+    PcapngEpbHeader hdr = {
+        .type = PCAPNG_EPB_TYPE,
+        .len = block_len,
+        .ifid = 0,
+        .ts_high = (uint64_t)slot->ts_ns >> 32,
+        .ts_low = (uint32_t)slot->ts_ns,
+        .cap_len = slot->len,
+        .orig_len = slot->orig_len,
+    };
+    PcapngEpbTrailer trailer = {
+        .flags_code = PCAPNG_OPT_EPB_FLAGS,
+        .flags_len = sizeof(uint32_t),
+        .flags = slot->dir,
+        .end_code = PCAPNG_OPT_ENDOFOPT,
+        .len = block_len,
+    };
+
+    fwrite(&hdr, sizeof(hdr), 1, cap->file);
+    fwrite(slot->data, slot->len, 1, cap->file);
+    fwrite(pad, padded - slot->len, 1, cap->file);
+    fwrite(&trailer, sizeof(trailer), 1, cap->file);
+}
+
+static unsigned int cxl_capture_drain(CXLCapture *cap)
+{
+    uint32_t tail = cap->tail;
+    unsigned int n = 0;
+    CXLCaptureSlot *slot;
+
+    for (;;) {
+        slot = &cap->slots[tail % CXL_CAPTURE_RING_SLOTS];
+        if (qatomic_load_acquire(&slot->seq) != tail + 1) {
+            break;
+        }
+        cxl_capture_write_slot(cap, slot);
+        /* hand the slot back to the producers */
+        qatomic_store_release(&cap->tail, ++tail);
+        n++;
+    }
+
+    return n;
+}
+
+static void *cxl_capture_main(void *opaque)
+{
+    CXLCapture *cap = opaque;
+
+    for (;;) {
+        qemu_event_reset(&cap->wake);
+        if (cxl_capture_drain(cap)) {
+            continue;
+        }
+        if (qatomic_read(&cap->stop)) {
+            break;
+        }
+        fflush(cap->file);
+        qemu_event_wait(&cap->wake);
+    }
+
+    return NULL;
+}
+
+void cxl_capture_packet(CXLCapture *cap, CXLCaptureDir dir, const void *buf,
+                        size_t len)
+{
+    CXLCaptureSlot *slot;
+    uint32_t head;
+
+    do {
+        head = qatomic_read(&cap->head);
+        if (head - qatomic_load_acquire(&cap->tail) >=
+            CXL_CAPTURE_RING_SLOTS) {
+            qatomic_inc(&cap->dropped);
+            return;
+        }
+    } while (qatomic_cmpxchg(&cap->head, head, head + 1) != head);
+
+    slot = &cap->slots[head % CXL_CAPTURE_RING_SLOTS];
+    slot->ts_ns = qemu_clock_get_ns(QEMU_CLOCK_HOST);
+    slot->dir = dir;
+    slot->orig_len = len;
+    slot->len = MIN(len, CXL_CAPTURE_SNAPLEN);
+    memcpy(slot->data, buf, slot->len);
+    qatomic_store_release(&slot->seq, head + 1);
+
+    qemu_event_set(&cap->wake);
+}
+
+void cxl_capture_close(CXLCapture *cap)
+{
+    qatomic_set(&cap->stop, true);
+    qemu_event_set(&cap->wake);
+    qemu_thread_join(&cap->thread);
+
+    if (cap->dropped) {
+        warn_report("cxl capture %s: dropped %u packets, ring full",
+                    cap->path, cap->dropped);
+    }
+    fclose(cap->file);
+    qemu_event_destroy(&cap->wake);
+    g_free(cap->slots);
+    g_free(cap->path);
+    g_free(cap);
+}
+
+CXLCapture *cxl_capture_open(const char *path, Error **errp)
+{
+    CXLCapture *cap;
+    FILE *file;
+
+    file = fopen(path, "wb");
+    if (!file) {
+        error_setg_errno(errp, errno, "cannot open capture file '%s'", path);
+        return NULL;
+    }
+
+    cap = g_new0(CXLCapture, 1);
+    cap->path = g_strdup(path);
+    cap->file = file;
+    cap->slots = g_new0(CXLCaptureSlot, CXL_CAPTURE_RING_SLOTS);
+    setvbuf(file, NULL, _IOFBF, CXL_CAPTURE_FILE_BUFSIZE);
+
+    if (!cxl_capture_write_header(file)) {
+        error_setg_errno(errp, errno, "cannot write capture file '%s'", path);
+        fclose(file);
+        g_free(cap->slots);
+        g_free(cap->path);
+        g_free(cap);
+        return NULL;
+    }
+
+    qemu_event_init(&cap->wake, false);
+    qemu_thread_create(&cap->thread, "cxl-capture", cxl_capture_main, cap,
+                       QEMU_THREAD_JOINABLE);
+
+    return cap;
+}
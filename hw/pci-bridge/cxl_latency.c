@@ -0,0 +1,142 @@
+/*
+ * QEMU CXL Remote Transaction Latency Histogram Implementation
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+#include "hw/cxl/cxl_latency.h"
+
+static unsigned int cxl_latency_bucket(uint64_t ns)
+{
+    unsigned int msb, shift;
+
+    if (ns < CXL_LATENCY_SUB_BUCKETS) {
+        return ns;
+    }
+
+    msb = 63 - clz64(ns);
+    shift = msb - CXL_LATENCY_SUB_BUCKET_BITS;
+
+    return ((shift + 1) << CXL_LATENCY_SUB_BUCKET_BITS) +
+           ((ns >> shift) & (CXL_LATENCY_SUB_BUCKETS - 1));
+}
+
+static uint64_t cxl_latency_bucket_lower(unsigned int idx)
+{
+    unsigned int shift;
+
+    if (idx < CXL_LATENCY_SUB_BUCKETS) {
+        return idx;
+    }
+
+    shift = (idx >> CXL_LATENCY_SUB_BUCKET_BITS) - 1;
+
+    return (uint64_t)(CXL_LATENCY_SUB_BUCKETS +
+                      (idx & (CXL_LATENCY_SUB_BUCKETS - 1))) << shift;
+}
+
+static uint64_t cxl_latency_bucket_upper(unsigned int idx)
+{
+    unsigned int shift;
+
+    if (idx < CXL_LATENCY_SUB_BUCKETS) {
+        return idx;
+    }
+
+    shift = (idx >> CXL_LATENCY_SUB_BUCKET_BITS) - 1;
+
+    return cxl_latency_bucket_lower(idx) + (1ULL << shift) - 1;
+}
+
+/* Upper bound of the bucket holding the rank-th smallest value (from 1) */
+static uint64_t cxl_latency_percentile(const uint64_t *counts, uint64_t total,
+                                       unsigned int permille)
+{
+    uint64_t rank = DIV_ROUND_UP(total * permille, 1000);
+    uint64_t seen = 0;
+    unsigned int i;
+
+    if (!total) {
+        return 0;
+    }
+
+    for (i = 0; i < CXL_LATENCY_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= MAX(rank, 1)) {
+            return cxl_latency_bucket_upper(i);
+        }
+    }
+
+    return cxl_latency_bucket_upper(CXL_LATENCY_BUCKETS - 1);
+}
+
+void cxl_latency_record(CXLLatencyHistogram *hist, int64_t start_ns)
+{
+    int64_t delta = get_clock() - start_ns;
+    uint64_t ns = MAX(delta, 0);
+
+    stat64_add(&hist->buckets[cxl_latency_bucket(ns)], 1);
+    stat64_add(&hist->sum_ns, ns);
+    stat64_min(&hist->min_ns, ns);
+    stat64_max(&hist->max_ns, ns);
+}
+
+CxlLatencyClassInfo *cxl_latency_query(CXLLatencyHistogram *hist,
+                                       CxlLatencyClass type)
+{
+    CxlLatencyClassInfo *info = g_new0(CxlLatencyClassInfo, 1);
+    CxlLatencyBucketList **tail = &info->buckets;
+    g_autofree uint64_t *counts = g_new(uint64_t, CXL_LATENCY_BUCKETS);
+    uint64_t total = 0;
+    unsigned int i;
+
+    /*
+     * Take one snapshot of the buckets so the percentiles agree with each
+     * other even while transactions keep being recorded.
+     */
+    for (i = 0; i < CXL_LATENCY_BUCKETS; i++) {
+        counts[i] = stat64_get(&hist->buckets[i]);
+        total += counts[i];
+
+        if (counts[i]) {
+            CxlLatencyBucket *bucket = g_new0(CxlLatencyBucket, 1);
+
+            bucket->lower_ns = cxl_latency_bucket_lower(i);
+            bucket->upper_ns = cxl_latency_bucket_upper(i);
+            bucket->count = counts[i];
+            QAPI_LIST_APPEND(tail, bucket);
+        }
+    }
+
+    info->type = type;
+    info->count = total;
+    if (total) {
+        info->min_ns = stat64_get(&hist->min_ns);
+        info->max_ns = stat64_get(&hist->max_ns);
+        info->mean_ns = stat64_get(&hist->sum_ns) / total;
+    }
+    info->p50_ns = cxl_latency_percentile(counts, total, 500);
+    info->p90_ns = cxl_latency_percentile(counts, total, 900);
+    info->p99_ns = cxl_latency_percentile(counts, total, 990);
+    info->p999_ns = cxl_latency_percentile(counts, total, 999);
+
+    return info;
+}
+
+void cxl_latency_reset(CXLLatencyHistogram *hist)
+{
+    unsigned int i;
+
+    for (i = 0; i < CXL_LATENCY_BUCKETS; i++) {
+        stat64_init(&hist->buckets[i], 0);
+    }
+    stat64_init(&hist->sum_ns, 0);
+    stat64_init(&hist->min_ns, UINT64_MAX);
+    stat64_init(&hist->max_ns, 0);
+}
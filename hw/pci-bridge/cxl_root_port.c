@@ -20,14 +20,19 @@
 #include "qemu/osdep.h"
 #include "qemu/log.h"
 #include "qemu/range.h"
+#include "qemu/timer.h"
 #include "hw/pci/pci_bridge.h"
 #include "hw/pci/pcie_port.h"
 #include "hw/pci/msi.h"
 #include "hw/qdev-properties.h"
 #include "hw/sysbus.h"
 #include "qapi/error.h"
+#include "qapi/qapi-commands-cxl.h"
+#include "sysemu/sysemu.h"
 #include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_capture.h"
 #include "hw/cxl/cxl_emulator_packet.h"
+#include "hw/cxl/cxl_latency.h"
 #include "hw/cxl/cxl_socket_transport.h"
 #include "trace.h"
 
@@ -60,6 +65,14 @@ typedef struct CXLRootPort {
     uint32_t socket_port;
     uint32_t switch_port;
     int socket_fd;
+
+    /* pcap-ng file recording the socket stream, if requested */
+    char *capture_path;
+    CXLCapture *capture;
+    Notifier exit_notifier;
+
+    /* Remote transaction latency, indexed by CxlLatencyClass */
+    CXLLatencyHistogram latency[CXL_LATENCY_CLASS__MAX];
 } CXLRootPort;
 
 #define TYPE_CXL_ROOT_PORT "cxl-rp"
@@ -121,6 +134,7 @@ MemTxResult cxl_remote_cxl_mem_read(PCIDevice *d, hwaddr host_addr,
     trace_cxl_root_cxl_cxl_mem_read(host_addr);
 
     CXLRootPort *crp = CXL_ROOT_PORT(d);
+    int64_t start_ns = get_clock();
 
     uint16_t tag;
     if (!send_cxl_mem_mem_read(crp->socket_fd, host_addr, &tag)) {
@@ -140,6 +154,7 @@ MemTxResult cxl_remote_cxl_mem_read(PCIDevice *d, hwaddr host_addr,
 
     *data = *(uint8_t *)(cxl_packet->data);
     release_packet_entry(tag);
+    cxl_latency_record(&crp->latency[CXL_LATENCY_CLASS_MEM_READ], start_ns);
 
     return MEMTX_OK;
 }
@@ -208,6 +223,7 @@ MemTxResult cxl_remote_cxl_mem_write(PCIDevice *d, hwaddr host_addr,
     trace_cxl_root_cxl_cxl_mem_write(host_addr);
 
     CXLRootPort *crp = CXL_ROOT_PORT(d);
+    int64_t start_ns = get_clock();
 
     uint16_t tag;
 
@@ -223,6 +239,7 @@ MemTxResult cxl_remote_cxl_mem_write(PCIDevice *d, hwaddr host_addr,
         trace_cxl_root_debug_message("Failed to get CXL.mem MEM DATA response");
         return MEMTX_OK;
     }
+    cxl_latency_record(&crp->latency[CXL_LATENCY_CLASS_MEM_WRITE], start_ns);
 
     return MEMTX_OK;
 }
@@ -232,6 +249,7 @@ void cxl_remote_mem_read(PCIDevice *d, uint64_t addr, uint64_t *val, int size)
     trace_cxl_root_cxl_io_mmio_read(addr, size);
 
     CXLRootPort *crp = CXL_ROOT_PORT(d);
+    int64_t start_ns = get_clock();
     uint16_t tag;
 
     if (!send_cxl_io_mem_read(crp->socket_fd, addr, size, &tag)) {
@@ -249,6 +267,7 @@ void cxl_remote_mem_read(PCIDevice *d, uint64_t addr, uint64_t *val, int size)
 
     *val = cxl_packet->data;
     release_packet_entry(tag);
+    cxl_latency_record(&crp->latency[CXL_LATENCY_CLASS_MMIO_READ], start_ns);
 }
 
 void cxl_remote_mem_write(PCIDevice *d, uint64_t addr, uint64_t val, int size)
@@ -256,12 +275,15 @@ void cxl_remote_mem_write(PCIDevice *d, uint64_t addr, uint64_t val, int size)
     trace_cxl_root_cxl_io_mmio_write(addr, size, val);
 
     CXLRootPort *crp = CXL_ROOT_PORT(d);
+    int64_t start_ns = get_clock();
     uint16_t tag;
 
     if (!send_cxl_io_mem_write(crp->socket_fd, addr, val, size, &tag)) {
         trace_cxl_root_debug_message("Failed to send CXL.io MEM WR request");
         assert(0);
     }
+    /* posted, so this only covers handing the request to the socket */
+    cxl_latency_record(&crp->latency[CXL_LATENCY_CLASS_MMIO_WRITE], start_ns);
 }
 
 static bool is_type0_config_request(PCIDevice *root_port, uint16_t bdf)
@@ -289,6 +311,7 @@ void cxl_remote_config_space_read(PCIDevice *d, uint16_t bdf, uint32_t offset,
 
     CXLRootPort *crp = CXL_ROOT_PORT(d);
     bool type0 = is_type0_config_request(d, bdf);
+    int64_t start_ns;
     uint16_t tag;
     const uint8_t bus = bdf >> 8;
     const uint8_t device = bdf & 0x1F >> 3;
@@ -302,6 +325,7 @@ void cxl_remote_config_space_read(PCIDevice *d, uint16_t bdf, uint32_t offset,
                                                  size);
     }
 
+    start_ns = get_clock();
     if (!send_cxl_io_config_space_read(crp->socket_fd, bdf, offset, size, type0,
                                        &tag)) {
         trace_cxl_root_debug_message("Failed to send CXL.io CFG RD request");
@@ -309,6 +333,7 @@ void cxl_remote_config_space_read(PCIDevice *d, uint16_t bdf, uint32_t offset,
     }
 
     wait_for_cxl_io_cfg_completion(crp->socket_fd, tag, val);
+    cxl_latency_record(&crp->latency[CXL_LATENCY_CLASS_CONFIG_READ], start_ns);
 
     release_packet_entry(tag);
 }
@@ -323,6 +348,7 @@ void cxl_remote_config_space_write(PCIDevice *d, uint16_t bdf, uint32_t offset,
 
     CXLRootPort *crp = CXL_ROOT_PORT(d);
     bool type0 = is_type0_config_request(d, bdf);
+    int64_t start_ns;
     uint16_t tag;
     const uint8_t bus = bdf >> 8;
     const uint8_t device = bdf & 0x1F >> 3;
@@ -336,6 +362,7 @@ void cxl_remote_config_space_write(PCIDevice *d, uint16_t bdf, uint32_t offset,
                                                   size, val);
     }
 
+    start_ns = get_clock();
     if (!send_cxl_io_config_space_write(crp->socket_fd, bdf, offset, val, size,
                                         type0, &tag)) {
         trace_cxl_root_debug_message("Failed to send CXL.io CFG WR request");
@@ -343,6 +370,8 @@ void cxl_remote_config_space_write(PCIDevice *d, uint16_t bdf, uint32_t offset,
     }
 
     wait_for_cxl_io_cfg_completion(crp->socket_fd, tag, NULL);
+    cxl_latency_record(&crp->latency[CXL_LATENCY_CLASS_CONFIG_WRITE],
+                       start_ns);
 
     release_packet_entry(tag);
 }
@@ -464,6 +493,21 @@ static void build_dvsecs(CXLComponentState *cxl)
                                REG_LOC_DVSEC, REG_LOC_DVSEC_REVID, dvsec);
 }
 
+static void cxl_rp_capture_release(CXLRootPort *crp)
+{
+    cxl_socket_set_capture(crp->socket_fd, NULL);
+    cxl_capture_close(crp->capture);
+    crp->capture = NULL;
+}
+
+/* The root port is never unplugged, so the capture is flushed on exit */
+static void cxl_rp_exit_notify(Notifier *notifier, void *data)
+{
+    CXLRootPort *crp = container_of(notifier, CXLRootPort, exit_notifier);
+
+    cxl_rp_capture_release(crp);
+}
+
 static bool cxl_rp_init_socket_client(CXLRootPort *crp)
 {
     crp->socket_fd = create_socket_client(crp->socket_host, crp->socket_port);
@@ -471,6 +515,10 @@ static bool cxl_rp_init_socket_client(CXLRootPort *crp)
         return false;
     }
 
+    if (crp->capture) {
+        cxl_socket_set_capture(crp->socket_fd, crp->capture);
+    }
+
     if (!send_sideband_connection_request(crp->socket_fd, crp->switch_port)) {
         trace_cxl_root_debug_message(
             "CXL Root Port: Failed to send connection request");
@@ -597,15 +645,38 @@ static void cxl_rp_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    for (int i = 0; i < CXL_LATENCY_CLASS__MAX; i++) {
+        cxl_latency_reset(&crp->latency[i]);
+    }
+
+    if (crp->capture_path) {
+        crp->capture = cxl_capture_open(crp->capture_path, errp);
+        if (!crp->capture) {
+            return;
+        }
+    }
+
     if (!cxl_rp_init_socket_client(crp)) {
-        return;
+        goto err_release_capture;
     }
 
     if (!cxl_rp_enumerate_child_devices(crp, errp)) {
-        return;
+        goto err_release_capture;
+    }
+
+    /* Only a port whose transport came up has a capture left to flush */
+    if (crp->capture) {
+        crp->exit_notifier.notify = cxl_rp_exit_notify;
+        qemu_add_exit_notifier(&crp->exit_notifier);
     }
 
     trace_cxl_root_debug_message("Realized CXLRootPort Class instance");
+    return;
+
+err_release_capture:
+    if (crp->capture) {
+        cxl_rp_capture_release(crp);
+    }
 }
 
 static void cxl_rp_reset_hold(Object *obj)
@@ -631,6 +702,7 @@ static Property gen_rp_props[] = {
     DEFINE_PROP_STRING("socket-host", CXLRootPort, socket_host),
     DEFINE_PROP_UINT32("socket-port", CXLRootPort, socket_port, 8000),
     DEFINE_PROP_UINT32("switch-port", CXLRootPort, switch_port, 0),
+    DEFINE_PROP_STRING("capture", CXLRootPort, capture_path),
     DEFINE_PROP_END_OF_LIST()
 };
 
@@ -683,6 +755,62 @@ static void cxl_rp_write_config(PCIDevice *d, uint32_t address, uint32_t val,
     cxl_rp_dvsec_write_config(d, address, val, len);
 }
 
+static int cxl_rp_query_latency(Object *obj, void *opaque)
+{
+    CxlLatencyInfoList ***tail = opaque;
+    CxlLatencyClassInfoList **class_tail;
+    CxlLatencyInfo *info;
+    CXLRootPort *crp;
+
+    if (!object_dynamic_cast(obj, TYPE_CXL_ROOT_PORT) ||
+        !cxl_is_remote_root_port(PCI_DEVICE(obj))) {
+        return 0;
+    }
+
+    crp = CXL_ROOT_PORT(obj);
+    info = g_new0(CxlLatencyInfo, 1);
+    info->path = object_get_canonical_path(obj);
+    class_tail = &info->classes;
+    for (int i = 0; i < CXL_LATENCY_CLASS__MAX; i++) {
+        QAPI_LIST_APPEND(class_tail, cxl_latency_query(&crp->latency[i], i));
+    }
+    QAPI_LIST_APPEND(*tail, info);
+
+    return 0;
+}
+
+static int cxl_rp_reset_latency(Object *obj, void *opaque)
+{
+    CXLRootPort *crp;
+
+    if (!object_dynamic_cast(obj, TYPE_CXL_ROOT_PORT) ||
+        !cxl_is_remote_root_port(PCI_DEVICE(obj))) {
+        return 0;
+    }
+
+    crp = CXL_ROOT_PORT(obj);
+    for (int i = 0; i < CXL_LATENCY_CLASS__MAX; i++) {
+        cxl_latency_reset(&crp->latency[i]);
+    }
+
+    return 0;
+}
+
+CxlLatencyInfoList *qmp_query_cxl_latency(bool has_reset, bool reset,
+                                          Error **errp)
+{
+    CxlLatencyInfoList *head = NULL, **tail = &head;
+
+    object_child_foreach_recursive(object_get_root(), cxl_rp_query_latency,
+                                   &tail);
+    if (has_reset && reset) {
+        object_child_foreach_recursive(object_get_root(),
+                                       cxl_rp_reset_latency, NULL);
+    }
+
+    return head;
+}
+
 static void cxl_root_port_class_init(ObjectClass *oc, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(oc);
@@ -2,9 +2,12 @@
 #include "qemu/log.h"
 #include "qemu/range.h"
 #include "qemu/bitops.h"
+#include "qemu/atomic.h"
 #include "hw/cxl/cxl_socket_transport.h"
+#include "hw/cxl/cxl_capture.h"
 #include "hw/cxl/cxl_endian.h"
 #include "hw/cxl/cxl_pretty.h"
+#include "exec/replay-core.h"
 #include "trace.h"
 
 #include <arpa/inet.h>
@@ -43,6 +46,15 @@ typedef struct packet_table_entry {
 
 packet_table_entry_t packet_entries[512] = { 0 };
 
+#define MAX_CAPTURES 16
+
+typedef struct capture_entry {
+    int socket_fd;
+    CXLCapture *cap;
+} capture_entry_t;
+
+static capture_entry_t capture_entries[MAX_CAPTURES];
+
 /* FUNCTION PROTOTYPES */
 
 /**
@@ -57,11 +69,76 @@ static bool wait_for_payload(int socket_fd, uint8_t *buffer, size_t buffer_size,
 static bool wait_for_system_header(int socket_fd, uint8_t *buffer,
                                    size_t buffer_size);
 static uint16_t get_next_tag(void);
+static size_t read_packet(int socket_fd, uint8_t *buffer, size_t buffer_size);
 static bool process_incoming_packets(int socket_fd);
 static packet_table_entry_t *get_packet_entry(uint16_t tag);
+static CXLCapture *get_capture(int socket_fd);
+static ssize_t send_packet(int socket_fd, const void *packet, size_t size);
 
 /* DEFINITIONS */
 
+CXLCapture *get_capture(int socket_fd)
+{
+    int i;
+
+    for (i = 0; i < MAX_CAPTURES; i++) {
+        CXLCapture *cap = qatomic_load_acquire(&capture_entries[i].cap);
+
+        if (cap && capture_entries[i].socket_fd == socket_fd) {
+            return cap;
+        }
+    }
+
+    return NULL;
+}
+
+/* Passing a NULL capture stops recording the socket */
+bool cxl_socket_set_capture(int socket_fd, CXLCapture *cap)
+{
+    int i;
+
+    for (i = 0; i < MAX_CAPTURES; i++) {
+        if (capture_entries[i].cap &&
+            capture_entries[i].socket_fd == socket_fd) {
+            qatomic_store_release(&capture_entries[i].cap, cap);
+            return true;
+        }
+    }
+
+    if (!cap) {
+        return true;
+    }
+
+    for (i = 0; i < MAX_CAPTURES; i++) {
+        if (!capture_entries[i].cap) {
+            capture_entries[i].socket_fd = socket_fd;
+            qatomic_store_release(&capture_entries[i].cap, cap);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+ssize_t send_packet(int socket_fd, const void *packet, size_t size)
+{
+    CXLCapture *cap = get_capture(socket_fd);
+    ssize_t ret;
+
+    /* On replay there is no emulator, responses come from the log */
+    if (replay_mode == REPLAY_MODE_PLAY) {
+        ret = size;
+    } else {
+        ret = write(socket_fd, packet, size);
+    }
+
+    if (cap && ret != -1) {
+        cxl_capture_packet(cap, CXL_CAPTURE_TX, packet, ret);
+    }
+
+    return ret;
+}
+
 static inline cxl_io_fmt_type_t get_io_fmt(uint8_t *raw_pckt_pld_buf)
 {
     return ((cxl_io_header_t *)raw_pckt_pld_buf)->fmt_type;
@@ -122,14 +199,12 @@ uint16_t get_next_tag(void)
     return 0;
 }
 
-bool process_incoming_packets(int socket_fd)
+/* Reads one whole packet, returns its length or 0 on failure */
+size_t read_packet(int socket_fd, uint8_t *buffer, size_t buffer_size)
 {
-    uint8_t buffer[MAX_PAYLOAD_SIZE];
-    size_t buffer_size = sizeof(buffer);
-
     if (!wait_for_system_header(socket_fd, buffer, buffer_size)) {
         trace_cxl_socket_debug_msg("Failed to get system header");
-        return false;
+        return 0;
     }
 
     trace_cxl_socket_debug_msg("Received system header");
@@ -149,13 +224,44 @@ bool process_incoming_packets(int socket_fd)
     if (!wait_for_payload(socket_fd, &buffer[buffer_offset], buffer_size,
                           remaining_payload_size)) {
         trace_cxl_socket_debug_msg("Failed to get packet payload");
+        return 0;
+    }
+
+    return system_header->payload_length;
+}
+
+/*
+ * Received packets are the only nondeterministic input of the transport, so
+ * under record/replay every receive, including a failed one, is an event in
+ * the replay log and playback never touches the socket.
+ */
+bool process_incoming_packets(int socket_fd)
+{
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    size_t payload_length;
+
+    if (replay_mode == REPLAY_MODE_PLAY) {
+        payload_length = replay_read_cxl_packet(buffer, sizeof(buffer));
+    } else {
+        payload_length = read_packet(socket_fd, buffer, sizeof(buffer));
+        if (replay_mode == REPLAY_MODE_RECORD) {
+            replay_save_cxl_packet(buffer, payload_length);
+        }
+    }
+
+    if (!payload_length) {
         return false;
     }
 
+    CXLCapture *cap = get_capture(socket_fd);
+    if (cap) {
+        cxl_capture_packet(cap, CXL_CAPTURE_RX, buffer, payload_length);
+    }
+
     const uint16_t tag = 0;
     assert(packet_entries[tag].packet_size == 0);
-    memcpy(packet_entries[tag].packet, buffer, system_header->payload_length);
-    packet_entries[tag].packet_size = system_header->payload_length;
+    memcpy(packet_entries[tag].packet, buffer, payload_length);
+    packet_entries[tag].packet_size = payload_length;
     return true;
 }
 
@@ -192,7 +298,7 @@ bool send_sideband_connection_request(int socket_fd, uint32_t port)
     packet.sideband_header.type = SIDEBAND_CONNECTION_REQUEST;
     packet.port = port;
 
-    if (write(socket_fd, &packet, sizeof(packet)) == -1) {
+    if (send_packet(socket_fd, &packet, sizeof(packet)) == -1) {
         // TODO: Add trace for warning
         return false;
     }
@@ -238,7 +344,7 @@ bool send_cxl_mem_mem_write(int socket_fd, hwaddr hpa, uint8_t *data,
 
     trace_cxl_socket_debug_num("CXL.mem M2S_RWD Packet Size", sizeof(packet));
 
-    bool successful = write(socket_fd, &packet, sizeof(packet)) != -1;
+    bool successful = send_packet(socket_fd, &packet, sizeof(packet)) != -1;
 
     trace_cxl_socket_debug_msg("[Sending Packet] END");
 
@@ -260,7 +366,7 @@ bool send_cxl_mem_mem_read(int socket_fd, hwaddr hpa, uint16_t *tag)
 
     trace_cxl_socket_debug_num("CXL.mem M2S_REQ Packet Size", sizeof(packet));
 
-    bool successful = write(socket_fd, &packet, sizeof(packet)) != -1;
+    bool successful = send_packet(socket_fd, &packet, sizeof(packet)) != -1;
 
     trace_cxl_socket_debug_msg("[Sending Packet] END");
 
@@ -336,7 +442,7 @@ bool send_cxl_io_mem_read(int socket_fd, hwaddr hpa, int size, uint16_t *tag)
 
     trace_cxl_socket_debug_num("MRD_64B Packet Size", sizeof(packet));
 
-    bool successful = write(socket_fd, &packet, sizeof(packet)) != -1;
+    bool successful = send_packet(socket_fd, &packet, sizeof(packet)) != -1;
 
     trace_cxl_socket_debug_msg("[Sending Packet] END");
 
@@ -377,7 +483,7 @@ bool send_cxl_io_mem_write(int socket_fd, hwaddr hpa, uint64_t val, int size,
 
     trace_cxl_socket_debug_num("MRD_64B Packet Size", sizeof(packet));
 
-    bool successful = write(socket_fd, &packet, sizeof(packet)) != -1;
+    bool successful = send_packet(socket_fd, &packet, sizeof(packet)) != -1;
 
     trace_cxl_socket_debug_msg("[Sending Packet] END");
 
@@ -444,7 +550,7 @@ bool send_cxl_io_config_space_read(int socket_fd, uint16_t bdf, uint32_t offset,
 
     trace_cxl_socket_debug_num("CFG RD Packet Size", sizeof(packet));
 
-    bool successful = write(socket_fd, &packet, sizeof(packet)) != -1;
+    bool successful = send_packet(socket_fd, &packet, sizeof(packet)) != -1;
 
     trace_cxl_socket_debug_msg("[Sending Packet] END");
 
@@ -481,7 +587,7 @@ bool send_cxl_io_config_space_write(int socket_fd, uint16_t bdf,
 
     trace_cxl_socket_debug_num("CFG WR Packet Size", sizeof(packet));
 
-    bool successful = write(socket_fd, &packet, sizeof(packet)) != -1;
+    bool successful = send_packet(socket_fd, &packet, sizeof(packet)) != -1;
 
     trace_cxl_socket_debug_msg("[Sending Packet] END");
 
@@ -590,6 +696,14 @@ int32_t create_socket_client(const char *host, uint32_t port)
         return -1;
     }
 
+    /*
+     * On replay the socket is only a handle for the capture, all received
+     * packets come from the replay log.
+     */
+    if (replay_mode == REPLAY_MODE_PLAY) {
+        return sockfd;
+    }
+
     // Set the socket address
     struct sockaddr_in addr;
     struct hostent *he;
@@ -89,6 +89,8 @@ static void cxl_usp_reset(DeviceState *qdev)
     pci_bridge_reset(qdev);
     pcie_cap_deverr_reset(d);
     latch_registers(usp);
+    /* The downstream ports the table describes are all realized by now */
+    cxl_doe_cdat_update(&usp->cxl_cstate, &error_fatal);
 }
 
 static void build_dvsecs(CXLComponentState *cxl)
@@ -122,46 +124,8 @@ static void build_dvsecs(CXLComponentState *cxl)
 
 static bool cxl_doe_cdat_rsp(DOECap *doe_cap)
 {
-    CDATObject *cdat = &CXL_USP(doe_cap->pdev)->cxl_cstate.cdat;
-    uint16_t ent;
-    void *base;
-    uint32_t len;
-    CDATReq *req = pcie_doe_get_write_mbox_ptr(doe_cap);
-    CDATRsp rsp;
-
-    cxl_doe_cdat_update(&CXL_USP(doe_cap->pdev)->cxl_cstate, &error_fatal);
-    assert(cdat->entry_len);
-
-    /* Discard if request length mismatched */
-    if (pcie_doe_get_obj_len(req) <
-        DIV_ROUND_UP(sizeof(CDATReq), sizeof(uint32_t))) {
-        return false;
-    }
-
-    ent = req->entry_handle;
-    base = cdat->entry[ent].base;
-    len = cdat->entry[ent].length;
-
-    rsp = (CDATRsp) {
-        .header = {
-            .vendor_id = CXL_VENDOR_ID,
-            .data_obj_type = CXL_DOE_TABLE_ACCESS,
-            .reserved = 0x0,
-            .length = DIV_ROUND_UP((sizeof(rsp) + len), sizeof(uint32_t)),
-        },
-        .rsp_code = CXL_DOE_TAB_RSP,
-        .table_type = CXL_DOE_TAB_TYPE_CDAT,
-        .entry_handle = (ent < cdat->entry_len - 1) ?
-                        ent + 1 : CXL_DOE_TAB_ENT_MAX,
-    };
-
-    memcpy(doe_cap->read_mbox, &rsp, sizeof(rsp));
-    memcpy(doe_cap->read_mbox + DIV_ROUND_UP(sizeof(rsp), sizeof(uint32_t)),
-           base, len);
-
-    doe_cap->read_mbox_len += rsp.header.length;
-
-    return true;
+    return cxl_doe_cdat_read_entry(doe_cap,
+                                   &CXL_USP(doe_cap->pdev)->cxl_cstate);
 }
 
 static DOEProtocol doe_cdat_prot[] = {
@@ -342,6 +306,10 @@ err_bridge:
 
 static void cxl_usp_exitfn(PCIDevice *d)
 {
+    CXLUpstreamPort *usp = CXL_USP(d);
+
+    pcie_doe_fini(&usp->doe_cdat);
+    cxl_doe_cdat_release(&usp->cxl_cstate);
     pcie_aer_exit(d);
     pcie_cap_exit(d);
     msi_uninit(d);
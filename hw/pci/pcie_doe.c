@@ -12,6 +12,9 @@
 #include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "qemu/range.h"
+#include "qemu/main-loop.h"
+#include "block/aio-wait.h"
+#include "block/thread-pool.h"
 #include "hw/pci/pci.h"
 #include "hw/pci/pcie.h"
 #include "hw/pci/pcie_doe.h"
@@ -122,9 +125,13 @@ void pcie_doe_init(PCIDevice *dev, DOECap *doe_cap, uint16_t offset,
 
 void pcie_doe_fini(DOECap *doe_cap)
 {
+    /* The handler of a request still in flight uses the mailboxes */
+    AIO_WAIT_WHILE(NULL, doe_cap->status.busy);
+
     g_free(doe_cap->read_mbox);
     g_free(doe_cap->write_mbox);
-    g_free(doe_cap);
+    doe_cap->read_mbox = NULL;
+    doe_cap->write_mbox = NULL;
 }
 
 uint32_t pcie_doe_build_protocol(DOEProtocol *p)
@@ -201,16 +208,51 @@ static void pcie_doe_set_error(DOECap *doe_cap, bool err)
     }
 }
 
+/*
+ * Requests are answered from the thread pool, so neither the vCPU that
+ * sets GO nor the main loop waits on a protocol handler, and the DOE
+ * instances of several devices progress at the same time. Busy stays set
+ * until the handler returns; meanwhile the guest can only read the status
+ * or ask for an abort, which takes effect once the handler is done.
+ */
+static int pcie_doe_worker(void *opaque)
+{
+    DOECap *doe_cap = opaque;
+
+    return doe_cap->handle_request(doe_cap) ? 0 : -EINVAL;
+}
+
+static void pcie_doe_worker_done(void *opaque, int ret)
+{
+    DOECap *doe_cap = opaque;
+
+    doe_cap->status.busy = 0;
+    doe_cap->handle_request = NULL;
+
+    if (doe_cap->abort_pending) {
+        doe_cap->abort_pending = false;
+        pcie_doe_set_error(doe_cap, 0);
+        pcie_doe_reset_mbox(doe_cap);
+    } else if (ret == 0) {
+        pcie_doe_set_ready(doe_cap, 1);
+        return;
+    } else {
+        pcie_doe_reset_mbox(doe_cap);
+    }
+
+    /* Busy clearing raises the interrupt too, r6.0 7.9.24.4 */
+    pcie_doe_irq_assert(doe_cap);
+}
+
 /*
  * Check incoming request in write_mbox for protocol format
  */
 static void pcie_doe_prepare_rsp(DOECap *doe_cap)
 {
-    bool success = false;
     int p;
     bool (*handle_request)(DOECap *) = NULL;
 
-    if (doe_cap->status.error) {
+    if (doe_cap->status.error || doe_cap->status.busy) {
         return;
     }
 
@@ -239,16 +281,22 @@ static void pcie_doe_prepare_rsp(DOECap *doe_cap)
      * indicated Length for a data object, then the
      * data object must be silently discarded.
      */
-    if (handle_request && (doe_cap->write_mbox_len ==
+    if (!handle_request || (doe_cap->write_mbox_len !=
         pcie_doe_get_obj_len(pcie_doe_get_write_mbox_ptr(doe_cap)))) {
-        success = handle_request(doe_cap);
-    }
-
-    if (success) {
-        pcie_doe_set_ready(doe_cap, 1);
-    } else {
         pcie_doe_reset_mbox(doe_cap);
+        return;
     }
+
+    /* A response left unread is dropped for the new one */
+    pcie_doe_set_ready(doe_cap, 0);
+    doe_cap->read_mbox_idx = 0;
+    doe_cap->read_mbox_len = 0;
+
+    doe_cap->status.busy = 1;
+    doe_cap->handle_request = handle_request;
+    thread_pool_submit_aio(aio_get_thread_pool(qemu_get_aio_context()),
+                           pcie_doe_worker, doe_cap,
+                           pcie_doe_worker_done, doe_cap);
 }
 
 /*
@@ -324,6 +372,10 @@ bool pcie_doe_write_config(DOECap *doe_cap,
     switch (addr) {
     case PCI_EXP_DOE_CTRL:
         if (FIELD_EX32(val, PCI_DOE_CAP_CONTROL, DOE_ABORT)) {
+            if (doe_cap->status.busy) {
+                doe_cap->abort_pending = true;
+                return true;
+            }
             pcie_doe_set_ready(doe_cap, 0);
             pcie_doe_set_error(doe_cap, 0);
             pcie_doe_reset_mbox(doe_cap);
@@ -347,8 +399,8 @@ bool pcie_doe_write_config(DOECap *doe_cap,
         }
         break;
     case PCI_EXP_DOE_RD_DATA_MBOX:
-        /* Mailbox should be DW accessed */
-        if (size != DWORD_BYTE) {
+        /* Mailbox should be DW accessed, and is the handler's while busy */
+        if (size != DWORD_BYTE || doe_cap->status.busy) {
             return true;
         }
         doe_cap->read_mbox_idx++;
@@ -361,8 +413,8 @@ bool pcie_doe_write_config(DOECap *doe_cap,
         }
         break;
     case PCI_EXP_DOE_WR_DATA_MBOX:
-        /* Mailbox should be DW accessed */
-        if (size != DWORD_BYTE) {
+        /* Mailbox should be DW accessed, and is the handler's while busy */
+        if (size != DWORD_BYTE || doe_cap->status.busy) {
             return true;
         }
         doe_cap->write_mbox[doe_cap->write_mbox_len] = val;
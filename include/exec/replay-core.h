@@ -77,4 +77,11 @@ void replay_save_random(int ret, void *buf, size_t len);
 /* Loads the saved values for the random number generator */
 int replay_read_random(void *buf, size_t len);
 
+/* Processing packets from CXL remote transports */
+
+/* Saves a received packet, a zero len records a failed receive */
+void replay_save_cxl_packet(const void *buf, size_t len);
+/* Loads a saved packet, returns its length or 0 for a failed receive */
+size_t replay_read_cxl_packet(void *buf, size_t size);
+
 #endif
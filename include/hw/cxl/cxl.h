@@ -14,6 +14,7 @@
 #include "qapi/qapi-types-machine.h"
 #include "qapi/qapi-visit-machine.h"
 #include "qemu/typedefs.h"
+#include "qemu/thread.h"
 #include "hw/pci/pci_host.h"
 #include "hw/pci/pcie_port.h"
 #include "cxl_pci.h"
@@ -26,8 +27,6 @@
 #define CXL_WINDOW_MAX 10
 
 typedef struct CXLHost CXLHost;
-#define CXL_BOOT_WAIT_TIME 30000000
-#define CXL_THREAD_DELAY 20
 
 #define CXL_DUMP_CACHE 0
 #define CXL_DEBUG_PRINT 0
@@ -101,6 +100,11 @@ struct CXLHost {
 
     CXLComponentState cxl_cstate;
     bool passthrough;
+
+    /* Host cache shared by the Type 1/2 devices below this bridge */
+    struct HostCache *hcache;
+    uint32_t hcache_users;
+    QemuSpin coh_lock;
 };
 
 #define TYPE_PXB_CXL_HOST "pxb-cxl-host"
@@ -0,0 +1,72 @@
+/*
+ * QEMU CXL Type2 Bias Table Configuration
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef CXL_BIAS_H
+#define CXL_BIAS_H
+
+#include "qemu/units.h"
+#include "hw/registerfields.h"
+#include "hw/cxl/cxl_packet.h"
+
+/*
+ * The bias table holds one bit per page of device memory; a set bit means
+ * the page is in device bias. The page size is configurable between 4 KiB
+ * and 2 MiB.
+ *
+ * Pages below CXL_BIAS_BOOT_HOST_SIZE start out in host bias and the rest
+ * in device bias, which is the layout the fixed two-entry table used to
+ * hard-wire.
+ */
+
+#define CXL_BIAS_MIN_GRANULARITY (4 * KiB)
+#define CXL_BIAS_MAX_GRANULARITY (2 * MiB)
+#define CXL_BIAS_DEFAULT_GRANULARITY CXL_BIAS_MAX_GRANULARITY
+#define CXL_BIAS_BOOT_HOST_SIZE (0x8000000)
+
+typedef struct CXLBiasTable {
+    unsigned long *bitmap;
+    uint64_t nr_pages;
+    uint32_t page_shift;
+    uint64_t flips;
+} CXLBiasTable;
+
+BiasState cxl_bias_table_lookup(CXLBiasTable *bt, uint64_t dpa);
+bool cxl_bias_table_range_valid(CXLBiasTable *bt, uint64_t dpa, uint64_t size);
+void cxl_bias_table_set_range(CXLBiasTable *bt, uint64_t dpa, uint64_t size,
+                              BiasState state);
+
+void cxl_bias_table_init(CXLBiasTable **bt, uint64_t mem_size,
+                         uint64_t granularity);
+void cxl_bias_table_release(CXLBiasTable **bt);
+
+/*
+ * Vendor specific device capability used by the guest driver to flip the
+ * bias of a page-aligned range. Software programs BASE and SIZE, then writes
+ * CTRL with TARGET and FLIP set. The device flushes whichever side loses
+ * ownership of the range before updating the table, then sets STS.DONE (or
+ * STS.ERR for a range that is not page-aligned or out of bounds) and clears
+ * CTRL.FLIP.
+ */
+#define CXL_BIAS_CONTROL_CAP_ID 0x8000
+#define CXL_BIAS_CONTROL_REGISTERS_OFFSET 0xc00
+#define CXL_BIAS_CONTROL_REGISTERS_LENGTH 0x20
+
+REG64(CXL_BIAS_CAP, 0)
+FIELD(CXL_BIAS_CAP, PAGE_SHIFT, 0, 8)
+FIELD(CXL_BIAS_CAP, NUM_PAGES, 32, 32)
+REG64(CXL_BIAS_RANGE_BASE, 0x8)
+REG64(CXL_BIAS_RANGE_SIZE, 0x10)
+REG32(CXL_BIAS_CTRL, 0x18)
+FIELD(CXL_BIAS_CTRL, TARGET, 0, 1)
+FIELD(CXL_BIAS_CTRL, FLIP, 1, 1)
+REG32(CXL_BIAS_STS, 0x1c)
+FIELD(CXL_BIAS_STS, DONE, 0, 1)
+FIELD(CXL_BIAS_STS, ERR, 1, 1)
+
+#endif
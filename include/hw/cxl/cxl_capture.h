@@ -0,0 +1,67 @@
+/*
+ * QEMU CXL Socket Packet Capture Configuration
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef CXL_CAPTURE_H
+#define CXL_CAPTURE_H
+
+#include "qemu/thread.h"
+
+/*
+ * Records every packet exchanged with the remote switch into a pcap-ng file.
+ *
+ * The file has a single interface of link type LINKTYPE_USER0 with
+ * nanosecond timestamps. Every packet is stored as an Enhanced Packet Block
+ * holding the raw bytes as they went over the socket, starting with the
+ * system_header_packet_t, so cxl_pretty.c or a Wireshark dissector bound to
+ * USER0 can decode it. The epb_flags option gives the direction: inbound
+ * for packets received from the switch, outbound for packets sent to it.
+ *
+ * Packets are copied into a fixed ring of slots by the thread doing the
+ * socket I/O, which only claims a slot with a compare-and-swap and never
+ * blocks. A background thread drains the ring into a buffered stdio stream.
+ * When the ring is full the packet is dropped and counted.
+ */
+#define CXL_CAPTURE_LINKTYPE (147) /* LINKTYPE_USER0 */
+#define CXL_CAPTURE_SNAPLEN (512)
+#define CXL_CAPTURE_RING_SLOTS (4096)
+#define CXL_CAPTURE_FILE_BUFSIZE (1 << 20)
+
+typedef enum CXLCaptureDir {
+    CXL_CAPTURE_RX = 1, /* pcap-ng epb_flags inbound */
+    CXL_CAPTURE_TX = 2, /* pcap-ng epb_flags outbound */
+} CXLCaptureDir;
+
+/* A slot is ready to be written out once seq equals its ring index + 1 */
+typedef struct CXLCaptureSlot {
+    uint32_t seq;
+    uint32_t dir;
+    uint32_t len;
+    uint32_t orig_len;
+    int64_t ts_ns;
+    uint8_t data[CXL_CAPTURE_SNAPLEN];
+} CXLCaptureSlot;
+
+typedef struct CXLCapture {
+    char *path;
+    FILE *file;
+    CXLCaptureSlot *slots;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;
+    bool stop;
+    QemuEvent wake;
+    QemuThread thread;
+} CXLCapture;
+
+CXLCapture *cxl_capture_open(const char *path, Error **errp);
+void cxl_capture_close(CXLCapture *cap);
+void cxl_capture_packet(CXLCapture *cap, CXLCaptureDir dir, const void *buf,
+                        size_t len);
+
+#endif
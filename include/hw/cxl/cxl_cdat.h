@@ -160,8 +160,6 @@ typedef struct CDATObject {
     bool to_update;
     void *private;
     char *filename;
-    uint8_t *buf;
-    struct CDATSubHeader **built_buf;
-    int built_buf_len;
+    GBytes *table; /* Serialised table, shared with identical devices */
 } CDATObject;
 #endif /* CXL_CDAT_H */
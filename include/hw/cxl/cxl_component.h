@@ -241,6 +241,7 @@ static inline int cxl_decoder_count_enc(int count)
 }
 
 uint8_t cxl_interleave_ways_enc(int iw, Error **errp);
+int cxl_interleave_ways_dec(uint8_t iw_enc, Error **errp);
 uint8_t cxl_interleave_granularity_enc(uint64_t gran, Error **errp);
 
 static inline hwaddr cxl_decode_ig(int ig)
@@ -254,5 +255,6 @@ bool cxl_get_hb_passthrough(PCIHostState *hb);
 void cxl_doe_cdat_init(CXLComponentState *cxl_cstate, Error **errp);
 void cxl_doe_cdat_release(CXLComponentState *cxl_cstate);
 void cxl_doe_cdat_update(CXLComponentState *cxl_cstate, Error **errp);
+bool cxl_doe_cdat_read_entry(DOECap *doe_cap, CXLComponentState *cxl_cstate);
 
 #endif
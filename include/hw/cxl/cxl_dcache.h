@@ -71,7 +71,7 @@ typedef struct {
     uint64_t counter;
 } CacheSet;
 
-typedef struct {
+typedef struct DeviceCache {
     CacheSet *sets;
     uint32_t num_sets;
     uint32_t cachesize;
@@ -79,6 +79,7 @@ typedef struct {
     uint64_t blk_mask;
     uint64_t set_mask;
     uint64_t tag_mask;
+    GRand *rng; /* random victim picks, per cache like the sets */
 } Cache;
 
 uint64_t device_cache_extract_tag(Cache *cache, uint64_t daddr);
@@ -11,10 +11,17 @@
 #ifndef CXL_DEVICE_H
 #define CXL_DEVICE_H
 
+#include "hw/cxl/cxl_bias.h"
 #include "hw/cxl/cxl_component.h"
+#include "hw/cxl/cxl_events.h"
 #include "hw/cxl/cxl_packet.h"
+#include "hw/cxl/cxl_stats.h"
+#include "hw/cxl/cxl_traffic.h"
 #include "hw/pci/pci_device.h"
 #include "hw/register.h"
+#include "qemu/interval-tree.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
 
 /*
  * The following is how a CXL device's Memory Device registers are laid out.
@@ -22,27 +29,23 @@
  * capability headers start at offset 0 and are contiguously packed. The headers
  * themselves provide offsets to the register fields. For this emulation, the
  * actual registers  * will start at offset 0x80 (m == 0x80). No secondary
- * mailbox is implemented which means that the offset of the start of the
- * mailbox payload (n) is given by
- * n = m + sizeof(mailbox registers) + sizeof(device registers).
+ * mailbox is implemented. The mailbox comes last so that its payload, whose
+ * size each device may pick, does not move anything else; the offset of the
+ * start of the mailbox payload (n) is given by
+ * n = m + sizeof(device registers) + sizeof(memory device registers) +
+ *     sizeof(mailbox registers).
  *
- *                       +---------------------------------+
- *                       |                                 |
- *                       |    Memory Device Registers      |
- *                       |                                 |
- * n + PAYLOAD_SIZE_MAX  -----------------------------------
+ * n + PAYLOAD_SIZE      -----------------------------------
  *                  ^    |                                 |
  *                  |    |                                 |
  *                  |    |                                 |
- *                  |    |                                 |
- *                  |    |                                 |
  *                  |    |         Mailbox Payload         |
  *                  |    |                                 |
  *                  |    |                                 |
- *                  |    |                                 |
  *                  n    -----------------------------------
  *                  ^    |       Mailbox Registers         |
- *                  |    |                                 |
+ *                  |    -----------------------------------
+ *                  |    |    Memory Device Registers      |
  *                  |    -----------------------------------
  *                  |    |                                 |
  *                  |    |        Device Registers         |
@@ -68,23 +71,76 @@
 #define CXL_DEVICE_STATUS_REGISTERS_OFFSET 0x80 /* Read comment above */
 #define CXL_DEVICE_STATUS_REGISTERS_LENGTH 0x8 /* 8.2.8.3.1 */
 
-#define CXL_MAILBOX_REGISTERS_OFFSET \
+#define CXL_MEMORY_DEVICE_REGISTERS_OFFSET \
     (CXL_DEVICE_STATUS_REGISTERS_OFFSET + CXL_DEVICE_STATUS_REGISTERS_LENGTH)
+#define CXL_MEMORY_DEVICE_REGISTERS_LENGTH 0x8
+
+#define CXL_MAILBOX_REGISTERS_OFFSET \
+    (CXL_MEMORY_DEVICE_REGISTERS_OFFSET + CXL_MEMORY_DEVICE_REGISTERS_LENGTH)
 #define CXL_MAILBOX_REGISTERS_SIZE 0x20 /* 8.2.8.4, Figure 139 */
-#define CXL_MAILBOX_PAYLOAD_SHIFT 11
-#define CXL_MAILBOX_MAX_PAYLOAD_SIZE (1 << CXL_MAILBOX_PAYLOAD_SHIFT)
-#define CXL_MAILBOX_REGISTERS_LENGTH \
-    (CXL_MAILBOX_REGISTERS_SIZE + CXL_MAILBOX_MAX_PAYLOAD_SIZE)
+/* Payload Size is encoded as a power of 2 from 256 bytes to 1 MiB, 8.2.8.4.3 */
+#define CXL_MAILBOX_PAYLOAD_SHIFT_MIN 8
+#define CXL_MAILBOX_PAYLOAD_SHIFT_MAX 20
+#define CXL_MAILBOX_DEFAULT_PAYLOAD_SIZE (1 << 11)
+#define CXL_MAILBOX_MAX_PAYLOAD_SIZE (1 << CXL_MAILBOX_PAYLOAD_SHIFT_MAX)
+#define CXL_MAILBOX_REGISTERS_LENGTH(payload_size) \
+    (CXL_MAILBOX_REGISTERS_SIZE + (payload_size))
 
-#define CXL_MEMORY_DEVICE_REGISTERS_OFFSET \
-    (CXL_MAILBOX_REGISTERS_OFFSET + CXL_MAILBOX_REGISTERS_LENGTH)
-#define CXL_MEMORY_DEVICE_REGISTERS_LENGTH 0x8
+#define CXL_MMIO_SIZE(payload_size) \
+    (CXL_MAILBOX_REGISTERS_OFFSET + CXL_MAILBOX_REGISTERS_LENGTH(payload_size))
 
-#define CXL_MMIO_SIZE                                               \
-    (CXL_DEVICE_CAP_REG_SIZE + CXL_DEVICE_STATUS_REGISTERS_LENGTH + \
-     CXL_MAILBOX_REGISTERS_LENGTH + CXL_MEMORY_DEVICE_REGISTERS_LENGTH)
+/*
+ * Background commands run on worker threads that split a pass over a list of
+ * host memory segments between them, CXL 3.0 8.2.8.4.7
+ */
+typedef enum CXLBgPass {
+    CXL_BG_PASS_READ,
+    CXL_BG_PASS_ZERO,
+} CXLBgPass;
+
+typedef struct CXLBgSegment {
+    MemoryRegion *mr;
+    uint64_t offset;
+    uint64_t len;
+} CXLBgSegment;
+
+#define CXL_BG_MAX_WORKERS (64)
+#define CXL_BG_DEFAULT_WORKERS (4)
+
+struct cxl_device_state;
+typedef struct CXLBgWorker {
+    struct cxl_device_state *cxl_dstate;
+    QemuThread thread;
+    uint64_t start; /* byte range of the concatenated segments */
+    uint64_t end;
+} CXLBgWorker;
+
+/* Runs on the main loop once the pass is over, sets bg.ret_code */
+typedef void (*CXLBgComplete)(struct cxl_device_state *cxl_dstate,
+                              bool aborted);
+
+/*
+ * One event log, a ring of capacity records. Handles are handed out in
+ * insertion order, so the oldest record sits at head and Clear Event Records
+ * only ever retires records from there.
+ */
+typedef struct CXLEventLog {
+    CXLEventRecordRaw *records;
+    uint16_t capacity;
+    uint16_t head;
+    uint16_t count;
+    uint16_t next_handle;
+    uint16_t overflow_err_count;
+    uint64_t first_overflow_timestamp;
+    uint64_t last_overflow_timestamp;
+    bool irq_enabled;
+    int irq_vec;
+} CXLEventLog;
 
 typedef struct cxl_device_state {
+    /* Device the register block belongs to */
+    Object *obj;
+
     MemoryRegion device_registers;
 
     /* mmio for device capabilities array - 8.2.8.2 */
@@ -98,15 +154,19 @@ typedef struct cxl_device_state {
         };
     };
 
-    /* mmio for the mailbox registers 8.2.8.4 */
+    /*
+     * mmio for the mailbox registers 8.2.8.4. The state is allocated at
+     * CXL_MAILBOX_REGISTERS_LENGTH(payload_size) bytes by
+     * cxl_device_register_block_init().
+     */
     struct {
         MemoryRegion mailbox;
-        uint16_t payload_size;
+        uint32_t payload_size;
         union {
-            uint8_t mbox_reg_state[CXL_MAILBOX_REGISTERS_LENGTH];
-            uint16_t mbox_reg_state16[CXL_MAILBOX_REGISTERS_LENGTH / 2];
-            uint32_t mbox_reg_state32[CXL_MAILBOX_REGISTERS_LENGTH / 4];
-            uint64_t mbox_reg_state64[CXL_MAILBOX_REGISTERS_LENGTH / 8];
+            uint8_t *mbox_reg_state;
+            uint16_t *mbox_reg_state16;
+            uint32_t *mbox_reg_state32;
+            uint64_t *mbox_reg_state64;
         };
         struct cel_log {
             uint16_t opcode;
@@ -115,22 +175,53 @@ typedef struct cxl_device_state {
         size_t cel_size;
     };
 
+    struct {
+        uint32_t nr_workers;
+        bool running;
+        bool abort;
+        bool media_disabled;
+        uint16_t opcode;
+        uint16_t ret_code;
+        CXLBgPass pass;
+        GArray *segs;
+        uint64_t total;
+        uint64_t done;
+        uint32_t pending;
+        CXLBgWorker *workers;
+        CXLBgComplete complete;
+        QEMUBH *bh;
+    } bg;
+
     struct {
         bool set;
         uint64_t last_set;
         uint64_t host_set;
     } timestamp;
 
-    /* memory region for persistent memory, HDM */
+    /* Event logs, empty unless the device called cxl_event_init() */
+    CXLEventLog event_logs[CXL_EVENT_TYPE_MAX];
+
+    /* memory region sizes, volatile capacity first in DPA space */
+    uint64_t mem_size;
     uint64_t pmem_size;
+    uint64_t vmem_size;
 } CXLDeviceState;
 
-/* Initialize the register block for a device */
+/*
+ * Initialize the register block for a device, with a mailbox payload of
+ * dev->payload_size bytes or the default size when that is 0
+ */
 void cxl_device_register_block_init(Object *obj, CXLDeviceState *dev);
 
+/* Free what cxl_device_register_block_init() allocated */
+void cxl_device_register_block_release(CXLDeviceState *dev);
+
 /* Set up default values for the register block */
 void cxl_device_register_init_common(CXLDeviceState *dev);
 
+/* Device time as set by the host through Set Timestamp, 0 until then */
+uint64_t cxl_device_get_timestamp(CXLDeviceState *cxl_dstate);
+
 /*
  * CXL 2.0 - 8.2.8.1 including errata F4
  * Documented as a 128 bit register, but 64 bit accesses and the second
@@ -172,11 +263,39 @@ CXL_DEVICE_CAPABILITY_HEADER_REGISTER(MAILBOX, CXL_DEVICE_CAP_HDR1_OFFSET +
 CXL_DEVICE_CAPABILITY_HEADER_REGISTER(MEMORY_DEVICE,
                                       CXL_DEVICE_CAP_HDR1_OFFSET +
                                           CXL_DEVICE_CAP_REG_SIZE * 2)
+/* Type 2 only, see cxl_bias.h */
+CXL_DEVICE_CAPABILITY_HEADER_REGISTER(BIAS_CONTROL,
+                                      CXL_DEVICE_CAP_HDR1_OFFSET +
+                                          CXL_DEVICE_CAP_REG_SIZE * 3)
+
+/* CXL 3.0 8.2.8.3.1 Event Status Register, one bit per CXLEventLogType */
+REG64(CXL_DEV_EVENT_STATUS, 0)
+    FIELD(CXL_DEV_EVENT_STATUS, EVENT_STATUS, 0, 32)
 
 void cxl_initialize_mailbox(CXLDeviceState *cxl_dstate);
 void cxl_process_mailbox(CXLDeviceState *cxl_dstate);
 
-#define cxl_device_cap_init(dstate, reg, cap_id)                        \
+bool cxl_mailbox_bg_start(CXLDeviceState *cxl_dstate, uint16_t opcode,
+                          CXLBgPass pass, GArray *segs,
+                          CXLBgComplete complete);
+uint8_t cxl_mailbox_bg_percent(CXLDeviceState *cxl_dstate);
+void cxl_mailbox_bg_abort(CXLDeviceState *cxl_dstate);
+void cxl_mailbox_bg_release(CXLDeviceState *cxl_dstate);
+
+void cxl_event_init(CXLDeviceState *cxl_dstate, uint16_t log_size,
+                    int irq_vec);
+void cxl_event_release(CXLDeviceState *cxl_dstate);
+uint32_t cxl_event_status(CXLDeviceState *cxl_dstate);
+bool cxl_event_insert(CXLDeviceState *cxl_dstate, CXLEventLogType log_type,
+                      CXLEventRecordRaw *event);
+uint16_t cxl_event_get_records(CXLDeviceState *cxl_dstate,
+                               CXLEventLogType log_type,
+                               CXLGetEventPayload *pl, uint16_t max_recs);
+int cxl_event_clear_records(CXLDeviceState *cxl_dstate,
+                            CXLClearEventPayload *pl);
+void cxl_event_irq_assert(CXLDeviceState *cxl_dstate);
+
+#define cxl_device_cap_init(dstate, reg, cap_id, length)                \
     do {                                                                \
         uint32_t *cap_hdrs = dstate->caps_reg_state32;                  \
         int which = R_CXL_DEV_##reg##_CAP_HDR0;                         \
@@ -189,7 +308,7 @@ void cxl_process_mailbox(CXLDeviceState *cxl_dstate);
                        CAP_OFFSET, CXL_##reg##_REGISTERS_OFFSET);       \
         cap_hdrs[which + 2] =                                           \
             FIELD_DP32(cap_hdrs[which + 2], CXL_DEV_##reg##_CAP_HDR2,   \
-                       CAP_LENGTH, CXL_##reg##_REGISTERS_LENGTH);       \
+                       CAP_LENGTH, length);                             \
     } while (0)
 
 /* CXL 2.0 8.2.8.4.3 Mailbox Capabilities Register */
@@ -209,7 +328,7 @@ FIELD(CXL_DEV_MAILBOX_CTRL, BG_INT_EN, 2, 1)
 REG64(CXL_DEV_MAILBOX_CMD, 8)
 FIELD(CXL_DEV_MAILBOX_CMD, COMMAND, 0, 8)
 FIELD(CXL_DEV_MAILBOX_CMD, COMMAND_SET, 8, 8)
-FIELD(CXL_DEV_MAILBOX_CMD, LENGTH, 16, 20)
+FIELD(CXL_DEV_MAILBOX_CMD, LENGTH, 16, 21)
 
 /* CXL 2.0 8.2.8.4.6 Mailbox Status Register */
 REG64(CXL_DEV_MAILBOX_STS, 0x10)
@@ -250,6 +369,7 @@ struct CXLType1Dev {
     HostMemoryBackend *hostmem;
     HostMemoryBackend *lsa;
     uint64_t sn;
+    CXLTrafficProps traffic_props;
 
     /* State */
     AddressSpace hostmem_as;
@@ -261,6 +381,16 @@ struct CXLType1Dev {
 
     /* Error injection */
     CXLErrorList error_list;
+
+    /* Coherence */
+    struct CXLHost *hb;
+    struct DeviceCache *dcache;
+
+    /* Coherence statistics, see query-cxl-stats */
+    struct CXLStats *stats;
+
+    /* Traffic generators, indexed by CxlTrafficSide */
+    CXLTrafficGen traffic[CXL_TRAFFIC_SIDE__MAX];
 };
 
 #define TYPE_CXL_TYPE1 "cxl-type1"
@@ -288,17 +418,37 @@ struct CXLType2Dev {
     HostMemoryBackend *hostmem;
     HostMemoryBackend *lsa;
     uint64_t sn;
+    uint32_t sf_entries;
+    uint64_t bias_granularity;
+    CXLTrafficProps traffic_props;
 
     /* State */
     AddressSpace hostmem_as;
     CXLComponentState cxl_cstate;
     CXLDeviceState cxl_dstate;
+    int hdm_position; /* interleave way, -1 until the HDM path is routed */
 
     /* DOE */
     DOECap doe_cdat;
 
     /* Error injection */
     CXLErrorList error_list;
+
+    /* Coherence */
+    struct CXLHost *hb;
+    struct DeviceCache *dcache;
+    struct DeviceCoh *dcoh;
+
+    /* Bias table and its control registers */
+    struct CXLBiasTable *bias;
+    MemoryRegion bias_registers;
+    uint8_t bias_reg_state[CXL_BIAS_CONTROL_REGISTERS_LENGTH];
+
+    /* Coherence statistics, see query-cxl-stats */
+    struct CXLStats *stats;
+
+    /* Traffic generators, indexed by CxlTrafficSide */
+    CXLTrafficGen traffic[CXL_TRAFFIC_SIDE__MAX];
 };
 
 #define TYPE_CXL_TYPE2 "cxl-type2"
@@ -318,25 +468,144 @@ struct CXLType2Class {
                     uint64_t offset);
 };
 
+/* CXL 3.0 8.2.9.8.4.1 - Source of a Get Poison List media error record */
+#define CXL_POISON_TYPE_EXTERNAL 0x1
+#define CXL_POISON_TYPE_INTERNAL 0x2
+#define CXL_POISON_TYPE_INJECTED 0x3
+
+#define CXL_POISON_LIST_LIMIT_DEFAULT 256
+
+/* Poisoned DPA range [node.start, node.last], whole 64 byte lines */
+typedef struct CXLPoison {
+    IntervalTreeNode node;
+    uint8_t type;
+} CXLPoison;
+
+/*
+ * Dynamic capacity regions follow the static capacity in DPA space, each
+ * one a slice of the volatile-dc-memdev backend. Capacity is granted and
+ * taken back in extents of whole blocks, CXL 3.0 9.13.3.
+ */
+/* Capacities are reported, and partitions aligned, in 256MiB units */
+#define CXL_CAPACITY_MULTIPLIER (256 * MiB)
+
+#define DCD_MAX_NUM_REGION 8
+#define CXL_DC_BLOCK_SIZE (2 * MiB)
+#define CXL_DC_MAX_EXTENTS 512
+
+/* CXL 3.0 Table 8-48 Dynamic Capacity Extent */
+typedef struct CXLDCExtentRaw {
+    uint64_t start_dpa;
+    uint64_t len;
+    uint8_t tag[0x10];
+    uint16_t shared_seq;
+    uint8_t rsvd[0x6];
+} QEMU_PACKED CXLDCExtentRaw;
+
+typedef struct CXLDCExtent {
+    uint64_t start_dpa;
+    uint64_t len;
+    uint8_t tag[0x10];
+    uint16_t shared_seq;
+    QTAILQ_ENTRY(CXLDCExtent) node;
+} CXLDCExtent;
+typedef QTAILQ_HEAD(, CXLDCExtent) CXLDCExtentList;
+
+typedef struct CXLDCRegion {
+    uint64_t base;       /* DPA */
+    uint64_t decode_len;
+    uint64_t len;
+    uint64_t block_size;
+    uint32_t dsmadhandle;
+    uint8_t flags;
+    unsigned long *blk_bitmap; /* blocks backed by an accepted extent */
+} CXLDCRegion;
+
+/* A media error found by Scan Media, reported by Get Scan Media Results */
+typedef struct CXLMediaErrorRecord {
+    uint64_t dpa;
+    uint64_t length;
+    uint8_t type;
+} CXLMediaErrorRecord;
+
+/* Access characteristics of one kind of capacity */
+typedef struct CXLType3Perf {
+    uint64_t read_latency;    /* picoseconds */
+    uint64_t write_latency;
+    uint64_t read_bandwidth;  /* MB/s */
+    uint64_t write_bandwidth;
+} CXLType3Perf;
+
 struct CXLType3Dev {
     /* Private */
     PCIDevice parent_obj;
 
     /* Properties */
-    HostMemoryBackend *hostmem;
+    HostMemoryBackend *hostmem; /* legacy alias of hostvmem */
+    HostMemoryBackend *hostvmem;
+    HostMemoryBackend *hostpmem;
     HostMemoryBackend *lsa;
     uint64_t sn;
+    uint32_t poison_list_limit;
+    uint16_t event_log_size;
+    bool direct_map;
+    bool cdat_calibrate;
 
     /* State */
-    AddressSpace hostmem_as;
+    AddressSpace hostvmem_as;
+    AddressSpace hostpmem_as;
+    /* Guest physical mappings of the static capacity, see direct-map */
+    MemoryRegion direct_vmem;
+    MemoryRegion direct_pmem;
     CXLComponentState cxl_cstate;
     CXLDeviceState cxl_dstate;
 
     /* DOE */
     DOECap doe_cdat;
+    /* Published in the DSLBIS entries, see cdat-calibrate */
+    CXLType3Perf vmem_perf;
+    CXLType3Perf pmem_perf;
 
     /* Error injection */
     CXLErrorList error_list;
+
+    /*
+     * Poison list, keyed by DPA so the read path can look up an access in
+     * O(log n) and skip the lookup entirely while the list is empty
+     */
+    IntervalTreeRoot poison_tree;
+    uint32_t poison_list_cnt;
+    bool poison_list_overflowed;
+    uint64_t poison_list_overflow_ts;
+
+    /* Scan Media records, pending until the background pass completes */
+    GArray *scan_media_pending;
+    GArray *scan_media_results;
+
+    /* Dynamic capacity */
+    struct {
+        HostMemoryBackend *host_dc;
+        AddressSpace host_dc_as;
+        uint8_t num_regions;
+        uint64_t total_capacity;
+        /* Extents the host accepted, and those offered but not answered */
+        CXLDCExtentList extents;
+        CXLDCExtentList extents_pending;
+        uint32_t total_extent_count;
+        uint32_t ext_list_gen_seq;
+        CXLType3Perf perf;
+        CXLDCRegion regions[DCD_MAX_NUM_REGION];
+    } dc;
+
+    /* Multi-headed device, one head per QEMU process sharing the backends */
+    struct {
+        char *state_file;
+        uint32_t head;
+        uint32_t nr_heads;
+        int fd;
+        struct CXLMHDState *state;
+        size_t state_size;
+    } mhd;
 };
 
 #define TYPE_CXL_TYPE3 "cxl-type3"
@@ -381,12 +650,54 @@ H2DRsp cxl_type1_response(PCIDevice *d, CXLCacheReq req, uint8_t *buf,
 
 S2MRsp cxl_type2_access(PCIDevice *d, CXLMemReq req, uint8_t *buf,
                         unsigned size, MemTxAttrs attrs);
-M2SRsp_BIRsp cxl_type2_response(CXLMemReq req, MemTxAttrs attrs);
+M2SRsp_BIRsp cxl_type2_response(PCIDevice *d, CXLMemReq req,
+                                MemTxAttrs attrs);
+bool cxl_type2_hpa_to_dpa(PCIDevice *d, hwaddr hpa, uint64_t *dpa);
+bool cxl_type2_dpa_to_hpa(PCIDevice *d, uint64_t dpa, hwaddr *hpa);
+void cxl_type2_hdm_position_update(PCIDevice *d);
+MemTxResult cxl_type2_mem_read(PCIDevice *d, uint64_t dpa, uint8_t *buf,
+                               unsigned size, MemTxAttrs attrs);
+MemTxResult cxl_type2_mem_write(PCIDevice *d, uint64_t dpa,
+                                const uint8_t *buf, unsigned size,
+                                MemTxAttrs attrs);
 
 MemTxResult cxl_type3_read(PCIDevice *d, hwaddr host_addr, uint64_t *data,
                            unsigned size, MemTxAttrs attrs);
 MemTxResult cxl_type3_write(PCIDevice *d, hwaddr host_addr, uint64_t data,
                             unsigned size, MemTxAttrs attrs);
+MemTxResult cxl_type3_dpa_write(CXLType3Dev *ct3d, uint64_t dpa,
+                                const void *buf, unsigned size);
+
+CXLPoison *cxl_type3_poison_find(CXLType3Dev *ct3d, uint64_t dpa,
+                                 uint64_t length);
+bool cxl_type3_poison_add(CXLType3Dev *ct3d, uint64_t dpa, uint64_t length,
+                          uint8_t type);
+void cxl_type3_poison_clear(CXLType3Dev *ct3d, uint64_t dpa, uint64_t length);
+void cxl_type3_poison_set_overflowed(CXLType3Dev *ct3d);
+GArray *cxl_type3_dpa_segments(CXLType3Dev *ct3d, uint64_t dpa,
+                               uint64_t length);
+
+CXLDCRegion *cxl_type3_dc_find_region(CXLType3Dev *ct3d, uint64_t dpa,
+                                      uint64_t len);
+bool cxl_type3_dc_range_backed(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len);
+void cxl_type3_dc_extent_list_insert(CXLDCExtentList *list, uint64_t dpa,
+                                     uint64_t len, const uint8_t *tag,
+                                     uint16_t shared_seq);
+void cxl_type3_dc_extent_list_clear(CXLDCExtentList *list);
+bool cxl_type3_dc_extent_list_covers(CXLDCExtentList *list, uint64_t dpa,
+                                     uint64_t len);
+void cxl_type3_dc_accept(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len,
+                         const uint8_t *tag);
+void cxl_type3_dc_release(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len);
+void cxl_type3_direct_map_update(CXLType3Dev *ct3d);
+
+void cxl_type3_calibrate(CXLType3Dev *ct3d);
+
+bool cxl_type3_mhd_init(CXLType3Dev *ct3d, Error **errp);
+void cxl_type3_mhd_release(CXLType3Dev *ct3d);
+bool cxl_type3_mhd_available(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len);
+bool cxl_type3_mhd_claim(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len);
+void cxl_type3_mhd_unclaim(CXLType3Dev *ct3d, uint64_t dpa, uint64_t len);
 
 bool cxl_is_remote_root_port(PCIDevice *d);
 PCIDevice *cxl_get_root_port(PCIDevice *d);
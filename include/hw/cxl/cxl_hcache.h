@@ -10,6 +10,8 @@
 #ifndef CXL_HCACHE_H
 #define CXL_HCACHE_H
 
+#include "hw/cxl/cxl.h"
+
 /*
  * A CacheSet is a set of cache blocks. A memory block that maps to a set can be
  * put in any of the blocks inside the set. The number of block per set is
@@ -62,6 +64,7 @@ typedef struct {
     uint64_t state : 2;
     uint64_t tag   : 62;
     uint8_t *data;
+    PCIDevice *owner; /* device the cached line belongs to */
 } CacheBlock;
 
 typedef struct {
@@ -70,7 +73,7 @@ typedef struct {
     uint64_t counter;
 } CacheSet;
 
-typedef struct {
+typedef struct HostCache {
     CacheSet *sets;
     int num_sets;
     int cachesize;
@@ -86,9 +89,13 @@ CacheState host_cache_extract_block_state(Cache *cache, uint64_t set,
                                           int32_t blk);
 uint8_t *host_cache_extract_block_addr(Cache *cache, uint64_t set, int32_t blk);
 uint64_t host_cache_assem_haddr(Cache *cache, uint64_t set, int32_t blk);
+PCIDevice *host_cache_extract_block_owner(Cache *cache, uint64_t set,
+                                          int32_t blk);
 
 void host_cache_update_block_state(Cache *cache, uint64_t tag, uint64_t set,
                                    int32_t blk, CacheState state);
+void host_cache_update_block_owner(Cache *cache, uint64_t set, int32_t blk,
+                                   PCIDevice *owner);
 int32_t host_cache_find_replace_block(Cache *cache, uint64_t set);
 int32_t host_cache_find_invalid_block(Cache *cache, uint64_t set);
 int32_t host_cache_find_valid_block(Cache *cache, uint64_t tag, uint64_t set);
@@ -99,7 +106,19 @@ void host_cache_data_read(Cache *cache, uint64_t haddr, uint64_t set,
 void host_cache_data_write(Cache *cache, uint64_t haddr, uint64_t set,
                            int32_t blk, uint64_t *data, uint32_t size);
 
+MemTxResult host_cache_evict_block(Cache *cache, uint64_t set, int32_t blk,
+                                   MemTxAttrs attrs);
+void host_cache_invalidate_owner(Cache *cache, PCIDevice *owner);
+
 void cxl_host_cache_init(Cache **cache);
 void cxl_host_cache_release(Cache **cache);
 
+/*
+ * The host cache is owned by the CXL host bridge and shared by every Type 1/2
+ * device below it. Devices attach at realize and detach at exit; the cache is
+ * allocated by the first user and freed with the last one.
+ */
+CXLHost *cxl_host_cache_attach(PCIDevice *d);
+void cxl_host_cache_detach(CXLHost *hb, PCIDevice *d);
+
 #endif
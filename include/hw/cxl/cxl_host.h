@@ -16,6 +16,8 @@
 void cxl_machine_init(Object *obj, CXLState *state);
 void cxl_fmws_link_targets(CXLState *stat, Error **errp);
 void cxl_hook_up_pxb_registers(PCIBus *bus, CXLState *state, Error **errp);
+int cxl_host_hdm_position(PCIDevice *d, hwaddr base, int ways, hwaddr gran);
+void cxl_host_hdm_committed(CXLComponentState *cxl_cstate);
 
 extern const MemoryRegionOps cfmws_ops;
 
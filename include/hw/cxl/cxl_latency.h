@@ -0,0 +1,45 @@
+/*
+ * QEMU CXL Remote Transaction Latency Histogram Configuration
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef CXL_LATENCY_H
+#define CXL_LATENCY_H
+
+#include "qapi/qapi-types-cxl.h"
+#include "qemu/stats64.h"
+
+/*
+ * Log-bucketed latency histogram in the style of HdrHistogram. Every power
+ * of two range of nanoseconds is split into 2^CXL_LATENCY_SUB_BUCKET_BITS
+ * linear sub-buckets, so a recorded value is known to within 1/8 (12.5%) of
+ * itself whatever its magnitude. Values below 2^CXL_LATENCY_SUB_BUCKET_BITS
+ * ns get one bucket each.
+ *
+ * Recording is lock-free; a histogram may be updated by any number of vCPU
+ * threads while it is being read. Percentiles are reported as the upper
+ * bound of the bucket holding the requested rank. A reset is not atomic
+ * with respect to concurrent recording.
+ */
+#define CXL_LATENCY_SUB_BUCKET_BITS (3)
+#define CXL_LATENCY_SUB_BUCKETS (1 << CXL_LATENCY_SUB_BUCKET_BITS)
+#define CXL_LATENCY_BUCKETS \
+    ((64 - CXL_LATENCY_SUB_BUCKET_BITS + 1) << CXL_LATENCY_SUB_BUCKET_BITS)
+
+typedef struct CXLLatencyHistogram {
+    Stat64 sum_ns;
+    Stat64 min_ns;
+    Stat64 max_ns;
+    Stat64 buckets[CXL_LATENCY_BUCKETS];
+} CXLLatencyHistogram;
+
+void cxl_latency_record(CXLLatencyHistogram *hist, int64_t start_ns);
+CxlLatencyClassInfo *cxl_latency_query(CXLLatencyHistogram *hist,
+                                       CxlLatencyClass type);
+void cxl_latency_reset(CXLLatencyHistogram *hist);
+
+#endif
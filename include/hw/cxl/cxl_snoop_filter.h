@@ -0,0 +1,61 @@
+/*
+ * QEMU CXL Device Snoop Filter Configuration
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef CXL_SNOOP_FILTER_H
+#define CXL_SNOOP_FILTER_H
+
+/*
+ * The snoop filter tracks the device memory lines the host may hold a copy
+ * of. Lines are kept as inline keys in an open-addressing table with linear
+ * probing, so a lookup never allocates and usually touches a single host
+ * cache line.
+ *
+ * The table has twice as many slots as the filter capacity to keep probe
+ * sequences short. Once the filter holds capacity lines, inserting a new
+ * line evicts an existing one and returns its address. The caller must then
+ * back-invalidate that line in the host before the eviction is complete.
+ */
+
+#define DEVICE_SF_DEFAULT_ENTRIES (1024)
+/*
+ * The filter only needs to cover what the host can cache, and 1M lines
+ * (64 MiB) is well past any host cache while keeping the slot table at
+ * 16 MiB.
+ */
+#define DEVICE_SF_MAX_ENTRIES (1U << 20)
+#define DEVICE_SF_NO_VICTIM (-1ULL)
+
+typedef struct {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t inserts;
+    uint64_t removes;
+    uint64_t back_invalidations;
+    uint32_t occupancy;
+    uint32_t peak_occupancy;
+} SnoopFilterStats;
+
+typedef struct SnoopFilter {
+    uint64_t *slots; /* line number + 1, 0 marks an empty slot */
+    uint32_t num_slots; /* power of 2 */
+    uint32_t hash_shift;
+    uint32_t capacity;
+    uint32_t hand; /* next slot probed for an overflow victim */
+    SnoopFilterStats stats;
+} SnoopFilter;
+
+bool device_sf_lookup(SnoopFilter *sf, uint64_t daddr);
+uint64_t device_sf_insert(SnoopFilter *sf, uint64_t daddr);
+void device_sf_remove(SnoopFilter *sf, uint64_t daddr);
+void device_sf_remove_range(SnoopFilter *sf, uint64_t daddr, uint64_t size);
+
+void cxl_device_sf_init(SnoopFilter **sf, uint32_t capacity);
+void cxl_device_sf_release(SnoopFilter **sf);
+
+#endif
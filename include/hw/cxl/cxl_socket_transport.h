@@ -12,6 +12,7 @@
 #include <stdint.h>
 
 #include "cxl_emulator_packet.h"
+#include "cxl_capture.h"
 
 bool release_packet_entry(uint16_t tag);
 
@@ -50,5 +51,6 @@ void wait_for_cxl_io_cfg_completion(int socket_fd, uint16_t tag,
 // Socket
 
 int32_t create_socket_client(const char *host, uint32_t port);
+bool cxl_socket_set_capture(int socket_fd, CXLCapture *cap);
 
 #endif // CXL_SOCKET_TRANSPORT_H
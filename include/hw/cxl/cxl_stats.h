@@ -0,0 +1,69 @@
+/*
+ * QEMU CXL Coherence Statistics Configuration
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef CXL_STATS_H
+#define CXL_STATS_H
+
+#include "qapi/qapi-types-cxl.h"
+#include "qemu/stats64.h"
+
+/*
+ * Per-device counters of the Type 1/2 coherence engines.
+ *
+ * The counters are split into shards. A shard starts on a cache line and is
+ * padded to whole cache lines, so no two shards share one. Every thread that
+ * updates a counter is bound to a shard the first time it does so, and vCPU
+ * and traffic generator threads normally bump their own lines: the counter
+ * lines stay in the updating CPU's cache instead of bouncing between the
+ * threads (and lengthening the coh_lock hold times) on every access.
+ * Readers sum all shards without taking any lock. A reset races with
+ * concurrent updates and may lose the increments made while it runs.
+ *
+ * Snoops are counted from the device's point of view: sent are the
+ * back-invalidate snoops (BISnp*) the device issues to the host, received are
+ * the snoops the host issues to the device (H2D Snp* or the M2S SnpType).
+ */
+typedef enum CXLStatCounter {
+    CXL_STAT_HOST_HIT = 0,
+    CXL_STAT_HOST_MISS,
+    CXL_STAT_HOST_EVICTION,
+    CXL_STAT_HOST_WRITEBACK,
+    CXL_STAT_DEVICE_HIT,
+    CXL_STAT_DEVICE_MISS,
+    CXL_STAT_DEVICE_EVICTION,
+    CXL_STAT_DEVICE_WRITEBACK,
+    CXL_STAT_SNP_SENT_DATA,
+    CXL_STAT_SNP_SENT_CUR,
+    CXL_STAT_SNP_SENT_INV,
+    CXL_STAT_SNP_RECV_DATA,
+    CXL_STAT_SNP_RECV_CUR,
+    CXL_STAT_SNP_RECV_INV,
+    CXL_STAT_BIAS_FLIP,
+    CXL_STAT_BACK_INVALIDATION,
+    CXL_STAT__MAX,
+} CXLStatCounter;
+
+#define CXL_STATS_SHARDS (16)
+
+typedef struct CXLStatsShard {
+    Stat64 counters[CXL_STAT__MAX];
+} QEMU_ALIGNED(64) CXLStatsShard;
+
+typedef struct CXLStats {
+    CXLStatsShard shards[CXL_STATS_SHARDS];
+} CXLStats;
+
+void cxl_stats_inc(CXLStats *stats, CXLStatCounter counter);
+CxlStats *cxl_stats_query(CXLStats *stats);
+void cxl_stats_reset(CXLStats *stats);
+
+void cxl_stats_init(CXLStats **stats);
+void cxl_stats_release(CXLStats **stats);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * QEMU CXL Traffic Generator Configuration
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef CXL_TRAFFIC_H
+#define CXL_TRAFFIC_H
+
+#include "qapi/qapi-types-cxl.h"
+#include "qemu/stats64.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "exec/memattrs.h"
+
+/*
+ * Each Type 1/2 device has a host side and a device side generator. A
+ * generator runs a number of threads that issue accesses to device memory
+ * offsets through a per-side access callback, which maps the offset to the
+ * right address space and takes the coherence lock per access.
+ *
+ * The defaults reproduce the random stress loops that used to run
+ * unconditionally: single byte random accesses, half of them writes, over
+ * the 128 MiB above the first 128 MiB, paced at one access every 20 us,
+ * starting 30 s after realize.
+ */
+#define CXL_TRAFFIC_MAX_THREADS (64)
+#define CXL_TRAFFIC_MAX_SIZE (4 * KiB)
+#define CXL_TRAFFIC_DEFAULT_BASE (128 * MiB)
+#define CXL_TRAFFIC_DEFAULT_WORKING_SET (128 * MiB)
+#define CXL_TRAFFIC_DEFAULT_RATE (50000)
+#define CXL_TRAFFIC_DEFAULT_DELAY (30000)
+
+/*
+ * Access callback. Returns MEMTX_DECODE_ERROR when daddr cannot be reached
+ * from this side right now, which counts as skipped rather than failed.
+ */
+typedef MemTxResult (*CXLTrafficAccess)(PCIDevice *d, uint64_t daddr,
+                                        uint8_t *buf, uint32_t size,
+                                        bool is_write);
+
+typedef struct CXLTrafficConfig {
+    CxlTrafficPattern pattern;
+    uint8_t read_pct;
+    uint32_t size;
+    uint64_t base;
+    uint64_t working_set;
+    uint64_t stride;
+    uint64_t rate;
+    uint32_t threads;
+    uint64_t seed;
+    uint32_t delay_ms;
+} CXLTrafficConfig;
+
+/* Device properties, shared by both generators of a device */
+typedef struct CXLTrafficProps {
+    bool host;
+    bool device;
+    char *pattern;
+    CXLTrafficConfig cfg;
+} CXLTrafficProps;
+
+typedef struct CXLTrafficGen CXLTrafficGen;
+
+typedef struct CXLTrafficWorker {
+    CXLTrafficGen *gen;
+    QemuThread thread;
+    uint32_t idx;
+    Stat64 reads;
+    Stat64 writes;
+    Stat64 bytes;
+    Stat64 errors;
+    Stat64 skipped;
+} CXLTrafficWorker;
+
+struct CXLTrafficGen {
+    PCIDevice *d;
+    const char *name;
+    CXLTrafficAccess access;
+    uint64_t mem_size;
+    uint8_t fill;
+
+    CXLTrafficConfig cfg;
+    CXLTrafficWorker *workers;
+    uint32_t nr_workers;
+    bool running;
+    bool stop;
+    int64_t start_ns;
+    int64_t stop_ns;
+};
+
+#define DEFINE_CXL_TRAFFIC_PROPERTIES(_state, _field)                         \
+    DEFINE_PROP_BOOL("host-traffic", _state, _field.host, false),             \
+    DEFINE_PROP_BOOL("device-traffic", _state, _field.device, false),         \
+    DEFINE_PROP_STRING("traffic-pattern", _state, _field.pattern),            \
+    DEFINE_PROP_UINT8("traffic-read-percent", _state, _field.cfg.read_pct,    \
+                      50),                                                    \
+    DEFINE_PROP_UINT32("traffic-size", _state, _field.cfg.size, 1),           \
+    DEFINE_PROP_SIZE("traffic-base", _state, _field.cfg.base,                 \
+                     CXL_TRAFFIC_DEFAULT_BASE),                               \
+    DEFINE_PROP_SIZE("traffic-working-set", _state, _field.cfg.working_set,   \
+                     CXL_TRAFFIC_DEFAULT_WORKING_SET),                        \
+    DEFINE_PROP_SIZE("traffic-stride", _state, _field.cfg.stride, 64),        \
+    DEFINE_PROP_UINT64("traffic-rate", _state, _field.cfg.rate,               \
+                       CXL_TRAFFIC_DEFAULT_RATE),                             \
+    DEFINE_PROP_UINT32("traffic-threads", _state, _field.cfg.threads, 1),     \
+    DEFINE_PROP_UINT64("traffic-seed", _state, _field.cfg.seed, 0),           \
+    DEFINE_PROP_UINT32("traffic-delay", _state, _field.cfg.delay_ms,          \
+                       CXL_TRAFFIC_DEFAULT_DELAY)
+
+bool cxl_traffic_realize(CXLTrafficGen *gens, PCIDevice *d,
+                         CXLTrafficProps *props, uint64_t mem_size,
+                         CXLTrafficAccess host, CXLTrafficAccess device,
+                         Error **errp);
+void cxl_traffic_unrealize(CXLTrafficGen *gens);
+
+bool cxl_traffic_start(CXLTrafficGen *gen, const CXLTrafficConfig *cfg,
+                       Error **errp);
+void cxl_traffic_stop(CXLTrafficGen *gen);
+void cxl_traffic_get_stats(CXLTrafficGen *gen, CxlTrafficStats *stats);
+
+#endif
@@ -13,11 +13,14 @@
 #define CFMWS_BASE_ADDR (0x490000000)
 
 BiasState cxl_device_type1_dcoh_bias_lookup(uint64_t daddr);
-D2HRsp cxl_device_type1_dcoh_access(AddressSpace *as, uint64_t daddr,
+D2HRsp cxl_device_type1_dcoh_access(PCIDevice *d, uint64_t daddr,
                                     CXLCacheReq req, uint8_t *buf,
                                     uint32_t size, MemTxAttrs attrs);
 
+MemTxResult cxl_device_type1_dcoh_traffic(PCIDevice *d, uint64_t daddr,
+                                          uint8_t *buf, uint32_t size,
+                                          bool is_write);
 void cxl_device_type1_dcoh_init(PCIDevice *d);
-void cxl_device_type1_dcoh_release(void);
+void cxl_device_type1_dcoh_release(PCIDevice *d);
 
 #endif
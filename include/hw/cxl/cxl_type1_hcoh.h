@@ -21,8 +21,14 @@ MemTxResult cxl_host_type1_hcoh_write(PCIDevice *d, uint64_t haddr,
                                       MemTxAttrs attrs);
 H2DRsp cxl_host_type1_hcoh_response(PCIDevice *d, CXLCacheReq req, uint8_t *buf,
                                     unsigned size, MemTxAttrs attrs);
+MemTxResult cxl_host_type1_hcoh_evict(PCIDevice *d, struct HostCache *hcache,
+                                      uint64_t set, int32_t blk,
+                                      MemTxAttrs attrs);
 
-void cxl_host_type1_hcoh_init(PCIDevice *d);
-void cxl_host_type1_hcoh_release(void);
+MemTxResult cxl_host_type1_hcoh_traffic(PCIDevice *d, uint64_t daddr,
+                                        uint8_t *buf, uint32_t size,
+                                        bool is_write);
+bool cxl_host_type1_hcoh_init(PCIDevice *d, Error **errp);
+void cxl_host_type1_hcoh_release(PCIDevice *d);
 
 #endif
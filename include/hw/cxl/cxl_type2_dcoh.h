@@ -10,21 +10,14 @@
 #ifndef CXL_TYPE2_DCOH_H
 #define CXL_TYPE2_DCOH_H
 
-#define CFMWS_BASE_ADDR (0x490000000)
-#define DEVICE_BIAS_CACHE_SIZE (2)
-#define DEVICE_BIAS_ENTRY_SIZE (0x8000000)
-
-typedef struct {
-    GHashTable *sf_table;
-    uint32_t *bias_cache;
-    uint32_t bias_cache_size;
-    uint32_t bias_entry_size;
+typedef struct DeviceCoh {
+    struct SnoopFilter *sf;
 } DeviceCoh;
 
 #if (CXL_DCOH_BIAS_PRINT == 1)
 #define CXL_DCOH_BIAS(addr, fmt, args...)                             \
     do {                                                              \
-        if (DEVICE_BIAS == cxl_device_type2_dcoh_bias_lookup(addr)) { \
+        if (1) {                                                      \
             error_report("[%s:%d] " fmt, __func__, __LINE__, ##args); \
         }                                                             \
     } while (0)
@@ -34,12 +27,17 @@ typedef struct {
     } while (0)
 #endif
 
-BiasState cxl_device_type2_dcoh_bias_lookup(uint64_t daddr);
-S2MRsp cxl_device_type2_dcoh_access(AddressSpace *as, uint64_t daddr,
+BiasState cxl_device_type2_dcoh_bias_lookup(PCIDevice *d, uint64_t daddr);
+S2MRsp cxl_device_type2_dcoh_access(PCIDevice *d, uint64_t daddr,
                                     CXLMemReq req, uint8_t *buf, uint32_t size,
                                     MemTxAttrs attrs);
+MemTxResult cxl_device_type2_dcoh_flush_range(PCIDevice *d, uint64_t daddr,
+                                              uint64_t size, MemTxAttrs attrs);
 
+MemTxResult cxl_device_type2_dcoh_traffic(PCIDevice *d, uint64_t daddr,
+                                          uint8_t *buf, uint32_t size,
+                                          bool is_write);
 void cxl_device_type2_dcoh_init(PCIDevice *d);
-void cxl_device_type2_dcoh_release(void);
+void cxl_device_type2_dcoh_release(PCIDevice *d);
 
 #endif
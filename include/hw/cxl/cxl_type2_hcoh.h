@@ -10,16 +10,6 @@
 #ifndef CXL_TYPE2_HCOH_H
 #define CXL_TYPE2_HCOH_H
 
-#define CFMWS_BASE_ADDR (0x490000000)
-#define HOST_BIAS_TABLE_SIZE (2)
-#define HOST_BIAS_ENTRY_SIZE (0x8000000)
-
-typedef struct {
-    uint32_t *bias_table;
-    uint32_t bias_table_size;
-    uint32_t bias_entry_size;
-} HostCoh;
-
 typedef enum {
     MEM_Read_MemInv = 0,
     MEM_NDR_MemInv,
@@ -42,18 +32,33 @@ typedef enum {
     } while (0)
 #endif
 
-BiasState cxl_host_type2_hcoh_bias_lookup(uint64_t haddr);
+BiasState cxl_host_type2_hcoh_bias_lookup(PCIDevice *d, uint64_t haddr);
 MemTxResult cxl_host_type2_hcoh_read(PCIDevice *d, uint64_t haddr,
                                      uint64_t *data, uint32_t size,
                                      MemTxAttrs attrs);
 MemTxResult cxl_host_type2_hcoh_write(PCIDevice *d, uint64_t haddr,
                                       uint64_t data, uint32_t size,
                                       MemTxAttrs attrs);
+MemTxResult cxl_host_type2_hcoh_read_range(PCIDevice *d, uint64_t haddr,
+                                           uint8_t *buf, uint64_t len,
+                                           MemTxAttrs attrs);
+MemTxResult cxl_host_type2_hcoh_write_range(PCIDevice *d, uint64_t haddr,
+                                            const uint8_t *buf, uint64_t len,
+                                            MemTxAttrs attrs);
 MemTxResult cxl_host_type2_hcoh_command(PCIDevice *d, uint64_t haddr,
                                         uint8_t *buf, MemTxAttrs attrs);
-M2SRsp_BIRsp cxl_host_type2_hcoh_response(CXLMemReq request, MemTxAttrs attrs);
+M2SRsp_BIRsp cxl_host_type2_hcoh_response(PCIDevice *d, CXLMemReq request,
+                                          MemTxAttrs attrs);
+MemTxResult cxl_host_type2_hcoh_evict(PCIDevice *d, struct HostCache *hcache,
+                                      uint64_t set, int32_t blk,
+                                      MemTxAttrs attrs);
+MemTxResult cxl_host_type2_hcoh_flush_range(PCIDevice *d, uint64_t daddr,
+                                            uint64_t size, MemTxAttrs attrs);
 
-void cxl_host_type2_hcoh_init(PCIDevice *d);
-void cxl_host_type2_hcoh_release(void);
+MemTxResult cxl_host_type2_hcoh_traffic(PCIDevice *d, uint64_t daddr,
+                                        uint8_t *buf, uint32_t size,
+                                        bool is_write);
+bool cxl_host_type2_hcoh_init(PCIDevice *d, Error **errp);
+void cxl_host_type2_hcoh_release(PCIDevice *d);
 
 #endif
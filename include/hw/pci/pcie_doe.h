@@ -64,7 +64,11 @@ struct DOEHeader {
     uint32_t length;
 } QEMU_PACKED;
 
-/* Protocol infos and rsp function callback */
+/*
+ * Protocol infos and rsp function callback. The callback runs in a worker
+ * thread without the BQL, so it may only use the DOE mailboxes and device
+ * state that does not change while the guest runs.
+ */
 struct DOEProtocol {
     uint16_t vendor_id;
     uint8_t data_obj_type;
@@ -106,6 +110,10 @@ struct DOECap {
     /* Protocols and its callback response */
     DOEProtocol *protocols;
     uint16_t protocol_num;
+
+    /* Handler of the request in flight while status.busy is set */
+    bool (*handle_request)(DOECap *);
+    bool abort_pending;
 };
 
 void pcie_doe_init(PCIDevice *pdev, DOECap *doe_cap, uint16_t offset,
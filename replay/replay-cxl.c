@@ -0,0 +1,42 @@
+/*
+ * replay-cxl.c
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "sysemu/replay.h"
+#include "replay-internal.h"
+
+void replay_save_cxl_packet(const void *buf, size_t len)
+{
+    g_assert(replay_mutex_locked());
+
+    replay_save_instructions();
+    replay_put_event(EVENT_CXL_PACKET);
+    replay_put_array(buf, len);
+}
+
+size_t replay_read_cxl_packet(void *buf, size_t size)
+{
+    g_autofree uint8_t *data = NULL;
+    size_t len = 0;
+    g_assert(replay_mutex_locked());
+
+    replay_account_executed_instructions();
+    if (replay_next_event_is(EVENT_CXL_PACKET)) {
+        replay_get_array_alloc(&data, &len);
+        replay_finish_event();
+        g_assert(len <= size);
+        memcpy(buf, data, len);
+    } else {
+        error_report("Missing CXL packet event in the replay log");
+        exit(1);
+    }
+    return len;
+}
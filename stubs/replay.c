@@ -16,6 +16,15 @@ int replay_read_random(void *buf, size_t len)
     return 0;
 }
 
+void replay_save_cxl_packet(const void *buf, size_t len)
+{
+}
+
+size_t replay_read_cxl_packet(void *buf, size_t size)
+{
+    return 0;
+}
+
 bool replay_reverse_step(void)
 {
     return false;
@@ -0,0 +1,294 @@
+/*
+ * QTest microbenchmarks for the CXL fixed memory window
+ *
+ * Builds Type 1, Type 2, Type 3 and remote Type 3 topologies, commits the
+ * host bridge and endpoint HDM decoders through the component registers the
+ * same way a guest driver would, and then times qtest_memread/memwrite loops
+ * over the CFMWS. Results are reported in ns/op with g_test_message(), run
+ * with --tap -m slow for meaningful numbers.
+ *
+ * The remote Type 3 case needs a switch to talk to, for example
+ * contrib/cxl-switch-emu, and is skipped unless QTEST_CXL_SWITCH is set to
+ * its host:port.
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/units.h"
+#include "libqtest.h"
+#include "hw/pci/pci_regs.h"
+
+/*
+ * Memory layout of a q35 machine with the default -m 128M: nothing above
+ * 4G, so the CXL host register region starts right at 4G and the first
+ * fixed window at the next 256M boundary after that 1M region.
+ */
+#define CXL_HOST_REG_BASE 0x100000000ULL
+#define CXL_FMW_BASE 0x110000000ULL
+#define CXL_FMW_SIZE_STR "4G"
+#define CXL_CACHE_MEM_OFFSET 0x1000
+
+/* 8.2.5.12 - CXL HDM Decoder Capability Structure, decoder 0 only */
+#define HDM_GLOBAL_CONTROL 0x114
+#define HDM_GLOBAL_CONTROL_ENABLE (1 << 1)
+#define HDM_DECODER0_BASE_LO 0x120
+#define HDM_DECODER0_BASE_HI 0x124
+#define HDM_DECODER0_SIZE_LO 0x128
+#define HDM_DECODER0_SIZE_HI 0x12c
+#define HDM_DECODER0_CTRL 0x130
+#define HDM_DECODER0_CTRL_COMMIT (1 << 9)
+#define HDM_DECODER0_CTRL_COMMITTED (1 << 10)
+#define HDM_DECODER0_TARGET_LIST_LO 0x134
+
+#define CXL_PXB_BUS 52
+#define CXL_DEV_SIZE (256 * MiB)
+
+/* Endpoint BARs are placed in the 32-bit PCI hole, 1M apart */
+#define CXL_BAR_BASE 0xe0000000U
+#define CXL_BAR_STRIDE 0x100000U
+
+#define BENCH_ITERS_QUICK 256
+#define BENCH_ITERS_SLOW 65536
+#define BENCH_SPAN (4 * MiB)
+#define BENCH_MAX_SIZE 4096
+
+typedef struct CXLBenchTopo {
+    const char *name;
+    const char *dev_type;
+    int ways;
+    unsigned int gran;
+    bool remote;
+} CXLBenchTopo;
+
+static const CXLBenchTopo cxl_bench_topos[] = {
+    { "type1", "cxl-type1", 1, 256, false },
+    { "type2", "cxl-type2", 1, 256, false },
+    { "type3", "cxl-type3", 1, 256, false },
+    { "type3-x2-256", "cxl-type3", 2, 256, false },
+    { "type3-x2-4k", "cxl-type3", 2, 4096, false },
+    { "type3-x4-256", "cxl-type3", 4, 256, false },
+    { "type3-remote", NULL, 1, 256, true },
+};
+
+static const size_t cxl_bench_sizes[] = { 1, 2, 4, 8, 64, 256, 4096 };
+
+static uint32_t cxl_cfg_readl(QTestState *qts, uint8_t bus, uint8_t devfn,
+                              uint8_t offset)
+{
+    qtest_outl(qts, 0xcf8, 0x80000000U | bus << 16 | devfn << 8 | offset);
+    return qtest_inl(qts, 0xcfc);
+}
+
+static void cxl_cfg_writel(QTestState *qts, uint8_t bus, uint8_t devfn,
+                           uint8_t offset, uint32_t val)
+{
+    qtest_outl(qts, 0xcf8, 0x80000000U | bus << 16 | devfn << 8 | offset);
+    qtest_outl(qts, 0xcfc, val);
+}
+
+static uint32_t cxl_encode_ig(unsigned int gran)
+{
+    return ctz32(gran) - 8;
+}
+
+static uint32_t cxl_encode_iw(int ways)
+{
+    return ctz32(ways);
+}
+
+/* Program and commit HDM decoder 0 of the component block at @base */
+static void cxl_commit_hdm(QTestState *qts, uint64_t base,
+                           const CXLBenchTopo *t, uint32_t targets)
+{
+    uint64_t cm = base + CXL_CACHE_MEM_OFFSET;
+    uint64_t size = CXL_DEV_SIZE * t->ways;
+    uint32_t ctrl;
+
+    qtest_writel(qts, cm + HDM_GLOBAL_CONTROL, HDM_GLOBAL_CONTROL_ENABLE);
+    qtest_writel(qts, cm + HDM_DECODER0_BASE_LO, (uint32_t)CXL_FMW_BASE);
+    qtest_writel(qts, cm + HDM_DECODER0_BASE_HI, CXL_FMW_BASE >> 32);
+    qtest_writel(qts, cm + HDM_DECODER0_SIZE_LO, (uint32_t)size);
+    qtest_writel(qts, cm + HDM_DECODER0_SIZE_HI, size >> 32);
+    qtest_writel(qts, cm + HDM_DECODER0_TARGET_LIST_LO, targets);
+    qtest_writel(qts, cm + HDM_DECODER0_CTRL,
+                 cxl_encode_ig(t->gran) | cxl_encode_iw(t->ways) << 4 |
+                 HDM_DECODER0_CTRL_COMMIT);
+
+    ctrl = qtest_readl(qts, cm + HDM_DECODER0_CTRL);
+    g_assert(ctrl & HDM_DECODER0_CTRL_COMMITTED);
+}
+
+/*
+ * Root port i sits at devfn i.0 on the pxb bus with secondary bus
+ * CXL_PXB_BUS + 1 + i, and its endpoint gets a 1M window for BAR0, the
+ * component registers.
+ */
+static void cxl_setup_endpoint(QTestState *qts, const CXLBenchTopo *t, int i)
+{
+    uint8_t rp_devfn = i << 3;
+    uint8_t sec = CXL_PXB_BUS + 1 + i;
+    uint32_t bar = CXL_BAR_BASE + i * CXL_BAR_STRIDE;
+    uint32_t window = (bar >> 16) | ((bar + CXL_BAR_STRIDE - 1) & 0xfff00000);
+
+    cxl_cfg_writel(qts, CXL_PXB_BUS, rp_devfn, PCI_PRIMARY_BUS,
+                   CXL_PXB_BUS | sec << 8 | sec << 16);
+    cxl_cfg_writel(qts, CXL_PXB_BUS, rp_devfn, PCI_MEMORY_BASE, window);
+    cxl_cfg_writel(qts, CXL_PXB_BUS, rp_devfn, PCI_COMMAND,
+                   PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+
+    g_assert_cmphex(cxl_cfg_readl(qts, sec, 0, PCI_VENDOR_ID), !=, 0xffffffff);
+    cxl_cfg_writel(qts, sec, 0, PCI_BASE_ADDRESS_0,
+                   bar | PCI_BASE_ADDRESS_MEM_TYPE_64);
+    cxl_cfg_writel(qts, sec, 0, PCI_BASE_ADDRESS_1, 0);
+    cxl_cfg_writel(qts, sec, 0, PCI_COMMAND,
+                   PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+
+    cxl_commit_hdm(qts, bar, t, 0);
+}
+
+static QTestState *cxl_bench_start(const CXLBenchTopo *t)
+{
+    g_autoptr(GString) cmdline = g_string_new(NULL);
+    const char *sw = g_getenv("QTEST_CXL_SWITCH");
+    g_autofree char *host = NULL;
+    const char *port = NULL;
+    uint32_t targets = 0;
+    QTestState *qts;
+    int i;
+
+    if (t->remote) {
+        if (!sw || !strchr(sw, ':')) {
+            return NULL;
+        }
+        host = g_strndup(sw, strchr(sw, ':') - sw);
+        port = strchr(sw, ':') + 1;
+    }
+
+    g_string_printf(cmdline,
+                    "-machine q35,cxl=on "
+                    "-device pxb-cxl,id=cxl.0,bus=pcie.0,bus_nr=%d "
+                    "-M cxl-fmw.0.targets.0=cxl.0,cxl-fmw.0.size="
+                    CXL_FMW_SIZE_STR " ",
+                    CXL_PXB_BUS);
+    for (i = 0; i < t->ways; i++) {
+        g_string_append_printf(cmdline,
+                               "-device cxl-rp,id=rp%d,bus=cxl.0,chassis=0,"
+                               "slot=%d,port=%d,addr=%d.0",
+                               i, i, i, i);
+        if (t->remote) {
+            g_string_append_printf(cmdline, ",socket-host=%s,socket-port=%s ",
+                                   host, port);
+            continue;
+        }
+        g_string_append_printf(cmdline,
+                               " -object memory-backend-ram,id=cxl-mem%d,"
+                               "size=256M "
+                               "-device %s,bus=rp%d,memdev=cxl-mem%d,"
+                               "id=cxl-dev%d ",
+                               i, t->dev_type, i, i, i);
+    }
+
+    qts = qtest_init(cmdline->str);
+
+    /* The host bridge interleaves across its root ports in port order */
+    for (i = 0; i < t->ways; i++) {
+        targets |= i << (i * 8);
+    }
+    cxl_commit_hdm(qts, CXL_HOST_REG_BASE, t, targets);
+
+    if (!t->remote) {
+        for (i = 0; i < t->ways; i++) {
+            cxl_setup_endpoint(qts, t, i);
+        }
+    }
+
+    return qts;
+}
+
+/* Write a pattern across every interleave target and read it back */
+static void cxl_bench_check(QTestState *qts, const CXLBenchTopo *t)
+{
+    uint8_t wbuf[256], rbuf[256];
+    uint64_t addr;
+    int i, j;
+
+    for (i = 0; i < t->ways * 2; i++) {
+        addr = CXL_FMW_BASE + (uint64_t)i * t->gran;
+        for (j = 0; j < sizeof(wbuf); j++) {
+            wbuf[j] = i * 31 + j;
+        }
+        qtest_memwrite(qts, addr, wbuf, sizeof(wbuf));
+        qtest_memread(qts, addr, rbuf, sizeof(rbuf));
+        g_assert(memcmp(wbuf, rbuf, sizeof(wbuf)) == 0);
+    }
+}
+
+static double cxl_bench_loop(QTestState *qts, size_t size, int iters,
+                             bool write)
+{
+    static uint8_t buf[BENCH_MAX_SIZE];
+    uint64_t addr;
+    int i;
+
+    g_test_timer_start();
+    for (i = 0; i < iters; i++) {
+        addr = CXL_FMW_BASE + ((uint64_t)i * size) % BENCH_SPAN;
+        if (write) {
+            qtest_memwrite(qts, addr, buf, size);
+        } else {
+            qtest_memread(qts, addr, buf, size);
+        }
+    }
+
+    return g_test_timer_elapsed() * 1e9 / iters;
+}
+
+static void cxl_bench(const void *data)
+{
+    const CXLBenchTopo *t = data;
+    int iters = g_test_slow() ? BENCH_ITERS_SLOW : BENCH_ITERS_QUICK;
+    QTestState *qts;
+    double rd, wr;
+    int i;
+
+    qts = cxl_bench_start(t);
+    if (!qts) {
+        g_test_skip("QTEST_CXL_SWITCH=host:port not set");
+        return;
+    }
+
+    cxl_bench_check(qts, t);
+
+    for (i = 0; i < ARRAY_SIZE(cxl_bench_sizes); i++) {
+        size_t size = cxl_bench_sizes[i];
+
+        wr = cxl_bench_loop(qts, size, iters, true);
+        rd = cxl_bench_loop(qts, size, iters, false);
+        g_test_message("%s ways=%d gran=%u size=%zu: read %.0f ns/op, "
+                       "write %.0f ns/op",
+                       t->name, t->ways, t->gran, size, rd, wr);
+    }
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(cxl_bench_topos); i++) {
+        g_autofree char *path = g_strdup_printf("/cxl/bench/%s",
+                                                cxl_bench_topos[i].name);
+
+        qtest_add_data_func(path, &cxl_bench_topos[i], cxl_bench);
+    }
+
+    return g_test_run();
+}
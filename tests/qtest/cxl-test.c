@@ -6,7 +6,13 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "libqtest-single.h"
+#include "qapi/qmp/qdict.h"
+#include "hw/pci/pci_regs.h"
 
 #define QEMU_PXB_CMD "-machine q35,cxl=on " \
                      "-device pxb-cxl,id=cxl.0,bus=pcie.0,bus_nr=52 "  \
@@ -104,6 +110,590 @@ static void cxl_t3d(void)
     rmdir(tmpfs);
 }
 
+/*
+ * No firmware runs under qtest, so the root ports are given their bus
+ * numbers by hand and extended config space, where the DOE capability
+ * lives, is reached through the q35 MMCONFIG window once it is enabled.
+ */
+#define CXL_PXB_BUS 52
+#define Q35_PCIEXBAR 0x60
+#define Q35_PCIEXBAR_BASE 0xb0000000U
+#define CXL_DOE_CDAT_OFFSET 0x190
+#define CXL_DOE_POLL_US (10 * 1000 * 1000)
+#define CXL_CDAT_TABLE_MAX 4096
+
+/* Endpoint device register BARs are placed in the 32-bit PCI hole */
+#define CXL_BAR_BASE 0xe0000000U
+#define CXL_BAR_STRIDE 0x400000U
+
+/* 8.2.8.4 - Mailbox registers, behind the device status and memdev blocks */
+#define CXL_MBOX_OFFSET 0x90
+#define CXL_MBOX_CAP 0x00
+#define CXL_MBOX_CTRL 0x04
+#define CXL_MBOX_CTRL_DOORBELL 1
+#define CXL_MBOX_CMD 0x08
+#define CXL_MBOX_STS 0x10
+#define CXL_MBOX_STS_BG_OP 1
+#define CXL_MBOX_BG_CMD_STS 0x18
+#define CXL_MBOX_BG_POLL_US (10 * 1000 * 1000)
+#define CXL_MBOX_PAYLOAD 0x20
+#define CXL_MBOX_PAYLOAD_SIZE 2048
+#define CXL_MBOX_PAYLOAD_MAX (1 * MiB)
+
+/* 8.2.9 - Command opcodes and return codes used below */
+#define CXL_MBOX_GET_EVENT_RECORDS 0x0100
+#define CXL_MBOX_CLEAR_EVENT_RECORDS 0x0101
+#define CXL_MBOX_GET_LSA 0x4102
+#define CXL_MBOX_SET_LSA 0x4103
+#define CXL_MBOX_GET_POISON_LIST 0x4300
+#define CXL_MBOX_GET_DC_EXTENT_LIST 0x4801
+#define CXL_MBOX_ADD_DC_RESPONSE 0x4802
+#define CXL_MBOX_RELEASE_DC 0x4803
+#define CXL_MBOX_SANITIZE 0x4400
+#define CXL_MBOX_SUCCESS 0x0
+#define CXL_MBOX_BG_STARTED 0x1
+#define CXL_MBOX_INVALID_INPUT 0x2
+#define CXL_MBOX_INVALID_HANDLE 0xe
+#define CXL_MBOX_INVALID_PA 0xf
+#define CXL_MBOX_RESOURCES_EXHAUSTED 0x1d
+
+static void cxl_cfg_writel(uint8_t bus, uint8_t devfn, uint8_t offset,
+                           uint32_t val)
+{
+    outl(0xcf8, 0x80000000U | bus << 16 | devfn << 8 | offset);
+    outl(0xcfc, val);
+}
+
+static uint32_t cxl_ecam_readl(uint8_t bus, uint16_t offset)
+{
+    return readl(Q35_PCIEXBAR_BASE + (bus << 20) + offset);
+}
+
+static void cxl_ecam_writel(uint8_t bus, uint16_t offset, uint32_t val)
+{
+    writel(Q35_PCIEXBAR_BASE + (bus << 20) + offset, val);
+}
+
+/* Root port @i sits at devfn i.0 with secondary bus CXL_PXB_BUS + 1 + i */
+static uint8_t cxl_setup_rp(int i)
+{
+    uint8_t sec = CXL_PXB_BUS + 1 + i;
+
+    cxl_cfg_writel(0, 0, Q35_PCIEXBAR + 4, 0);
+    cxl_cfg_writel(0, 0, Q35_PCIEXBAR, Q35_PCIEXBAR_BASE | 1);
+    cxl_cfg_writel(CXL_PXB_BUS, i << 3, PCI_PRIMARY_BUS,
+                   CXL_PXB_BUS | sec << 8 | sec << 16);
+
+    return sec;
+}
+
+/*
+ * Map the device registers of the endpoint below root port @i and return
+ * the address of its mailbox.
+ */
+static uint64_t cxl_setup_mailbox(int i)
+{
+    uint8_t sec = cxl_setup_rp(i);
+    uint32_t bar = CXL_BAR_BASE + i * CXL_BAR_STRIDE;
+    uint32_t window = (bar >> 16) | ((bar + CXL_BAR_STRIDE - 1) & 0xfff00000);
+
+    cxl_cfg_writel(CXL_PXB_BUS, i << 3, PCI_MEMORY_BASE, window);
+    cxl_cfg_writel(CXL_PXB_BUS, i << 3, PCI_COMMAND,
+                   PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+    cxl_cfg_writel(sec, 0, PCI_BASE_ADDRESS_2,
+                   bar | PCI_BASE_ADDRESS_MEM_TYPE_64);
+    cxl_cfg_writel(sec, 0, PCI_BASE_ADDRESS_3, 0);
+    cxl_cfg_writel(sec, 0, PCI_COMMAND,
+                   PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+
+    return bar + CXL_MBOX_OFFSET;
+}
+
+/*
+ * Send @opcode with @in_len bytes of @pl, which is then overwritten with
+ * the output payload. Returns the mailbox return code.
+ */
+static uint16_t cxl_mbox_cmd(uint64_t mbox, uint16_t opcode, void *pl,
+                             size_t in_len, size_t *out_len)
+{
+    uint64_t cmd;
+    size_t len;
+
+    memwrite(mbox + CXL_MBOX_PAYLOAD, pl, in_len);
+    writeq(mbox + CXL_MBOX_CMD, opcode | (uint64_t)in_len << 16);
+    writel(mbox + CXL_MBOX_CTRL, CXL_MBOX_CTRL_DOORBELL);
+    g_assert(!(readl(mbox + CXL_MBOX_CTRL) & CXL_MBOX_CTRL_DOORBELL));
+
+    cmd = readq(mbox + CXL_MBOX_CMD);
+    len = extract64(cmd, 16, 21);
+    g_assert_cmpuint(len, <=, CXL_MBOX_PAYLOAD_MAX);
+    memread(mbox + CXL_MBOX_PAYLOAD, pl, len);
+    if (out_len) {
+        *out_len = len;
+    }
+
+    return extract64(readq(mbox + CXL_MBOX_STS), 32, 16);
+}
+
+/* Wait for the running background command, returns its return code */
+static uint16_t cxl_mbox_bg_wait(uint64_t mbox)
+{
+    int i;
+
+    for (i = 0; i < CXL_MBOX_BG_POLL_US / 1000; i++) {
+        if (!(readq(mbox + CXL_MBOX_STS) & CXL_MBOX_STS_BG_OP)) {
+            break;
+        }
+        g_usleep(1000);
+    }
+    g_assert(!(readq(mbox + CXL_MBOX_STS) & CXL_MBOX_STS_BG_OP));
+
+    return extract64(readq(mbox + CXL_MBOX_BG_CMD_STS), 32, 16);
+}
+
+/* Run a QMP command and report whether it was accepted */
+static bool G_GNUC_PRINTF(1, 2) cxl_qmp_ok(const char *fmt, ...)
+{
+    va_list ap;
+    QDict *resp;
+    bool ok;
+
+    va_start(ap, fmt);
+    resp = qtest_vqmp(global_qtest, fmt, ap);
+    va_end(ap);
+    ok = !qdict_haskey(resp, "error");
+    qobject_unref(resp);
+
+    return ok;
+}
+
+static bool cxl_inject_poison(uint64_t start, uint64_t length)
+{
+    return cxl_qmp_ok("{ 'execute': 'cxl-inject-poison', 'arguments': {"
+                      " 'path': '/machine/peripheral/cxl-pmem0',"
+                      " 'start': %" PRIu64 ", 'length': %" PRIu64 " } }",
+                      start, length);
+}
+
+/* Get Poison List over [@start, @start + @len), returns the record count */
+static uint16_t cxl_get_poison_list(uint64_t mbox, uint64_t start,
+                                    uint64_t len, uint8_t *pl)
+{
+    size_t out_len;
+
+    stq_le_p(pl, start);
+    stq_le_p(pl + 8, len / 64);
+    g_assert_cmpuint(cxl_mbox_cmd(mbox, CXL_MBOX_GET_POISON_LIST, pl, 16,
+                                  &out_len), ==, CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(out_len, ==, 0x20 + lduw_le_p(pl + 10) * 16);
+
+    return lduw_le_p(pl + 10);
+}
+
+static void cxl_t3d_poison(void)
+{
+    g_autoptr(GString) cmdline = g_string_new(NULL);
+    g_autofree const char *tmpfs = NULL;
+    uint8_t pl[CXL_MBOX_PAYLOAD_SIZE];
+    uint64_t mbox;
+
+    tmpfs = g_dir_make_tmp("cxl-test-XXXXXX", NULL);
+
+    g_string_printf(cmdline, QEMU_PXB_CMD QEMU_RP QEMU_T3D, tmpfs, tmpfs);
+
+    qtest_start(cmdline->str);
+    mbox = cxl_setup_mailbox(0);
+    g_assert(cxl_inject_poison(0x1000, 0x1000));
+    g_assert(cxl_inject_poison(0x4000, 64));
+    /* Misaligned, overlapping and out of range injections are refused */
+    g_assert(!cxl_inject_poison(0x8020, 64));
+    g_assert(!cxl_inject_poison(0x9000, 100));
+    g_assert(!cxl_inject_poison(0x1800, 64));
+    g_assert(!cxl_inject_poison(256 * 1024 * 1024, 64));
+
+    /* Only the accepted injections show up, in DPA order, 64 byte units */
+    g_assert_cmpuint(cxl_get_poison_list(mbox, 0, 256 * MiB, pl), ==, 2);
+    g_assert_cmphex(ldq_le_p(pl + 0x20) & ~7ULL, ==, 0x1000);
+    g_assert_cmpuint(ldl_le_p(pl + 0x28), ==, 0x1000 / 64);
+    g_assert_cmphex(ldq_le_p(pl + 0x30) & ~7ULL, ==, 0x4000);
+    g_assert_cmpuint(ldl_le_p(pl + 0x38), ==, 1);
+
+    /* A query is clipped to the range asked for */
+    g_assert_cmpuint(cxl_get_poison_list(mbox, 0x1800, 0x1000, pl), ==, 1);
+    g_assert_cmphex(ldq_le_p(pl + 0x20) & ~7ULL, ==, 0x1800);
+    g_assert_cmpuint(ldl_le_p(pl + 0x28), ==, 0x800 / 64);
+    g_assert_cmpuint(cxl_get_poison_list(mbox, 0x2000, 0x2000, pl), ==, 0);
+    qtest_end();
+    rmdir(tmpfs);
+}
+
+/*
+ * A 1 MiB payload, the largest there is, carries a whole label area update
+ * in one command, with the 21 bit LENGTH field at its top value.
+ */
+static void cxl_t3d_mbox_payload(void)
+{
+    g_autoptr(GString) cmdline = g_string_new(NULL);
+    g_autofree const char *tmpfs = NULL;
+    g_autofree uint8_t *pl = g_malloc(CXL_MBOX_PAYLOAD_MAX);
+    g_autofree uint8_t *lsa = g_malloc(CXL_MBOX_PAYLOAD_MAX);
+    size_t out_len;
+    uint64_t mbox;
+    QDict *resp;
+    int i;
+
+    tmpfs = g_dir_make_tmp("cxl-test-XXXXXX", NULL);
+
+    g_string_printf(cmdline, QEMU_PXB_CMD QEMU_2RP QEMU_T3D
+                    "-global cxl-type3.mbox-payload-size=1M "
+                    "-object memory-backend-ram,id=cxl-mem1,size=256M ",
+                    tmpfs, tmpfs);
+
+    qtest_start(cmdline->str);
+    mbox = cxl_setup_mailbox(0);
+    g_assert_cmpuint(extract32(readl(mbox + CXL_MBOX_CAP), 0, 5), ==,
+                     ctz32(CXL_MBOX_PAYLOAD_MAX));
+
+    for (i = 0; i < CXL_MBOX_PAYLOAD_MAX; i++) {
+        lsa[i] = g_test_rand_int();
+    }
+    memset(pl, 0, 8);
+    memcpy(pl + 8, lsa, CXL_MBOX_PAYLOAD_MAX - 8);
+    g_assert_cmpuint(cxl_mbox_cmd(mbox, CXL_MBOX_SET_LSA, pl,
+                                  CXL_MBOX_PAYLOAD_MAX, &out_len), ==,
+                     CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(out_len, ==, 0);
+
+    stl_le_p(pl, 0);
+    stl_le_p(pl + 4, CXL_MBOX_PAYLOAD_MAX);
+    g_assert_cmpuint(cxl_mbox_cmd(mbox, CXL_MBOX_GET_LSA, pl, 8, &out_len),
+                     ==, CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(out_len, ==, CXL_MBOX_PAYLOAD_MAX);
+    g_assert(!memcmp(pl, lsa, CXL_MBOX_PAYLOAD_MAX - 8));
+
+    /* Past the payload size the transfer is refused */
+    stl_le_p(pl, 0);
+    stl_le_p(pl + 4, CXL_MBOX_PAYLOAD_MAX + 1);
+    g_assert_cmpuint(cxl_mbox_cmd(mbox, CXL_MBOX_GET_LSA, pl, 8, &out_len),
+                     ==, CXL_MBOX_INVALID_INPUT);
+
+    /* Sizes the capability register cannot encode fail to realize */
+    resp = qmp("{ 'execute': 'device_add', 'arguments': {"
+               " 'driver': 'cxl-type3', 'bus': 'rp1', 'id': 'cxl-vmem1',"
+               " 'volatile-memdev': 'cxl-mem1',"
+               " 'mbox-payload-size': %u } }", 2 * CXL_MBOX_PAYLOAD_MAX);
+    g_assert(qdict_haskey(resp, "error"));
+    g_assert(strstr(qdict_get_str(qdict_get_qdict(resp, "error"), "desc"),
+                    "mbox-payload-size"));
+    qobject_unref(resp);
+    qtest_end();
+    rmdir(tmpfs);
+}
+
+static bool cxl_inject_gmer(const char *log, uint32_t count)
+{
+    return cxl_qmp_ok("{ 'execute': 'cxl-inject-general-media-event',"
+                      " 'arguments': {"
+                      " 'path': '/machine/peripheral/cxl-pmem0', 'log': %s,"
+                      " 'flags': 1, 'dpa': 4096, 'descriptor': 3, 'type': 0,"
+                      " 'transaction-type': 192, 'channel': 1, 'rank': 0,"
+                      " 'count': %u } }",
+                      log, count);
+}
+
+#define CXL_EVENT_LOG_INFO 0
+#define CXL_EVENT_LOG_FAIL 2
+#define CXL_EVENT_RECORD_SIZE 128
+#define CXL_EVENT_HANDLE(pl, i) \
+    lduw_le_p((pl) + 0x20 + (i) * CXL_EVENT_RECORD_SIZE + 20)
+
+/* Get Event Records of @log, returns the record count */
+static uint16_t cxl_get_events(uint64_t mbox, uint8_t log, uint8_t *pl)
+{
+    size_t out_len;
+
+    pl[0] = log;
+    g_assert_cmpuint(cxl_mbox_cmd(mbox, CXL_MBOX_GET_EVENT_RECORDS, pl, 1,
+                                  &out_len), ==, CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(out_len, ==,
+                     0x20 + lduw_le_p(pl + 20) * CXL_EVENT_RECORD_SIZE);
+
+    return lduw_le_p(pl + 20);
+}
+
+/* Clear Event Records of @log for the @nr handles from @first on */
+static uint16_t cxl_clear_events(uint64_t mbox, uint8_t log, uint8_t flags,
+                                 uint16_t first, uint8_t nr)
+{
+    uint8_t pl[6 + 2 * UINT8_MAX];
+    int i;
+
+    pl[0] = log;
+    pl[1] = flags;
+    pl[2] = nr;
+    memset(pl + 3, 0, 3);
+    for (i = 0; i < nr; i++) {
+        stw_le_p(pl + 6 + 2 * i, first + i);
+    }
+
+    return cxl_mbox_cmd(mbox, CXL_MBOX_CLEAR_EVENT_RECORDS, pl, 6 + 2 * nr,
+                        NULL);
+}
+
+static void cxl_t3d_events(void)
+{
+    g_autoptr(GString) cmdline = g_string_new(NULL);
+    g_autofree const char *tmpfs = NULL;
+    uint8_t pl[CXL_MBOX_PAYLOAD_SIZE];
+    uint16_t handle;
+    uint64_t mbox;
+    int i;
+
+    tmpfs = g_dir_make_tmp("cxl-test-XXXXXX", NULL);
+
+    g_string_printf(cmdline, QEMU_PXB_CMD QEMU_RP QEMU_T3D
+                    "-global cxl-type3.event-log-size=4 ", tmpfs, tmpfs);
+
+    qtest_start(cmdline->str);
+    mbox = cxl_setup_mailbox(0);
+    g_assert(!cxl_inject_gmer("fatal", 0));
+    g_assert(!cxl_inject_gmer("debug", 1));
+
+    /* Records come back oldest first with consecutive handles */
+    g_assert(cxl_inject_gmer("failure", 3));
+    g_assert_cmpuint(cxl_get_events(mbox, CXL_EVENT_LOG_FAIL, pl), ==, 3);
+    g_assert_cmpuint(pl[0], ==, 0);
+    handle = CXL_EVENT_HANDLE(pl, 0);
+    for (i = 1; i < 3; i++) {
+        g_assert_cmpuint(CXL_EVENT_HANDLE(pl, i), ==, handle + i);
+    }
+
+    /* Only the oldest records can be cleared */
+    g_assert_cmpuint(cxl_clear_events(mbox, CXL_EVENT_LOG_FAIL, 0,
+                                      handle + 1, 1), ==,
+                     CXL_MBOX_INVALID_HANDLE);
+    g_assert_cmpuint(cxl_clear_events(mbox, CXL_EVENT_LOG_FAIL, 0,
+                                      handle, 2), ==, CXL_MBOX_SUCCESS);
+
+    /* Refilling the log wraps the ring, the order has to survive that */
+    g_assert(cxl_inject_gmer("failure", 3));
+    g_assert_cmpuint(cxl_get_events(mbox, CXL_EVENT_LOG_FAIL, pl), ==, 4);
+    for (i = 0; i < 4; i++) {
+        g_assert_cmpuint(CXL_EVENT_HANDLE(pl, i), ==, handle + 2 + i);
+    }
+
+    /* Past the log size the records are only counted as overflow */
+    g_assert(cxl_inject_gmer("failure", 2));
+    g_assert_cmpuint(cxl_get_events(mbox, CXL_EVENT_LOG_FAIL, pl), ==, 4);
+    g_assert_cmpuint(pl[0], ==, 1);
+    g_assert_cmpuint(lduw_le_p(pl + 2), ==, 2);
+    g_assert_cmpuint(CXL_EVENT_HANDLE(pl, 0), ==, handle + 2);
+
+    /* Draining the log drops the overflow state along with the records */
+    g_assert_cmpuint(cxl_clear_events(mbox, CXL_EVENT_LOG_FAIL, 0,
+                                      handle + 2, 4), ==, CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(cxl_get_events(mbox, CXL_EVENT_LOG_FAIL, pl), ==, 0);
+    g_assert_cmpuint(pl[0], ==, 0);
+    g_assert_cmpuint(lduw_le_p(pl + 2), ==, 0);
+
+    /* Logs are independent, and Clear All empties one without handles */
+    g_assert(cxl_inject_gmer("informational", 5));
+    g_assert_cmpuint(cxl_get_events(mbox, CXL_EVENT_LOG_FAIL, pl), ==, 0);
+    g_assert_cmpuint(cxl_get_events(mbox, CXL_EVENT_LOG_INFO, pl), ==, 4);
+    g_assert_cmpuint(pl[0], ==, 1);
+    g_assert_cmpuint(cxl_clear_events(mbox, CXL_EVENT_LOG_INFO, 1, 0, 0), ==,
+                     CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(cxl_get_events(mbox, CXL_EVENT_LOG_INFO, pl), ==, 0);
+    g_assert_cmpuint(pl[0], ==, 0);
+    qtest_end();
+    rmdir(tmpfs);
+}
+
+#define QEMU_DCD "-object memory-backend-file,id=cxl-dcmem0,share=on," \
+                 "mem-path=%s/dcmem0,size=512M " \
+                 "-device cxl-type3,bus=rp0,volatile-dc-memdev=cxl-dcmem0," \
+                 "num-dc-regions=2,id=cxl-dcd0 "
+
+static bool cxl_dc_extent(const char *cmd, uint8_t region, uint64_t offset,
+                          uint64_t len)
+{
+    return cxl_qmp_ok("{ 'execute': %s, 'arguments': {"
+                      " 'path': '/machine/peripheral/cxl-dcd0', 'region': %u,"
+                      " 'extents': [ { 'offset': %" PRIu64 ","
+                      " 'len': %" PRIu64 " } ] } }",
+                      cmd, region, offset, len);
+}
+
+#define CXL_DC_EXTENT_SIZE 48
+
+/* Get Dynamic Capacity Extent List from the start, returns the total */
+static uint32_t cxl_get_dc_extents(uint64_t mbox, uint8_t *pl)
+{
+    size_t out_len;
+
+    stl_le_p(pl, UINT32_MAX);
+    stl_le_p(pl + 4, 0);
+    g_assert_cmpuint(cxl_mbox_cmd(mbox, CXL_MBOX_GET_DC_EXTENT_LIST, pl, 8,
+                                  &out_len), ==, CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(ldl_le_p(pl), ==, ldl_le_p(pl + 4));
+    g_assert_cmpuint(out_len, ==, 0x10 + ldl_le_p(pl) * CXL_DC_EXTENT_SIZE);
+
+    return ldl_le_p(pl + 4);
+}
+
+/* Add Dynamic Capacity Response or Release Dynamic Capacity of one range */
+static uint16_t cxl_dc_update(uint64_t mbox, uint16_t opcode, uint64_t dpa,
+                              uint64_t len)
+{
+    uint8_t pl[8 + 24] = { 0 };
+
+    stl_le_p(pl, 1);
+    stq_le_p(pl + 8, dpa);
+    stq_le_p(pl + 16, len);
+
+    return cxl_mbox_cmd(mbox, opcode, pl, sizeof(pl), NULL);
+}
+
+static void cxl_t3d_dcd(void)
+{
+    g_autoptr(GString) cmdline = g_string_new(NULL);
+    g_autofree const char *tmpfs = NULL;
+    g_autofree char *mem = NULL;
+    uint8_t pl[CXL_MBOX_PAYLOAD_SIZE];
+    uint8_t data[4096];
+    uint64_t mbox;
+    int fd;
+
+    tmpfs = g_dir_make_tmp("cxl-test-XXXXXX", NULL);
+    mem = g_strdup_printf("%s/dcmem0", tmpfs);
+
+    g_string_printf(cmdline, QEMU_PXB_CMD QEMU_RP QEMU_DCD, tmpfs);
+
+    qtest_start(cmdline->str);
+    mbox = cxl_setup_mailbox(0);
+    g_assert(cxl_dc_extent("cxl-add-dynamic-capacity", 0, 0, 4 * MiB));
+    g_assert(cxl_dc_extent("cxl-add-dynamic-capacity", 1, 0, 2 * MiB));
+    /* Overlapping an offer, misaligned, out of range or unknown region */
+    g_assert(!cxl_dc_extent("cxl-add-dynamic-capacity", 0, 2 * MiB, 2 * MiB));
+    g_assert(!cxl_dc_extent("cxl-add-dynamic-capacity", 0, 1 * MiB, 2 * MiB));
+    g_assert(!cxl_dc_extent("cxl-add-dynamic-capacity", 1, 256 * MiB,
+                            2 * MiB));
+    g_assert(!cxl_dc_extent("cxl-add-dynamic-capacity", 2, 0, 2 * MiB));
+    /* Nothing was accepted by the guest, so there is nothing to release */
+    g_assert(!cxl_dc_extent("cxl-release-dynamic-capacity", 0, 0, 2 * MiB));
+    g_assert_cmpuint(cxl_get_dc_extents(mbox, pl), ==, 0);
+    g_assert_cmpuint(cxl_dc_update(mbox, CXL_MBOX_RELEASE_DC, 0, 4 * MiB), ==,
+                     CXL_MBOX_INVALID_PA);
+
+    /* Region 0 sits at DPA 0, take up its offer and leave region 1's */
+    g_assert_cmpuint(cxl_dc_update(mbox, CXL_MBOX_ADD_DC_RESPONSE, 0,
+                                   4 * MiB), ==, CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(cxl_get_dc_extents(mbox, pl), ==, 1);
+    g_assert_cmphex(ldq_le_p(pl + 0x10), ==, 0);
+    g_assert_cmphex(ldq_le_p(pl + 0x18), ==, 4 * MiB);
+    /* The response answered the whole offer, a second one has nothing */
+    g_assert_cmpuint(cxl_dc_update(mbox, CXL_MBOX_ADD_DC_RESPONSE,
+                                   256 * MiB, 2 * MiB), ==,
+                     CXL_MBOX_INVALID_PA);
+
+    /* Sanitize wipes accepted capacity along with the static partitions */
+    fd = open(mem, O_RDWR);
+    g_assert(fd >= 0);
+    memset(data, 0xa5, sizeof(data));
+    g_assert_cmpint(pwrite(fd, data, sizeof(data), 4 * MiB - sizeof(data)),
+                    ==, sizeof(data));
+    g_assert_cmpuint(cxl_mbox_cmd(mbox, CXL_MBOX_SANITIZE, pl, 0, NULL), ==,
+                     CXL_MBOX_BG_STARTED);
+    g_assert_cmpuint(cxl_mbox_bg_wait(mbox), ==, CXL_MBOX_SUCCESS);
+    g_assert_cmpint(pread(fd, data, sizeof(data), 4 * MiB - sizeof(data)),
+                    ==, sizeof(data));
+    g_assert(buffer_is_zero(data, sizeof(data)));
+    close(fd);
+    g_assert_cmpuint(cxl_get_dc_extents(mbox, pl), ==, 1);
+
+    /* Ask for the extent back and let the guest hand it over */
+    g_assert(cxl_dc_extent("cxl-release-dynamic-capacity", 0, 0, 4 * MiB));
+    g_assert_cmpuint(cxl_dc_update(mbox, CXL_MBOX_RELEASE_DC, 0, 4 * MiB), ==,
+                     CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(cxl_get_dc_extents(mbox, pl), ==, 0);
+    g_assert(!cxl_dc_extent("cxl-release-dynamic-capacity", 0, 0, 4 * MiB));
+    qtest_end();
+    unlink(mem);
+    rmdir(tmpfs);
+}
+
+#define QEMU_MHD "-object memory-backend-file,id=cxl-dcmem0,share=on," \
+                 "mem-path=%s/dcmem0,size=512M " \
+                 "-device cxl-type3,bus=rp0,volatile-dc-memdev=cxl-dcmem0," \
+                 "num-dc-regions=2,mhd-state-file=%s/mhd0,mhd-heads=2," \
+                 "mhd-head=%d,direct-map=on,id=cxl-dcd0 "
+
+/*
+ * Both heads are offered the same block. Whichever accepts it first holds
+ * it, until it releases the block the other head can neither accept it nor
+ * be offered it again.
+ */
+static void cxl_t3d_mhd(void)
+{
+    g_autofree const char *tmpfs = NULL;
+    g_autofree char *state = NULL;
+    g_autofree char *mem = NULL;
+    uint8_t pl[CXL_MBOX_PAYLOAD_SIZE];
+    QTestState *head[2];
+    uint64_t mbox[2];
+    int i;
+
+    tmpfs = g_dir_make_tmp("cxl-test-XXXXXX", NULL);
+
+    /* Both heads map the same backend and state file */
+    for (i = 0; i < 2; i++) {
+        head[i] = qtest_initf(QEMU_PXB_CMD QEMU_RP QEMU_MHD, tmpfs, tmpfs, i);
+    }
+    for (i = 0; i < 2; i++) {
+        global_qtest = head[i];
+        mbox[i] = cxl_setup_mailbox(0);
+        g_assert(cxl_dc_extent("cxl-add-dynamic-capacity", 0, 0, 2 * MiB));
+    }
+
+    global_qtest = head[0];
+    g_assert_cmpuint(cxl_dc_update(mbox[0], CXL_MBOX_ADD_DC_RESPONSE, 0,
+                                   2 * MiB), ==, CXL_MBOX_SUCCESS);
+    global_qtest = head[1];
+    g_assert_cmpuint(cxl_dc_update(mbox[1], CXL_MBOX_ADD_DC_RESPONSE, 0,
+                                   2 * MiB), ==, CXL_MBOX_RESOURCES_EXHAUSTED);
+
+    /* Decline the offer, a block held elsewhere cannot be offered again */
+    memset(pl, 0, 8);
+    g_assert_cmpuint(cxl_mbox_cmd(mbox[1], CXL_MBOX_ADD_DC_RESPONSE, pl, 8,
+                                  NULL), ==, CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(cxl_get_dc_extents(mbox[1], pl), ==, 0);
+    g_assert(!cxl_dc_extent("cxl-add-dynamic-capacity", 0, 0, 2 * MiB));
+    g_assert(cxl_dc_extent("cxl-add-dynamic-capacity", 0, 2 * MiB, 2 * MiB));
+    g_assert_cmpuint(cxl_dc_update(mbox[1], CXL_MBOX_ADD_DC_RESPONSE,
+                                   2 * MiB, 2 * MiB), ==, CXL_MBOX_SUCCESS);
+
+    /* Once head 0 lets go the block can move over */
+    global_qtest = head[0];
+    g_assert_cmpuint(cxl_dc_update(mbox[0], CXL_MBOX_RELEASE_DC, 0, 2 * MiB),
+                     ==, CXL_MBOX_SUCCESS);
+    global_qtest = head[1];
+    g_assert(cxl_dc_extent("cxl-add-dynamic-capacity", 0, 0, 2 * MiB));
+    g_assert_cmpuint(cxl_dc_update(mbox[1], CXL_MBOX_ADD_DC_RESPONSE, 0,
+                                   2 * MiB), ==, CXL_MBOX_SUCCESS);
+    g_assert_cmpuint(cxl_get_dc_extents(mbox[1], pl), ==, 2);
+
+    global_qtest = NULL;
+    for (i = 0; i < 2; i++) {
+        qtest_quit(head[i]);
+    }
+
+    state = g_strdup_printf("%s/mhd0", tmpfs);
+    mem = g_strdup_printf("%s/dcmem0", tmpfs);
+    unlink(state);
+    unlink(mem);
+    rmdir(tmpfs);
+}
+
 static void cxl_1pxb_2rp_2t3d(void)
 {
     g_autoptr(GString) cmdline = g_string_new(NULL);
@@ -119,6 +709,152 @@ static void cxl_1pxb_2rp_2t3d(void)
     rmdir(tmpfs);
 }
 
+/*
+ * Read the whole CDAT of the endpoint on @bus one entry at a time through
+ * its DOE mailbox, the way the Linux cxl_pci driver does.
+ */
+static GByteArray *cxl_doe_read_cdat(uint8_t bus)
+{
+    GByteArray *table = g_byte_array_new();
+    uint16_t doe = CXL_DOE_CDAT_OFFSET;
+    uint32_t handle = 0;
+    uint32_t status, len, dw;
+    int i;
+
+    while (handle != 0xffff) {
+        g_assert_cmpuint(table->len, <, CXL_CDAT_TABLE_MAX);
+
+        /* CDAT Read Entry request, CXL r3.0 8.1.11.1 */
+        cxl_ecam_writel(bus, doe + PCI_DOE_WRITE, 0x1e98 | 2 << 16);
+        cxl_ecam_writel(bus, doe + PCI_DOE_WRITE, 3);
+        cxl_ecam_writel(bus, doe + PCI_DOE_WRITE, handle << 16);
+        cxl_ecam_writel(bus, doe + PCI_DOE_CTRL, PCI_DOE_CTRL_GO);
+
+        for (i = 0; i < CXL_DOE_POLL_US / 100; i++) {
+            status = cxl_ecam_readl(bus, doe + PCI_DOE_STATUS);
+            if (!(status & PCI_DOE_STATUS_BUSY)) {
+                break;
+            }
+            g_usleep(100);
+        }
+        g_assert(status & PCI_DOE_STATUS_DATA_OBJECT_READY);
+        g_assert(!(status & PCI_DOE_STATUS_ERROR));
+
+        g_assert_cmphex(cxl_ecam_readl(bus, doe + PCI_DOE_READ), ==,
+                        0x1e98 | 2 << 16);
+        cxl_ecam_writel(bus, doe + PCI_DOE_READ, 0);
+        len = cxl_ecam_readl(bus, doe + PCI_DOE_READ);
+        cxl_ecam_writel(bus, doe + PCI_DOE_READ, 0);
+        g_assert_cmpuint(len, >, 3);
+        handle = cxl_ecam_readl(bus, doe + PCI_DOE_READ) >> 16;
+        cxl_ecam_writel(bus, doe + PCI_DOE_READ, 0);
+
+        for (i = 3; i < len; i++) {
+            dw = cpu_to_le32(cxl_ecam_readl(bus, doe + PCI_DOE_READ));
+            cxl_ecam_writel(bus, doe + PCI_DOE_READ, 0);
+            g_byte_array_append(table, (uint8_t *)&dw, sizeof(dw));
+        }
+        g_assert(!(cxl_ecam_readl(bus, doe + PCI_DOE_STATUS) &
+                   PCI_DOE_STATUS_DATA_OBJECT_READY));
+    }
+
+    return table;
+}
+
+static void cxl_check_cdat(GByteArray *table)
+{
+    uint8_t sum = 0;
+    int i;
+
+    g_assert_cmpuint(table->len, >=, 16);
+    g_assert_cmpuint(ldl_le_p(table->data), ==, table->len);
+    for (i = 0; i < table->len; i++) {
+        sum += table->data[i];
+    }
+    g_assert_cmpuint(sum, ==, 0);
+}
+
+/*
+ * Identical endpoints share one cached copy of their default CDAT, so read
+ * both back and check neither points into a table the other has dropped.
+ */
+static void cxl_1pxb_2rp_2t3d_cdat(void)
+{
+    g_autoptr(GString) cmdline = g_string_new(NULL);
+    g_autofree const char *tmpfs = NULL;
+    GByteArray *cdat[2];
+    int i;
+
+    tmpfs = g_dir_make_tmp("cxl-test-XXXXXX", NULL);
+
+    g_string_printf(cmdline, QEMU_PXB_CMD QEMU_2RP QEMU_2T3D,
+                    tmpfs, tmpfs, tmpfs, tmpfs);
+
+    qtest_start(cmdline->str);
+    for (i = 0; i < 2; i++) {
+        cdat[i] = cxl_doe_read_cdat(cxl_setup_rp(i));
+        cxl_check_cdat(cdat[i]);
+    }
+    g_assert_cmpuint(cdat[0]->len, ==, cdat[1]->len);
+    g_assert(!memcmp(cdat[0]->data, cdat[1]->data, cdat[0]->len));
+    for (i = 0; i < 2; i++) {
+        g_byte_array_unref(cdat[i]);
+    }
+    qtest_end();
+    rmdir(tmpfs);
+}
+
+#define QEMU_CALIB_T3D "-object memory-backend-ram,id=cxl-vmem0,size=256M " \
+                       "-object memory-backend-ram,id=cxl-vmem1,size=256M " \
+                       "-device cxl-type3,bus=rp0,volatile-memdev=cxl-vmem0," \
+                       "cdat-calibrate=on,id=cxl-vmem0 " \
+                       "-device cxl-type3,bus=rp1,volatile-memdev=cxl-vmem1," \
+                       "direct-map=on,cdat-calibrate=on,id=cxl-vmem1 "
+
+#define CDAT_HEADER_SIZE 16
+#define CDAT_TYPE_DSLBIS 1
+
+/*
+ * Calibrated DSLBIS entries, timed on the emulated and the direct mapped
+ * path, have to come out as a usable base unit and an entry that is
+ * neither 0 (not reported) nor 0xffff (reserved).
+ */
+static void cxl_1pxb_2rp_2t3d_calibrate(void)
+{
+    GByteArray *cdat;
+    uint32_t off;
+    uint16_t len, entry;
+    int i, nr_dslbis;
+
+    qtest_start(QEMU_PXB_CMD QEMU_2RP QEMU_CALIB_T3D);
+    for (i = 0; i < 2; i++) {
+        cdat = cxl_doe_read_cdat(cxl_setup_rp(i));
+        cxl_check_cdat(cdat);
+
+        nr_dslbis = 0;
+        for (off = CDAT_HEADER_SIZE; off < cdat->len; off += len) {
+            g_assert_cmpuint(off + 4, <=, cdat->len);
+            len = lduw_le_p(cdat->data + off + 2);
+            g_assert_cmpuint(len, >=, 4);
+            g_assert_cmpuint(off + len, <=, cdat->len);
+            if (cdat->data[off] != CDAT_TYPE_DSLBIS) {
+                continue;
+            }
+
+            /* Latency and bandwidth for reads and for writes */
+            g_assert_cmpuint(len, ==, 24);
+            g_assert_cmpuint(ldq_le_p(cdat->data + off + 8), !=, 0);
+            entry = lduw_le_p(cdat->data + off + 16);
+            g_assert_cmpuint(entry, !=, 0);
+            g_assert_cmpuint(entry, !=, UINT16_MAX);
+            nr_dslbis++;
+        }
+        g_assert_cmpint(nr_dslbis, ==, 4);
+        g_byte_array_unref(cdat);
+    }
+    qtest_end();
+}
+
 static void cxl_2pxb_4rp_4t3d(void)
 {
     g_autoptr(GString) cmdline = g_string_new(NULL);
@@ -148,7 +884,15 @@ int main(int argc, char **argv)
     qtest_add_func("/pci/cxl/rp_x2", cxl_2root_port);
 #ifdef CONFIG_POSIX
     qtest_add_func("/pci/cxl/type3_device", cxl_t3d);
+    qtest_add_func("/pci/cxl/type3_device_poison", cxl_t3d_poison);
+    qtest_add_func("/pci/cxl/type3_device_mbox_payload", cxl_t3d_mbox_payload);
+    qtest_add_func("/pci/cxl/type3_device_events", cxl_t3d_events);
+    qtest_add_func("/pci/cxl/type3_device_dcd", cxl_t3d_dcd);
+    qtest_add_func("/pci/cxl/type3_device_mhd", cxl_t3d_mhd);
     qtest_add_func("/pci/cxl/rp_x2_type3_x2", cxl_1pxb_2rp_2t3d);
+    qtest_add_func("/pci/cxl/rp_x2_type3_x2_cdat", cxl_1pxb_2rp_2t3d_cdat);
+    qtest_add_func("/pci/cxl/rp_x2_type3_x2_calibrate",
+                   cxl_1pxb_2rp_2t3d_calibrate);
     qtest_add_func("/pci/cxl/pxb_x2_root_port_x4_type3_x4", cxl_2pxb_4rp_4t3d);
 #endif
     return g_test_run();
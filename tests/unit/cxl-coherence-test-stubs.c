@@ -0,0 +1,53 @@
+/*
+ * Stubs for the CXL coherence tester
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_dcache.h"
+
+#include "cxl-coherence-test.h"
+
+uint64_t cxl_coh_test_stats[CXL_STAT__MAX];
+
+void cxl_stats_inc(CXLStats *stats, CXLStatCounter counter)
+{
+    cxl_coh_test_stats[counter]++;
+}
+
+void cxl_stats_init(CXLStats **stats)
+{
+    *stats = NULL;
+}
+
+void cxl_stats_release(CXLStats **stats)
+{
+    *stats = NULL;
+}
+
+/* The tester sets up the host bridge itself, nothing attaches through PCI */
+PCIBus *pci_device_root_bus(const PCIDevice *d)
+{
+    g_assert_not_reached();
+}
+
+int cxl_coh_test_dcache_probe(struct DeviceCache *dcache, uint64_t daddr,
+                              uint8_t **data)
+{
+    uint64_t tag = device_cache_extract_tag(dcache, daddr);
+    uint64_t set = device_cache_extract_set(dcache, daddr);
+    int32_t blk = device_cache_find_valid_block(dcache, tag, set);
+
+    if (blk == -1) {
+        *data = NULL;
+        return CACHE_INVALID;
+    }
+
+    *data = device_cache_extract_block_addr(dcache, set, blk);
+    return device_cache_extract_block_state(dcache, set, blk);
+}
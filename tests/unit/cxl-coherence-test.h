@@ -0,0 +1,27 @@
+/*
+ * Randomized differential tester for the CXL Type 1/2 coherence engines
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef CXL_COHERENCE_TEST_H
+#define CXL_COHERENCE_TEST_H
+
+#include "hw/cxl/cxl_stats.h"
+
+/* Counters bumped by the engines through the cxl_stats_inc() stub */
+extern uint64_t cxl_coh_test_stats[CXL_STAT__MAX];
+
+/*
+ * State of the device cache line holding daddr, with *data pointing at its
+ * contents when it is valid. The value is a CacheState, which has the same
+ * encoding in cxl_hcache.h and cxl_dcache.h; the two headers cannot be
+ * included together, so the device cache is probed from the stubs.
+ */
+int cxl_coh_test_dcache_probe(struct DeviceCache *dcache, uint64_t daddr,
+                              uint8_t **data);
+
+#endif
@@ -0,0 +1,533 @@
+/*
+ * Randomized differential tester for the CXL Type 1/2 coherence engines
+ *
+ * Host and device agents issue interleaved random reads and writes through
+ * the traffic entry points of the host (HCOH) and device (DCOH) engines,
+ * while Type 2 devices flip random pages between host and device bias
+ * underneath them. Every read is compared with a flat golden copy of device
+ * memory. After every operation each line it touched is checked for:
+ *
+ *  - single writer: a line in E or M on one side is invalid on the other
+ *  - no stale copies: every valid cached copy matches the golden memory
+ *  - write back: a line cached nowhere has the golden data in memory
+ *  - bias: a Type 2 device caches nothing in a host-bias page
+ *
+ * The device glue normally provided by hw/mem/cxl_type1.c and cxl_type2.c
+ * is implemented below on top of flat buffers, so the engines run without a
+ * machine. The working set is a few times the size of the caches so
+ * evictions, snoop filter overflows and cross-device victims are frequent.
+ *
+ * With -m slow the run is 50 times longer. With -m perf the per-line checks
+ * are skipped, only reads are compared, and the reported ops/s measure the
+ * engines themselves.
+ *
+ * Copyright (c) 2024 EEUM, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "qemu/units.h"
+#include "qom/object.h"
+#include "hw/cxl/cxl.h"
+#include "hw/cxl/cxl_bias.h"
+#include "hw/cxl/cxl_hcache.h"
+#include "hw/cxl/cxl_type1_dcoh.h"
+#include "hw/cxl/cxl_type1_hcoh.h"
+#include "hw/cxl/cxl_type2_dcoh.h"
+#include "hw/cxl/cxl_type2_hcoh.h"
+
+#include "cxl-coherence-test.h"
+
+#define COH_MEM_SIZE (64 * KiB)
+#define COH_WORKING_SET (16 * KiB)
+#define COH_BIAS_PAGE (4 * KiB)
+#define COH_SF_ENTRIES (16)
+#define COH_LINE HOST_BLKSIZE
+#define COH_MAX_ACCESS (2 * COH_LINE)
+#define COH_MAX_DEVS (2)
+
+#define COH_OPS_QUICK (200000)
+#define COH_OPS_SLOW (10000000)
+#define COH_FLIP_PCT (2)
+
+/* Type 1 lines live at CFMWS_BASE_ADDR + dpa, hard-wired in the engines */
+#define COH_TYPE1_HPA_BASE CFMWS_BASE_ADDR
+#define COH_TYPE2_HPA_BASE (CFMWS_BASE_ADDR + COH_MEM_SIZE)
+
+typedef struct CXLCohDev {
+    PCIDevice *d;
+    bool type2;
+    hwaddr hpa_base;
+    uint8_t *mem;
+    uint8_t *golden;
+    struct DeviceCache *dcache;
+    CXLTrafficAccess host_access;
+    CXLTrafficAccess device_access;
+} CXLCohDev;
+
+typedef struct CXLCohTest {
+    CXLHost *hb;
+    CXLCohDev devs[COH_MAX_DEVS];
+    int ndevs;
+    bool check;
+    uint8_t stamp;
+    uint64_t ops;
+    uint64_t rejected;
+    uint64_t flips;
+} CXLCohTest;
+
+typedef struct CXLCohConfig {
+    const char *name;
+    bool type1;
+    bool type2;
+} CXLCohConfig;
+
+static const CXLCohConfig coh_configs[] = {
+    { "type1", true, false },
+    { "type2", false, true },
+    { "mixed", true, true },
+};
+
+static const char *const coh_state_name[] = { "I", "S", "E", "M" };
+
+/* The device glue has no other way back to the running test */
+static CXLCohTest *coh;
+
+static CXLCohDev *coh_dev(PCIDevice *d)
+{
+    for (int i = 0; i < coh->ndevs; i++) {
+        if (coh->devs[i].d == d) {
+            return &coh->devs[i];
+        }
+    }
+    g_assert_not_reached();
+}
+
+static uint8_t *coh_mem(PCIDevice *d, hwaddr hpa, unsigned size)
+{
+    CXLCohDev *dev = coh_dev(d);
+
+    g_assert(hpa >= dev->hpa_base);
+    g_assert(hpa - dev->hpa_base + size <= COH_MEM_SIZE);
+
+    return dev->mem + (hpa - dev->hpa_base);
+}
+
+MemTxResult cxl_type1_read(PCIDevice *d, hwaddr host_addr, uint64_t *data,
+                           unsigned size, MemTxAttrs attrs)
+{
+    memcpy(data, coh_mem(d, host_addr, size), size);
+    return MEMTX_OK;
+}
+
+MemTxResult cxl_type1_write(PCIDevice *d, hwaddr host_addr, uint64_t *data,
+                            unsigned size, MemTxAttrs attrs)
+{
+    memcpy(coh_mem(d, host_addr, size), data, size);
+    return MEMTX_OK;
+}
+
+D2HRsp cxl_type1_access(PCIDevice *d, CXLCacheReq req, uint8_t *buf,
+                        unsigned size, MemTxAttrs attrs)
+{
+    return cxl_device_type1_dcoh_access(d, req.Address - COH_TYPE1_HPA_BASE,
+                                        req, buf, size, attrs);
+}
+
+H2DRsp cxl_type1_response(PCIDevice *d, CXLCacheReq req, uint8_t *buf,
+                          unsigned size, MemTxAttrs attrs)
+{
+    return cxl_host_type1_hcoh_response(d, req, buf, size, attrs);
+}
+
+bool cxl_type2_hpa_to_dpa(PCIDevice *d, hwaddr hpa, uint64_t *dpa)
+{
+    CXLCohDev *dev = coh_dev(d);
+
+    if (hpa < dev->hpa_base || hpa - dev->hpa_base >= COH_MEM_SIZE) {
+        return false;
+    }
+    *dpa = hpa - dev->hpa_base;
+    return true;
+}
+
+bool cxl_type2_dpa_to_hpa(PCIDevice *d, uint64_t dpa, hwaddr *hpa)
+{
+    if (dpa >= COH_MEM_SIZE) {
+        return false;
+    }
+    *hpa = coh_dev(d)->hpa_base + dpa;
+    return true;
+}
+
+void cxl_type2_hdm_position_update(PCIDevice *d)
+{
+}
+
+S2MRsp cxl_type2_access(PCIDevice *d, CXLMemReq req, uint8_t *buf,
+                        unsigned size, MemTxAttrs attrs)
+{
+    uint64_t dpa;
+
+    if (!cxl_type2_hpa_to_dpa(d, req.Address, &dpa)) {
+        return S2MRsp_CMP_ERROR;
+    }
+    return cxl_device_type2_dcoh_access(d, dpa, req, buf, size, attrs);
+}
+
+M2SRsp_BIRsp cxl_type2_response(PCIDevice *d, CXLMemReq req,
+                                MemTxAttrs attrs)
+{
+    return cxl_host_type2_hcoh_response(d, req, attrs);
+}
+
+MemTxResult cxl_type2_mem_read(PCIDevice *d, uint64_t dpa, uint8_t *buf,
+                               unsigned size, MemTxAttrs attrs)
+{
+    memcpy(buf, coh_mem(d, coh_dev(d)->hpa_base + dpa, size), size);
+    return MEMTX_OK;
+}
+
+MemTxResult cxl_type2_mem_write(PCIDevice *d, uint64_t dpa,
+                                const uint8_t *buf, unsigned size,
+                                MemTxAttrs attrs)
+{
+    memcpy(coh_mem(d, coh_dev(d)->hpa_base + dpa, size), buf, size);
+    return MEMTX_OK;
+}
+
+static void G_GNUC_NORETURN coh_fail(CXLCohDev *dev, uint64_t daddr,
+                                     CacheState hstate, CacheState dstate,
+                                     const char *why)
+{
+    g_test_message("op %" PRIu64 ": %s, type%d daddr 0x%" PRIx64
+                   " host %s device %s",
+                   coh->ops, why, dev->type2 ? 2 : 1, daddr,
+                   coh_state_name[hstate], coh_state_name[dstate]);
+    g_assert_not_reached();
+}
+
+static void coh_check_line(CXLCohDev *dev, uint64_t daddr)
+{
+    Cache *hcache = coh->hb->hcache;
+    hwaddr haddr = dev->hpa_base + daddr;
+    uint64_t tag = host_cache_extract_tag(hcache, haddr);
+    uint64_t set = host_cache_extract_set(hcache, haddr);
+    int32_t blk = host_cache_find_valid_block(hcache, tag, set);
+    const uint8_t *golden = dev->golden + daddr;
+    CacheState hstate = CACHE_INVALID, dstate;
+    uint8_t *hdata = NULL, *ddata;
+
+    if (blk != -1) {
+        hstate = host_cache_extract_block_state(hcache, set, blk);
+        hdata = host_cache_extract_block_addr(hcache, set, blk);
+        g_assert(host_cache_extract_block_owner(hcache, set, blk) == dev->d);
+    }
+    dstate = cxl_coh_test_dcache_probe(dev->dcache, daddr, &ddata);
+
+    if ((hstate >= CACHE_EXCLUSIVE && dstate != CACHE_INVALID) ||
+        (dstate >= CACHE_EXCLUSIVE && hstate != CACHE_INVALID)) {
+        coh_fail(dev, daddr, hstate, dstate, "single writer violated");
+    }
+    if (dev->type2 && dstate != CACHE_INVALID &&
+        HOST_BIAS == cxl_device_type2_dcoh_bias_lookup(dev->d, daddr)) {
+        coh_fail(dev, daddr, hstate, dstate, "device caches host-bias line");
+    }
+    if (hdata && memcmp(hdata, golden, COH_LINE)) {
+        coh_fail(dev, daddr, hstate, dstate, "stale host copy");
+    }
+    if (ddata && memcmp(ddata, golden, COH_LINE)) {
+        coh_fail(dev, daddr, hstate, dstate, "stale device copy");
+    }
+    if (!hdata && !ddata && memcmp(dev->mem + daddr, golden, COH_LINE)) {
+        coh_fail(dev, daddr, hstate, dstate, "lost write back");
+    }
+}
+
+static void coh_check_range(CXLCohDev *dev, uint64_t daddr, uint64_t size)
+{
+    uint64_t line;
+
+    for (line = QEMU_ALIGN_DOWN(daddr, COH_LINE); line < daddr + size;
+         line += COH_LINE) {
+        coh_check_line(dev, line);
+    }
+}
+
+static void coh_access(CXLCohDev *dev, bool host, bool is_write)
+{
+    static const uint32_t sizes[] = { 1, 2, 4, 8, 16, COH_LINE,
+                                      COH_MAX_ACCESS };
+    uint32_t size = sizes[g_test_rand_int_range(0, ARRAY_SIZE(sizes))];
+    uint64_t daddr = g_test_rand_int_range(0, COH_WORKING_SET - size + 1);
+    MemTxResult expect = MEMTX_OK, result;
+    uint8_t buf[COH_MAX_ACCESS];
+    uint64_t page_end;
+
+    /*
+     * The device engine gives up at the first host-bias page, keep device
+     * accesses within one page so they either fully happen or not at all.
+     */
+    if (dev->type2 && !host) {
+        page_end = QEMU_ALIGN_DOWN(daddr, COH_BIAS_PAGE) + COH_BIAS_PAGE;
+        daddr = MIN(daddr, page_end - size);
+        if (HOST_BIAS == cxl_device_type2_dcoh_bias_lookup(dev->d, daddr)) {
+            expect = MEMTX_DECODE_ERROR;
+        }
+    }
+
+    if (is_write) {
+        for (uint32_t i = 0; i < size; i++) {
+            buf[i] = coh->stamp++;
+        }
+    }
+
+    result = (host ? dev->host_access : dev->device_access)(dev->d, daddr, buf,
+                                                            size, is_write);
+    g_assert_cmpint(result, ==, expect);
+    if (result != MEMTX_OK) {
+        coh->rejected++;
+        return;
+    }
+
+    if (is_write) {
+        memcpy(dev->golden + daddr, buf, size);
+    } else if (memcmp(buf, dev->golden + daddr, size)) {
+        coh_fail(dev, daddr, CACHE_INVALID, CACHE_INVALID,
+                 host ? "host read stale data" : "device read stale data");
+    }
+
+    if (coh->check) {
+        coh_check_range(dev, daddr, size);
+    }
+}
+
+/* Same sequence as ct2d_bias_flip() in hw/mem/cxl_type2.c */
+static void coh_flip(CXLCohDev *dev)
+{
+    CXLType2Dev *ct2d = CXL_TYPE2(dev->d);
+    uint64_t base = g_test_rand_int_range(0, COH_WORKING_SET / COH_BIAS_PAGE) *
+                    COH_BIAS_PAGE;
+    BiasState target = g_test_rand_bit() ? DEVICE_BIAS : HOST_BIAS;
+    MemTxResult result;
+
+    qemu_spin_lock(&ct2d->hb->coh_lock);
+    if (target == DEVICE_BIAS) {
+        result = cxl_host_type2_hcoh_flush_range(dev->d, base, COH_BIAS_PAGE,
+                                                 MEMTXATTRS_UNSPECIFIED);
+    } else {
+        result = cxl_device_type2_dcoh_flush_range(dev->d, base, COH_BIAS_PAGE,
+                                                   MEMTXATTRS_UNSPECIFIED);
+    }
+    g_assert_cmpint(result, ==, MEMTX_OK);
+    cxl_bias_table_set_range(ct2d->bias, base, COH_BIAS_PAGE, target);
+    qemu_spin_unlock(&ct2d->hb->coh_lock);
+
+    coh->flips++;
+
+    if (coh->check) {
+        coh_check_range(dev, base, COH_BIAS_PAGE);
+    }
+}
+
+static void coh_add_dev(const char *type)
+{
+    CXLCohDev *dev = &coh->devs[coh->ndevs++];
+
+    /* Only the QOM casts are needed, the PCIDevice itself stays unused */
+    dev->d = (PCIDevice *)object_new(type);
+    dev->type2 = !strcmp(type, TYPE_CXL_TYPE2);
+    dev->mem = g_malloc(COH_MEM_SIZE);
+    for (uint64_t i = 0; i < COH_MEM_SIZE; i++) {
+        dev->mem[i] = g_test_rand_int();
+    }
+    dev->golden = g_malloc(COH_MEM_SIZE);
+    memcpy(dev->golden, dev->mem, COH_MEM_SIZE);
+
+    if (dev->type2) {
+        CXLType2Dev *ct2d = CXL_TYPE2(dev->d);
+
+        dev->hpa_base = COH_TYPE2_HPA_BASE;
+        dev->host_access = cxl_host_type2_hcoh_traffic;
+        dev->device_access = cxl_device_type2_dcoh_traffic;
+        ct2d->hb = coh->hb;
+        ct2d->sf_entries = COH_SF_ENTRIES;
+        cxl_device_type2_dcoh_init(dev->d);
+        cxl_bias_table_init(&ct2d->bias, COH_MEM_SIZE, COH_BIAS_PAGE);
+        dev->dcache = ct2d->dcache;
+    } else {
+        CXLType1Dev *ct1d = CXL_TYPE1(dev->d);
+
+        dev->hpa_base = COH_TYPE1_HPA_BASE;
+        dev->host_access = cxl_host_type1_hcoh_traffic;
+        dev->device_access = cxl_device_type1_dcoh_traffic;
+        ct1d->hb = coh->hb;
+        cxl_device_type1_dcoh_init(dev->d);
+        dev->dcache = ct1d->dcache;
+    }
+}
+
+static void coh_del_dev(CXLCohDev *dev)
+{
+    if (dev->type2) {
+        cxl_bias_table_release(&CXL_TYPE2(dev->d)->bias);
+        cxl_device_type2_dcoh_release(dev->d);
+    } else {
+        cxl_device_type1_dcoh_release(dev->d);
+    }
+    g_free(dev->mem);
+    g_free(dev->golden);
+    object_unref(OBJECT(dev->d));
+}
+
+static void coh_setup(const CXLCohConfig *cfg)
+{
+    coh = g_new0(CXLCohTest, 1);
+    coh->check = !g_test_perf();
+
+    coh->hb = g_new0(CXLHost, 1);
+    qemu_spin_init(&coh->hb->coh_lock);
+    cxl_host_cache_init(&coh->hb->hcache);
+
+    if (cfg->type1) {
+        coh_add_dev(TYPE_CXL_TYPE1);
+    }
+    if (cfg->type2) {
+        coh_add_dev(TYPE_CXL_TYPE2);
+    }
+
+    memset(cxl_coh_test_stats, 0, sizeof(cxl_coh_test_stats));
+}
+
+static void coh_teardown(void)
+{
+    for (int i = 0; i < coh->ndevs; i++) {
+        coh_del_dev(&coh->devs[i]);
+    }
+    cxl_host_cache_release(&coh->hb->hcache);
+    g_free(coh->hb);
+    g_free(coh);
+    coh = NULL;
+}
+
+static double coh_pct(uint64_t part, uint64_t other)
+{
+    return part + other ? 100.0 * part / (part + other) : 0;
+}
+
+static void test_coherence(const void *data)
+{
+    const CXLCohConfig *cfg = data;
+    uint64_t nops = g_test_slow() || g_test_perf() ? COH_OPS_SLOW
+                                                   : COH_OPS_QUICK;
+    uint64_t *stats = cxl_coh_test_stats;
+    CXLCohDev *dev;
+    double secs;
+    int op;
+
+    coh_setup(cfg);
+
+    g_test_timer_start();
+    for (coh->ops = 0; coh->ops < nops; coh->ops++) {
+        dev = &coh->devs[g_test_rand_int_range(0, coh->ndevs)];
+        op = g_test_rand_int_range(0, 100);
+
+        if (dev->type2 && op < COH_FLIP_PCT) {
+            coh_flip(dev);
+        } else {
+            coh_access(dev, op & 1, op & 2);
+        }
+    }
+    secs = g_test_timer_elapsed();
+
+    for (int i = 0; i < coh->ndevs; i++) {
+        coh_check_range(&coh->devs[i], 0, COH_WORKING_SET);
+    }
+
+    g_test_message("%s: %" PRIu64 " ops in %.2f s, %.2f Mops/s%s; "
+                   "%" PRIu64 " rejected, %" PRIu64 " bias flips; "
+                   "host hit %.1f%%, device hit %.1f%%, "
+                   "%" PRIu64 " back-invalidations",
+                   cfg->name, nops, secs, nops / secs / 1e6,
+                   coh->check ? " (checked)" : "", coh->rejected, coh->flips,
+                   coh_pct(stats[CXL_STAT_HOST_HIT], stats[CXL_STAT_HOST_MISS]),
+                   coh_pct(stats[CXL_STAT_DEVICE_HIT],
+                           stats[CXL_STAT_DEVICE_MISS]),
+                   stats[CXL_STAT_BACK_INVALIDATION]);
+
+    coh_teardown();
+}
+
+/*
+ * The Type 2 range API walks a host access line by line under one lock, start
+ * and end in the middle of a line so the first and last chunks are partial.
+ */
+static void test_coherence_range(void)
+{
+    const uint64_t daddr = COH_LINE - 8, len = 2 * COH_LINE + 16;
+    CXLCohDev *dev;
+    uint8_t buf[2 * COH_LINE + 16];
+    MemTxResult result;
+
+    coh_setup(&coh_configs[1]);
+    dev = &coh->devs[0];
+    g_assert(dev->type2);
+
+    for (uint64_t i = 0; i < len; i++) {
+        buf[i] = coh->stamp++;
+    }
+    result = cxl_host_type2_hcoh_write_range(dev->d, dev->hpa_base + daddr,
+                                             buf, len, MEMTXATTRS_UNSPECIFIED);
+    g_assert_cmpint(result, ==, MEMTX_OK);
+    memcpy(dev->golden + daddr, buf, len);
+    coh_check_range(dev, 0, 4 * COH_LINE);
+
+    /* The four lines touched were each brought in once */
+    g_assert_cmpuint(cxl_coh_test_stats[CXL_STAT_HOST_MISS], ==, 4);
+    g_assert_cmpuint(cxl_coh_test_stats[CXL_STAT_HOST_HIT], ==, 0);
+
+    memset(buf, 0, len);
+    result = cxl_host_type2_hcoh_read_range(dev->d, dev->hpa_base + daddr - 4,
+                                            buf, len + 8,
+                                            MEMTXATTRS_UNSPECIFIED);
+    g_assert_cmpint(result, ==, MEMTX_OK);
+    g_assert(!memcmp(buf, dev->golden + daddr - 4, len + 8));
+    g_assert_cmpuint(cxl_coh_test_stats[CXL_STAT_HOST_MISS], ==, 4);
+    g_assert_cmpuint(cxl_coh_test_stats[CXL_STAT_HOST_HIT], ==, 4);
+
+    coh_teardown();
+}
+
+/* Stand-ins for the PCI devices, the engines only cast to them */
+static const TypeInfo coh_type_infos[] = {
+    {
+        .name = TYPE_CXL_TYPE1,
+        .parent = TYPE_OBJECT,
+        .instance_size = sizeof(CXLType1Dev),
+    }, {
+        .name = TYPE_CXL_TYPE2,
+        .parent = TYPE_OBJECT,
+        .instance_size = sizeof(CXLType2Dev),
+    },
+};
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    module_call_init(MODULE_INIT_QOM);
+    type_register_static_array(coh_type_infos, ARRAY_SIZE(coh_type_infos));
+
+    for (int i = 0; i < ARRAY_SIZE(coh_configs); i++) {
+        g_autofree char *path = g_strdup_printf("/cxl/coherence/%s",
+                                                coh_configs[i].name);
+
+        g_test_add_data_func(path, &coh_configs[i], test_coherence);
+    }
+    g_test_add_func("/cxl/coherence/type2-range", test_coherence_range);
+
+    return g_test_run();
+}